@@ -0,0 +1,180 @@
+#include "include/apdu_forward.h"
+#include <string.h>
+
+#define OBIS_STRING(a, b, c, d, e) 0x09, 0x06, a, b, c, d, e, 0xFF
+#define SCALER_UNIT(scaler, unit) 0x02, 0x02, 0x0F, scaler, 0x16, unit
+
+// Version 1. OBIS codes as tagged octet strings, in the B = 1 form of Kamstrup and the B = 0 form
+// of most other meters, list identifiers and the scaler_units of the usual units. The most common
+// strings come last, no distance is shorter than another but the order is part of the format.
+const uint8_t apdu_forward_dictionary[] = {
+    // List identifiers
+    0x0A, 0x0E, 'K', 'a', 'm', 's', 't', 'r', 'u', 'p', '_', 'V', '0', '0', '0', '1',
+    0x0A, 0x0B, 'A', 'I', 'D', 'O', 'N', '_', 'V', '0', '0', '0', '1',
+    0x09, 0x07, 'K', 'F', 'M', '_', '0', '0', '1',
+    // Clock, meter identification
+    OBIS_STRING(0, 0, 1, 0, 0), OBIS_STRING(0, 0, 96, 1, 0), OBIS_STRING(0, 0, 96, 1, 1),
+    OBIS_STRING(0, 0, 96, 1, 7), OBIS_STRING(0, 0, 42, 0, 0), OBIS_STRING(1, 1, 0, 0, 1),
+    OBIS_STRING(1, 1, 0, 0, 5),
+    // Scaler_units: W, var, Wh, varh, V and A in the scalers meters use
+    SCALER_UNIT(0x00, 0x1B), SCALER_UNIT(0x00, 0x1D), SCALER_UNIT(0x00, 0x1E), SCALER_UNIT(0x01, 0x1E),
+    SCALER_UNIT(0x00, 0x20), SCALER_UNIT(0x01, 0x20), SCALER_UNIT(0xFF, 0x23), SCALER_UNIT(0xFF, 0x21),
+    SCALER_UNIT(0xFE, 0x21), SCALER_UNIT(0xFD, 0x21), SCALER_UNIT(0xFE, 0xFF),
+    // Instantaneous values and energy registers, Kamstrup
+    OBIS_STRING(1, 1, 32, 7, 0), OBIS_STRING(1, 1, 52, 7, 0), OBIS_STRING(1, 1, 72, 7, 0),
+    OBIS_STRING(1, 1, 31, 7, 0), OBIS_STRING(1, 1, 51, 7, 0), OBIS_STRING(1, 1, 71, 7, 0),
+    OBIS_STRING(1, 1, 21, 7, 0), OBIS_STRING(1, 1, 41, 7, 0), OBIS_STRING(1, 1, 61, 7, 0),
+    OBIS_STRING(1, 1, 22, 7, 0), OBIS_STRING(1, 1, 42, 7, 0), OBIS_STRING(1, 1, 62, 7, 0),
+    OBIS_STRING(1, 1, 23, 7, 0), OBIS_STRING(1, 1, 43, 7, 0), OBIS_STRING(1, 1, 63, 7, 0),
+    OBIS_STRING(1, 1, 24, 7, 0), OBIS_STRING(1, 1, 44, 7, 0), OBIS_STRING(1, 1, 64, 7, 0),
+    OBIS_STRING(1, 1, 33, 7, 0), OBIS_STRING(1, 1, 53, 7, 0), OBIS_STRING(1, 1, 73, 7, 0),
+    OBIS_STRING(1, 1, 13, 7, 0), OBIS_STRING(1, 1, 1, 7, 0), OBIS_STRING(1, 1, 2, 7, 0),
+    OBIS_STRING(1, 1, 3, 7, 0), OBIS_STRING(1, 1, 4, 7, 0), OBIS_STRING(1, 1, 1, 8, 0),
+    OBIS_STRING(1, 1, 2, 8, 0), OBIS_STRING(1, 1, 3, 8, 0), OBIS_STRING(1, 1, 4, 8, 0),
+    // The same, standard OBIS
+    OBIS_STRING(1, 0, 32, 7, 0), OBIS_STRING(1, 0, 52, 7, 0), OBIS_STRING(1, 0, 72, 7, 0),
+    OBIS_STRING(1, 0, 31, 7, 0), OBIS_STRING(1, 0, 51, 7, 0), OBIS_STRING(1, 0, 71, 7, 0),
+    OBIS_STRING(1, 0, 21, 7, 0), OBIS_STRING(1, 0, 41, 7, 0), OBIS_STRING(1, 0, 61, 7, 0),
+    OBIS_STRING(1, 0, 22, 7, 0), OBIS_STRING(1, 0, 42, 7, 0), OBIS_STRING(1, 0, 62, 7, 0),
+    OBIS_STRING(1, 0, 23, 7, 0), OBIS_STRING(1, 0, 43, 7, 0), OBIS_STRING(1, 0, 63, 7, 0),
+    OBIS_STRING(1, 0, 24, 7, 0), OBIS_STRING(1, 0, 44, 7, 0), OBIS_STRING(1, 0, 64, 7, 0),
+    OBIS_STRING(1, 0, 33, 7, 0), OBIS_STRING(1, 0, 53, 7, 0), OBIS_STRING(1, 0, 73, 7, 0),
+    OBIS_STRING(1, 0, 13, 7, 0), OBIS_STRING(1, 0, 1, 7, 0), OBIS_STRING(1, 0, 2, 7, 0),
+    OBIS_STRING(1, 0, 3, 7, 0), OBIS_STRING(1, 0, 4, 7, 0), OBIS_STRING(1, 0, 1, 8, 0),
+    OBIS_STRING(1, 0, 2, 8, 0), OBIS_STRING(1, 0, 3, 8, 0), OBIS_STRING(1, 0, 4, 8, 0),
+};
+
+const size_t apdu_forward_dictionary_size = sizeof(apdu_forward_dictionary);
+
+// Byte at position of the dictionary followed by the APDU
+static uint8_t history_at(const uint8_t *apdu, size_t position)
+{
+    return position < sizeof(apdu_forward_dictionary) ? apdu_forward_dictionary[position] : apdu[position - sizeof(apdu_forward_dictionary)];
+}
+
+// Longest earlier string matching the APDU at pos, returns its length, 0 if shorter than a match
+static size_t longest_match(const uint8_t *apdu, size_t length, size_t pos, size_t *distance)
+{
+    size_t here = sizeof(apdu_forward_dictionary) + pos;
+    size_t limit = length - pos < APDU_FORWARD_MAX_MATCH ? length - pos : APDU_FORWARD_MAX_MATCH;
+    size_t best = 0;
+
+    for (size_t start = 0; start < here && best < limit; start++)
+    {
+        if (history_at(apdu, start) != apdu[pos])
+        {
+            continue;
+        }
+        size_t match = 1;
+        while (match < limit && history_at(apdu, start + match) == apdu[pos + match])
+        {
+            match++;
+        }
+        if (match > best)
+        {
+            best = match;
+            *distance = here - start;
+        }
+    }
+    return best >= APDU_FORWARD_MIN_MATCH ? best : 0;
+}
+
+static size_t put_literals(const uint8_t *literals, size_t count, uint8_t *out)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+    out[0] = (uint8_t)(count - 1);
+    memcpy(&out[1], literals, count);
+    return 1 + count;
+}
+
+size_t apdu_forward_compress(const uint8_t *apdu, size_t length, uint8_t *out, size_t size)
+{
+    if (length > APDU_FORWARD_MAX_APDU || size < APDU_FORWARD_BOUND(length))
+    {
+        return 0;
+    }
+
+    out[0] = APDU_FORWARD_VERSION;
+    out[1] = (uint8_t)length;
+    out[2] = (uint8_t)(length >> 8);
+    size_t out_pos = APDU_FORWARD_HEADER_SIZE;
+    size_t literal_start = 0;
+
+    for (size_t pos = 0; pos < length;)
+    {
+        size_t distance = 0;
+        size_t match = longest_match(apdu, length, pos, &distance);
+        if (match == 0)
+        {
+            pos++;
+            if (pos - literal_start == APDU_FORWARD_MAX_LITERALS)
+            {
+                out_pos += put_literals(&apdu[literal_start], pos - literal_start, &out[out_pos]);
+                literal_start = pos;
+            }
+            continue;
+        }
+
+        out_pos += put_literals(&apdu[literal_start], pos - literal_start, &out[out_pos]);
+        out[out_pos++] = (uint8_t)(0x80 | (match - APDU_FORWARD_MIN_MATCH));
+        out[out_pos++] = (uint8_t)distance;
+        out[out_pos++] = (uint8_t)(distance >> 8);
+        pos += match;
+        literal_start = pos;
+    }
+    out_pos += put_literals(&apdu[literal_start], length - literal_start, &out[out_pos]);
+    return out_pos;
+}
+
+size_t apdu_forward_decompress(const uint8_t *data, size_t length, uint8_t *out, size_t size)
+{
+    if (length < APDU_FORWARD_HEADER_SIZE || data[0] != APDU_FORWARD_VERSION)
+    {
+        return 0;
+    }
+    size_t apdu_length = data[1] | (size_t)data[2] << 8;
+    if (apdu_length > size)
+    {
+        return 0;
+    }
+
+    size_t out_pos = 0;
+    for (size_t pos = APDU_FORWARD_HEADER_SIZE; pos < length;)
+    {
+        uint8_t token = data[pos++];
+        if (token < 0x80)
+        {
+            size_t count = (size_t)token + 1;
+            if (pos + count > length || out_pos + count > apdu_length)
+            {
+                return 0;
+            }
+            memcpy(&out[out_pos], &data[pos], count);
+            pos += count;
+            out_pos += count;
+            continue;
+        }
+
+        size_t count = (size_t)(token & 0x7F) + APDU_FORWARD_MIN_MATCH;
+        if (pos + 2 > length)
+        {
+            return 0;
+        }
+        size_t distance = data[pos] | (size_t)data[pos + 1] << 8;
+        pos += 2;
+        size_t here = sizeof(apdu_forward_dictionary) + out_pos;
+        if (distance == 0 || distance > here || out_pos + count > apdu_length)
+        {
+            return 0;
+        }
+        // Byte by byte, the copy may overlap what it produces
+        for (size_t i = 0; i < count; i++, out_pos++)
+        {
+            out[out_pos] = history_at(out, here - distance + i);
+        }
+    }
+    return out_pos == apdu_length ? apdu_length : 0;
+}
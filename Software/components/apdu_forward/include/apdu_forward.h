@@ -0,0 +1,42 @@
+#ifndef APDU_FORWARD_H
+#define APDU_FORWARD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Compression of raw DLMS APDUs forwarded to the coordinator, for meters the on-device decoder does
+// not know. Most of a push repeats between frames and between meters: OBIS codes, data type tags
+// and scaler_units. The compressor is LZ77 over a static dictionary of those, followed by the APDU
+// itself, so even the first frame compresses and no state is kept between frames.
+//
+// Compressed APDU:
+//   header  version (APDU_FORWARD_VERSION, names the dictionary), APDU length (U16 little-endian)
+//   tokens  0x00-0x7F  literal run: token + 1 bytes follow
+//           0x80-0xFF  copy (token & 0x7F) + 3 bytes from distance D back, D a U16 little-endian
+//                      after the token. Distances count over the dictionary followed by the
+//                      APDU bytes produced so far; a copy may overlap the bytes it produces.
+
+#define APDU_FORWARD_VERSION 1
+#define APDU_FORWARD_MAX_APDU 1024
+#define APDU_FORWARD_HEADER_SIZE 3
+#define APDU_FORWARD_MIN_MATCH 3
+#define APDU_FORWARD_MAX_MATCH (0x7F + APDU_FORWARD_MIN_MATCH)
+#define APDU_FORWARD_MAX_LITERALS 0x80
+
+// Largest compressed size of an APDU of length bytes: all literals
+#define APDU_FORWARD_BOUND(length) (APDU_FORWARD_HEADER_SIZE + (length) + ((length) + APDU_FORWARD_MAX_LITERALS - 1) / APDU_FORWARD_MAX_LITERALS)
+
+// The dictionary both ends must share for APDU_FORWARD_VERSION
+extern const uint8_t apdu_forward_dictionary[];
+extern const size_t apdu_forward_dictionary_size;
+
+// Compress an APDU of up to APDU_FORWARD_MAX_APDU bytes into out, which must hold
+// APDU_FORWARD_BOUND(length). Returns the compressed size, 0 if the APDU is too long or out too
+// small. The search is exhaustive, a few ms on the ESP32-C6 for a 300 byte push.
+size_t apdu_forward_compress(const uint8_t *apdu, size_t length, uint8_t *out, size_t size);
+
+// The reverse, as the backend does it. Returns the APDU length, 0 for a corrupt or unknown stream
+// or one that does not fit into size bytes.
+size_t apdu_forward_decompress(const uint8_t *data, size_t length, uint8_t *out, size_t size);
+
+#endif // APDU_FORWARD_H
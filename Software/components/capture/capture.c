@@ -0,0 +1,215 @@
+#include "include/capture.h"
+#include <string.h>
+
+#define VARINT_MAX 10
+
+static size_t varint_encode(uint64_t value, uint8_t *out)
+{
+    size_t length = 0;
+    do
+    {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        out[length++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return length;
+}
+
+static uint8_t ring_at(const capture_t *capture, size_t offset)
+{
+    return capture->buffer[(capture->tail + offset) % capture->size];
+}
+
+// Decode the varint at offset from the tail, returns its length
+static size_t ring_varint(const capture_t *capture, size_t offset, uint64_t *value)
+{
+    size_t length = 0;
+    *value = 0;
+    uint8_t byte;
+    do
+    {
+        byte = ring_at(capture, offset + length);
+        *value |= (uint64_t)(byte & 0x7F) << (7 * length);
+        length++;
+    } while ((byte & 0x80) && length < VARINT_MAX);
+    return length;
+}
+
+static void ring_put(capture_t *capture, const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        capture->buffer[capture->head] = data[i];
+        capture->head = (capture->head + 1) % capture->size;
+    }
+    capture->used += length;
+}
+
+static void drop_oldest(capture_t *capture)
+{
+    uint64_t delta;
+    size_t varint = ring_varint(capture, 0, &delta);
+    size_t record = varint + 1 + ring_at(capture, varint);
+
+    capture->tail = (capture->tail + record) % capture->size;
+    capture->used -= record;
+    capture->records--;
+    capture->overwritten++;
+
+    // The next record becomes the oldest, its delta was relative to the one just dropped
+    if (capture->records > 0)
+    {
+        ring_varint(capture, 0, &delta);
+        capture->first_us += (int64_t)delta;
+    }
+}
+
+void capture_init(capture_t *capture, uint8_t *buffer, size_t size)
+{
+    capture->buffer = buffer;
+    capture->size = size;
+    capture_clear(capture);
+}
+
+void capture_clear(capture_t *capture)
+{
+    capture->head = 0;
+    capture->tail = 0;
+    capture->used = 0;
+    capture->first_us = 0;
+    capture->last_us = 0;
+    capture->records = 0;
+    capture->overwritten = 0;
+}
+
+void capture_write(capture_t *capture, int64_t time_us, const uint8_t *data, size_t length)
+{
+    while (length > 0)
+    {
+        uint8_t header[VARINT_MAX + 1];
+        size_t chunk = length < CAPTURE_MAX_RECORD ? length : CAPTURE_MAX_RECORD;
+        uint64_t delta = capture->records > 0 && time_us > capture->last_us ? (uint64_t)(time_us - capture->last_us) : 0;
+        size_t header_size = varint_encode(delta, header);
+        header[header_size++] = (uint8_t)chunk;
+
+        if (header_size + chunk > capture->size)
+        {
+            return;
+        }
+        while (capture->size - capture->used < header_size + chunk)
+        {
+            drop_oldest(capture);
+        }
+
+        if (capture->records == 0)
+        {
+            capture->first_us = time_us;
+        }
+        ring_put(capture, header, header_size);
+        ring_put(capture, data, chunk);
+        capture->last_us = capture->records > 0 && time_us < capture->last_us ? capture->last_us : time_us;
+        capture->records++;
+
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+// The export is the header, a zero delta for the first record and the ring from the first
+// record's length byte on
+static size_t export_prefix(const capture_t *capture, uint8_t *prefix, size_t *skip)
+{
+    memcpy(prefix, CAPTURE_MAGIC, 4);
+    prefix[4] = CAPTURE_VERSION;
+    prefix[5] = prefix[6] = prefix[7] = 0;
+    uint64_t first = (uint64_t)capture->first_us;
+    for (int i = 0; i < 8; i++)
+    {
+        prefix[8 + i] = (uint8_t)(first >> (8 * i));
+    }
+
+    if (capture->records == 0)
+    {
+        *skip = 0;
+        return CAPTURE_HEADER_SIZE;
+    }
+
+    uint64_t delta;
+    *skip = ring_varint(capture, 0, &delta);
+    prefix[CAPTURE_HEADER_SIZE] = 0;
+    return CAPTURE_HEADER_SIZE + 1;
+}
+
+size_t capture_export_size(const capture_t *capture)
+{
+    uint8_t prefix[CAPTURE_HEADER_SIZE + 1];
+    size_t skip;
+    size_t prefix_size = export_prefix(capture, prefix, &skip);
+    return prefix_size + capture->used - skip;
+}
+
+size_t capture_export(const capture_t *capture, size_t offset, uint8_t *out, size_t size)
+{
+    uint8_t prefix[CAPTURE_HEADER_SIZE + 1];
+    size_t skip;
+    size_t prefix_size = export_prefix(capture, prefix, &skip);
+    size_t total = prefix_size + capture->used - skip;
+    size_t count = 0;
+
+    for (; count < size && offset < total; count++, offset++)
+    {
+        out[count] = offset < prefix_size ? prefix[offset] : ring_at(capture, skip + offset - prefix_size);
+    }
+    return count;
+}
+
+bool capture_reader_init(capture_reader_t *reader, const uint8_t *data, size_t length)
+{
+    if (length < CAPTURE_HEADER_SIZE || memcmp(data, CAPTURE_MAGIC, 4) != 0 || data[4] != CAPTURE_VERSION)
+    {
+        return false;
+    }
+
+    uint64_t first = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        first |= (uint64_t)data[8 + i] << (8 * i);
+    }
+
+    reader->data = data;
+    reader->length = length;
+    reader->pos = CAPTURE_HEADER_SIZE;
+    reader->time_us = (int64_t)first;
+    return true;
+}
+
+bool capture_reader_next(capture_reader_t *reader, capture_record_t *record)
+{
+    uint64_t delta = 0;
+    size_t pos = reader->pos;
+    int shift = 0;
+    uint8_t byte;
+
+    do
+    {
+        if (pos >= reader->length || shift >= 7 * VARINT_MAX)
+        {
+            return false;
+        }
+        byte = reader->data[pos++];
+        delta |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    if (pos >= reader->length || reader->data[pos] == 0 || pos + 1 + reader->data[pos] > reader->length)
+    {
+        return false;
+    }
+
+    reader->time_us += (int64_t)delta;
+    record->time_us = reader->time_us;
+    record->length = reader->data[pos];
+    record->bytes = &reader->data[pos + 1];
+    reader->pos = pos + 1 + record->length;
+    return true;
+}
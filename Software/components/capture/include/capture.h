@@ -0,0 +1,60 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Ring buffer of raw UART RX bytes with microsecond timestamps, for reproducing field issues.
+// When full, the oldest records are overwritten.
+//
+// Export format, all integers little-endian:
+//   header  "WZCP", version (1), 3 reserved bytes, int64 time of the first record in us
+//   record  LEB128 delta to the previous record in us (0 for the first), length (1..255), bytes
+// Reads longer than 255 bytes are split into several records, the later ones with delta 0.
+
+#define CAPTURE_MAGIC "WZCP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 16
+#define CAPTURE_MAX_RECORD 255
+
+typedef struct {
+    uint8_t *buffer;
+    size_t size;
+    size_t head;            // Next write position
+    size_t tail;            // Start of the oldest record
+    size_t used;
+    int64_t first_us;       // Time of the oldest record, its stored delta is not used
+    int64_t last_us;        // Time of the newest record
+    uint32_t records;
+    uint32_t overwritten;   // Records dropped to make room since the last clear
+} capture_t;
+
+typedef struct {
+    int64_t time_us;
+    const uint8_t *bytes;
+    uint8_t length;
+} capture_record_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    size_t pos;
+    int64_t time_us;
+} capture_reader_t;
+
+void capture_init(capture_t *capture, uint8_t *buffer, size_t size);
+void capture_clear(capture_t *capture);
+void capture_write(capture_t *capture, int64_t time_us, const uint8_t *data, size_t length);
+
+// The export is produced in pieces so it can be sent over small transports: export_size is the
+// total length, capture_export copies up to size bytes starting at offset and returns the count.
+size_t capture_export_size(const capture_t *capture);
+size_t capture_export(const capture_t *capture, size_t offset, uint8_t *out, size_t size);
+
+// Walk an exported capture. init fails on a bad header, next returns false at the end or at a
+// truncated record.
+bool capture_reader_init(capture_reader_t *reader, const uint8_t *data, size_t length);
+bool capture_reader_next(capture_reader_t *reader, capture_record_t *record);
+
+#endif // CAPTURE_H
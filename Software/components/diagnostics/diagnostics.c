@@ -0,0 +1,3 @@
+#include "include/diagnostics.h"
+
+atomic_uint_least32_t diag_counters[DIAG_COUNTER_COUNT];
@@ -0,0 +1,41 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Health counters for remote monitoring. They count since boot and are safe to update from any
+// task: increments are relaxed atomic adds, a single instruction on the ESP32-C6.
+
+typedef enum {
+    DIAG_FRAMES_OK,             // Frames with a valid FCS
+    DIAG_FCS_ERRORS,
+    DIAG_RESYNCS,               // Frames dropped after losing the framing
+    DIAG_UART_FIFO_OVERFLOWS,
+    DIAG_UART_BUFFER_FULL,
+    DIAG_SILENCE_DISCARDED,     // Bytes dropped while waiting for a quiet line at startup
+    DIAG_PARSE_US,              // CPU time spent parsing
+    DIAG_DECRYPT_ERRORS,        // Ciphered frames dropped before any field was released
+    DIAG_CLIENT_ERRORS,         // DLMS client read cycles that failed
+    DIAG_APDU_FORWARD_ERRORS,   // APDUs too long to keep or to compress for forwarding
+    DIAG_COUNTER_COUNT
+} diag_counter_t;
+
+extern atomic_uint_least32_t diag_counters[DIAG_COUNTER_COUNT];
+
+static inline void diag_add(diag_counter_t counter, uint32_t value)
+{
+    atomic_fetch_add_explicit(&diag_counters[counter], value, memory_order_relaxed);
+}
+
+static inline void diag_increment(diag_counter_t counter)
+{
+    diag_add(counter, 1);
+}
+
+static inline uint32_t diag_get(diag_counter_t counter)
+{
+    return atomic_load_explicit(&diag_counters[counter], memory_order_relaxed);
+}
+
+#endif // DIAGNOSTICS_H
@@ -0,0 +1,740 @@
+#include "include/dlms_client.h"
+#include <string.h>
+#include "dlog.h"
+
+// HDLC frame format type 3: flag, format with the segmentation bit and the 11-bit length,
+// addresses, control, HCS if there is an information field, the information, FCS, flag
+#define HDLC_FLAG 0x7E
+#define HDLC_FORMAT_TYPE_3 0xA0
+#define HDLC_SEGMENTED 0x08
+#define HDLC_LENGTH_MASK 0x07FF
+#define HDLC_MIN_LENGTH 7               // Format, two 1-byte addresses, control, FCS
+#define HDLC_MAX_OVERHEAD 14            // Flags, format, 4-byte server address, client address, control, HCS, FCS
+#define HDLC_DEFAULT_MAX_INFO 128
+
+// Control field with the poll/final bit set. I frames carry N(R) << 5 and N(S) << 1.
+#define HDLC_POLL 0x10
+#define HDLC_SNRM 0x93
+#define HDLC_UA 0x73
+#define HDLC_DM 0x1F
+#define HDLC_FRMR 0x97
+#define HDLC_RR 0x11
+
+// UA parameter negotiation: format 0x81, group 0x80, group length, then id, length, value
+#define HDLC_PARAM_FORMAT 0x81
+#define HDLC_PARAM_GROUP 0x80
+#define HDLC_PARAM_MAX_INFO_RX 0x06     // Longest information field the meter receives
+
+#define LLC_SIZE 3
+
+// xDLMS APDUs
+#define APDU_AARQ 0x60
+#define APDU_AARE 0x61
+#define APDU_GET_REQUEST 0xC0
+#define APDU_GET_RESPONSE 0xC4
+#define GET_NORMAL 0x01
+#define GET_WITH_LIST 0x03
+#define INVOKE_ID_PRIORITY 0xC0         // High priority, confirmed; the invoke id goes in the low nibble
+#define ATTRIBUTE_VALUE 2
+#define ATTRIBUTE_SCALER_UNIT 3
+#define GET_REQUEST_HEADER 7            // LLC, tag, type, invoke id, list count
+#define GET_REQUEST_ITEM 10             // Class, OBIS code, attribute, no access selection
+
+// AARQ/AARE components
+#define AARE_RESULT 0xA2
+#define AARE_USER_INFORMATION 0xBE
+#define BER_OCTET_STRING 0x04
+#define INITIATE_RESPONSE 0x08
+#define CONFORMANCE_MULTIPLE_REFERENCES 0x02    // Bit 14, in the second byte
+
+static const char *TAG = "Client";
+
+static const uint8_t kLlcRequest[LLC_SIZE] = {0xE6, 0xE6, 0x00};
+static const uint8_t kLlcResponse[LLC_SIZE] = {0xE6, 0xE7, 0x00};
+
+// Logical name referencing without ciphering
+static const uint8_t kApplicationContext[] = {0xA1, 0x09, 0x06, 0x07, 0x60, 0x85, 0x74, 0x05, 0x08, 0x01, 0x01};
+
+// ACSE requirements with the authentication bit, and the low level security mechanism name
+static const uint8_t kLowLevelSecurity[] = {0x8A, 0x02, 0x07, 0x80, 0x8B, 0x07, 0x60, 0x85, 0x74, 0x05, 0x08, 0x02, 0x01};
+
+// InitiateRequest: no dedicated key, response allowed, no QoS, DLMS version 6, the conformance
+// block with get and multiple references only, and the largest PDU taken
+static const uint8_t kInitiateRequest[] = {
+    0x01, 0x00, 0x00, 0x00, 0x06, 0x5F, 0x1F, 0x04, 0x00, 0x00, 0x02, 0x10,
+    DLMS_CLIENT_APDU_SIZE >> 8, DLMS_CLIENT_APDU_SIZE & 0xFF};
+
+#define OBIS(a, b, c, d, e) {a, b, c, d, e, 0xFF}
+
+// Units as in meter_snapshot_t: V, A/100, W, var, 1/100, Wh. The scalers apply until the
+// scaler_unit of the registers has been read.
+const dlms_client_object_t dlms_client_objects[] = {
+    {DLMS_CLASS_CLOCK, OBIS(0, 0, 1, 0, 0), DLMS_FIELD_TIMESTAMP, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 32, 7, 0), RMS_VOLTAGE_A, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 52, 7, 0), RMS_VOLTAGE_B, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 72, 7, 0), RMS_VOLTAGE_C, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 31, 7, 0), RMS_CURRENT_A, 2, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 51, 7, 0), RMS_CURRENT_B, 2, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 71, 7, 0), RMS_CURRENT_C, 2, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 21, 7, 0), ACTIVE_POWER_A, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 41, 7, 0), ACTIVE_POWER_B, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 61, 7, 0), ACTIVE_POWER_C, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 23, 7, 0), REACTIVE_POWER_A, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 43, 7, 0), REACTIVE_POWER_B, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 63, 7, 0), REACTIVE_POWER_C, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 33, 7, 0), POWER_FACTOR_A, 2, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 53, 7, 0), POWER_FACTOR_B, 2, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 73, 7, 0), POWER_FACTOR_C, 2, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 1, 7, 0), ACTIVE_POWER_IMPORT, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 2, 7, 0), ACTIVE_POWER_EXPORT, 0, 1},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 1, 8, 0), ACTIVE_ENERGY_IMPORT, 0, 10},
+    {DLMS_CLASS_REGISTER, OBIS(1, 0, 2, 8, 0), ACTIVE_ENERGY_EXPORT, 0, 10},
+};
+const size_t dlms_client_object_count = sizeof(dlms_client_objects) / sizeof(dlms_client_objects[0]);
+
+void dlms_client_init(dlms_client_t *client, const dlms_client_config_t *config)
+{
+    memset(client, 0, sizeof(dlms_client_t));
+    client->config = *config;
+    client->state = DLMS_CLIENT_DISCONNECTED;
+
+    if (client->config.object_count > DLMS_CLIENT_MAX_OBJECTS)
+    {
+        DLOGW(TAG, "Only the first %d of %d objects are read", DLMS_CLIENT_MAX_OBJECTS, client->config.object_count);
+        client->config.object_count = DLMS_CLIENT_MAX_OBJECTS;
+    }
+    for (uint8_t i = 0; i < client->config.object_count; i++)
+    {
+        client->scalers[i] = client->config.objects[i].scaler;
+    }
+
+    // Server address in 1, 2 or 4 bytes of 7 bits, the last one ending in 1
+    uint16_t upper = config->server_address;
+    uint16_t lower = config->physical_address;
+    if (lower == 0 && upper < 0x80)
+    {
+        client->server_hdlc[0] = (uint8_t)(upper << 1 | 1);
+        client->server_hdlc_size = 1;
+    }
+    else if (upper < 0x80 && lower < 0x80)
+    {
+        client->server_hdlc[0] = (uint8_t)(upper << 1);
+        client->server_hdlc[1] = (uint8_t)(lower << 1 | 1);
+        client->server_hdlc_size = 2;
+    }
+    else
+    {
+        client->server_hdlc[0] = (uint8_t)((upper >> 7) << 1);
+        client->server_hdlc[1] = (uint8_t)((upper & 0x7F) << 1);
+        client->server_hdlc[2] = (uint8_t)((lower >> 7) << 1);
+        client->server_hdlc[3] = (uint8_t)((lower & 0x7F) << 1 | 1);
+        client->server_hdlc_size = 4;
+    }
+}
+
+void dlms_client_set_callback(dlms_client_t *client, dlms_field_callback_t callback, void *context)
+{
+    client->callback = callback;
+    client->callback_context = context;
+}
+
+static void notify(dlms_client_t *client, dlms_field_type_t type, uint8_t *data, uint16_t length)
+{
+    if (client->callback != NULL)
+    {
+        dlms_field_t field = {.type = type, .data = data, .length = length};
+        client->callback(&field, client->callback_context);
+    }
+}
+
+// Offset of the information field in tx
+static uint16_t info_offset(const dlms_client_t *client)
+{
+    return 1 + 2 + client->server_hdlc_size + 1 + 1 + 2;
+}
+
+// Append the complemented FCS of frame[1..pos), least significant byte first
+static uint16_t append_fcs(uint8_t *frame, uint16_t pos)
+{
+    uint16_t fcs = DLMS_FCS_INIT;
+    for (uint16_t i = 1; i < pos; i++)
+    {
+        fcs = dlms_fcs_update(fcs, frame[i]);
+    }
+    fcs = (uint16_t)~fcs;
+    frame[pos++] = (uint8_t)fcs;
+    frame[pos++] = (uint8_t)(fcs >> 8);
+    return pos;
+}
+
+// Send a frame whose information field, if any, is already at info_offset() in tx
+static void send_frame(dlms_client_t *client, uint8_t control, uint16_t info_length)
+{
+    uint8_t *tx = client->tx;
+    uint16_t length = (uint16_t)(2 + client->server_hdlc_size + 1 + 1 + (info_length > 0 ? 2 + info_length : 0) + 2);
+    uint16_t pos = 0;
+
+    tx[pos++] = HDLC_FLAG;
+    tx[pos++] = (uint8_t)(HDLC_FORMAT_TYPE_3 | length >> 8);
+    tx[pos++] = (uint8_t)length;
+    memcpy(&tx[pos], client->server_hdlc, client->server_hdlc_size);
+    pos += client->server_hdlc_size;
+    tx[pos++] = (uint8_t)(client->config.client_address << 1 | 1);
+    tx[pos++] = control;
+    if (info_length > 0)
+    {
+        pos = append_fcs(tx, pos);
+        pos += info_length;
+    }
+    pos = append_fcs(tx, pos);
+    tx[pos++] = HDLC_FLAG;
+
+    client->config.send(tx, pos, client->config.send_context);
+}
+
+static void send_information(dlms_client_t *client, uint16_t info_length)
+{
+    uint8_t control = (uint8_t)(client->receive_sequence << 5 | HDLC_POLL | client->send_sequence << 1);
+    client->send_sequence = (client->send_sequence + 1) & 0x07;
+    client->apdu_length = 0;
+    send_frame(client, control, info_length);
+}
+
+static void fail_cycle(dlms_client_t *client, uint32_t now_ms)
+{
+    uint8_t reason = DLMS_ABORT_CLIENT;
+    notify(client, START, NULL, 0);
+    notify(client, ABORT, &reason, 1);
+
+    client->state = DLMS_CLIENT_DISCONNECTED;
+    client->in_frame = false;
+    client->apdu_length = 0;
+    client->deadline_ms = now_ms + (client->config.interval_ms > DLMS_CLIENT_RETRY_MS ? client->config.interval_ms : DLMS_CLIENT_RETRY_MS);
+}
+
+static void finish_cycle(dlms_client_t *client, uint32_t now_ms)
+{
+    notify(client, START, NULL, 0);
+    for (uint8_t i = 0; i < client->held_count; i++)
+    {
+        notify(client, (dlms_field_type_t)client->held[i].type, client->held[i].data, client->held[i].length);
+    }
+    notify(client, END, NULL, 0);
+
+    client->cycle++;
+    client->state = DLMS_CLIENT_IDLE;
+    uint32_t next = client->cycle_start_ms + client->config.interval_ms;
+    client->deadline_ms = (int32_t)(next - now_ms) > 0 ? next : now_ms;
+}
+
+static bool object_due(const dlms_client_t *client, uint8_t index)
+{
+    const dlms_client_object_t *object = &client->config.objects[index];
+    if (client->reading_scalers)
+    {
+        return object->class_id == DLMS_CLASS_REGISTER;
+    }
+    return object->every <= 1 || client->cycle % object->every == 0;
+}
+
+// Request the next objects due in this cycle, the scaler_units first if they are not known. The
+// cycle ends when none are left.
+static void send_next_request(dlms_client_t *client, uint32_t now_ms)
+{
+    uint8_t capacity = 1;
+    if (client->multiple_references)
+    {
+        int fit = ((int)client->max_info_tx - GET_REQUEST_HEADER) / GET_REQUEST_ITEM;
+        capacity = fit < 1 ? 1 : fit < DLMS_CLIENT_LIST_MAX ? (uint8_t)fit : DLMS_CLIENT_LIST_MAX;
+    }
+
+    client->pending_count = 0;
+    while (client->pending_count == 0)
+    {
+        while (client->next_object < client->config.object_count && client->pending_count < capacity)
+        {
+            uint8_t index = client->next_object++;
+            if (object_due(client, index))
+            {
+                client->pending[client->pending_count++] = index;
+            }
+        }
+        if (client->pending_count > 0)
+        {
+            break;
+        }
+        if (!client->reading_scalers)
+        {
+            finish_cycle(client, now_ms);
+            return;
+        }
+        client->reading_scalers = false;
+        client->scalers_read = true;
+        client->next_object = 0;
+    }
+
+    uint8_t *info = &client->tx[info_offset(client)];
+    uint16_t pos = LLC_SIZE;
+    memcpy(info, kLlcRequest, LLC_SIZE);
+    info[pos++] = APDU_GET_REQUEST;
+    info[pos++] = client->pending_count > 1 ? GET_WITH_LIST : GET_NORMAL;
+    client->invoke_id = (client->invoke_id + 1) & 0x0F;
+    info[pos++] = INVOKE_ID_PRIORITY | client->invoke_id;
+    if (client->pending_count > 1)
+    {
+        info[pos++] = client->pending_count;
+    }
+    for (uint8_t i = 0; i < client->pending_count; i++)
+    {
+        const dlms_client_object_t *object = &client->config.objects[client->pending[i]];
+        info[pos++] = (uint8_t)(object->class_id >> 8);
+        info[pos++] = (uint8_t)object->class_id;
+        memcpy(&info[pos], object->obis, DLMS_OBIS_SIZE);
+        pos += DLMS_OBIS_SIZE;
+        info[pos++] = client->reading_scalers ? ATTRIBUTE_SCALER_UNIT : ATTRIBUTE_VALUE;
+        info[pos++] = 0x00;
+    }
+
+    send_information(client, pos);
+    client->state = DLMS_CLIENT_READING;
+    client->deadline_ms = now_ms + client->config.timeout_ms;
+}
+
+static void begin_reading(dlms_client_t *client, uint32_t now_ms)
+{
+    client->next_object = 0;
+    client->held_count = 0;
+    client->reading_scalers = !client->scalers_read;
+    send_next_request(client, now_ms);
+}
+
+static void open_link(dlms_client_t *client, uint32_t now_ms)
+{
+    DLOGI(TAG, "Connecting to the meter");
+    client->cycle_start_ms = now_ms;
+    client->send_sequence = 0;
+    client->receive_sequence = 0;
+    client->max_info_tx = HDLC_DEFAULT_MAX_INFO;
+    send_frame(client, HDLC_SNRM, 0);
+    client->state = DLMS_CLIENT_CONNECTING;
+    client->deadline_ms = now_ms + client->config.timeout_ms;
+}
+
+static void associate(dlms_client_t *client, uint32_t now_ms)
+{
+    uint8_t *info = &client->tx[info_offset(client)];
+    uint16_t pos = LLC_SIZE;
+    memcpy(info, kLlcRequest, LLC_SIZE);
+
+    uint8_t *aarq = &info[pos];
+    pos += 2;
+    memcpy(&info[pos], kApplicationContext, sizeof(kApplicationContext));
+    pos += sizeof(kApplicationContext);
+
+    const char *password = client->config.password;
+    size_t password_length = password != NULL ? strlen(password) : 0;
+    if (password_length > DLMS_CLIENT_PASSWORD_MAX)
+    {
+        password_length = DLMS_CLIENT_PASSWORD_MAX;
+    }
+    if (password_length > 0)
+    {
+        memcpy(&info[pos], kLowLevelSecurity, sizeof(kLowLevelSecurity));
+        pos += sizeof(kLowLevelSecurity);
+        info[pos++] = 0xAC;         // Calling authentication value, a GraphicString
+        info[pos++] = (uint8_t)(password_length + 2);
+        info[pos++] = 0x80;
+        info[pos++] = (uint8_t)password_length;
+        memcpy(&info[pos], password, password_length);
+        pos += password_length;
+    }
+
+    info[pos++] = AARE_USER_INFORMATION;
+    info[pos++] = sizeof(kInitiateRequest) + 2;
+    info[pos++] = BER_OCTET_STRING;
+    info[pos++] = sizeof(kInitiateRequest);
+    memcpy(&info[pos], kInitiateRequest, sizeof(kInitiateRequest));
+    pos += sizeof(kInitiateRequest);
+
+    aarq[0] = APDU_AARQ;
+    aarq[1] = (uint8_t)(pos - LLC_SIZE - 2);
+
+    send_information(client, pos);
+    client->state = DLMS_CLIENT_ASSOCIATING;
+    client->deadline_ms = now_ms + client->config.timeout_ms;
+}
+
+// The meter may lower the information field it receives below the default, or raise it
+static void process_ua(dlms_client_t *client, const uint8_t *info, uint16_t length)
+{
+    if (length < 3 || info[0] != HDLC_PARAM_FORMAT || info[1] != HDLC_PARAM_GROUP)
+    {
+        return;
+    }
+    for (uint16_t pos = 3; pos + 2 <= length && pos + 2 + info[pos + 1] <= length; pos += 2 + info[pos + 1])
+    {
+        if (info[pos] != HDLC_PARAM_MAX_INFO_RX || info[pos + 1] > 4)
+        {
+            continue;
+        }
+        uint32_t value = 0;
+        for (uint8_t i = 0; i < info[pos + 1]; i++)
+        {
+            value = value << 8 | info[pos + 2 + i];
+        }
+        uint16_t largest = DLMS_CLIENT_FRAME_SIZE - HDLC_MAX_OVERHEAD;
+        client->max_info_tx = value < largest ? (uint16_t)value : largest;
+    }
+}
+
+// AARE: the association result, and the conformance block of the InitiateResponse in the user
+// information
+static bool process_aare(dlms_client_t *client)
+{
+    const uint8_t *apdu = client->apdu;
+    uint16_t length = client->apdu_length;
+    if (length < 2 || apdu[0] != APDU_AARE)
+    {
+        DLOGW(TAG, "Expected an AARE, got %02X", length > 0 ? apdu[0] : 0);
+        return false;
+    }
+
+    int result = -1;
+    const uint8_t *initiate = NULL;
+    uint8_t initiate_length = 0;
+    for (uint16_t pos = 2; pos + 2 <= length && pos + 2 + apdu[pos + 1] <= length; pos += 2 + apdu[pos + 1])
+    {
+        const uint8_t *content = &apdu[pos + 2];
+        uint8_t size = apdu[pos + 1];
+        if (apdu[pos] == AARE_RESULT && size >= 3)
+        {
+            result = content[2];
+        }
+        else if (apdu[pos] == AARE_USER_INFORMATION && size >= 2 && content[0] == BER_OCTET_STRING && content[1] <= size - 2)
+        {
+            initiate = &content[2];
+            initiate_length = content[1];
+        }
+    }
+    if (result != 0)
+    {
+        DLOGW(TAG, "Association rejected, result %d", result);
+        return false;
+    }
+
+    // Tag, QoS (0x00, or 0x01 and a byte), DLMS version, conformance 5F 1F 04 00 and 3 bytes
+    if (initiate == NULL || initiate_length < 2 || initiate[0] != INITIATE_RESPONSE)
+    {
+        DLOGW(TAG, "No InitiateResponse in the AARE");
+        return false;
+    }
+    uint8_t pos = initiate[1] != 0 ? 4 : 3;
+    if (pos + 7 > initiate_length || initiate[pos] != 0x5F || initiate[pos + 1] != 0x1F)
+    {
+        DLOGW(TAG, "No conformance block in the AARE");
+        return false;
+    }
+    client->multiple_references = initiate[pos + 5] & CONFORMANCE_MULTIPLE_REFERENCES;
+    DLOGI(TAG, "Associated, %s", DLOG_STR(client->multiple_references ? "GET with list" : "single GET"));
+    return true;
+}
+
+static void process_result(dlms_client_t *client, uint8_t index, uint8_t *data, uint16_t size)
+{
+    const dlms_client_object_t *object = &client->config.objects[index];
+
+    if (client->reading_scalers)
+    {
+        // scaler_unit: a structure of the scaler, an integer, and the unit, an enum
+        if (size == 6 && data[0] == DLMS_TAG_STRUCTURE && data[2] == DLMS_TAG_INTEGER && data[4] == DLMS_TAG_ENUM &&
+            !dlms_field_scaler(object->type, (int8_t)data[3], data[5], &client->scalers[index]))
+        {
+            DLOGW(TAG, "Unit %d does not fit %s", data[5], DLOG_STR(dlms_field_name(object->type)));
+        }
+        return;
+    }
+
+    uint8_t tag = data[0];
+    bool prefixed = tag == DLMS_TAG_OCTET_STRING || tag == DLMS_TAG_VISIBLE_STRING || tag == DLMS_TAG_UTF8_STRING;
+    uint8_t *value = prefixed ? &data[2] : &data[1];
+    uint8_t length = (uint8_t)(prefixed ? data[1] : size - 1);
+
+    dlms_held_field_t *held = &client->held[client->held_count];
+    dlms_field_t field;
+    if (client->held_count >= DLMS_CLIENT_MAX_OBJECTS ||
+        !dlms_value_to_field(object->type, client->scalers[index], tag, value, length, held->data, &field))
+    {
+        DLOGW(TAG, "Unexpected type %02X for %s", tag, DLOG_STR(dlms_field_name(object->type)));
+        return;
+    }
+    held->type = (uint8_t)field.type;
+    held->length = (uint8_t)field.length;
+    if (field.data != held->data)
+    {
+        memcpy(held->data, field.data, field.length);
+    }
+    client->held_count++;
+}
+
+// GET response, normal or with a list: for every object a data element or a data access result
+static bool process_get_response(dlms_client_t *client)
+{
+    uint8_t *apdu = client->apdu;
+    uint16_t length = client->apdu_length;
+    if (length < 3 || apdu[0] != APDU_GET_RESPONSE || (apdu[2] & 0x0F) != client->invoke_id)
+    {
+        DLOGW(TAG, "Unexpected response %02X", length > 0 ? apdu[0] : 0);
+        return false;
+    }
+
+    uint16_t pos = 3;
+    uint8_t count = 1;
+    if (apdu[1] == GET_WITH_LIST && length > pos)
+    {
+        count = apdu[pos++];
+    }
+    else if (apdu[1] != GET_NORMAL)
+    {
+        DLOGW(TAG, "Unsupported GET response type %d", apdu[1]);
+        return false;
+    }
+    if (count != client->pending_count)
+    {
+        DLOGW(TAG, "%d results for %d objects", count, client->pending_count);
+        return false;
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (pos + 2 > length)
+        {
+            return false;
+        }
+        if (apdu[pos] != 0)
+        {
+            DLOGW(TAG, "Object %d not read, result %d", client->pending[i], apdu[pos + 1]);
+            pos += 2;
+            continue;
+        }
+        pos++;
+        uint16_t size = dlms_element_size(&apdu[pos], length - pos);
+        if (size == 0)
+        {
+            DLOGW(TAG, "Malformed data for object %d", client->pending[i]);
+            return false;
+        }
+        process_result(client, client->pending[i], &apdu[pos], size);
+        pos += size;
+    }
+    return true;
+}
+
+static bool process_information(dlms_client_t *client, uint8_t control, bool segmented, const uint8_t *info, uint16_t length, uint32_t now_ms)
+{
+    uint8_t sequence = (control >> 1) & 0x07;
+    if (sequence != client->receive_sequence)
+    {
+        DLOGW(TAG, "I frame %d, expected %d", sequence, client->receive_sequence);
+        return true;
+    }
+    client->receive_sequence = (sequence + 1) & 0x07;
+
+    // The LLC header only leads the first segment
+    if (client->apdu_length == 0)
+    {
+        if (length < LLC_SIZE || memcmp(info, kLlcResponse, LLC_SIZE) != 0)
+        {
+            DLOGW(TAG, "No LLC header");
+            fail_cycle(client, now_ms);
+            return false;
+        }
+        info += LLC_SIZE;
+        length -= LLC_SIZE;
+    }
+    if (client->apdu_length + length > DLMS_CLIENT_APDU_SIZE)
+    {
+        DLOGW(TAG, "Response longer than %d bytes", DLMS_CLIENT_APDU_SIZE);
+        fail_cycle(client, now_ms);
+        return false;
+    }
+    memcpy(&client->apdu[client->apdu_length], info, length);
+    client->apdu_length += length;
+
+    // Ask for the next segment
+    if (segmented)
+    {
+        send_frame(client, (uint8_t)(client->receive_sequence << 5 | HDLC_RR), 0);
+        return true;
+    }
+
+    if (client->state == DLMS_CLIENT_ASSOCIATING)
+    {
+        if (!process_aare(client))
+        {
+            fail_cycle(client, now_ms);
+            return false;
+        }
+        client->cycle = 0;
+        client->scalers_read = false;
+        begin_reading(client, now_ms);
+    }
+    else if (client->state == DLMS_CLIENT_READING)
+    {
+        if (!process_get_response(client))
+        {
+            fail_cycle(client, now_ms);
+            return false;
+        }
+        send_next_request(client, now_ms);
+    }
+    return true;
+}
+
+static bool process_frame(dlms_client_t *client, uint32_t now_ms)
+{
+    const uint8_t *frame = client->frame;
+    uint16_t length = client->frame_length;
+
+    uint16_t fcs = DLMS_FCS_INIT;
+    for (uint16_t i = 0; i < length - 2; i++)
+    {
+        fcs = dlms_fcs_update(fcs, frame[i]);
+    }
+    if ((uint16_t)(frame[length - 2] | frame[length - 1] << 8) != (uint16_t)~fcs)
+    {
+        DLOGW(TAG, "FCS mismatch");
+        return false;
+    }
+
+    // Our address, then the meter's, each ending with the low bit set
+    uint16_t pos = 2;
+    uint8_t destination = frame[pos];
+    for (int address = 0; address < 2; address++)
+    {
+        while (pos < length - 2 && !(frame[pos] & 0x01))
+        {
+            pos++;
+        }
+        pos++;
+    }
+    if (pos >= length - 2)
+    {
+        DLOGW(TAG, "Frame without control field");
+        return false;
+    }
+    if (destination != (uint8_t)(client->config.client_address << 1 | 1))
+    {
+        return true;
+    }
+
+    uint8_t control = frame[pos++];
+    const uint8_t *info = &frame[pos + 2];
+    uint16_t info_length = pos + 2 < length - 2 ? (uint16_t)(length - 2 - pos - 2) : 0;
+
+    if ((control & 0x01) == 0)
+    {
+        if (client->state != DLMS_CLIENT_ASSOCIATING && client->state != DLMS_CLIENT_READING)
+        {
+            return true;
+        }
+        return process_information(client, control, frame[0] & HDLC_SEGMENTED, info, info_length, now_ms);
+    }
+
+    switch (control | HDLC_POLL)
+    {
+    case HDLC_UA:
+        if (client->state == DLMS_CLIENT_CONNECTING)
+        {
+            process_ua(client, info, info_length);
+            associate(client, now_ms);
+        }
+        break;
+    case HDLC_DM:
+    case HDLC_FRMR:
+        DLOGW(TAG, "Link refused by the meter, control %02X", control);
+        if (client->state != DLMS_CLIENT_DISCONNECTED)
+        {
+            fail_cycle(client, now_ms);
+        }
+        return false;
+    default:
+        break;
+    }
+    return true;
+}
+
+bool dlms_client_process_byte(dlms_client_t *client, uint8_t byte, uint32_t now_ms)
+{
+    // The timeout counts from the last byte, long responses at 2400 baud take a while
+    if (client->state == DLMS_CLIENT_CONNECTING || client->state == DLMS_CLIENT_ASSOCIATING || client->state == DLMS_CLIENT_READING)
+    {
+        client->deadline_ms = now_ms + client->config.timeout_ms;
+    }
+
+    if (!client->in_frame)
+    {
+        client->in_frame = byte == HDLC_FLAG;
+        client->frame_pos = 0;
+        return true;
+    }
+    if (client->frame_pos == 0)
+    {
+        // A closing flag followed by an opening one
+        if (byte == HDLC_FLAG)
+        {
+            return true;
+        }
+        if ((byte & 0xF0) != HDLC_FORMAT_TYPE_3)
+        {
+            client->in_frame = false;
+            return true;
+        }
+    }
+
+    client->frame[client->frame_pos++] = byte;
+    if (client->frame_pos == 2)
+    {
+        client->frame_length = (uint16_t)((client->frame[0] << 8 | byte) & HDLC_LENGTH_MASK);
+        if (client->frame_length < HDLC_MIN_LENGTH || client->frame_length > DLMS_CLIENT_FRAME_SIZE)
+        {
+            DLOGW(TAG, "Frame length %d", client->frame_length);
+            client->in_frame = false;
+            return false;
+        }
+    }
+    if (client->frame_pos < 2 || client->frame_pos < client->frame_length)
+    {
+        return true;
+    }
+
+    // The closing flag is taken as the opening flag of the next frame
+    client->in_frame = false;
+    return process_frame(client, now_ms);
+}
+
+uint32_t dlms_client_poll(dlms_client_t *client, uint32_t now_ms)
+{
+    int32_t remaining = (int32_t)(client->deadline_ms - now_ms);
+    if (remaining > 0)
+    {
+        return (uint32_t)remaining;
+    }
+
+    switch (client->state)
+    {
+    case DLMS_CLIENT_DISCONNECTED:
+        open_link(client, now_ms);
+        break;
+    case DLMS_CLIENT_IDLE:
+        client->cycle_start_ms = now_ms;
+        begin_reading(client, now_ms);
+        break;
+    default:
+        DLOGW(TAG, "No response from the meter, state %d", client->state);
+        fail_cycle(client, now_ms);
+        break;
+    }
+
+    remaining = (int32_t)(client->deadline_ms - now_ms);
+    return remaining > 0 ? (uint32_t)remaining : 0;
+}
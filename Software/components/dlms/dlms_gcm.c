@@ -0,0 +1,221 @@
+#include "include/dlms_gcm.h"
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#else
+#include <time.h>
+#endif
+
+// Reduction of the four bits shifted out of the low end, for the GCM polynomial
+static const uint64_t kReduce4[16] = {
+    0x0000, 0x1C20, 0x3840, 0x2460, 0x7080, 0x6CA0, 0x48C0, 0x54E0,
+    0xE100, 0xFD20, 0xD940, 0xC560, 0x9180, 0x8DA0, 0xA9C0, 0xB5E0,
+};
+
+static uint32_t now_us(void)
+{
+#ifdef ESP_PLATFORM
+    return (uint32_t)esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u);
+#endif
+}
+
+static uint64_t get_u64(const uint8_t *in)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        value = value << 8 | in[i];
+    }
+    return value;
+}
+
+static void put_u64(uint8_t *out, uint64_t value)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        out[i] = (uint8_t)value;
+        value >>= 8;
+    }
+}
+
+void dlms_gcm_init(dlms_gcm_t *gcm)
+{
+    memset(gcm, 0, sizeof(dlms_gcm_t));
+    mbedtls_aes_init(&gcm->aes);
+}
+
+void dlms_gcm_free(dlms_gcm_t *gcm)
+{
+    mbedtls_aes_free(&gcm->aes);
+    memset(gcm, 0, sizeof(dlms_gcm_t));
+}
+
+bool dlms_gcm_set_key(dlms_gcm_t *gcm, const uint8_t *key)
+{
+    uint8_t h[DLMS_GCM_BLOCK_SIZE] = {0};
+
+    if (mbedtls_aes_setkey_enc(&gcm->aes, key, DLMS_GCM_KEY_SIZE * 8) != 0 ||
+        mbedtls_aes_crypt_ecb(&gcm->aes, MBEDTLS_AES_ENCRYPT, h, h) != 0)
+    {
+        return false;
+    }
+
+    // GCM keeps the bits reflected: entry 8 is the hash key, 4, 2 and 1 are it times x, x^2
+    // and x^3, the others are sums of those
+    uint64_t high = get_u64(h);
+    uint64_t low = get_u64(&h[8]);
+    gcm->table_high[0] = 0;
+    gcm->table_low[0] = 0;
+    gcm->table_high[8] = high;
+    gcm->table_low[8] = low;
+    for (int i = 4; i > 0; i >>= 1)
+    {
+        uint64_t carry = low & 1 ? 0xE100000000000000ull : 0;
+        low = high << 63 | low >> 1;
+        high = high >> 1 ^ carry;
+        gcm->table_high[i] = high;
+        gcm->table_low[i] = low;
+    }
+    for (int i = 2; i <= 8; i *= 2)
+    {
+        for (int j = 1; j < i; j++)
+        {
+            gcm->table_high[i + j] = gcm->table_high[i] ^ gcm->table_high[j];
+            gcm->table_low[i + j] = gcm->table_low[i] ^ gcm->table_low[j];
+        }
+    }
+    return true;
+}
+
+// hash = (hash ^ block) * H, four bits at a time from the last byte
+static void ghash_block(dlms_gcm_t *gcm, const uint8_t *block)
+{
+    uint8_t x[DLMS_GCM_BLOCK_SIZE];
+    for (int i = 0; i < DLMS_GCM_BLOCK_SIZE; i++)
+    {
+        x[i] = gcm->hash[i] ^ block[i];
+    }
+
+    uint64_t high = 0;
+    uint64_t low = 0;
+    for (int i = DLMS_GCM_BLOCK_SIZE - 1; i >= 0; i--)
+    {
+        uint8_t nibbles[2] = {x[i] & 0x0F, x[i] >> 4};
+        for (int n = 0; n < 2; n++)
+        {
+            if (i != DLMS_GCM_BLOCK_SIZE - 1 || n != 0)
+            {
+                uint8_t rem = low & 0x0F;
+                low = high << 60 | low >> 4;
+                high = high >> 4 ^ kReduce4[rem] << 48;
+            }
+            high ^= gcm->table_high[nibbles[n]];
+            low ^= gcm->table_low[nibbles[n]];
+        }
+    }
+    put_u64(gcm->hash, high);
+    put_u64(&gcm->hash[8], low);
+}
+
+static void next_keystream(dlms_gcm_t *gcm)
+{
+    // Only the last 32 bits count
+    for (int i = DLMS_GCM_BLOCK_SIZE - 1; i >= DLMS_GCM_BLOCK_SIZE - 4; i--)
+    {
+        if (++gcm->counter[i] != 0)
+        {
+            break;
+        }
+    }
+    mbedtls_aes_crypt_ecb(&gcm->aes, MBEDTLS_AES_ENCRYPT, gcm->counter, gcm->keystream);
+}
+
+void dlms_gcm_start(dlms_gcm_t *gcm, const uint8_t *iv, const uint8_t *aad, size_t aad_length)
+{
+    uint32_t start = now_us();
+
+    memcpy(gcm->j0, iv, DLMS_GCM_IV_SIZE);
+    memset(&gcm->j0[DLMS_GCM_IV_SIZE], 0, DLMS_GCM_BLOCK_SIZE - DLMS_GCM_IV_SIZE - 1);
+    gcm->j0[DLMS_GCM_BLOCK_SIZE - 1] = 1;
+    memcpy(gcm->counter, gcm->j0, DLMS_GCM_BLOCK_SIZE);
+    memset(gcm->hash, 0, DLMS_GCM_BLOCK_SIZE);
+    gcm->aad_length = (uint32_t)aad_length;
+    gcm->text_length = 0;
+    gcm->pos = 0;
+
+    for (size_t offset = 0; offset < aad_length; offset += DLMS_GCM_BLOCK_SIZE)
+    {
+        size_t size = aad_length - offset < DLMS_GCM_BLOCK_SIZE ? aad_length - offset : DLMS_GCM_BLOCK_SIZE;
+        memset(gcm->block, 0, DLMS_GCM_BLOCK_SIZE);
+        memcpy(gcm->block, &aad[offset], size);
+        ghash_block(gcm, gcm->block);
+    }
+    next_keystream(gcm);
+
+    gcm->busy_us = now_us() - start;
+}
+
+// The block work happens when a block completes: hash its ciphertext and encrypt the next
+// counter, so the bytes in between cost an XOR
+static void complete_block(dlms_gcm_t *gcm)
+{
+    uint32_t start = now_us();
+    ghash_block(gcm, gcm->block);
+    next_keystream(gcm);
+    gcm->pos = 0;
+    gcm->busy_us += now_us() - start;
+}
+
+uint8_t dlms_gcm_encrypt(dlms_gcm_t *gcm, uint8_t byte)
+{
+    uint8_t out = byte ^ gcm->keystream[gcm->pos];
+    gcm->block[gcm->pos++] = out;
+    gcm->text_length++;
+    if (gcm->pos == DLMS_GCM_BLOCK_SIZE)
+    {
+        complete_block(gcm);
+    }
+    return out;
+}
+
+uint8_t dlms_gcm_decrypt(dlms_gcm_t *gcm, uint8_t byte)
+{
+    uint8_t out = byte ^ gcm->keystream[gcm->pos];
+    gcm->block[gcm->pos++] = byte;
+    gcm->text_length++;
+    if (gcm->pos == DLMS_GCM_BLOCK_SIZE)
+    {
+        complete_block(gcm);
+    }
+    return out;
+}
+
+void dlms_gcm_finish(dlms_gcm_t *gcm, uint8_t *tag)
+{
+    uint32_t start = now_us();
+
+    if (gcm->pos > 0)
+    {
+        memset(&gcm->block[gcm->pos], 0, DLMS_GCM_BLOCK_SIZE - gcm->pos);
+        ghash_block(gcm, gcm->block);
+    }
+
+    // Lengths in bits
+    uint8_t lengths[DLMS_GCM_BLOCK_SIZE];
+    put_u64(lengths, (uint64_t)gcm->aad_length * 8);
+    put_u64(&lengths[8], (uint64_t)gcm->text_length * 8);
+    ghash_block(gcm, lengths);
+
+    mbedtls_aes_crypt_ecb(&gcm->aes, MBEDTLS_AES_ENCRYPT, gcm->j0, tag);
+    for (int i = 0; i < DLMS_GCM_BLOCK_SIZE; i++)
+    {
+        tag[i] ^= gcm->hash[i];
+    }
+
+    gcm->busy_us += now_us() - start;
+}
@@ -1,6 +1,6 @@
 #include "include/dlms_parser.h"
 #include <string.h>
-#include "esp_log.h"
+#include "dlog.h"
 
 // Frame markers and escape characters
 #define DLMS_START_MARKER 0x7E
@@ -8,77 +8,197 @@
 #define DLMS_ESCAPE 0x7D
 #define DLMS_ESCAPE_MASK 0x20
 
-// DLMS/COSEM data type tags
-#define DLMS_TAG_OCTET_STRING         0x09  // length-prefixed raw bytes
-#define DLMS_TAG_VISIBLE_STRING       0x0A  // length-prefixed ASCII
-#define DLMS_TAG_DOUBLE_LONG_UNSIGNED 0x06  // 4-byte unsigned integer
-#define DLMS_TAG_UNSIGNED             0x12  // 2-byte unsigned integer
-#define DLMS_TAG_DATE_TIME            0x0C  // 12-byte date-time structure
+// General-glo-ciphering: tag, system title, length of the rest, security control byte, frame
+// counter, then the ciphertext of the APDU and the authentication tag
+#define DLMS_TAG_GENERAL_GLO_CIPHERING 0xDB
+#define DLMS_SYSTEM_TITLE_SIZE         8
+#define DLMS_CIPHER_LENGTH_OFFSET      10    // After the tag and the system title with its length
+#define DLMS_SECURITY_HEADER_SIZE      5     // Security control byte and frame counter
+#define DLMS_CIPHER_TAG_SIZE           12
+#define DLMS_SC_AUTHENTICATION         0x10
+#define DLMS_SC_ENCRYPTION             0x20
+
+// Element sizes that are not fixed
+#define DLMS_ELEMENT_LENGTH_PREFIXED -1
+#define DLMS_ELEMENT_CONTAINER       -2
+#define DLMS_ELEMENT_UNKNOWN         -3
+#define DLMS_ELEMENT_MAX_DEPTH       8     // Nesting of arrays and structures dlms_element_size() follows
 
 // Common sizes and lengths
 #define DLMS_SIZE_U32         4
 #define DLMS_SIZE_U16         2
 #define DLMS_SIZE_DATE_TIME   12
-#define DLMS_OBIS_ADDR_LEN    6
+#define DLMS_HDLC_ADDRESS_MAX 4
+#define DLMS_HDLC_SEGMENTED   0x08  // Frame format bit: the information field goes on in the next frame
+#define DLMS_HDLC_LENGTH_HIGH 0x07  // Upper bits of the 11-bit frame length
+#define DLMS_HDLC_UNNUMBERED  0x01  // Control field bit 0: U-frame or S-frame, clear on I-frames
+#define DLMS_HDLC_SEND_SEQUENCE(control) (((control) >> 1) & 0x07)  // N(S) of an I-frame
+#define DLMS_LLC_LSAP         0xE6  // LLC destination, then 0xE6 or 0xE7 as source and 0x00
 
 static const char *TAG = "Parser";
 
-static dlms_data_t data;
+static const char *const kFieldNames[] = {
+    [RMS_VOLTAGE_A] = "RMS Voltage A",
+    [RMS_VOLTAGE_B] = "RMS Voltage B",
+    [RMS_VOLTAGE_C] = "RMS Voltage C",
+    [RMS_CURRENT_A] = "RMS Current A",
+    [RMS_CURRENT_B] = "RMS Current B",
+    [RMS_CURRENT_C] = "RMS Current C",
+    [ACTIVE_POWER_A] = "Active Power A",
+    [ACTIVE_POWER_B] = "Active Power B",
+    [ACTIVE_POWER_C] = "Active Power C",
+    [REACTIVE_POWER_A] = "Reactive Power A",
+    [REACTIVE_POWER_B] = "Reactive Power B",
+    [REACTIVE_POWER_C] = "Reactive Power C",
+    [POWER_FACTOR_A] = "Power Factor A",
+    [POWER_FACTOR_B] = "Power Factor B",
+    [POWER_FACTOR_C] = "Power Factor C",
+    [ACTIVE_ENERGY_IMPORT] = "Active Energy Import",
+    [ACTIVE_ENERGY_EXPORT] = "Active Energy Export",
+    [ACTIVE_POWER_IMPORT] = "Active Power Import",
+    [ACTIVE_POWER_EXPORT] = "Active Power Export",
+    [DLMS_FIELD_TIMESTAMP] = "Timestamp",
+    [SERIAL_NUMBER] = "Serial Identifier",
+};
+
+static const int64_t kPowersOfTen[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+                                       10000000000, 100000000000, 1000000000000, 10000000000000, 100000000000000,
+                                       1000000000000000, 10000000000000000, 100000000000000000, 1000000000000000000};
 
-// Mapping of OBIS codes to field type and data length
+#define POWERS_OF_TEN_MAX (int8_t)(sizeof(kPowersOfTen) / sizeof(kPowersOfTen[0]) - 1)
+
+// Fixed-point format of every field as in meter_snapshot_t: the COSEM unit, the power of ten of
+// the field's unit to it, and the big-endian width values saturate to
 typedef struct {
-    uint8_t obis[DLMS_OBIS_ADDR_LEN];
-    int type;              // dlms_field_t.type enum; use int to avoid header dependency
-    uint8_t length;        // number of data bytes
-    const char *label;     // optional log label
-} dlms_obis_map_t;
-
-static const dlms_obis_map_t kObisMap[] = {
-    {{0x01,0x01,0x20,0x07,0x00,0xFF}, RMS_VOLTAGE_A,       DLMS_SIZE_U16, "RMS Voltage A"},
-    {{0x01,0x01,0x34,0x07,0x00,0xFF}, RMS_VOLTAGE_B,       DLMS_SIZE_U16, "RMS Voltage B"},
-    {{0x01,0x01,0x48,0x07,0x00,0xFF}, RMS_VOLTAGE_C,       DLMS_SIZE_U16, "RMS Voltage C"},
-    {{0x01,0x01,0x21,0x07,0x00,0xFF}, POWER_FACTOR_A,      DLMS_SIZE_U16, "Power Factor A"},
-    {{0x01,0x01,0x35,0x07,0x00,0xFF}, POWER_FACTOR_B,      DLMS_SIZE_U16, "Power Factor B"},
-    {{0x01,0x01,0x49,0x07,0x00,0xFF}, POWER_FACTOR_C,      DLMS_SIZE_U16, "Power Factor C"},
-    {{0x01,0x01,0x1F,0x07,0x00,0xFF}, RMS_CURRENT_A,       DLMS_SIZE_U32, "RMS Current A"},
-    {{0x01,0x01,0x33,0x07,0x00,0xFF}, RMS_CURRENT_B,       DLMS_SIZE_U32, "RMS Current B"},
-    {{0x01,0x01,0x47,0x07,0x00,0xFF}, RMS_CURRENT_C,       DLMS_SIZE_U32, "RMS Current C"},
-    {{0x01,0x01,0x15,0x07,0x00,0xFF}, ACTIVE_POWER_A,      DLMS_SIZE_U32, "Active Power A"},
-    {{0x01,0x01,0x29,0x07,0x00,0xFF}, ACTIVE_POWER_B,      DLMS_SIZE_U32, "Active Power B"},
-    {{0x01,0x01,0x3D,0x07,0x00,0xFF}, ACTIVE_POWER_C,      DLMS_SIZE_U32, "Active Power C"},
-    {{0x01,0x01,0x16,0x07,0x00,0xFF}, REACTIVE_POWER_A,    DLMS_SIZE_U32, "Reactive Power A"},
-    {{0x01,0x01,0x2A,0x07,0x00,0xFF}, REACTIVE_POWER_B,    DLMS_SIZE_U32, "Reactive Power B"},
-    {{0x01,0x01,0x3E,0x07,0x00,0xFF}, REACTIVE_POWER_C,    DLMS_SIZE_U32, "Reactive Power C"},
-    {{0x01,0x01,0x01,0x08,0x00,0xFF}, ACTIVE_ENERGY_IMPORT, DLMS_SIZE_U32, "Active Energy Import"},
-    {{0x01,0x01,0x02,0x08,0x00,0xFF}, ACTIVE_ENERGY_EXPORT, DLMS_SIZE_U32, "Active Energy Export"},
-    {{0x01,0x01,0x00,0x00,0x01,0xFF}, SERIAL_NUMBER,       DLMS_SIZE_U32, "Serial Identifier"},
+    uint8_t unit;
+    int8_t exponent;
+    uint8_t size;
+    bool is_signed;
+} field_format_t;
+
+static const field_format_t kFieldFormats[] = {
+    [RMS_VOLTAGE_A] = {DLMS_UNIT_V, 0, DLMS_SIZE_U16, false},
+    [RMS_VOLTAGE_B] = {DLMS_UNIT_V, 0, DLMS_SIZE_U16, false},
+    [RMS_VOLTAGE_C] = {DLMS_UNIT_V, 0, DLMS_SIZE_U16, false},
+    [RMS_CURRENT_A] = {DLMS_UNIT_A, -2, DLMS_SIZE_U32, false},
+    [RMS_CURRENT_B] = {DLMS_UNIT_A, -2, DLMS_SIZE_U32, false},
+    [RMS_CURRENT_C] = {DLMS_UNIT_A, -2, DLMS_SIZE_U32, false},
+    [ACTIVE_POWER_A] = {DLMS_UNIT_W, 0, DLMS_SIZE_U32, true},
+    [ACTIVE_POWER_B] = {DLMS_UNIT_W, 0, DLMS_SIZE_U32, true},
+    [ACTIVE_POWER_C] = {DLMS_UNIT_W, 0, DLMS_SIZE_U32, true},
+    [REACTIVE_POWER_A] = {DLMS_UNIT_VAR, 0, DLMS_SIZE_U32, true},
+    [REACTIVE_POWER_B] = {DLMS_UNIT_VAR, 0, DLMS_SIZE_U32, true},
+    [REACTIVE_POWER_C] = {DLMS_UNIT_VAR, 0, DLMS_SIZE_U32, true},
+    [POWER_FACTOR_A] = {DLMS_UNIT_NONE, -2, DLMS_SIZE_U16, false},
+    [POWER_FACTOR_B] = {DLMS_UNIT_NONE, -2, DLMS_SIZE_U16, false},
+    [POWER_FACTOR_C] = {DLMS_UNIT_NONE, -2, DLMS_SIZE_U16, false},
+    [ACTIVE_ENERGY_IMPORT] = {DLMS_UNIT_WH, 0, DLMS_SIZE_U32, false},
+    [ACTIVE_ENERGY_EXPORT] = {DLMS_UNIT_WH, 0, DLMS_SIZE_U32, false},
+    [ACTIVE_POWER_IMPORT] = {DLMS_UNIT_W, 0, DLMS_SIZE_U32, false},
+    [ACTIVE_POWER_EXPORT] = {DLMS_UNIT_W, 0, DLMS_SIZE_U32, false},
+    [DLMS_FIELD_TIMESTAMP] = {DLMS_UNIT_NONE, 0, DLMS_SIZE_DATE_TIME, false},
+    [SERIAL_NUMBER] = {DLMS_UNIT_NONE, 0, DLMS_SIZE_U32, false},
 };
 
-static inline bool obis_eq(const uint8_t *a, const uint8_t *b)
-{
-    return memcmp(a, b, DLMS_OBIS_ADDR_LEN) == 0;
-}
-
 void dlms_parser_init(dlms_parser_t *parser)
 {
     memset(parser, 0, sizeof(dlms_parser_t));
     parser->state = DLMS_STATE_WAITING_START;
     parser->escape_next = false;
-
-    memset(&data, 0, sizeof(dlms_data_t));
+    parser->profiles = dlms_profiles;
+    parser->profile_count = dlms_profile_count;
+    parser->subscribed = DLMS_FIELDS_ALL;
+    dlms_gcm_init(&parser->gcm);
 }
 
 static void notify_callback(dlms_parser_t *parser, dlms_field_t *field)
 {
+    // Values of an authenticated APDU wait for its tag
+    if (parser->cipher_pending && parser->authenticated && field->type > ABORT)
+    {
+        if (parser->held_count >= DLMS_HELD_FIELDS || field->length > DLMS_HELD_FIELD_SIZE)
+        {
+            DLOGW(TAG, "No room to hold %s", DLOG_STR(dlms_field_name(field->type)));
+            return;
+        }
+        dlms_held_field_t *held = &parser->held[parser->held_count++];
+        held->type = (uint8_t)field->type;
+        held->length = (uint8_t)field->length;
+        memcpy(held->data, field->data, field->length);
+        return;
+    }
+
     if (parser->callback != NULL)
     {
-        parser->callback(field);
+        parser->callback(field, parser->callback_context);
+    }
+}
+
+void dlms_parser_set_callback(dlms_parser_t *parser, dlms_field_callback_t callback, void *context)
+{
+    parser->callback = callback;
+    parser->callback_context = context;
+}
+
+void dlms_parser_set_profiles(dlms_parser_t *parser, const dlms_profile_t *profiles, size_t count)
+{
+    parser->profiles = profiles;
+    parser->profile_count = count;
+    parser->profile = NULL;
+    parser->pending_entry = 0;
+}
+
+bool dlms_parser_set_keys(dlms_parser_t *parser, const uint8_t *encryption_key, const uint8_t *authentication_key)
+{
+    parser->has_authentication_key = authentication_key != NULL;
+    if (authentication_key != NULL)
+    {
+        memcpy(parser->authentication_key, authentication_key, DLMS_GCM_KEY_SIZE);
+    }
+    else
+    {
+        memset(parser->authentication_key, 0, sizeof(parser->authentication_key));
+    }
+
+    parser->has_encryption_key = encryption_key != NULL && dlms_gcm_set_key(&parser->gcm, encryption_key);
+    return encryption_key == NULL || parser->has_encryption_key;
+}
+
+void dlms_parser_set_apdu_buffer(dlms_parser_t *parser, uint8_t *buffer, uint16_t size)
+{
+    parser->raw = buffer;
+    parser->raw_size = size;
+    parser->raw_length = 0;
+    parser->raw_overflow = false;
+}
+
+const uint8_t *dlms_parser_apdu(const dlms_parser_t *parser, uint16_t *length)
+{
+    if (parser->raw == NULL || parser->raw_overflow)
+    {
+        return NULL;
     }
+    *length = parser->raw_length;
+    return parser->raw;
+}
+
+uint32_t dlms_parser_decrypt_us(const dlms_parser_t *parser)
+{
+    return parser->ciphered ? parser->gcm.busy_us : 0;
+}
+
+const dlms_profile_t *dlms_parser_profile(const dlms_parser_t *parser)
+{
+    return parser->profile;
 }
 
-void dlms_parser_set_callback(dlms_parser_t *parser, dlms_field_callback_t callback)
+const char *dlms_field_name(dlms_field_type_t type)
 {
-    parser->callback = callback;    
+    if (type < sizeof(kFieldNames) / sizeof(kFieldNames[0]) && kFieldNames[type] != NULL)
+    {
+        return kFieldNames[type];
+    }
+    return "Unknown";
 }
 
 
@@ -102,34 +222,718 @@ void process_end(dlms_parser_t *parser)
     
 }
 
-void process_payload(dlms_parser_t *parser, dlms_data_t *data)
+// A START was sent for this frame, the application must be told it will not see the END
+// Decoder state of a new APDU
+static void start_apdu(dlms_parser_t *parser)
+{
+    parser->has_obis = false;
+    parser->list_seen = false;
+    parser->position = 0;
+    parser->ciphered = false;
+    parser->authenticated = false;
+    parser->cipher_pending = false;
+    parser->held_count = 0;
+    parser->pending_entry = 0;
+    parser->skip_remaining = 0;
+    parser->raw_length = 0;
+    parser->raw_overflow = false;
+    parser->raw_undecoded = false;
+}
+
+static void process_abort(dlms_parser_t *parser, dlms_abort_reason_t reason)
 {
+    parser->cipher_pending = false;
+    parser->held_count = 0;
+    parser->segment_pending = false;
+    parser->pending_entry = 0;
 
-    //ESP_LOGI(TAG, "Processing payload");
-    
+    uint8_t reason_byte = (uint8_t)reason;
     dlms_field_t field;
+    field.type = ABORT;
+    field.data = &reason_byte;
+    field.length = 1;
+    notify_callback(parser, &field);
+}
+
+void process_timestamp(dlms_parser_t *parser, uint8_t *datetime)
+{
+    dlms_field_t field;
+    field.type = DLMS_FIELD_TIMESTAMP;
+    field.data = datetime;
+    field.length = DLMS_SIZE_DATE_TIME;
+    notify_callback(parser, &field);
+}
 
-    // Lookup OBIS in table
-    for (size_t i = 0; i < sizeof(kObisMap) / sizeof(kObisMap[0]); ++i)
+// Days since 1970-01-01 for a proleptic Gregorian date
+static int32_t days_from_civil(int32_t y, uint32_t m, uint32_t d)
+{
+    y -= m <= 2;
+    const int32_t era = (y >= 0 ? y : y - 399) / 400;
+    const uint32_t yoe = (uint32_t)(y - era * 400);
+    const uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t)doe - 719468;
+}
+
+uint32_t dlms_datetime_to_seconds(const uint8_t *datetime)
+{
+    uint16_t year = (uint16_t)(datetime[0] << 8 | datetime[1]);
+    uint8_t month = datetime[2];
+    uint8_t day = datetime[3];
+    uint8_t hour = datetime[5];
+    uint8_t minute = datetime[6];
+    uint8_t second = datetime[7];
+
+    // 0xFFFF / 0xFF mark "not specified"
+    if (year < 2000 || year == 0xFFFF || month < 1 || month > 12 || day < 1 || day > 31)
     {
-        if (obis_eq(data->address, kObisMap[i].obis))
+        return 0;
+    }
+    if (hour > 23) hour = 0;
+    if (minute > 59) minute = 0;
+    if (second > 59) second = 0;
+
+    int32_t days = days_from_civil(year, month, day) - days_from_civil(2000, 1, 1);
+    return (uint32_t)days * 86400u + hour * 3600u + minute * 60u + second;
+}
+
+static uint8_t obis_hash(const uint8_t *obis)
+{
+    // Value group C and D tell the quantities of a push list apart
+    return (uint8_t)((obis[2] * 5 + obis[3] * 3 + obis[4]) & (DLMS_PROFILE_LOOKUP_SIZE - 1));
+}
+
+// Precompute the lookup of a newly selected profile: entries by position, or by OBIS hash with
+// linear probing. Entries of fields that are not subscribed are left out, their values are skipped.
+static void select_profile(dlms_parser_t *parser, const dlms_profile_t *profile)
+{
+    memset(parser->lookup, 0, sizeof(parser->lookup));
+    parser->profile = profile;
+    parser->pending_entry = 0;
+
+    for (uint8_t i = 0; i < profile->entry_count && i < DLMS_PROFILE_LOOKUP_SIZE - 1; i++)
+    {
+        const dlms_profile_entry_t *entry = &profile->entries[i];
+        uint8_t slot = profile->positional ? entry->position : obis_hash(entry->obis);
+        parser->scalers[i] = entry->scaler;
+
+        if (!(parser->subscribed & DLMS_FIELD_BIT(entry->type)))
+        {
+            continue;
+        }
+        if (profile->positional)
         {
-            if (kObisMap[i].label)
+            if (slot < DLMS_PROFILE_LOOKUP_SIZE)
             {
-                ESP_LOGI(TAG, "Found %s", kObisMap[i].label);
+                parser->lookup[slot] = i + 1;
             }
-            field.type = kObisMap[i].type;
-            field.data = data->data;
-            field.length = kObisMap[i].length;
-            notify_callback(parser, &field);
-            break; // OBIS codes are unique; stop after first match
+            continue;
         }
+        while (parser->lookup[slot] != 0)
+        {
+            slot = (slot + 1) & (DLMS_PROFILE_LOOKUP_SIZE - 1);
+        }
+        parser->lookup[slot] = i + 1;
     }
+    DLOGI(TAG, "Meter profile %s", DLOG_STR(profile->name));
+}
+
+static const dlms_profile_entry_t *find_entry(const dlms_parser_t *parser)
+{
+    const dlms_profile_t *profile = parser->profile;
+
+    if (profile->positional)
+    {
+        uint8_t index = parser->position < DLMS_PROFILE_LOOKUP_SIZE ? parser->lookup[parser->position] : 0;
+        return index != 0 ? &profile->entries[index - 1] : NULL;
+    }
+    if (!parser->has_obis)
+    {
+        return NULL;
+    }
+    for (uint8_t slot = obis_hash(parser->obis); parser->lookup[slot] != 0; slot = (slot + 1) & (DLMS_PROFILE_LOOKUP_SIZE - 1))
+    {
+        const dlms_profile_entry_t *entry = &profile->entries[parser->lookup[slot] - 1];
+        if (memcmp(entry->obis, parser->obis, DLMS_OBIS_SIZE) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// The first string of a frame identifies the push list. The profile only changes when it does.
+static void check_list_id(dlms_parser_t *parser, const uint8_t *id, uint8_t length)
+{
+    parser->list_seen = true;
+
+    const dlms_profile_t *profile = parser->profile;
+    if (profile != NULL && profile->list_id != NULL && strlen(profile->list_id) <= length &&
+        memcmp(profile->list_id, id, strlen(profile->list_id)) == 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < parser->profile_count; i++)
+    {
+        const char *list_id = parser->profiles[i].list_id;
+        if (list_id == NULL || (strlen(list_id) <= length && memcmp(list_id, id, strlen(list_id)) == 0))
+        {
+            if (&parser->profiles[i] != profile)
+            {
+                select_profile(parser, &parser->profiles[i]);
+            }
+            return;
+        }
+    }
+}
+
+void dlms_parser_subscribe(dlms_parser_t *parser, uint32_t fields)
+{
+    parser->subscribed = fields;
+    if (parser->profile != NULL)
+    {
+        select_profile(parser, parser->profile);
+    }
+}
+
+void dlms_parser_element_counts(const dlms_parser_t *parser, uint32_t *decoded, uint32_t *skipped)
+{
+    *decoded = parser->elements_decoded;
+    *skipped = parser->elements_skipped;
+}
+
+static bool decode_integer(uint8_t tag, const uint8_t *value, uint8_t length, int64_t *number)
+{
+    uint64_t raw = 0;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        raw = raw << 8 | value[i];
+    }
+
+    switch (tag)
+    {
+    case DLMS_TAG_UNSIGNED:
+    case DLMS_TAG_LONG_UNSIGNED:
+    case DLMS_TAG_DOUBLE_LONG_UNSIGNED:
+    case DLMS_TAG_LONG64_UNSIGNED:
+    case DLMS_TAG_ENUM:
+        *number = (int64_t)raw;
+        return true;
+    case DLMS_TAG_INTEGER:
+        *number = (int8_t)raw;
+        return true;
+    case DLMS_TAG_LONG:
+        *number = (int16_t)raw;
+        return true;
+    case DLMS_TAG_DOUBLE_LONG:
+        *number = (int32_t)raw;
+        return true;
+    case DLMS_TAG_LONG64:
+        *number = (int64_t)raw;
+        return true;
+    default:
+        return false;
+    }
+}
+
+int64_t dlms_scale_number(int64_t value, int8_t scaler)
+{
+    if (value == 0 || scaler == 0)
+    {
+        return value;
+    }
+    if (scaler > 0)
+    {
+        if (scaler > POWERS_OF_TEN_MAX)
+        {
+            return value > 0 ? INT64_MAX : -INT64_MAX;
+        }
+        int64_t limit = INT64_MAX / kPowersOfTen[scaler];
+        return value > limit ? INT64_MAX : value < -limit ? -INT64_MAX : value * kPowersOfTen[scaler];
+    }
+    if (scaler < -POWERS_OF_TEN_MAX)
+    {
+        return 0;
+    }
+
+    // Half away from zero, without adding to a value that may be close to the int64_t range
+    int64_t divisor = kPowersOfTen[-scaler];
+    int64_t quotient = value / divisor;
+    int64_t remainder = value % divisor;
+    if (remainder >= divisor - remainder)
+    {
+        quotient++;
+    }
+    else if (-remainder >= divisor + remainder)
+    {
+        quotient--;
+    }
+    return quotient;
+}
+
+// Out of range values are clamped to the width of the field, not wrapped into it
+static int64_t saturate_value(int64_t value, const field_format_t *format)
+{
+    int64_t max = format->is_signed ? (INT64_C(1) << (8 * format->size - 1)) - 1 : (INT64_C(1) << (8 * format->size)) - 1;
+    int64_t min = format->is_signed ? -max - 1 : 0;
+    return value > max ? max : value < min ? min : value;
+}
+
+void dlms_number_to_field(uint8_t type, int64_t number, int8_t scaler, uint8_t *bytes, dlms_field_t *field)
+{
+    const field_format_t *format = &kFieldFormats[type < sizeof(kFieldFormats) / sizeof(kFieldFormats[0]) ? type : SERIAL_NUMBER];
+    number = saturate_value(dlms_scale_number(number, scaler), format);
+
+    uint8_t size = format->size;
+    for (uint8_t i = 0; i < size; i++)
+    {
+        bytes[i] = (uint8_t)((uint64_t)number >> (8 * (size - 1 - i)));
+    }
+    field->type = (dlms_field_type_t)type;
+    field->data = bytes;
+    field->length = size;
+}
+
+bool dlms_field_scaler(uint8_t type, int8_t scaler, uint8_t unit, int8_t *field_scaler)
+{
+    if (type >= sizeof(kFieldFormats) / sizeof(kFieldFormats[0]) || kFieldFormats[type].unit != unit)
+    {
+        return false;
+    }
+    int result = scaler - kFieldFormats[type].exponent;
+    *field_scaler = (int8_t)(result > DLMS_SCALER_MAX ? DLMS_SCALER_MAX : result < -DLMS_SCALER_MAX ? -DLMS_SCALER_MAX : result);
+    return true;
+}
+
+bool dlms_value_to_field(uint8_t type, int8_t scaler, uint8_t tag, uint8_t *value, uint8_t length, uint8_t *bytes, dlms_field_t *field)
+{
+    field->type = (dlms_field_type_t)type;
+
+    if (type == DLMS_FIELD_TIMESTAMP)
+    {
+        field->data = value;
+        field->length = DLMS_SIZE_DATE_TIME;
+        return tag == DLMS_TAG_OCTET_STRING && length == DLMS_SIZE_DATE_TIME;
+    }
+
+    int64_t number;
+    if (!decode_integer(tag, value, length, &number))
+    {
+        return false;
+    }
+    dlms_number_to_field(type, number, scaler, bytes, field);
+    return true;
+}
+
+static void process_value(dlms_parser_t *parser, uint8_t index, uint8_t tag, uint8_t *value, uint8_t length)
+{
+    const dlms_profile_entry_t *entry = &parser->profile->entries[index];
+    DLOGI(TAG, "Found %s", DLOG_STR(dlms_field_name(entry->type)));
+
+    uint8_t bytes[DLMS_SIZE_U32];
+    dlms_field_t field;
+    if (!dlms_value_to_field(entry->type, parser->scalers[index], tag, value, length, bytes, &field))
+    {
+        if (entry->type != DLMS_FIELD_TIMESTAMP)
+        {
+            DLOGW(TAG, "Unexpected type %02X", tag);
+        }
+        return;
+    }
+    notify_callback(parser, &field);
+}
+
+static void flush_pending(dlms_parser_t *parser)
+{
+    if (parser->pending_entry != 0)
+    {
+        process_value(parser, parser->pending_entry - 1, parser->pending_tag, parser->pending_value, parser->pending_length);
+        parser->pending_entry = 0;
+    }
+}
+
+// A value matched by OBIS code waits for the element after it, which may be its scaler_unit: a
+// structure of the scaler, an integer, and the unit, an enum. The meter's scaler then replaces
+// the profile's for this and later values of the entry. Returns true if the element was taken.
+static bool process_scaler_unit(dlms_parser_t *parser, uint8_t tag, const uint8_t *value)
+{
+    if (tag == DLMS_TAG_INTEGER && !parser->pending_has_scaler)
+    {
+        parser->pending_scaler = (int8_t)value[0];
+        parser->pending_has_scaler = true;
+        return true;
+    }
+    if (tag == DLMS_TAG_ENUM && parser->pending_has_scaler)
+    {
+        uint8_t index = parser->pending_entry - 1;
+        uint8_t type = parser->profile->entries[index].type;
+        if (!dlms_field_scaler(type, parser->pending_scaler, value[0], &parser->scalers[index]))
+        {
+            DLOGW(TAG, "Unit %d does not fit %s", value[0], DLOG_STR(dlms_field_name((dlms_field_type_t)type)));
+        }
+        flush_pending(parser);
+        return true;
+    }
+    flush_pending(parser);
+    return false;
+}
+
+// A complete data element of the frame body. An OBIS code is held until the element after it,
+// its value; positional profiles count the elements instead.
+static void process_element(dlms_parser_t *parser, uint8_t tag, uint8_t *value, uint8_t length)
+{
+    parser->elements_decoded++;
+    bool positional = parser->list_seen && parser->profile != NULL && parser->profile->positional;
+
+    if (parser->pending_entry != 0 && process_scaler_unit(parser, tag, value))
+    {
+        if (parser->position < UINT8_MAX)
+        {
+            parser->position++;
+        }
+        return;
+    }
+
+    if (!positional && !parser->has_obis && tag == DLMS_TAG_OCTET_STRING && length == DLMS_OBIS_SIZE)
+    {
+        memcpy(parser->obis, value, DLMS_OBIS_SIZE);
+        parser->has_obis = true;
+    }
+    else
+    {
+        if (!parser->list_seen && (tag == DLMS_TAG_OCTET_STRING || tag == DLMS_TAG_VISIBLE_STRING))
+        {
+            check_list_id(parser, value, length);
+        }
+        else if (parser->profile != NULL)
+        {
+            const dlms_profile_entry_t *entry = find_entry(parser);
+            if (entry != NULL)
+            {
+                uint8_t index = (uint8_t)(entry - parser->profile->entries);
+                if (!positional && entry->type != DLMS_FIELD_TIMESTAMP && length <= sizeof(parser->pending_value))
+                {
+                    parser->pending_entry = index + 1;
+                    parser->pending_tag = tag;
+                    parser->pending_length = length;
+                    parser->pending_has_scaler = false;
+                    memcpy(parser->pending_value, value, length);
+                }
+                else
+                {
+                    process_value(parser, index, tag, value, length);
+                }
+            }
+        }
+        parser->has_obis = false;
+    }
+
+    if (parser->position < UINT8_MAX)
+    {
+        parser->position++;
+    }
+}
+
+// Size of an element after its tag
+static int element_size(uint8_t tag)
+{
+    switch (tag)
+    {
+    case DLMS_TAG_NULL:
+        return 0;
+    case DLMS_TAG_BOOLEAN:
+    case DLMS_TAG_INTEGER:
+    case DLMS_TAG_UNSIGNED:
+    case DLMS_TAG_ENUM:
+        return 1;
+    case DLMS_TAG_LONG:
+    case DLMS_TAG_LONG_UNSIGNED:
+        return 2;
+    case DLMS_TAG_DOUBLE_LONG:
+    case DLMS_TAG_DOUBLE_LONG_UNSIGNED:
+    case DLMS_TAG_FLOAT32:
+    case DLMS_TAG_TIME:
+        return 4;
+    case DLMS_TAG_DATE:
+        return 5;
+    case DLMS_TAG_LONG64:
+    case DLMS_TAG_LONG64_UNSIGNED:
+    case DLMS_TAG_FLOAT64:
+        return 8;
+    case DLMS_TAG_DATE_TIME:
+        return DLMS_SIZE_DATE_TIME;
+    case DLMS_TAG_BIT_STRING:
+    case DLMS_TAG_OCTET_STRING:
+    case DLMS_TAG_VISIBLE_STRING:
+    case DLMS_TAG_UTF8_STRING:
+        return DLMS_ELEMENT_LENGTH_PREFIXED;
+    case DLMS_TAG_ARRAY:
+    case DLMS_TAG_STRUCTURE:
+        return DLMS_ELEMENT_CONTAINER;
+    default:
+        return DLMS_ELEMENT_UNKNOWN;
+    }
+}
+
+static uint16_t nested_element_size(const uint8_t *data, uint16_t length, uint8_t depth)
+{
+    if (length == 0 || depth > DLMS_ELEMENT_MAX_DEPTH)
+    {
+        return 0;
+    }
+
+    int size = element_size(data[0]);
+    if (size == DLMS_ELEMENT_UNKNOWN)
+    {
+        return 0;
+    }
+    if (size == DLMS_ELEMENT_CONTAINER)
+    {
+        if (length < 2)
+        {
+            return 0;
+        }
+        uint16_t pos = 2;
+        for (uint8_t i = 0; i < data[1]; i++)
+        {
+            uint16_t item = nested_element_size(&data[pos], length - pos, depth + 1);
+            if (item == 0)
+            {
+                return 0;
+            }
+            pos += item;
+        }
+        return pos;
+    }
+    uint16_t header = 1;
+    if (size == DLMS_ELEMENT_LENGTH_PREFIXED)
+    {
+        if (length < 2)
+        {
+            return 0;
+        }
+        size = data[0] == DLMS_TAG_BIT_STRING ? (data[1] + 7) / 8 : data[1];
+        header = 2;
+    }
+    return header + size <= length ? (uint16_t)(header + size) : 0;
+}
+
+uint16_t dlms_element_size(const uint8_t *data, uint16_t length)
+{
+    return nested_element_size(data, length, 0);
+}
+
+// Whether process_element() would only count an element: it cannot be the list identifier, an
+// OBIS code or a scaler_unit, and no subscribed entry takes its value. Known once its tag and
+// length are in.
+static bool element_unused(const dlms_parser_t *parser, uint8_t tag, int size)
+{
+    if (!parser->list_seen || parser->pending_entry != 0)
+    {
+        return false;
+    }
+    if (parser->profile == NULL)
+    {
+        return true;
+    }
+    if (!parser->profile->positional && !parser->has_obis)
+    {
+        return tag != DLMS_TAG_OCTET_STRING || size != DLMS_OBIS_SIZE;
+    }
+    return find_entry(parser) == NULL;
+}
+
+// The bytes of an unused element pass by in DLMS_STATE_DATA without being buffered
+static void skip_element(dlms_parser_t *parser, int size)
+{
+    parser->skip_remaining = (uint16_t)size;
+    parser->state_pos = 0;
+    parser->has_obis = false;
+    parser->elements_skipped++;
+
+    if (parser->position < UINT8_MAX)
+    {
+        parser->position++;
+    }
+}
+
+// Called with every byte of the frame body in buffer. Arrays and structures are stepped into,
+// their count is not needed to find the elements. Returns false on an unknown tag.
+static bool process_data_byte(dlms_parser_t *parser)
+{
+    uint8_t tag = parser->buffer[0];
+    int size = element_size(tag);
+    uint16_t header = 1;
+
+    if (size == DLMS_ELEMENT_UNKNOWN)
+    {
+        return false;
+    }
+    if (size == DLMS_ELEMENT_CONTAINER)
+    {
+        if (parser->state_pos == 2)
+        {
+            parser->state_pos = 0;
+        }
+        return true;
+    }
+    if (size == DLMS_ELEMENT_LENGTH_PREFIXED)
+    {
+        if (parser->state_pos < 2)
+        {
+            return true;
+        }
+        size = tag == DLMS_TAG_BIT_STRING ? (parser->buffer[1] + 7) / 8 : parser->buffer[1];
+        header = 2;
+    }
+
+    if (parser->state_pos == header && size > 0 && element_unused(parser, tag, size))
+    {
+        skip_element(parser, size);
+        return true;
+    }
+    if (parser->state_pos >= header + size)
+    {
+        process_element(parser, tag, &parser->buffer[header], (uint8_t)size);
+        parser->state_pos = 0;
+    }
+    return true;
+}
+
+// Called with every byte of the cipher header in buffer. Once it is complete the GCM message
+// starts and the plaintext states take over. Returns false for an APDU that cannot be decrypted.
+static bool process_cipher_header(dlms_parser_t *parser)
+{
+    const uint8_t *header = parser->buffer;
+    uint16_t pos = parser->state_pos;
+
+    if (pos <= DLMS_CIPHER_LENGTH_OFFSET)
+    {
+        if (pos == 2 && header[1] != DLMS_SYSTEM_TITLE_SIZE)
+        {
+            DLOGW(TAG, "System title of %d bytes", header[1]);
+            return false;
+        }
+        return true;
+    }
+
+    // Length in BER: one byte below 0x80, else 0x81 or 0x82 and that many bytes
+    uint8_t first = header[DLMS_CIPHER_LENGTH_OFFSET];
+    uint8_t length_size = first & 0x80 ? 1 + (first & 0x7F) : 1;
+    if (length_size > 3)
+    {
+        DLOGW(TAG, "Cipher length of %d bytes", length_size);
+        return false;
+    }
+    if (pos < DLMS_CIPHER_LENGTH_OFFSET + length_size + DLMS_SECURITY_HEADER_SIZE)
+    {
+        return true;
+    }
+
+    uint16_t length = length_size == 1 ? first : 0;
+    for (uint8_t i = 1; i < length_size; i++)
+    {
+        length = (uint16_t)(length << 8 | header[DLMS_CIPHER_LENGTH_OFFSET + i]);
+    }
+    const uint8_t *security = &header[DLMS_CIPHER_LENGTH_OFFSET + length_size];
+
+    // Suite 0 with the unicast key, encrypted and optionally authenticated
+    if ((security[0] & ~DLMS_SC_AUTHENTICATION) != DLMS_SC_ENCRYPTION)
+    {
+        DLOGW(TAG, "Unsupported security control %02X", security[0]);
+        return false;
+    }
+    bool authenticated = security[0] & DLMS_SC_AUTHENTICATION;
+    if (!parser->has_encryption_key || (authenticated && !parser->has_authentication_key))
+    {
+        DLOGW(TAG, "Ciphered frame but no %s key", DLOG_STR(parser->has_encryption_key ? "authentication" : "encryption"));
+        return false;
+    }
+
+    uint16_t overhead = DLMS_SECURITY_HEADER_SIZE + (authenticated ? DLMS_CIPHER_TAG_SIZE : 0);
+    if (length < overhead)
+    {
+        DLOGW(TAG, "Cipher length %d too short", length);
+        return false;
+    }
+
+    // IV: system title and frame counter. AAD: security control byte and authentication key.
+    uint8_t iv[DLMS_GCM_IV_SIZE];
+    uint8_t aad[1 + DLMS_GCM_KEY_SIZE];
+    memcpy(iv, &header[2], DLMS_SYSTEM_TITLE_SIZE);
+    memcpy(&iv[DLMS_SYSTEM_TITLE_SIZE], &security[1], DLMS_GCM_IV_SIZE - DLMS_SYSTEM_TITLE_SIZE);
+    aad[0] = security[0];
+    memcpy(&aad[1], parser->authentication_key, DLMS_GCM_KEY_SIZE);
+    dlms_gcm_start(&parser->gcm, iv, aad, authenticated ? sizeof(aad) : 0);
+
+    parser->ciphered = true;
+    parser->authenticated = authenticated;
+    parser->cipher_pending = true;
+    parser->cipher_remaining = length - overhead;
+    parser->held_count = 0;
+    return true;
+}
+
+// Called with the complete tag in buffer. The held fields go out if it matches, otherwise the
+// frame is dropped at the FCS, so line errors still count as such.
+static void process_cipher_tag(dlms_parser_t *parser)
+{
+    uint8_t tag[DLMS_GCM_BLOCK_SIZE];
+    dlms_gcm_finish(&parser->gcm, tag);
+
+    // Compare all bytes, the time must not tell how many matched
+    uint8_t difference = 0;
+    for (uint8_t i = 0; i < DLMS_CIPHER_TAG_SIZE; i++)
+    {
+        difference |= tag[i] ^ parser->buffer[i];
+    }
+    if (difference != 0)
+    {
+        DLOGW(TAG, "Authentication tag mismatch");
+        return;
+    }
+
+    parser->cipher_pending = false;
+    for (uint8_t i = 0; i < parser->held_count; i++)
+    {
+        dlms_field_t field;
+        field.type = (dlms_field_type_t)parser->held[i].type;
+        field.data = parser->held[i].data;
+        field.length = parser->held[i].length;
+        notify_callback(parser, &field);
+    }
+    parser->held_count = 0;
 }
 
 //TODO: Clean up this awful mess of a function
+uint32_t dlms_parser_poll(dlms_parser_t *parser, uint32_t now_ms)
+{
+    // A frame has started once its frame format byte is in
+    bool started = parser->segment_pending || parser->state > DLMS_STATE_FRAME_FORMAT ||
+                   (parser->state == DLMS_STATE_FRAME_FORMAT && parser->state_pos > 0);
+    if (!started || parser->byte_count != parser->poll_byte_count)
+    {
+        parser->poll_byte_count = parser->byte_count;
+        parser->poll_ms = now_ms;
+        return started ? DLMS_SEGMENT_TIMEOUT_MS : UINT32_MAX;
+    }
+
+    uint32_t quiet_ms = now_ms - parser->poll_ms;
+    if (quiet_ms < DLMS_SEGMENT_TIMEOUT_MS)
+    {
+        return DLMS_SEGMENT_TIMEOUT_MS - quiet_ms;
+    }
+    DLOGW(TAG, "No byte for %u ms in a frame - DLMS_STATE_WAITING_START", quiet_ms);
+    parser->state = DLMS_STATE_WAITING_START;
+    process_abort(parser, DLMS_ABORT_RESYNC);
+    return UINT32_MAX;
+}
+
 bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
 {
+    parser->byte_count++;
+
     // // Handle escape sequences except in START and END states
     // if (parser->state != DLMS_STATE_WAITING_START &&
     //     parser->state != DLMS_STATE_END)
@@ -150,6 +954,52 @@ bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
     //     }
     // }
 
+    // The FCS covers everything between the flags except itself. A flag right after the opening
+    // one belongs to no frame.
+    if (parser->state > DLMS_STATE_WAITING_START && parser->state < DLMS_STATE_CHECKSUM &&
+        !(parser->state == DLMS_STATE_FRAME_FORMAT && parser->state_pos == 0 && byte == DLMS_START_MARKER))
+    {
+        parser->checksum = dlms_fcs_update(parser->checksum, byte);
+    }
+
+    // The raw APDU for forwarding: the information field after the LLC header, still ciphered
+    if (parser->raw != NULL && parser->state >= DLMS_STATE_ARRAY && parser->state <= DLMS_STATE_CIPHER_SKIP &&
+        parser->state != DLMS_STATE_HEADER)
+    {
+        if (parser->raw_length < parser->raw_size)
+        {
+            parser->raw[parser->raw_length++] = byte;
+        }
+        else
+        {
+            parser->raw_overflow = true;
+        }
+    }
+
+    // Inside a ciphered APDU the plaintext states see the decrypted bytes, the tag follows
+    if (parser->ciphered &&
+        (parser->state == DLMS_STATE_ARRAY || parser->state == DLMS_STATE_TIMESTAMP || parser->state == DLMS_STATE_DATA))
+    {
+        if (parser->cipher_remaining > 0)
+        {
+            byte = dlms_gcm_decrypt(&parser->gcm, byte);
+            parser->cipher_remaining--;
+            parser->cipher_pending = parser->authenticated || parser->cipher_remaining > 0;
+        }
+        else if (parser->authenticated)
+        {
+            parser->state = DLMS_STATE_CIPHER_TAG;
+            parser->state_pos = 0;
+        }
+        else
+        {
+            DLOGW(TAG, "Frame continues after the ciphertext - DLMS_STATE_WAITING_START");
+            parser->state = DLMS_STATE_WAITING_START;
+            process_abort(parser, DLMS_ABORT_DECRYPT);
+            return false;
+        }
+    }
+
     switch (parser->state)
     {
     case DLMS_STATE_WAITING_START: // OK
@@ -157,15 +1007,18 @@ bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
         {
             parser->frame_pos = 0;
             parser->state_pos = 0;
-            parser->checksum = 0;
+            parser->checksum = DLMS_FCS_INIT;
             parser->frame_length = 0;
             parser->escape_next = false;
+            // A continuation segment carries on with the APDU of the previous frame
+            if (!parser->segment_pending)
+            {
+                start_apdu(parser);
+            }
             parser->state = DLMS_STATE_FRAME_FORMAT;
-            ESP_LOGI(TAG, "Change state to: DLMS_STATE_FRAME_FORMAT");
+            DLOGD(TAG, "Change state to: DLMS_STATE_FRAME_FORMAT");
 
             parser->frame_pos++;
-
-            process_start(parser);
         }
         break;
 
@@ -173,14 +1026,39 @@ bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
 
         if (parser->state_pos == 0)
         {
-            parser->buffer[parser->state_pos++] = byte;
+            // Back-to-back flags: the previous one closed a frame we lost track of, this one opens the next
+            if (byte == DLMS_START_MARKER)
+            {
+                break;
+            }
+            // Only HDLC frame format type 3 is used, anything else means we started inside a frame
+            if ((byte & 0xF0) != 0xA0)
+            {
+                DLOGW(TAG, "Not a frame format byte %02X - DLMS_STATE_WAITING_START", byte);
+                parser->state = DLMS_STATE_WAITING_START;
+                if (parser->segment_pending)
+                {
+                    process_abort(parser, DLMS_ABORT_RESYNC);
+                }
+                return false;
+            }
+            parser->hdlc_byte = byte;
+            parser->state_pos++;
+            parser->segmented = (byte & DLMS_HDLC_SEGMENTED) != 0;
+
+            // Only now is this a frame: a closing flag followed by a quiet line must not start one.
+            // The segments of one APDU make one frame for the callback.
+            if (!parser->segment_pending)
+            {
+                process_start(parser);
+            }
         }
         else
         {
-            uint8_t byte0 = parser->buffer[0];
+            uint8_t byte0 = parser->hdlc_byte;
             uint8_t byte1 = byte;
 
-            parser->frame_length = ((byte0 & 0x0F) << 8) | byte1;
+            parser->frame_length = ((byte0 & DLMS_HDLC_LENGTH_HIGH) << 8) | byte1;
 
             parser->state = DLMS_STATE_DESTINATION_ADDRESS;
             parser->state_pos = 0;
@@ -192,24 +1070,36 @@ bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
         break;
 
     case DLMS_STATE_DESTINATION_ADDRESS:
-
-        // TODO: Evaluate length of destination address
-        parser->state = DLMS_STATE_SOURCE_ADDRESS;
-        // ESP_LOGI(TAG, "Change state to: DLMS_STATE_SOURCE_ADDRESS");
-        parser->state_pos = 0;
-        parser->frame_pos++;
-
-        break;
-
     case DLMS_STATE_SOURCE_ADDRESS:
-        // TODO: Evaluate length of source address
-        parser->state = DLMS_STATE_CONTROL;
-        // ESP_LOGI(TAG, "Change state to: DLMS_STATE_CONTROL");
-        parser->state_pos = 0;
+
+        // HDLC addresses take 1, 2 or 4 bytes, the last one has the low bit set
+        if (byte & 0x01)
+        {
+            parser->state = parser->state == DLMS_STATE_DESTINATION_ADDRESS ? DLMS_STATE_SOURCE_ADDRESS : DLMS_STATE_CONTROL;
+            parser->state_pos = 0;
+        }
+        else if (++parser->state_pos >= DLMS_HDLC_ADDRESS_MAX)
+        {
+            DLOGW(TAG, "Address too long - DLMS_STATE_WAITING_START");
+            parser->state = DLMS_STATE_WAITING_START;
+            process_abort(parser, DLMS_ABORT_RESYNC);
+            return false;
+        }
         parser->frame_pos++;
         break;
 
     case DLMS_STATE_CONTROL:
+        // Segments sent as I-frames are numbered: a gap in N(S) is a lost segment. This frame is
+        // taken as a new APDU then, the LLC header check drops it if it is not one.
+        if (parser->segment_pending && !(byte & DLMS_HDLC_UNNUMBERED) && !(parser->control & DLMS_HDLC_UNNUMBERED) &&
+            DLMS_HDLC_SEND_SEQUENCE(byte) != ((DLMS_HDLC_SEND_SEQUENCE(parser->control) + 1) & 0x07))
+        {
+            DLOGW(TAG, "Segment N(S) %u after %u", DLMS_HDLC_SEND_SEQUENCE(byte), DLMS_HDLC_SEND_SEQUENCE(parser->control));
+            process_abort(parser, DLMS_ABORT_RESYNC);
+            start_apdu(parser);
+            process_start(parser);
+        }
+        parser->control = byte;
         parser->state = DLMS_STATE_HCS;
         // ESP_LOGI(TAG, "Change state to: DLMS_STATE_HCS");
         parser->state_pos = 0;
@@ -219,7 +1109,20 @@ bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
     case DLMS_STATE_HCS:
         if (parser->state_pos == 0)
         {
-            parser->buffer[parser->state_pos++] = byte;
+            parser->hdlc_byte = byte;
+            parser->state_pos++;
+        }
+        else if (parser->segment_pending && parser->frame_pos + 1 < parser->frame_length - 1)
+        {
+            // No LLC header in a continuation segment, its first byte may be in the middle of an
+            // element. Its first bytes are held until they show that.
+            parser->state = DLMS_STATE_SEGMENT_HEAD;
+            parser->state_pos = 0;
+        }
+        else if (parser->segment_pending)
+        {
+            parser->state = parser->apdu_state;
+            parser->state_pos = parser->apdu_pos;
         }
         else
         {
@@ -231,7 +1134,13 @@ bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
         break;
 
     case DLMS_STATE_ARRAY:
-        if (parser->state_pos == 4)
+        if (parser->state_pos == 0 && byte == DLMS_TAG_GENERAL_GLO_CIPHERING && !parser->ciphered)
+        {
+            parser->state = DLMS_STATE_CIPHER_HEADER;
+            parser->cipher_pending = true;
+            parser->buffer[parser->state_pos++] = byte;
+        }
+        else if (parser->state_pos == 4)
         { // Array length
             parser->state = DLMS_STATE_TIMESTAMP;
             parser->state_pos = 0;
@@ -247,21 +1156,35 @@ bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
 
     case DLMS_STATE_TIMESTAMP:
 
-        if (parser->state_pos < DLMS_SIZE_DATE_TIME)
-        {
-            parser->buffer[parser->state_pos++] = byte;
-        }
-        else
+        // Date-time of the notification: 0x00 for none, the length 12 and the date-time, or the
+        // same as a tagged octet string
+        parser->buffer[parser->state_pos++] = byte;
+
+        uint16_t header = parser->buffer[0] == DLMS_TAG_OCTET_STRING ? 2 : 1;
+        if (parser->state_pos >= header && parser->state_pos >= header + parser->buffer[header - 1])
         {
-            parser->state = DLMS_STATE_UNKNOWN;
+            if (parser->buffer[header - 1] == DLMS_SIZE_DATE_TIME && (parser->subscribed & DLMS_FIELD_BIT(DLMS_FIELD_TIMESTAMP)))
+            {
+                process_timestamp(parser, &parser->buffer[header]);
+            }
+            parser->state = DLMS_STATE_DATA;
             parser->state_pos = 0;
-            // ESP_LOGI(TAG, "Change state to: DLMS_STATE_UNKNOWN");
         }
         parser->frame_pos++;
         break;
 
     case DLMS_STATE_HEADER:
 
+        // An APDU starts with the LLC header. Without it this is a segment whose first frames were
+        // dropped, its bytes would land in the middle of some element.
+        if (parser->state_pos < 2 && (byte & 0xFE) != DLMS_LLC_LSAP)
+        {
+            DLOGW(TAG, "No LLC header - DLMS_STATE_WAITING_START");
+            parser->state = DLMS_STATE_WAITING_START;
+            process_abort(parser, DLMS_ABORT_RESYNC);
+            return false;
+        }
+
         if (parser->state_pos == 2)
         { // Header length
             parser->state = DLMS_STATE_ARRAY;
@@ -276,141 +1199,89 @@ bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
         parser->frame_pos++;
         break;
 
-    case DLMS_STATE_UNKNOWN:
-        if (parser->state_pos == 1)
-        { // Array length
-            parser->state = DLMS_STATE_DATA;
-            parser->state_pos = 0;
-            //    ESP_LOGI(TAG, "Change state to: DLMS_STATE_DATA");
+    case DLMS_STATE_DATA:
+
+        if (parser->raw_undecoded)
+        {
+            parser->frame_pos++;
+            break;
         }
-        else
+        if (parser->skip_remaining > 0)
         {
-            parser->state_pos++;
+            parser->skip_remaining--;
+            parser->frame_pos++;
+            break;
         }
 
-        parser->frame_pos++;
-        break;
-
-    case DLMS_STATE_DATA:
-
-        //ESP_LOGI(TAG, "%02x", byte);
-
-        parser->buffer[parser->state_pos++] = byte;
-
-        if (parser->state_pos > 1)
+        // A corrupted length or an unknown data type never completes an item. Drop the frame,
+        // unless it is kept for forwarding: then the rest passes by like a skipped element and
+        // the backend decodes what the parser cannot.
+        if (parser->state_pos >= sizeof(parser->buffer))
         {
-            uint8_t type = parser->buffer[0];
-            uint8_t length = parser->buffer[1];
-
-            /*if (byte == DLMS_END_MARKER)
-            {
-                ESP_LOGE(TAG, "XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX");
-            }*/
-
-            switch (type)
+            if (parser->raw != NULL)
             {
-            case DLMS_TAG_OCTET_STRING:
-
-                if (parser->state_pos >= 2 + length)
-                {
-
-                    uint8_t dataType = parser->buffer[2 + length];
-
-                    switch (dataType)
-                    {
-                    case DLMS_TAG_VISIBLE_STRING:
-
-                        if (parser->state_pos >= 3 + length)
-                        {
-                            uint8_t dataLength = parser->buffer[3 + length];
-
-                            if (parser->state_pos >= 4 + length + dataLength)
-                            {
-                                //ESP_LOGI(TAG, "String with address found with lenght %d", dataLength);
-                                parser->state_pos = 0;
-                            }
-                        }
-
-                        break;
-
-                    case DLMS_TAG_OCTET_STRING:
-
-                        if (parser->state_pos >= 3 + length)
-                        {
-                            uint8_t dataLength = parser->buffer[3 + length];
-
-                            if (parser->state_pos >= 4 + length + dataLength)
-                            {
-                                //ESP_LOGI(TAG, "Octet String with address found with lenght %d", dataLength);
-
-                                parser->state_pos = 0;
-                            }
-                        }
-
-                        break;
-                    case DLMS_TAG_DOUBLE_LONG_UNSIGNED:
-                        if (parser->state_pos >= 3 + length + DLMS_SIZE_U32)
-                        {
-                            //ESP_LOGI(TAG, "Data with address found with lenght %d", 4);
-                            //ESP_LOGI(TAG, "Current %02x%02x%02x%02x", parser->buffer[9], parser->buffer[10], parser->buffer[11], parser->buffer[12]);
-
-                            dlms_data_t data;
-                            memcpy(data.address, &parser->buffer[2], DLMS_OBIS_ADDR_LEN);
-                            
-                            data.data = &parser->buffer[2 + length + 1];
-                            data.length = DLMS_SIZE_U32;
-
-                            process_payload(parser, &data);
-                            parser->state_pos = 0;
-                        }
-
-                        break;
-                    case DLMS_TAG_UNSIGNED:
-
-                        if (parser->state_pos >= 3 + length + DLMS_SIZE_U16)
-                        {
-                            //ESP_LOGI(TAG, "Data with address found with lenght %d", 2);
-                            //ESP_LOGI(TAG, "Data %02x%02x", parser->buffer[9], parser->buffer[10]);
-
-                            dlms_data_t data;
-                            memcpy(data.address, &parser->buffer[2], DLMS_OBIS_ADDR_LEN);
-                            
-                            data.data = &parser->buffer[2 + length + 1];
-                            data.length = DLMS_SIZE_U16;
-
-                            process_payload(parser, &data);
-                            parser->state_pos = 0;
-                        }
-                        break;
-                    }
-                }
-
+                DLOGW(TAG, "Data item too long, rest of the APDU not decoded");
+                parser->raw_undecoded = true;
+                parser->frame_pos++;
                 break;
+            }
+            DLOGE(TAG, "Data item too long - DLMS_STATE_WAITING_START");
+            parser->state = DLMS_STATE_WAITING_START;
+            process_abort(parser, DLMS_ABORT_RESYNC);
+            return false;
+        }
 
-            case DLMS_TAG_VISIBLE_STRING:
-
-                if (parser->state_pos > 1 + length)
-                {
-                    ESP_LOGI(TAG, "String found with lenght %d", length);
-                    parser->state_pos = 0;
-                }
-
-                break;
+        parser->buffer[parser->state_pos++] = byte;
 
-            default:
+        if (!process_data_byte(parser))
+        {
+            if (parser->raw != NULL)
+            {
+                DLOGW(TAG, "Unknown data type %02X, rest of the APDU not decoded", parser->buffer[0]);
+                parser->raw_undecoded = true;
+                parser->frame_pos++;
                 break;
             }
+            DLOGE(TAG, "Unknown data type %02X - DLMS_STATE_WAITING_START", parser->buffer[0]);
+            parser->state = DLMS_STATE_WAITING_START;
+            process_abort(parser, DLMS_ABORT_RESYNC);
+            return false;
         }
 
+        parser->frame_pos++;
+        break;
+
+    case DLMS_STATE_CIPHER_HEADER:
+        parser->buffer[parser->state_pos++] = byte;
         parser->frame_pos++;
 
-        if (parser->frame_pos >= parser->frame_length - 1)
+        // The ciphertext may hold flags, so a header that cannot be used skips the APDU to keep
+        // the framing. The frame is dropped at the FCS.
+        if (!process_cipher_header(parser))
         {
-            parser->state = DLMS_STATE_CHECKSUM;
+            parser->state = DLMS_STATE_CIPHER_SKIP;
+        }
+        else if (parser->ciphered)
+        {
+            parser->state = DLMS_STATE_ARRAY;
             parser->state_pos = 0;
-            //ESP_LOGI(TAG, "Change state to: DLMS_STATE_CHECKSUM");
         }
+        break;
 
+    case DLMS_STATE_CIPHER_SKIP:
+        parser->frame_pos++;
+        break;
+
+    case DLMS_STATE_CIPHER_TAG:
+        parser->buffer[parser->state_pos++] = byte;
+        parser->frame_pos++;
+
+        // Nothing of the APDU is left after the tag
+        if (parser->state_pos == DLMS_CIPHER_TAG_SIZE)
+        {
+            process_cipher_tag(parser);
+            parser->state = DLMS_STATE_CIPHER_SKIP;
+        }
         break;
 
     case DLMS_STATE_CHECKSUM:
@@ -419,39 +1290,94 @@ bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
 
         if (parser->state_pos == 0)
         {
-            parser->buffer[parser->state_pos++] = byte;
+            parser->hdlc_byte = byte;
+            parser->state_pos++;
         }
         else
         {
+            // Sent least significant byte first, complemented
+            uint16_t fcs = (uint16_t)(parser->hdlc_byte | byte << 8);
+            if (fcs != (uint16_t)~parser->checksum)
+            {
+                DLOGW(TAG, "FCS %04X, expected %04X - DLMS_STATE_WAITING_START", fcs, (uint16_t)~parser->checksum);
+                parser->state = DLMS_STATE_WAITING_START;
+                process_abort(parser, DLMS_ABORT_FCS);
+                return false;
+            }
+            // More segments follow, the APDU is not complete yet
+            parser->segment_pending = parser->segmented;
+            // Ciphertext or tag cut short by the frame end, or a tag that did not match
+            if (!parser->segmented && parser->cipher_pending)
+            {
+                DLOGW(TAG, "Ciphered APDU not authenticated - DLMS_STATE_WAITING_START");
+                parser->state = DLMS_STATE_WAITING_START;
+                process_abort(parser, DLMS_ABORT_DECRYPT);
+                return false;
+            }
             parser->state = DLMS_STATE_END;
             parser->state_pos = 0;
-            ESP_LOGI(TAG, "Change state to: DLMS_STATE_END");
+            DLOGD(TAG, "Change state to: DLMS_STATE_END");
         }
         parser->frame_pos++;
+        break;
 
-        /*if (parser->checksum == byte) {
-            parser->state = DLMS_STATE_END;
-            //process_payload(parser);
-        } else {
-            parser->state = DLMS_STATE_WAITING_START;
-            ESP_LOGI(TAG, "Change state to: DLMS_STATE_WAITING_START");
-            return false;
-        }*/
+    case DLMS_STATE_SEGMENT_HEAD:
+        // Not in the FCS yet, nor counted in frame_pos: the state the bytes go to does that
+        parser->segment_head[parser->state_pos++] = byte;
+
+        if (parser->state_pos == DLMS_SEGMENT_HEAD_SIZE && (parser->segment_head[0] & 0xFE) == DLMS_LLC_LSAP &&
+            (parser->segment_head[1] & 0xFE) == DLMS_LLC_LSAP && parser->segment_head[2] == 0x00)
+        {
+            // The last segment of the previous APDU was lost, this one starts the next
+            DLOGW(TAG, "LLC header in a continuation segment");
+            process_abort(parser, DLMS_ABORT_RESYNC);
+            start_apdu(parser);
+            process_start(parser);
+            for (uint8_t i = 0; i < DLMS_SEGMENT_HEAD_SIZE; i++)
+            {
+                parser->checksum = dlms_fcs_update(parser->checksum, parser->segment_head[i]);
+            }
+            parser->frame_pos += DLMS_SEGMENT_HEAD_SIZE;
+            parser->state = DLMS_STATE_ARRAY;
+            parser->state_pos = 0;
+        }
+        else if (parser->state_pos == DLMS_SEGMENT_HEAD_SIZE || parser->frame_pos + parser->state_pos >= parser->frame_length - 1)
+        {
+            // Carry on with the APDU where the previous segment stopped
+            uint8_t count = (uint8_t)parser->state_pos;
+            parser->state = parser->apdu_state;
+            parser->state_pos = parser->apdu_pos;
+            for (uint8_t i = 0; i < count; i++)
+            {
+                if (!dlms_parser_process_byte(parser, parser->segment_head[i]))
+                {
+                    return false;
+                }
+            }
+        }
         break;
 
     case DLMS_STATE_END:
         parser->state = DLMS_STATE_WAITING_START;
-        ESP_LOGI(TAG, "Change state to: DLMS_STATE_WAITING_START");
+        DLOGD(TAG, "Change state to: DLMS_STATE_WAITING_START");
 
-        process_end(parser);
+        if (parser->segment_pending)
+        {
+            DLOGD(TAG, "Segment ended, the APDU goes on in the next frame");
+        }
+        else
+        {
+            flush_pending(parser);
+            process_end(parser);
+        }
         parser->frame_pos = 0;
-        ESP_LOGI(TAG, "---------------------------------------------------------");
+        DLOGD(TAG, "---------------------------------------------------------");
         
 
         
         if (byte != DLMS_END_MARKER)
         {
-            ESP_LOGE(TAG, "store_byte failed - DLMS_STATE_WAITING_START");
+            DLOGE(TAG, "store_byte failed - DLMS_STATE_WAITING_START");
             return false;
         }
         
@@ -461,5 +1387,17 @@ bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte)
         
     }
 
+    // The information field ends before the FCS. In a segmented frame the APDU goes on in the next
+    // frame right where this one stopped, even in the middle of a data element, so the element
+    // decoder state in buffer is kept and no segment is ever copied.
+    if (parser->state >= DLMS_STATE_ARRAY && parser->state <= DLMS_STATE_CIPHER_SKIP &&
+        parser->frame_pos >= parser->frame_length - 1)
+    {
+        parser->apdu_state = parser->state;
+        parser->apdu_pos = parser->state_pos;
+        parser->state = DLMS_STATE_CHECKSUM;
+        parser->state_pos = 0;
+    }
+
     return true;
 }
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "include/dlms_profile.h"
+#include "include/dlms_parser.h"
+
+#define OBIS(a, b, c, d, e) {a, b, c, d, e, 0xFF}
+#define COUNT(entries) (uint8_t)(sizeof(entries) / sizeof(entries[0]))
+
+// Kamstrup list 1 and list 2, "Kamstrup_V0001". List 1 carries a subset of list 2.
+// Units as in meter_snapshot_t: V, A/100, W, var, 1/100, Wh.
+static const dlms_profile_entry_t kKamstrup[] = {
+    {OBIS(1, 1, 32, 7, 0), 0, RMS_VOLTAGE_A, 0},
+    {OBIS(1, 1, 52, 7, 0), 0, RMS_VOLTAGE_B, 0},
+    {OBIS(1, 1, 72, 7, 0), 0, RMS_VOLTAGE_C, 0},
+    {OBIS(1, 1, 33, 7, 0), 0, POWER_FACTOR_A, 0},
+    {OBIS(1, 1, 53, 7, 0), 0, POWER_FACTOR_B, 0},
+    {OBIS(1, 1, 73, 7, 0), 0, POWER_FACTOR_C, 0},
+    {OBIS(1, 1, 31, 7, 0), 0, RMS_CURRENT_A, 0},
+    {OBIS(1, 1, 51, 7, 0), 0, RMS_CURRENT_B, 0},
+    {OBIS(1, 1, 71, 7, 0), 0, RMS_CURRENT_C, 0},
+    {OBIS(1, 1, 21, 7, 0), 0, ACTIVE_POWER_A, 0},
+    {OBIS(1, 1, 41, 7, 0), 0, ACTIVE_POWER_B, 0},
+    {OBIS(1, 1, 61, 7, 0), 0, ACTIVE_POWER_C, 0},
+    {OBIS(1, 1, 22, 7, 0), 0, REACTIVE_POWER_A, 0},
+    {OBIS(1, 1, 42, 7, 0), 0, REACTIVE_POWER_B, 0},
+    {OBIS(1, 1, 62, 7, 0), 0, REACTIVE_POWER_C, 0},
+    {OBIS(1, 1, 1, 8, 0), 0, ACTIVE_ENERGY_IMPORT, 0},
+    {OBIS(1, 1, 2, 8, 0), 0, ACTIVE_ENERGY_EXPORT, 0},
+    {OBIS(1, 1, 1, 7, 0), 0, ACTIVE_POWER_IMPORT, 0},
+    {OBIS(1, 1, 2, 7, 0), 0, ACTIVE_POWER_EXPORT, 0},
+    {OBIS(1, 1, 0, 0, 1), 0, SERIAL_NUMBER, 0},
+};
+
+// Aidon, "AIDON_V0001": voltage in V/10, current in A/10, energy in 10 Wh. The clock only comes
+// with the hourly list, the notification header has none.
+static const dlms_profile_entry_t kAidon[] = {
+    {OBIS(1, 0, 32, 7, 0), 0, RMS_VOLTAGE_A, -1},
+    {OBIS(1, 0, 52, 7, 0), 0, RMS_VOLTAGE_B, -1},
+    {OBIS(1, 0, 72, 7, 0), 0, RMS_VOLTAGE_C, -1},
+    {OBIS(1, 0, 31, 7, 0), 0, RMS_CURRENT_A, 1},
+    {OBIS(1, 0, 51, 7, 0), 0, RMS_CURRENT_B, 1},
+    {OBIS(1, 0, 71, 7, 0), 0, RMS_CURRENT_C, 1},
+    {OBIS(1, 0, 21, 7, 0), 0, ACTIVE_POWER_A, 0},
+    {OBIS(1, 0, 41, 7, 0), 0, ACTIVE_POWER_B, 0},
+    {OBIS(1, 0, 61, 7, 0), 0, ACTIVE_POWER_C, 0},
+    {OBIS(1, 0, 1, 7, 0), 0, ACTIVE_POWER_IMPORT, 0},
+    {OBIS(1, 0, 2, 7, 0), 0, ACTIVE_POWER_EXPORT, 0},
+    {OBIS(1, 0, 1, 8, 0), 0, ACTIVE_ENERGY_IMPORT, 1},
+    {OBIS(1, 0, 2, 8, 0), 0, ACTIVE_ENERGY_EXPORT, 1},
+    {OBIS(0, 0, 1, 0, 0), 0, DLMS_FIELD_TIMESTAMP, 0},
+};
+
+// Kaifa, "KFM_001": one structure of values in a fixed order, list identifier, meter id and
+// meter type first. Voltage in V/10, current in mA. The clock is taken from the header.
+static const dlms_profile_entry_t kKaifa[] = {
+    {{0}, 3, ACTIVE_POWER_IMPORT, 0},
+    {{0}, 4, ACTIVE_POWER_EXPORT, 0},
+    {{0}, 7, RMS_CURRENT_A, -1},
+    {{0}, 8, RMS_CURRENT_B, -1},
+    {{0}, 9, RMS_CURRENT_C, -1},
+    {{0}, 10, RMS_VOLTAGE_A, -1},
+    {{0}, 11, RMS_VOLTAGE_B, -1},
+    {{0}, 12, RMS_VOLTAGE_C, -1},
+    {{0}, 14, ACTIVE_ENERGY_IMPORT, 0},
+    {{0}, 15, ACTIVE_ENERGY_EXPORT, 0},
+};
+
+// Any other list, e.g. Landis+Gyr: standard OBIS codes, values passed on unscaled
+static const dlms_profile_entry_t kStandard[] = {
+    {OBIS(1, 0, 32, 7, 0), 0, RMS_VOLTAGE_A, 0},
+    {OBIS(1, 0, 52, 7, 0), 0, RMS_VOLTAGE_B, 0},
+    {OBIS(1, 0, 72, 7, 0), 0, RMS_VOLTAGE_C, 0},
+    {OBIS(1, 0, 33, 7, 0), 0, POWER_FACTOR_A, 0},
+    {OBIS(1, 0, 53, 7, 0), 0, POWER_FACTOR_B, 0},
+    {OBIS(1, 0, 73, 7, 0), 0, POWER_FACTOR_C, 0},
+    {OBIS(1, 0, 31, 7, 0), 0, RMS_CURRENT_A, 0},
+    {OBIS(1, 0, 51, 7, 0), 0, RMS_CURRENT_B, 0},
+    {OBIS(1, 0, 71, 7, 0), 0, RMS_CURRENT_C, 0},
+    {OBIS(1, 0, 21, 7, 0), 0, ACTIVE_POWER_A, 0},
+    {OBIS(1, 0, 41, 7, 0), 0, ACTIVE_POWER_B, 0},
+    {OBIS(1, 0, 61, 7, 0), 0, ACTIVE_POWER_C, 0},
+    {OBIS(1, 0, 22, 7, 0), 0, REACTIVE_POWER_A, 0},
+    {OBIS(1, 0, 42, 7, 0), 0, REACTIVE_POWER_B, 0},
+    {OBIS(1, 0, 62, 7, 0), 0, REACTIVE_POWER_C, 0},
+    {OBIS(1, 0, 1, 7, 0), 0, ACTIVE_POWER_IMPORT, 0},
+    {OBIS(1, 0, 2, 7, 0), 0, ACTIVE_POWER_EXPORT, 0},
+    {OBIS(1, 0, 1, 8, 0), 0, ACTIVE_ENERGY_IMPORT, 0},
+    {OBIS(1, 0, 2, 8, 0), 0, ACTIVE_ENERGY_EXPORT, 0},
+    {OBIS(0, 0, 1, 0, 0), 0, DLMS_FIELD_TIMESTAMP, 0},
+};
+
+const dlms_profile_t dlms_profiles[] = {
+    {"Kamstrup", "Kamstrup_V0001", false, kKamstrup, COUNT(kKamstrup)},
+    {"Aidon", "AIDON_V0001", false, kAidon, COUNT(kAidon)},
+    {"Kaifa", "KFM_001", true, kKaifa, COUNT(kKaifa)},
+    {"Standard OBIS", NULL, false, kStandard, COUNT(kStandard)},
+};
+
+const size_t dlms_profile_count = sizeof(dlms_profiles) / sizeof(dlms_profiles[0]);
@@ -0,0 +1,42 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+// Minimal stand-in for ESP-IDF's esp_log.h, used when the dlms component is built on the host.
+// Messages above HOST_LOG_LEVEL are compiled out so they do not distort benchmarks, the rest can
+// be silenced at run time with esp_log_level_set(). The tag is ignored, the level applies to all.
+
+#include <stdio.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+#ifndef HOST_LOG_LEVEL
+#define HOST_LOG_LEVEL ESP_LOG_WARN
+#endif
+
+extern esp_log_level_t host_log_level;
+
+#define HOST_LOG(level, letter, tag, format, ...)                                    \
+    do                                                                               \
+    {                                                                                \
+        if ((level) <= HOST_LOG_LEVEL && (level) <= host_log_level)                  \
+        {                                                                            \
+            fprintf(stderr, letter " (%s) " format "\n", tag, ##__VA_ARGS__);        \
+        }                                                                            \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) HOST_LOG(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) HOST_LOG(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+#endif // ESP_LOG_H
@@ -0,0 +1,23 @@
+#ifndef MBEDTLS_AES_H
+#define MBEDTLS_AES_H
+
+// Minimal stand-in for mbedTLS's aes.h, used when the dlms component is built on the host. Only
+// what dlms_gcm needs: AES-128 block encryption. On the device mbedTLS drives the AES peripheral.
+
+#include <stdint.h>
+
+#define MBEDTLS_AES_ENCRYPT 1
+#define MBEDTLS_AES_DECRYPT 0
+#define MBEDTLS_ERR_AES_INVALID_KEY_LENGTH -0x0020
+#define MBEDTLS_ERR_AES_BAD_INPUT_DATA -0x0021
+
+typedef struct {
+    uint8_t round_keys[176];
+} mbedtls_aes_context;
+
+void mbedtls_aes_init(mbedtls_aes_context *ctx);
+void mbedtls_aes_free(mbedtls_aes_context *ctx);
+int mbedtls_aes_setkey_enc(mbedtls_aes_context *ctx, const unsigned char *key, unsigned int keybits);
+int mbedtls_aes_crypt_ecb(mbedtls_aes_context *ctx, int mode, const unsigned char input[16], unsigned char output[16]);
+
+#endif // MBEDTLS_AES_H
@@ -0,0 +1,124 @@
+#ifndef DLMS_CLIENT_H
+#define DLMS_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "dlms_parser.h"
+
+// DLMS client for meters with an HDLC client port, for reading values instead of waiting for
+// pushes. The client connects the link (SNRM/UA), opens an association (AARQ/AARE, lowest level
+// or low level security) and then reads a list of objects on a fixed schedule. All objects due in
+// a cycle go out in as few GET requests as possible: with a list of attribute references when the
+// meter supports multiple references, else one at a time. The association stays open across
+// cycles and is only opened again after an error.
+//
+// The values of a cycle are held until its last response and then go to the callback as one
+// frame, START, fields, END, with the same types and units as the push parser. A cycle that fails
+// ends in START, ABORT with DLMS_ABORT_CLIENT. Registers (class 3) are scaled by their scaler_unit,
+// read once per association.
+//
+// The client does no I/O of its own: bytes from the meter go to dlms_client_process_byte(),
+// requests go out through the send function, and dlms_client_poll() runs the schedule.
+
+#define DLMS_CLIENT_FRAME_SIZE 160          // Received frame without flags: 128 byte information field and header
+#define DLMS_CLIENT_APDU_SIZE 512           // Response APDU from one or more segments, proposed as max PDU size
+#define DLMS_CLIENT_MAX_OBJECTS 24
+#define DLMS_CLIENT_LIST_MAX 12             // Attribute references per GET request
+#define DLMS_CLIENT_PASSWORD_MAX 16
+#define DLMS_CLIENT_RETRY_MS 10000          // Shortest wait before connecting again after an error
+
+#define DLMS_CLASS_DATA 1
+#define DLMS_CLASS_REGISTER 3
+#define DLMS_CLASS_CLOCK 8
+
+typedef struct {
+    uint16_t class_id;              // DLMS_CLASS_*; attribute 2, the value, is read
+    uint8_t obis[DLMS_OBIS_SIZE];
+    uint8_t type;                   // dlms_field_type_t
+    int8_t scaler;                  // Power of ten to the field's unit, replaced by the scaler_unit of a register
+    uint8_t every;                  // Read in every n-th cycle, 1 for every cycle
+} dlms_client_object_t;
+
+// Writes a request to the meter, returns the number of bytes written. Context is send_context of
+// the config.
+typedef int (*dlms_client_send_t)(const uint8_t *data, size_t length, void *context);
+
+typedef struct {
+    uint16_t server_address;        // Upper HDLC address, the logical device, 1 for the management device
+    uint16_t physical_address;      // Lower HDLC address, 0 to leave it out
+    uint8_t client_address;         // Client SAP: 0x10 public client, 0x01 management client
+    const char *password;           // Low level security password, NULL or "" for none
+    uint32_t interval_ms;           // From the start of one cycle to the next
+    uint32_t timeout_ms;            // Silence after a request before it is given up
+    const dlms_client_object_t *objects;
+    uint8_t object_count;
+    dlms_client_send_t send;
+    void *send_context;
+} dlms_client_config_t;
+
+typedef enum {
+    DLMS_CLIENT_DISCONNECTED,
+    DLMS_CLIENT_CONNECTING,         // SNRM sent, waiting for UA
+    DLMS_CLIENT_ASSOCIATING,        // AARQ sent, waiting for AARE
+    DLMS_CLIENT_IDLE,               // Associated, waiting for the next cycle
+    DLMS_CLIENT_READING,            // GET request sent, waiting for the response
+} dlms_client_state_t;
+
+typedef struct {
+    dlms_client_config_t config;
+    dlms_client_state_t state;
+    dlms_field_callback_t callback;
+    void *callback_context;
+
+    // HDLC link
+    uint8_t server_hdlc[4];         // Server address as sent
+    uint8_t server_hdlc_size;
+    uint8_t send_sequence;          // N(S) of the next I frame
+    uint8_t receive_sequence;       // N(S) expected from the meter
+    uint16_t max_info_tx;           // Largest information field the meter accepts
+    bool multiple_references;       // GET requests may carry a list
+
+    // Received frame, then the APDU put together from its segments
+    uint8_t frame[DLMS_CLIENT_FRAME_SIZE];
+    uint16_t frame_pos;
+    uint16_t frame_length;
+    bool in_frame;
+    uint8_t apdu[DLMS_CLIENT_APDU_SIZE];
+    uint16_t apdu_length;
+    uint8_t tx[DLMS_CLIENT_FRAME_SIZE];
+
+    // Schedule and the cycle in progress
+    uint32_t deadline_ms;           // Response timeout, or the start of the next cycle
+    uint32_t cycle_start_ms;
+    uint32_t cycle;                 // Cycles since the association was opened
+    bool scalers_read;              // The scaler_unit of every register is known
+    bool reading_scalers;           // The cycle reads scaler_units before the values
+    uint8_t next_object;            // Next object to consider for a request
+    uint8_t pending[DLMS_CLIENT_LIST_MAX];  // Objects of the outstanding request
+    uint8_t pending_count;
+    uint8_t invoke_id;
+    int8_t scalers[DLMS_CLIENT_MAX_OBJECTS];
+    dlms_held_field_t held[DLMS_CLIENT_MAX_OBJECTS];
+    uint8_t held_count;
+} dlms_client_t;
+
+// Standard OBIS objects of an IEC 62056 meter: instantaneous values every cycle, energy registers
+// every tenth
+extern const dlms_client_object_t dlms_client_objects[];
+extern const size_t dlms_client_object_count;
+
+void dlms_client_init(dlms_client_t *client, const dlms_client_config_t *config);
+
+// Set the callback function and the context it is called with
+void dlms_client_set_callback(dlms_client_t *client, dlms_field_callback_t callback, void *context);
+
+// Process a single byte from the meter. The next request may be sent from here. Returns false
+// when the byte ended a frame that was dropped.
+bool dlms_client_process_byte(dlms_client_t *client, uint8_t byte, uint32_t now_ms);
+
+// Start cycles and give up on requests that got no response. Returns the time in ms until it
+// must be called again, at the latest.
+uint32_t dlms_client_poll(dlms_client_t *client, uint32_t now_ms);
+
+#endif // DLMS_CLIENT_H
@@ -0,0 +1,47 @@
+#ifndef DLMS_GCM_H
+#define DLMS_GCM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "mbedtls/aes.h"
+
+// Streaming AES-128-GCM for ciphered DLMS APDUs, one byte at a time so the parser can decrypt
+// the frame as it arrives. Blocks are encrypted through mbedTLS, which uses the AES peripheral
+// when CONFIG_MBEDTLS_HARDWARE_AES is set; GHASH runs in software with 4-bit tables.
+
+#define DLMS_GCM_KEY_SIZE 16
+#define DLMS_GCM_IV_SIZE 12     // System title and frame counter
+#define DLMS_GCM_BLOCK_SIZE 16
+
+typedef struct {
+    mbedtls_aes_context aes;
+    uint64_t table_high[16];    // Multiples of the hash key by 4-bit values
+    uint64_t table_low[16];
+    uint8_t j0[DLMS_GCM_BLOCK_SIZE];        // Pre-counter block, encrypts the tag
+    uint8_t counter[DLMS_GCM_BLOCK_SIZE];
+    uint8_t keystream[DLMS_GCM_BLOCK_SIZE]; // Key stream of the current block
+    uint8_t block[DLMS_GCM_BLOCK_SIZE];     // Ciphertext of the current block
+    uint8_t hash[DLMS_GCM_BLOCK_SIZE];
+    uint8_t pos;
+    uint32_t aad_length;
+    uint32_t text_length;
+    uint32_t busy_us;           // Time spent on blocks since dlms_gcm_start()
+} dlms_gcm_t;
+
+void dlms_gcm_init(dlms_gcm_t *gcm);
+void dlms_gcm_free(dlms_gcm_t *gcm);
+
+// Set the 16-byte block cipher key. Returns false if mbedTLS rejects it.
+bool dlms_gcm_set_key(dlms_gcm_t *gcm, const uint8_t *key);
+
+// Start a message with a 12-byte IV and the additional authenticated data, which may be empty
+void dlms_gcm_start(dlms_gcm_t *gcm, const uint8_t *iv, const uint8_t *aad, size_t aad_length);
+
+uint8_t dlms_gcm_encrypt(dlms_gcm_t *gcm, uint8_t byte);
+uint8_t dlms_gcm_decrypt(dlms_gcm_t *gcm, uint8_t byte);
+
+// Complete the message and write the 16-byte tag. DLMS transmits the first 12 bytes.
+void dlms_gcm_finish(dlms_gcm_t *gcm, uint8_t *tag);
+
+#endif // DLMS_GCM_H
@@ -3,7 +3,46 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "dlms_profile.h"
+#include "dlms_gcm.h"
 
+// HDLC frame check sequence, CRC-16/X.25
+#define DLMS_FCS_INIT 0xFFFF
+#define DLMS_FCS_POLY 0x8408 // 0x1021 reflected
+
+// DLMS/COSEM data type tags
+#define DLMS_TAG_NULL                 0x00
+#define DLMS_TAG_ARRAY                0x01  // count, then the elements
+#define DLMS_TAG_STRUCTURE            0x02  // count, then the elements
+#define DLMS_TAG_BOOLEAN              0x03
+#define DLMS_TAG_BIT_STRING           0x04  // length in bits
+#define DLMS_TAG_DOUBLE_LONG          0x05  // 4-byte signed integer
+#define DLMS_TAG_DOUBLE_LONG_UNSIGNED 0x06  // 4-byte unsigned integer
+#define DLMS_TAG_OCTET_STRING         0x09  // length-prefixed raw bytes
+#define DLMS_TAG_VISIBLE_STRING       0x0A  // length-prefixed ASCII
+#define DLMS_TAG_UTF8_STRING          0x0C  // length-prefixed UTF-8
+#define DLMS_TAG_INTEGER              0x0F  // 1-byte signed integer
+#define DLMS_TAG_LONG                 0x10  // 2-byte signed integer
+#define DLMS_TAG_UNSIGNED             0x11  // 1-byte unsigned integer
+#define DLMS_TAG_LONG_UNSIGNED        0x12  // 2-byte unsigned integer
+#define DLMS_TAG_LONG64               0x14
+#define DLMS_TAG_LONG64_UNSIGNED      0x15
+#define DLMS_TAG_ENUM                 0x16
+#define DLMS_TAG_FLOAT32              0x17
+#define DLMS_TAG_FLOAT64              0x18
+#define DLMS_TAG_DATE_TIME            0x19
+#define DLMS_TAG_DATE                 0x1A
+#define DLMS_TAG_TIME                 0x1B
+
+// COSEM units of the fields, as in the unit of a scaler_unit
+#define DLMS_UNIT_W                   27
+#define DLMS_UNIT_VAR                 29
+#define DLMS_UNIT_WH                  30
+#define DLMS_UNIT_A                   33
+#define DLMS_UNIT_V                   35
+#define DLMS_UNIT_NONE                255
+
+#define DLMS_SCALER_MAX               9     // Largest power of ten values are scaled by
 
 // DLMS Parser States
 typedef enum {
@@ -16,16 +55,20 @@ typedef enum {
     DLMS_STATE_ARRAY,
     DLMS_STATE_HEADER,
     DLMS_STATE_TIMESTAMP, 
-    DLMS_STATE_UNKNOWN,   
     DLMS_STATE_DATA,        
+    DLMS_STATE_CIPHER_HEADER,   // General-glo-ciphering header, up to the frame counter
+    DLMS_STATE_CIPHER_TAG,      // Authentication tag after the ciphertext
+    DLMS_STATE_CIPHER_SKIP,     // Rest of an APDU that cannot be decrypted, up to the FCS
     DLMS_STATE_CHECKSUM,
-    DLMS_STATE_END
+    DLMS_STATE_END,
+    DLMS_STATE_SEGMENT_HEAD     // First bytes of a continuation segment, held until they are no LLC header
 } dlms_parser_state_t;
 
 // DLMS Field Types
 typedef enum {
     START,
     END,
+    ABORT,                  // A started frame was dropped, data[0] is the dlms_abort_reason_t
     RMS_VOLTAGE_A,
     RMS_VOLTAGE_B,
     RMS_VOLTAGE_C,
@@ -43,10 +86,24 @@ typedef enum {
     POWER_FACTOR_C,
     ACTIVE_ENERGY_IMPORT,
     ACTIVE_ENERGY_EXPORT,
+    ACTIVE_POWER_IMPORT,
+    ACTIVE_POWER_EXPORT,
     DLMS_FIELD_TIMESTAMP,
     SERIAL_NUMBER
 } dlms_field_type_t;
 
+// Subscription mask bit of a field type, see dlms_parser_subscribe()
+#define DLMS_FIELD_BIT(type) (1UL << (type))
+#define DLMS_FIELDS_ALL UINT32_MAX
+
+// Why a frame ended in ABORT instead of END
+typedef enum {
+    DLMS_ABORT_RESYNC,      // Framing lost, a data item never completed
+    DLMS_ABORT_FCS,         // Frame check sequence mismatch
+    DLMS_ABORT_DECRYPT,     // Ciphered APDU without keys, unsupported or failing authentication
+    DLMS_ABORT_CLIENT       // Read cycle of the DLMS client without a usable response
+} dlms_abort_reason_t;
+
 // Structure to hold parsed field data
 typedef struct {
     dlms_field_type_t type;
@@ -54,8 +111,21 @@ typedef struct {
     uint16_t length;
 } dlms_field_t;
 
-// Single callback function type
-typedef void (*dlms_field_callback_t)(dlms_field_t *field);
+#define DLMS_SEGMENT_HEAD_SIZE 3     // LLC header, the start of a new APDU
+#define DLMS_SEGMENT_TIMEOUT_MS 1000 // Quiet line after which a started frame or segmented APDU is dropped
+
+#define DLMS_HELD_FIELDS 32          // Fields of an authenticated APDU kept until its tag is checked
+#define DLMS_HELD_FIELD_SIZE 12      // Largest field, the date-time
+
+typedef struct {
+    uint8_t type;                   // dlms_field_type_t
+    uint8_t length;
+    uint8_t data[DLMS_HELD_FIELD_SIZE];
+} dlms_held_field_t;
+
+// Single callback function type. Context is the pointer given with the callback, e.g. the meter
+// channel the parser belongs to.
+typedef void (*dlms_field_callback_t)(dlms_field_t *field, void *context);
 
 // DLMS Parser context
 typedef struct {
@@ -65,26 +135,163 @@ typedef struct {
     uint16_t state_pos;
     uint16_t frame_length;
     uint16_t checksum;
+    uint8_t hdlc_byte;          // First byte of the frame format, HCS or FCS, kept out of buffer
+    uint8_t control;            // Control field of the current or last frame
     bool escape_next;           
     
     // Single callback
     dlms_field_callback_t callback;
+    void *callback_context;
+
+    // Meter profile, kept across frames until the list identifier changes
+    const dlms_profile_t *profiles;
+    size_t profile_count;
+    const dlms_profile_t *profile;
+    uint8_t lookup[DLMS_PROFILE_LOOKUP_SIZE];   // Entry index + 1 by OBIS hash or position, 0 if none
+
+    // Data elements of the current frame
+    uint8_t obis[DLMS_OBIS_SIZE];               // OBIS code waiting for its value
+    bool has_obis;
+    bool list_seen;                             // The list identifier has been checked
+    uint8_t position;                           // Index of the next element that is not an array or structure
+    int8_t scalers[DLMS_PROFILE_LOOKUP_SIZE];   // Per profile entry: power of ten to the field's unit, from the profile or the meter's scaler_unit
+
+    // Value matched by OBIS code, held until the element after it tells whether a scaler_unit follows
+    uint8_t pending_entry;                      // Entry index + 1, 0 if none
+    uint8_t pending_tag;
+    uint8_t pending_length;
+    uint8_t pending_value[8];
+    bool pending_has_scaler;
+    int8_t pending_scaler;
+
+    // Subscription. Elements no subscribed entry takes are stepped over by their encoded length,
+    // so decoding costs what is reported rather than what the meter sends.
+    uint32_t subscribed;                        // DLMS_FIELD_BIT of the fields to decode
+    uint16_t skip_remaining;                    // Bytes of a skipped element still to come
+    uint32_t elements_decoded;                  // Since init
+    uint32_t elements_skipped;
+
+    // Ciphered APDUs. The plaintext states get the decrypted bytes; the fields of an authenticated
+    // APDU are held back until the tag checks, so the callback only sees authentic values.
+    dlms_gcm_t gcm;
+    bool has_encryption_key;
+    bool has_authentication_key;
+    uint8_t authentication_key[DLMS_GCM_KEY_SIZE];
+    bool ciphered;                              // The current or last frame carries a ciphered APDU
+    bool authenticated;                         // An authentication tag follows the ciphertext
+    bool cipher_pending;                        // Ciphertext or tag still to come
+    uint16_t cipher_remaining;                  // Ciphertext bytes still to come
+    dlms_held_field_t held[DLMS_HELD_FIELDS];
+    uint8_t held_count;
+
+    // Segmented frames. The APDU is decoded as the segments come in, never put together: an
+    // element cut by a segment boundary waits in buffer as it would for its next byte. A
+    // continuation that starts with an LLC header, or an I-frame out of N(S) sequence, means a
+    // segment was lost: the APDU is dropped with ABORT(DLMS_ABORT_RESYNC).
+    bool segmented;                             // The current frame has the segmentation bit set
+    bool segment_pending;                       // A segment ended, the next frame continues its APDU
+    dlms_parser_state_t apdu_state;             // Where the APDU goes on in the next segment
+    uint16_t apdu_pos;
+    uint8_t segment_head[DLMS_SEGMENT_HEAD_SIZE];
+
+    // Timeout of a frame or segmented APDU that stopped coming, see dlms_parser_poll()
+    uint32_t byte_count;                        // Since init, wraps
+    uint32_t poll_byte_count;                   // byte_count at the last poll that saw progress
+    uint32_t poll_ms;                           // Time of that poll
+
+    // Raw APDU of the current frame, all segments, as received, see dlms_parser_set_apdu_buffer()
+    uint8_t *raw;
+    uint16_t raw_size;
+    uint16_t raw_length;
+    bool raw_overflow;                          // The APDU did not fit, it is not available
+    bool raw_undecoded;                         // An element the parser cannot decode, the rest is only kept
     
 } dlms_parser_t;
 
-typedef struct {
-    uint8_t address[6];
-    uint8_t *data;
-    uint16_t length;
-} dlms_data_t;
-
 // Initialize the DLMS parser
 void dlms_parser_init(dlms_parser_t *parser);
 
 // Process a single byte
 bool dlms_parser_process_byte(dlms_parser_t *parser, uint8_t byte);
 
-// Set the callback function
-void dlms_parser_set_callback(dlms_parser_t *parser, dlms_field_callback_t callback);
+// Drop a started frame, or a segmented APDU waiting for its next segment, once no byte came for
+// DLMS_SEGMENT_TIMEOUT_MS, with ABORT(DLMS_ABORT_RESYNC). Call it between reads with a
+// millisecond clock that may wrap. Returns the time in ms until it must be called again, at the
+// latest, UINT32_MAX if no frame is in progress.
+uint32_t dlms_parser_poll(dlms_parser_t *parser, uint32_t now_ms);
+
+// Set the callback function and the context it is called with
+void dlms_parser_set_callback(dlms_parser_t *parser, dlms_field_callback_t callback, void *context);
+
+// Replace the built-in meter profiles, e.g. with a table loaded from storage. The table must stay
+// valid while the parser uses it; the profile is selected again from the next frame.
+void dlms_parser_set_profiles(dlms_parser_t *parser, const dlms_profile_t *profiles, size_t count);
+
+// Decode only the fields in a mask of DLMS_FIELD_BIT(), DLMS_FIELDS_ALL after init. Values of
+// other fields are skipped by their length without being buffered or converted. The lookup of the
+// current profile is built again, so meter scaler_units are taken from the next push.
+void dlms_parser_subscribe(dlms_parser_t *parser, uint32_t fields);
+
+// Data elements of the frame bodies decoded and skipped since init
+void dlms_parser_element_counts(const dlms_parser_t *parser, uint32_t *decoded, uint32_t *skipped);
+
+// Set the global unicast encryption key (EK) and authentication key (AK) of the meter, 16 bytes
+// each, for ciphered push frames. NULL removes a key; meters that only encrypt need no AK.
+// Returns false if the encryption key is rejected.
+bool dlms_parser_set_keys(dlms_parser_t *parser, const uint8_t *encryption_key, const uint8_t *authentication_key);
+
+// Keep the raw APDU of each frame in buffer, e.g. to forward it for decoding elsewhere: the
+// information field after the LLC header of all its segments, still ciphered. NULL stops it.
+// While a buffer is set, an element of unknown type or one too long to decode does not drop the
+// frame: decoding stops there, the rest of the APDU is kept and the frame still ends with END.
+void dlms_parser_set_apdu_buffer(dlms_parser_t *parser, uint8_t *buffer, uint16_t size);
+
+// Raw APDU of the frame that just ended, valid in its END callback. NULL if no buffer is set or the
+// APDU did not fit.
+const uint8_t *dlms_parser_apdu(const dlms_parser_t *parser, uint16_t *length);
+
+// Time spent decrypting the last frame in us, 0 if it was not ciphered
+uint32_t dlms_parser_decrypt_us(const dlms_parser_t *parser);
+
+// Profile selected from the last list identifier, NULL before the first one
+const dlms_profile_t *dlms_parser_profile(const dlms_parser_t *parser);
+
+// Log label of a field type
+const char *dlms_field_name(dlms_field_type_t type);
+
+// Convert a COSEM value, given by its data type tag and the bytes after the tag and length, to a
+// field of the given type scaled by 10^scaler. Numbers saturate at the range of the field and are
+// written to bytes, which must hold 4; a date-time field points to value. Returns false for a
+// value the field type cannot take.
+bool dlms_value_to_field(uint8_t type, int8_t scaler, uint8_t tag, uint8_t *value, uint8_t length, uint8_t *bytes, dlms_field_t *field);
+
+// Scale a number by 10^scaler, rounding half away from zero and saturating at the int64_t range
+int64_t dlms_scale_number(int64_t value, int8_t scaler);
+
+// Write a number scaled by 10^scaler to bytes as a field of the given type, saturated at its
+// range, as dlms_value_to_field() does for a COSEM value. bytes must hold 4.
+void dlms_number_to_field(uint8_t type, int64_t number, int8_t scaler, uint8_t *bytes, dlms_field_t *field);
+
+// Power of ten from a COSEM scaler_unit to the units of a field, for dlms_value_to_field().
+// Returns false, leaving field_scaler as it is, if the unit is not the field's.
+bool dlms_field_scaler(uint8_t type, int8_t scaler, uint8_t unit, int8_t *field_scaler);
+
+// Encoded size of the COSEM data element at data with its tag, arrays and structures included,
+// 0 if it runs past length bytes, holds an unknown type or nests too deep
+uint16_t dlms_element_size(const uint8_t *data, uint16_t length);
+
+static inline uint16_t dlms_fcs_update(uint16_t fcs, uint8_t byte)
+{
+    fcs ^= byte;
+    for (int i = 0; i < 8; i++)
+    {
+        fcs = (fcs & 1) ? (fcs >> 1) ^ DLMS_FCS_POLY : fcs >> 1;
+    }
+    return fcs;
+}
+
+// Convert a 12-byte COSEM date-time to seconds since 2000-01-01 (ZCL UTCTime).
+// The meter's local time is used as is. Returns 0 if the date is not specified.
+uint32_t dlms_datetime_to_seconds(const uint8_t *datetime);
 
 #endif // DLMS_PARSER_H
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef DLMS_PROFILE_H
+#define DLMS_PROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Meter profiles: the push list of a meter type. The parser selects one by the list identifier,
+// the first string in the frame body, and keeps it until a frame carries another identifier.
+// A profile maps OBIS codes, or element positions for meters that send values without OBIS
+// codes, to field types and scales the values to the units of meter_snapshot_t. A scaler_unit
+// sent by the meter after a value takes the place of the entry's scaler.
+
+#define DLMS_OBIS_SIZE 6
+#define DLMS_PROFILE_LOOKUP_SIZE 64 // Lookup slots per parser, a power of two above the largest profile
+
+typedef struct {
+    uint8_t obis[DLMS_OBIS_SIZE];   // Unused by positional profiles
+    uint8_t position;               // Element index in the frame body, positional profiles only
+    uint8_t type;                   // dlms_field_type_t
+    int8_t scaler;                  // Power of ten from the meter's unit to the field's, -9 to 9, until the meter sends one
+} dlms_profile_entry_t;
+
+typedef struct {
+    const char *name;
+    const char *list_id;            // Prefix of the list identifier, NULL matches any list
+    bool positional;                // Entries are matched by position instead of OBIS code
+    const dlms_profile_entry_t *entries;
+    uint8_t entry_count;
+} dlms_profile_t;
+
+// Built-in profiles, searched in order. The last one has no list identifier and decodes unknown
+// lists by their standard OBIS codes.
+extern const dlms_profile_t dlms_profiles[];
+extern const size_t dlms_profile_count;
+
+#endif // DLMS_PROFILE_H
@@ -0,0 +1,42 @@
+#ifndef METER_FRONTEND_H
+#define METER_FRONTEND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "dlms_parser.h"
+#include "p1_parser.h"
+
+// Routes the meter UART to the DLMS/HDLC parser or the P1 telegram parser. With
+// METER_PROTOCOL_AUTO the protocol is taken from the first frame start: a 0x7E flag followed by an
+// HDLC type 3 frame format byte, or a '/' followed by the three letter manufacturer id of a P1
+// identification line. Bytes before it are dropped, the detected protocol is kept.
+
+#define METER_FRONTEND_DETECT_SIZE 4    // "/XXX"
+
+typedef enum {
+    METER_PROTOCOL_AUTO,
+    METER_PROTOCOL_DLMS,
+    METER_PROTOCOL_P1,
+} meter_protocol_t;
+
+typedef struct {
+    meter_protocol_t protocol;          // METER_PROTOCOL_AUTO until detected
+    dlms_parser_t *dlms;
+    p1_parser_t *p1;
+    uint8_t candidate[METER_FRONTEND_DETECT_SIZE];
+    uint8_t candidate_length;
+} meter_frontend_t;
+
+// Either parser may be NULL if that protocol is not used
+void meter_frontend_init(meter_frontend_t *frontend, meter_protocol_t protocol, dlms_parser_t *dlms, p1_parser_t *p1);
+
+// Process a single byte, see dlms_parser_process_byte() and p1_parser_process_byte()
+bool meter_frontend_process_byte(meter_frontend_t *frontend, uint8_t byte);
+
+// Give up on a frame that stopped coming, see dlms_parser_poll(). Returns the time in ms until it
+// must be called again, UINT32_MAX if nothing is pending; P1 telegrams have no timeout.
+uint32_t meter_frontend_poll(meter_frontend_t *frontend, uint32_t now_ms);
+
+const char *meter_protocol_name(meter_protocol_t protocol);
+
+#endif // METER_FRONTEND_H
@@ -0,0 +1,49 @@
+#ifndef METER_SNAPSHOT_H
+#define METER_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "dlms_parser.h"
+
+// Phase index used by all per-phase arrays
+typedef enum {
+    METER_PHASE_A,
+    METER_PHASE_B,
+    METER_PHASE_C,
+    METER_PHASE_COUNT
+} meter_phase_t;
+
+// One meter push, assembled from the fields parsed between START and END.
+// Values are in the fixed unit of each field, scaled by the parser from the meter's scaler_unit.
+typedef struct {
+    uint32_t present;                           // DLMS_FIELD_BIT() of every field seen in this frame
+    uint32_t timestamp;                         // Meter clock, seconds since 2000-01-01
+    uint16_t rms_voltage[METER_PHASE_COUNT];    // V
+    uint32_t rms_current[METER_PHASE_COUNT];    // A/100
+    int32_t active_power[METER_PHASE_COUNT];    // W
+    int32_t reactive_power[METER_PHASE_COUNT];  // var
+    uint16_t power_factor[METER_PHASE_COUNT];   // 1/100
+    uint32_t active_power_import;               // W, total of all phases
+    uint32_t active_power_export;               // W, total of all phases
+    uint64_t active_energy_import;              // Wh
+    uint64_t active_energy_export;              // Wh
+    uint32_t serial_number;
+} meter_snapshot_t;
+
+static inline void meter_snapshot_reset(meter_snapshot_t *snapshot)
+{
+    memset(snapshot, 0, sizeof(meter_snapshot_t));
+}
+
+static inline void meter_snapshot_mark(meter_snapshot_t *snapshot, dlms_field_type_t type)
+{
+    snapshot->present |= DLMS_FIELD_BIT(type);
+}
+
+static inline bool meter_snapshot_has(const meter_snapshot_t *snapshot, dlms_field_type_t type)
+{
+    return (snapshot->present & DLMS_FIELD_BIT(type)) != 0;
+}
+
+#endif // METER_SNAPSHOT_H
@@ -0,0 +1,75 @@
+#ifndef P1_PARSER_H
+#define P1_PARSER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "dlms_parser.h"
+
+// Streaming parser for ASCII telegrams as sent by DSMR P1 ports and IEC 62056-21 meters:
+//
+//   /ISk5\2MT382-1000
+//
+//   1-0:1.8.1(123456.789*kWh)
+//   1-0:32.7.0(220.1*V)
+//   !EF2F
+//
+// Each line is tokenized as it arrives, without a line buffer, and mapped by its OBIS reference
+// to the field types of the DLMS parser, scaled to the units of meter_snapshot_t. The fields go
+// to the same callback with the same START, END and ABORT framing, so everything downstream
+// handles both kinds of meter alike. The CRC-16 after the '!' covers the telegram from the '/';
+// telegrams that end in a bare '!' (DSMR 2.2, IEC 62056-21 mode D) are accepted unchecked.
+
+#define P1_MAX_GROUPS 6             // OBIS reference A-B:C.D.E*F
+#define P1_MAX_DIGITS 18            // Digits of a value kept in the int64_t mantissa
+#define P1_ENERGY_TOTAL 0x01        // Register x.8.0
+#define P1_ENERGY_TARIFF 0x02       // Registers x.8.1 to x.8.n
+
+typedef enum {
+    P1_STATE_WAITING_START,         // Up to the '/' of the identification line
+    P1_STATE_IDENTIFICATION,        // Rest of the identification line
+    P1_STATE_LINE_START,
+    P1_STATE_REFERENCE,             // OBIS reference up to the '('
+    P1_STATE_VALUE,                 // Value of the first group, up to '*' or ')'
+    P1_STATE_UNIT,                  // Unit of the first group, up to ')'
+    P1_STATE_LINE_REST,             // Further groups, up to the end of the line
+    P1_STATE_CRC,                   // Hex digits after the '!'
+} p1_parser_state_t;
+
+typedef struct {
+    p1_parser_state_t state;
+    uint16_t crc;                   // CRC-16 of the telegram so far
+    uint16_t expected_crc;
+    uint8_t crc_digits;
+
+    // Current line
+    uint8_t groups[P1_MAX_GROUPS];
+    uint8_t group_count;
+    bool reference_valid;           // Only digits and separators, no billing period
+    const dlms_profile_entry_t *entry;  // Mapping of the reference, NULL if not used
+    int64_t mantissa;               // Digits of the value without the decimal point
+    uint8_t digits;                 // Digits of the value seen, some may be dropped after the point
+    int8_t decimals;                // Digits after the decimal point, -1 before it
+    bool value_valid;
+    int8_t unit_scaler;             // Power of ten of the unit prefix, k or M
+    char text[13];                  // Timestamp YYMMDDhhmmssX, or two hex digits of the serial
+    uint8_t text_length;
+    uint32_t serial;
+
+    // Energy import and export, summed over the tariff registers unless the meter sends the total
+    int64_t energy_total[2];        // Wh
+    int64_t energy_sum[2];
+    uint8_t energy_seen[2];         // P1_ENERGY_* bits
+
+    dlms_field_callback_t callback;
+    void *callback_context;
+} p1_parser_t;
+
+void p1_parser_init(p1_parser_t *parser);
+
+// Set the callback function and the context it is called with
+void p1_parser_set_callback(p1_parser_t *parser, dlms_field_callback_t callback, void *context);
+
+// Process a single byte. Returns false when the byte ended the telegram with an error.
+bool p1_parser_process_byte(p1_parser_t *parser, uint8_t byte);
+
+#endif // P1_PARSER_H
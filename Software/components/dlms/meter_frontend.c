@@ -0,0 +1,112 @@
+#include "include/meter_frontend.h"
+#include <string.h>
+#include "dlog.h"
+
+#define HDLC_FLAG 0x7E
+#define HDLC_FORMAT_TYPE_3 0xA0     // High nibble of the frame format byte
+#define P1_START '/'
+
+static const char *TAG = "Frontend";
+
+void meter_frontend_init(meter_frontend_t *frontend, meter_protocol_t protocol, dlms_parser_t *dlms, p1_parser_t *p1)
+{
+    memset(frontend, 0, sizeof(meter_frontend_t));
+    frontend->protocol = protocol;
+    frontend->dlms = dlms;
+    frontend->p1 = p1;
+}
+
+const char *meter_protocol_name(meter_protocol_t protocol)
+{
+    switch (protocol)
+    {
+    case METER_PROTOCOL_DLMS:
+        return "DLMS";
+    case METER_PROTOCOL_P1:
+        return "P1";
+    default:
+        return "auto";
+    }
+}
+
+static bool is_letter(uint8_t byte)
+{
+    return (byte >= 'A' && byte <= 'Z') || (byte >= 'a' && byte <= 'z');
+}
+
+// Whether the candidate still looks like a frame start, and which protocol it confirms
+static meter_protocol_t check_candidate(const meter_frontend_t *frontend, bool *possible)
+{
+    const uint8_t *c = frontend->candidate;
+    uint8_t length = frontend->candidate_length;
+    *possible = true;
+
+    if (c[0] == HDLC_FLAG && frontend->dlms != NULL)
+    {
+        if (length == 1)
+        {
+            return METER_PROTOCOL_AUTO;
+        }
+        *possible = (c[1] & 0xF0) == HDLC_FORMAT_TYPE_3;
+        return *possible ? METER_PROTOCOL_DLMS : METER_PROTOCOL_AUTO;
+    }
+    if (c[0] == P1_START && frontend->p1 != NULL)
+    {
+        *possible = is_letter(c[length - 1]) || length == 1;
+        return *possible && length == METER_FRONTEND_DETECT_SIZE ? METER_PROTOCOL_P1 : METER_PROTOCOL_AUTO;
+    }
+    *possible = false;
+    return METER_PROTOCOL_AUTO;
+}
+
+static bool detect(meter_frontend_t *frontend, uint8_t byte)
+{
+    frontend->candidate[frontend->candidate_length++] = byte;
+
+    bool possible;
+    meter_protocol_t protocol = check_candidate(frontend, &possible);
+    if (!possible)
+    {
+        // The byte may start the next candidate, e.g. the opening flag after a closing one
+        frontend->candidate[0] = byte;
+        frontend->candidate_length = 1;
+        check_candidate(frontend, &possible);
+        frontend->candidate_length = possible ? 1 : 0;
+        return true;
+    }
+    if (protocol == METER_PROTOCOL_AUTO)
+    {
+        return true;
+    }
+
+    DLOGI(TAG, "Meter protocol %s detected", DLOG_STR(meter_protocol_name(protocol)));
+    frontend->protocol = protocol;
+    bool ok = true;
+    for (uint8_t i = 0; i < frontend->candidate_length; i++)
+    {
+        ok = meter_frontend_process_byte(frontend, frontend->candidate[i]);
+    }
+    return ok;
+}
+
+bool meter_frontend_process_byte(meter_frontend_t *frontend, uint8_t byte)
+{
+    switch (frontend->protocol)
+    {
+    case METER_PROTOCOL_DLMS:
+        return dlms_parser_process_byte(frontend->dlms, byte);
+    case METER_PROTOCOL_P1:
+        return p1_parser_process_byte(frontend->p1, byte);
+    default:
+        return detect(frontend, byte);
+    }
+}
+
+uint32_t meter_frontend_poll(meter_frontend_t *frontend, uint32_t now_ms)
+{
+    if (frontend->protocol != METER_PROTOCOL_DLMS)
+    {
+        return UINT32_MAX;
+    }
+    return dlms_parser_poll(frontend->dlms, now_ms);
+}
@@ -0,0 +1,517 @@
+#include "include/p1_parser.h"
+#include <string.h>
+#include "dlog.h"
+
+// Telegram markers
+#define P1_START '/'
+#define P1_END '!'
+
+// CRC-16/ARC over the telegram from '/' to '!'
+#define P1_CRC_INIT 0x0000
+#define P1_CRC_POLY 0xA001 // 0x8005 reflected
+#define P1_CRC_DIGITS 4
+
+// Groups of the OBIS reference
+#define P1_GROUP_A 0
+#define P1_GROUP_B 1
+#define P1_GROUP_C 2
+#define P1_GROUP_D 3
+#define P1_GROUP_E 4
+#define P1_GROUP_F 5
+
+#define P1_TIMESTAMP_LENGTH 13      // YYMMDDhhmmss and S or W
+#define P1_SERIAL_MODULUS 1000000000 // The last nine digits of the equipment identifier
+#define P1_MANTISSA_LIMIT 100000000000000000LL // 10^(P1_MAX_DIGITS - 1)
+
+#define OBIS(a, b, c, d, e) {a, b, c, d, e, 0xFF}
+
+static const char *TAG = "P1";
+
+// References as sent by DSMR and IEC 62056-21 meters. B, the channel, is not compared. The
+// scaler converts from the base unit (W, Wh, var, V, A) to the field's, a k or M prefix on the
+// unit is added to it.
+static const dlms_profile_entry_t kP1Entries[] = {
+    {OBIS(1, 0, 1, 7, 0), 0, ACTIVE_POWER_IMPORT, 0},
+    {OBIS(1, 0, 2, 7, 0), 0, ACTIVE_POWER_EXPORT, 0},
+    {OBIS(1, 0, 32, 7, 0), 0, RMS_VOLTAGE_A, 0},
+    {OBIS(1, 0, 52, 7, 0), 0, RMS_VOLTAGE_B, 0},
+    {OBIS(1, 0, 72, 7, 0), 0, RMS_VOLTAGE_C, 0},
+    {OBIS(1, 0, 31, 7, 0), 0, RMS_CURRENT_A, 2},
+    {OBIS(1, 0, 51, 7, 0), 0, RMS_CURRENT_B, 2},
+    {OBIS(1, 0, 71, 7, 0), 0, RMS_CURRENT_C, 2},
+    {OBIS(1, 0, 21, 7, 0), 0, ACTIVE_POWER_A, 0},
+    {OBIS(1, 0, 41, 7, 0), 0, ACTIVE_POWER_B, 0},
+    {OBIS(1, 0, 61, 7, 0), 0, ACTIVE_POWER_C, 0},
+    {OBIS(1, 0, 23, 7, 0), 0, REACTIVE_POWER_A, 0},
+    {OBIS(1, 0, 43, 7, 0), 0, REACTIVE_POWER_B, 0},
+    {OBIS(1, 0, 63, 7, 0), 0, REACTIVE_POWER_C, 0},
+    {OBIS(1, 0, 33, 7, 0), 0, POWER_FACTOR_A, 2},
+    {OBIS(1, 0, 53, 7, 0), 0, POWER_FACTOR_B, 2},
+    {OBIS(1, 0, 73, 7, 0), 0, POWER_FACTOR_C, 2},
+    {OBIS(1, 0, 1, 8, 0), 0, ACTIVE_ENERGY_IMPORT, 0},
+    {OBIS(1, 0, 2, 8, 0), 0, ACTIVE_ENERGY_EXPORT, 0},
+    {OBIS(0, 0, 1, 0, 0), 0, DLMS_FIELD_TIMESTAMP, 0},
+    {OBIS(0, 0, 96, 1, 1), 0, SERIAL_NUMBER, 0},
+};
+
+#define P1_ENTRY_COUNT (sizeof(kP1Entries) / sizeof(kP1Entries[0]))
+
+void p1_parser_init(p1_parser_t *parser)
+{
+    memset(parser, 0, sizeof(p1_parser_t));
+    parser->state = P1_STATE_WAITING_START;
+}
+
+void p1_parser_set_callback(p1_parser_t *parser, dlms_field_callback_t callback, void *context)
+{
+    parser->callback = callback;
+    parser->callback_context = context;
+}
+
+static void notify(p1_parser_t *parser, dlms_field_type_t type, uint8_t *data, uint16_t length)
+{
+    dlms_field_t field;
+    field.type = type;
+    field.data = data;
+    field.length = length;
+    if (parser->callback != NULL)
+    {
+        parser->callback(&field, parser->callback_context);
+    }
+}
+
+static void process_abort(p1_parser_t *parser, dlms_abort_reason_t reason)
+{
+    uint8_t reason_byte = (uint8_t)reason;
+    notify(parser, ABORT, &reason_byte, 1);
+}
+
+static uint16_t crc_update(uint16_t crc, uint8_t byte)
+{
+    crc ^= byte;
+    for (int i = 0; i < 8; i++)
+    {
+        crc = (crc & 1) ? (crc >> 1) ^ P1_CRC_POLY : crc >> 1;
+    }
+    return crc;
+}
+
+static int hex_value(uint8_t c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static bool is_digit(uint8_t c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static void start_telegram(p1_parser_t *parser)
+{
+    dlms_field_callback_t callback = parser->callback;
+    void *callback_context = parser->callback_context;
+    p1_parser_init(parser);
+    p1_parser_set_callback(parser, callback, callback_context);
+    parser->crc = crc_update(P1_CRC_INIT, P1_START);
+    parser->state = P1_STATE_IDENTIFICATION;
+    notify(parser, START, NULL, 0);
+}
+
+static void start_line(p1_parser_t *parser)
+{
+    parser->state = P1_STATE_LINE_START;
+    memset(parser->groups, 0, sizeof(parser->groups));
+    parser->group_count = 0;
+    parser->reference_valid = true;
+    parser->entry = NULL;
+}
+
+// A reference without the A-B: prefix, as short IEC 62056-21 lines send it, is electricity.
+// Energy registers match any tariff E.
+static const dlms_profile_entry_t *find_entry(p1_parser_t *parser)
+{
+    uint8_t *g = parser->groups;
+    if (!parser->reference_valid || (parser->group_count != 3 && parser->group_count != 5))
+    {
+        return NULL;
+    }
+    if (parser->group_count == 3)
+    {
+        memmove(&g[P1_GROUP_C], &g[P1_GROUP_A], 3);
+        g[P1_GROUP_A] = 1;
+        g[P1_GROUP_B] = 0;
+    }
+
+    for (size_t i = 0; i < P1_ENTRY_COUNT; i++)
+    {
+        const uint8_t *obis = kP1Entries[i].obis;
+        bool energy = kP1Entries[i].type == ACTIVE_ENERGY_IMPORT || kP1Entries[i].type == ACTIVE_ENERGY_EXPORT;
+        if (obis[P1_GROUP_A] == g[P1_GROUP_A] && obis[P1_GROUP_C] == g[P1_GROUP_C] && obis[P1_GROUP_D] == g[P1_GROUP_D] &&
+            (energy || obis[P1_GROUP_E] == g[P1_GROUP_E]))
+        {
+            return &kP1Entries[i];
+        }
+    }
+    return NULL;
+}
+
+// The reference has been read up to the '(': A-B:C.D.E, or C.D.E. A billing period (*F or &F)
+// or letters such as F.F or C.1.0 leave the line unmapped.
+static void reference_byte(p1_parser_t *parser, uint8_t byte)
+{
+    if (is_digit(byte))
+    {
+        if (parser->group_count == 0)
+        {
+            parser->group_count = 1;
+        }
+        uint8_t *group = &parser->groups[parser->group_count - 1];
+        uint16_t value = *group * 10 + (byte - '0');
+        if (value > 0xFF)
+        {
+            parser->reference_valid = false;
+        }
+        *group = (uint8_t)value;
+        return;
+    }
+
+    switch (byte)
+    {
+    case '-':
+    case ':':
+    case '.':
+        if (parser->group_count == 0 || parser->group_count >= P1_GROUP_F)
+        {
+            parser->reference_valid = false;
+            return;
+        }
+        parser->group_count++;
+        return;
+    case '(':
+        parser->entry = find_entry(parser);
+        parser->mantissa = 0;
+        parser->digits = 0;
+        parser->decimals = -1;
+        parser->value_valid = true;
+        parser->unit_scaler = 0;
+        parser->text_length = 0;
+        parser->serial = 0;
+        parser->state = P1_STATE_VALUE;
+        return;
+    default:
+        parser->reference_valid = false;
+        return;
+    }
+}
+
+static void value_byte(p1_parser_t *parser, uint8_t byte)
+{
+    const dlms_profile_entry_t *entry = parser->entry;
+
+    if (entry->type == DLMS_FIELD_TIMESTAMP)
+    {
+        if (parser->text_length < P1_TIMESTAMP_LENGTH)
+        {
+            parser->text[parser->text_length++] = (char)byte;
+        }
+        else
+        {
+            parser->value_valid = false;
+        }
+        return;
+    }
+
+    if (entry->type == SERIAL_NUMBER)
+    {
+        // Hex encoded ASCII, the decimal digits make up the serial number
+        int nibble = hex_value(byte);
+        if (nibble < 0)
+        {
+            parser->value_valid = false;
+            return;
+        }
+        parser->text[parser->text_length++] = (char)nibble;
+        if (parser->text_length == 2)
+        {
+            uint8_t c = (uint8_t)(parser->text[0] << 4 | parser->text[1]);
+            if (is_digit(c))
+            {
+                parser->serial = (uint32_t)(((uint64_t)parser->serial * 10 + (c - '0')) % P1_SERIAL_MODULUS);
+            }
+            parser->text_length = 0;
+        }
+        return;
+    }
+
+    if (is_digit(byte))
+    {
+        // Digits beyond the precision of the mantissa are only dropped after the decimal point
+        parser->digits++;
+        if (parser->mantissa < P1_MANTISSA_LIMIT)
+        {
+            parser->mantissa = parser->mantissa * 10 + (byte - '0');
+            parser->decimals += parser->decimals >= 0;
+        }
+        else if (parser->decimals < 0)
+        {
+            parser->value_valid = false;
+        }
+    }
+    else if (byte == '.' && parser->decimals < 0)
+    {
+        parser->decimals = 0;
+    }
+    else
+    {
+        parser->value_valid = false;
+    }
+}
+
+static void unit_byte(p1_parser_t *parser, uint8_t byte)
+{
+    // Only the first character can be a prefix: kW, kWh, kvar, MWh. m3 and mA are left alone.
+    if (parser->text_length++ == 0)
+    {
+        parser->unit_scaler = byte == 'k' ? 3 : byte == 'M' ? 6 : 0;
+    }
+}
+
+// Scaled and saturated like a decoded COSEM value, so both parsers send the same bytes
+static void emit_number(p1_parser_t *parser, dlms_field_type_t type, int64_t number, int8_t scaler)
+{
+    uint8_t bytes[4];
+    dlms_field_t field;
+
+    dlms_number_to_field(type, number, scaler, bytes, &field);
+    notify(parser, type, field.data, field.length);
+}
+
+// Power of ten from the digits to the field: the entry's scaler, the unit prefix and the decimals
+static int8_t value_scaler(const p1_parser_t *parser)
+{
+    return (int8_t)(parser->entry->scaler + parser->unit_scaler - (parser->decimals > 0 ? parser->decimals : 0));
+}
+
+// COSEM date-time from YYMMDDhhmmss and S (summer time) or W
+static void emit_timestamp(p1_parser_t *parser)
+{
+    uint8_t fields[6];
+    for (int i = 0; i < 6; i++)
+    {
+        uint8_t high = (uint8_t)parser->text[2 * i];
+        uint8_t low = (uint8_t)parser->text[2 * i + 1];
+        if (!is_digit(high) || !is_digit(low))
+        {
+            return;
+        }
+        fields[i] = (uint8_t)((high - '0') * 10 + (low - '0'));
+    }
+
+    uint16_t year = 2000 + fields[0];
+    uint8_t datetime[12] = {
+        (uint8_t)(year >> 8), (uint8_t)year, fields[1], fields[2], 0xFF,
+        fields[3], fields[4], fields[5], 0xFF, 0x80, 0x00,
+        parser->text[12] == 'S' ? 0x80 : 0x00,
+    };
+    notify(parser, DLMS_FIELD_TIMESTAMP, datetime, sizeof(datetime));
+}
+
+static void finish_value(p1_parser_t *parser)
+{
+    const dlms_profile_entry_t *entry = parser->entry;
+    parser->state = P1_STATE_LINE_REST;
+
+    if (!parser->value_valid)
+    {
+        DLOGW(TAG, "Malformed value");
+        return;
+    }
+
+    DLOGI(TAG, "Found %s", DLOG_STR(dlms_field_name(entry->type)));
+    switch (entry->type)
+    {
+    case DLMS_FIELD_TIMESTAMP:
+        if (parser->text_length == P1_TIMESTAMP_LENGTH)
+        {
+            emit_timestamp(parser);
+        }
+        return;
+    case SERIAL_NUMBER:
+        emit_number(parser, SERIAL_NUMBER, parser->serial, 0);
+        return;
+    default:
+        break;
+    }
+
+    if (parser->digits == 0)
+    {
+        return;
+    }
+
+    if (entry->type == ACTIVE_ENERGY_IMPORT || entry->type == ACTIVE_ENERGY_EXPORT)
+    {
+        int i = entry->type - ACTIVE_ENERGY_IMPORT;
+        int64_t number = dlms_scale_number(parser->mantissa, value_scaler(parser));
+        if (parser->groups[P1_GROUP_E] == 0)
+        {
+            parser->energy_total[i] = number;
+            parser->energy_seen[i] |= P1_ENERGY_TOTAL;
+        }
+        else
+        {
+            // Values have no sign, the sum saturates like the scaling
+            parser->energy_sum[i] = number > INT64_MAX - parser->energy_sum[i] ? INT64_MAX : parser->energy_sum[i] + number;
+            parser->energy_seen[i] |= P1_ENERGY_TARIFF;
+        }
+        return;
+    }
+
+    emit_number(parser, (dlms_field_type_t)entry->type, parser->mantissa, value_scaler(parser));
+}
+
+// The tariff registers are only complete at the end of the data
+static void emit_energy(p1_parser_t *parser)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (parser->energy_seen[i] != 0)
+        {
+            int64_t energy = (parser->energy_seen[i] & P1_ENERGY_TOTAL) ? parser->energy_total[i] : parser->energy_sum[i];
+            emit_number(parser, (dlms_field_type_t)(ACTIVE_ENERGY_IMPORT + i), energy, 0);
+        }
+    }
+}
+
+static bool finish_telegram(p1_parser_t *parser)
+{
+    parser->state = P1_STATE_WAITING_START;
+
+    if (parser->crc_digits == 0)
+    {
+        DLOGD(TAG, "Telegram without CRC");
+    }
+    else if (parser->crc_digits != P1_CRC_DIGITS || parser->expected_crc != parser->crc)
+    {
+        DLOGW(TAG, "CRC mismatch: calculated %04X, received %04X", parser->crc, parser->expected_crc);
+        process_abort(parser, DLMS_ABORT_FCS);
+        return false;
+    }
+
+    notify(parser, END, NULL, 0);
+    return true;
+}
+
+bool p1_parser_process_byte(p1_parser_t *parser, uint8_t byte)
+{
+    // A new telegram before the end of this one: the rest was lost
+    if (byte == P1_START)
+    {
+        if (parser->state != P1_STATE_WAITING_START)
+        {
+            DLOGW(TAG, "Telegram cut short");
+            process_abort(parser, DLMS_ABORT_RESYNC);
+            start_telegram(parser);
+            return false;
+        }
+        start_telegram(parser);
+        return true;
+    }
+
+    if (parser->state == P1_STATE_WAITING_START)
+    {
+        return true;
+    }
+    if (parser->state != P1_STATE_CRC)
+    {
+        parser->crc = crc_update(parser->crc, byte);
+    }
+
+    if (byte == '\n' && parser->state != P1_STATE_CRC)
+    {
+        start_line(parser);
+        return true;
+    }
+
+    switch (parser->state)
+    {
+    case P1_STATE_IDENTIFICATION:
+        break;
+
+    case P1_STATE_LINE_START:
+        if (byte == P1_END)
+        {
+            emit_energy(parser);
+            parser->state = P1_STATE_CRC;
+        }
+        else if (byte != '\r')
+        {
+            parser->state = P1_STATE_REFERENCE;
+            reference_byte(parser, byte);
+        }
+        break;
+
+    case P1_STATE_REFERENCE:
+        reference_byte(parser, byte);
+        break;
+
+    case P1_STATE_VALUE:
+        if (parser->entry == NULL)
+        {
+            parser->state = byte == ')' ? P1_STATE_LINE_REST : P1_STATE_VALUE;
+        }
+        else if (byte == ')')
+        {
+            finish_value(parser);
+        }
+        else if (byte == '*')
+        {
+            parser->state = P1_STATE_UNIT;
+        }
+        else
+        {
+            value_byte(parser, byte);
+        }
+        break;
+
+    case P1_STATE_UNIT:
+        if (byte == ')')
+        {
+            finish_value(parser);
+        }
+        else
+        {
+            unit_byte(parser, byte);
+        }
+        break;
+
+    case P1_STATE_LINE_REST:
+        break;
+
+    case P1_STATE_CRC:
+        if (byte == '\r' || byte == '\n')
+        {
+            return finish_telegram(parser);
+        }
+        int nibble = hex_value(byte);
+        if (nibble < 0 || parser->crc_digits == P1_CRC_DIGITS)
+        {
+            DLOGW(TAG, "Malformed CRC");
+            parser->state = P1_STATE_WAITING_START;
+            process_abort(parser, DLMS_ABORT_RESYNC);
+            return false;
+        }
+        parser->expected_crc = (uint16_t)(parser->expected_crc << 4 | nibble);
+        if (++parser->crc_digits == P1_CRC_DIGITS)
+        {
+            return finish_telegram(parser);
+        }
+        break;
+
+    default:
+        break;
+    }
+    return true;
+}
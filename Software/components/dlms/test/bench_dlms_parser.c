@@ -0,0 +1,236 @@
+// Parser throughput benchmark.
+//
+// Usage: bench_dlms_parser [-n iterations] [-m min_bytes_per_second] [capture.txt ...]
+//        bench_dlms_parser -g kamstrup|aidon|kaifa [-c pushes] [-F flip_rate] [-T truncate_rate] [-N noise_bytes]
+//                          [-k EK:AK] [-s fields]
+//
+// Without capture files the built-in frames and the recorded streams in the repository are used.
+// With -g the stream comes from the meter simulator instead. When impairments are given, a clean
+// and an impaired stream of the same pushes are compared to show what error recovery costs in
+// lost frames and parse time. With -k the simulated APDUs are ciphered and the decrypt time per
+// frame is reported as well. With -s only the fields in the mask of DLMS_FIELD_BIT() are decoded,
+// to compare the cost of a full decode with one that skips what is not reported.
+// With -m the benchmark fails when throughput drops below the given rate, so CI can catch regressions.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "esp_log.h"
+#include "replay.h"
+#include "meter_sim.h"
+#include "kamstrup_test_data.h"
+
+static const char *kDefaultCaptures[] = {
+    SOFTWARE_DIR "/Data.txt",
+    DLMS_DIR "/ExampleMessage.txt",
+    TEST_DATA_DIR "/kamstrup_back_to_back.txt",
+};
+
+static void append(replay_stream_t *all, const uint8_t *bytes, size_t length)
+{
+    all->bytes = realloc(all->bytes, all->length + length);
+    memcpy(all->bytes + all->length, bytes, length);
+    all->length += length;
+}
+
+static bool append_file(replay_stream_t *all, const char *path)
+{
+    replay_stream_t stream;
+    if (!replay_load_hex(path, &stream))
+    {
+        return false;
+    }
+    append(all, stream.bytes, stream.length);
+    replay_free(&stream);
+    return true;
+}
+
+static void append_simulated(replay_stream_t *all, const meter_sim_config_t *config, long pushes)
+{
+    static uint8_t buffer[METER_SIM_BUFFER_SIZE];
+    meter_sim_t sim;
+
+    meter_sim_init(&sim, config);
+    for (long i = 0; i < pushes; i++)
+    {
+        append(all, buffer, meter_sim_next(&sim, buffer, sizeof(buffer)));
+    }
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Replay the stream repeatedly, returns bytes per second
+static double measure(const char *name, const replay_stream_t *stream, long iterations, replay_result_t *result)
+{
+    uint64_t frames = 0;
+
+    // Warm up caches and the branch predictor
+    replay_run(stream, result);
+
+    double start = now_seconds();
+    for (long i = 0; i < iterations; i++)
+    {
+        replay_run(stream, result);
+        frames += result->frames;
+    }
+    double elapsed = now_seconds() - start;
+
+    double bytes = (double)stream->length * (double)iterations;
+    double rate = elapsed > 0 ? bytes / elapsed : 0;
+
+    printf("%s: %zu bytes, %u frames, %u fields\n", name, stream->length, result->frames, result->fields);
+    printf("Iterations: %ld in %.3f s\n", iterations, elapsed);
+    printf("Throughput: %.2f MB/s, %.0f frames/s, %.1f ns/byte\n",
+           rate / 1e6, elapsed > 0 ? (double)frames / elapsed : 0, bytes > 0 ? elapsed * 1e9 / bytes : 0);
+    printf("Elements: %u decoded, %u skipped\n", result->elements_decoded, result->elements_skipped);
+    if (result->decrypt_us > 0 || result->decrypt_errors > 0)
+    {
+        printf("Decrypt: %.1f us per frame, %u errors\n",
+               result->frames > 0 ? (double)result->decrypt_us / result->frames : 0, result->decrypt_errors);
+    }
+    return rate;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = 2000;
+    long pushes = 500;
+    double min_rate = 0;
+    replay_stream_t all = {0};
+    int captures = 0;
+    bool simulate = false;
+    meter_sim_config_t sim_config;
+
+    meter_sim_default_config(&sim_config);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            iterations = strtol(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+        {
+            min_rate = strtod(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+        {
+            if (!meter_sim_parse_format(argv[++i], &sim_config.format))
+            {
+                fprintf(stderr, "Unknown format %s\n", argv[i]);
+                return 1;
+            }
+            simulate = true;
+        }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            pushes = strtol(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc)
+        {
+            sim_config.bit_flip_rate = strtod(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc)
+        {
+            sim_config.truncate_rate = strtod(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "-N") == 0 && i + 1 < argc)
+        {
+            sim_config.noise_bytes = (uint16_t)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+        {
+            if (!meter_sim_parse_keys(argv[++i], &sim_config))
+            {
+                fprintf(stderr, "Keys must be EK:AK, 32 hex digits each\n");
+                return 1;
+            }
+            replay_set_keys(sim_config.encryption_key, sim_config.authentication_key);
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            replay_set_fields((uint32_t)strtoul(argv[++i], NULL, 0));
+        }
+        else
+        {
+            if (!append_file(&all, argv[i]))
+            {
+                return 1;
+            }
+            captures++;
+        }
+    }
+
+    if (iterations < 1)
+    {
+        iterations = 1;
+    }
+
+    // Broken frames are expected here, do not time the error logging
+    esp_log_level_set("Parser", ESP_LOG_NONE);
+
+    replay_result_t result;
+    double rate;
+
+    if (simulate)
+    {
+        meter_sim_config_t clean = sim_config;
+        clean.bit_flip_rate = 0;
+        clean.truncate_rate = 0;
+        clean.noise_bytes = 0;
+
+        append_simulated(&all, &clean, pushes);
+        rate = measure(meter_sim_format_name(sim_config.format), &all, iterations, &result);
+
+        bool impaired = sim_config.bit_flip_rate > 0 || sim_config.truncate_rate > 0 || sim_config.noise_bytes > 0;
+        if (impaired)
+        {
+            replay_stream_t damaged = {0};
+            replay_result_t damaged_result;
+
+            append_simulated(&damaged, &sim_config, pushes);
+            double damaged_rate = measure("Impaired", &damaged, iterations, &damaged_result);
+
+            printf("Recovery: %u of %u frames decoded, %u of %u fields, %+.1f ns/byte\n",
+                   damaged_result.frames, result.frames, damaged_result.fields, result.fields,
+                   (damaged_rate > 0 && rate > 0) ? 1e9 / damaged_rate - 1e9 / rate : 0);
+            free(damaged.bytes);
+        }
+    }
+    else
+    {
+        if (captures == 0)
+        {
+            append(&all, dlmsFrame, (size_t)dlmsFrameSize);
+            append(&all, kamstrup_test_data, kamstrup_test_data_size);
+            for (size_t i = 0; i < sizeof(kDefaultCaptures) / sizeof(kDefaultCaptures[0]); i++)
+            {
+                if (!append_file(&all, kDefaultCaptures[i]))
+                {
+                    return 1;
+                }
+            }
+        }
+        rate = measure("Stream", &all, iterations, &result);
+    }
+
+    free(all.bytes);
+
+    if (result.frames == 0)
+    {
+        fprintf(stderr, "No frames decoded\n");
+        return 1;
+    }
+    if (min_rate > 0 && rate < min_rate)
+    {
+        fprintf(stderr, "Throughput %.0f B/s is below the required %.0f B/s\n", rate, min_rate);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+#include "replay.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The parser callback has no user context, so the result being filled is kept here
+static dlms_parser_t parser;
+static p1_parser_t p1_parser;
+static meter_frontend_t frontend;
+static const uint8_t *encryption_key;
+static const uint8_t *authentication_key;
+static uint32_t subscribed = DLMS_FIELDS_ALL;
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool is_hex_token(const char *token, size_t length)
+{
+    if (length == 0 || length % 2 != 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        if (hex_value(token[i]) < 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool replay_load_hex(const char *path, replay_stream_t *stream)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    size_t capacity = 4096;
+    stream->bytes = malloc(capacity);
+    stream->length = 0;
+
+    char line[8192];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+        {
+            *comment = '\0';
+        }
+
+        char *p = line;
+        while (*p != '\0')
+        {
+            while (isspace((unsigned char)*p)) p++;
+            char *token = p;
+            while (*p != '\0' && !isspace((unsigned char)*p)) p++;
+
+            size_t length = (size_t)(p - token);
+            if (length == 0)
+            {
+                break;
+            }
+            if (!is_hex_token(token, length))
+            {
+                break; // Annotation, ignore the rest of the line
+            }
+
+            if (stream->length + length / 2 > capacity)
+            {
+                capacity = capacity * 2 + length / 2;
+                stream->bytes = realloc(stream->bytes, capacity);
+            }
+            for (size_t i = 0; i < length; i += 2)
+            {
+                stream->bytes[stream->length++] = (uint8_t)(hex_value(token[i]) << 4 | hex_value(token[i + 1]));
+            }
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+void replay_from_buffer(replay_stream_t *stream, const uint8_t *bytes, size_t length)
+{
+    stream->bytes = (uint8_t *)bytes;
+    stream->length = length;
+}
+
+void replay_free(replay_stream_t *stream)
+{
+    free(stream->bytes);
+    stream->bytes = NULL;
+    stream->length = 0;
+}
+
+static void collect_field(dlms_field_t *field, void *context)
+{
+    replay_result_t *result = context;
+
+    if (field->type == START)
+    {
+        return;
+    }
+    if (field->type == END)
+    {
+        result->frames++;
+        result->decrypt_us += dlms_parser_decrypt_us(&parser);
+        return;
+    }
+    if (field->type == ABORT)
+    {
+        result->aborts++;
+        result->fcs_errors += field->data[0] == DLMS_ABORT_FCS;
+        result->decrypt_errors += field->data[0] == DLMS_ABORT_DECRYPT;
+        return;
+    }
+
+    result->fields++;
+    if (field->type <= SERIAL_NUMBER)
+    {
+        result->count[field->type]++;
+    }
+
+    if (field->type == DLMS_FIELD_TIMESTAMP)
+    {
+        result->timestamp = dlms_datetime_to_seconds(field->data);
+        return;
+    }
+
+    uint32_t value = 0;
+    for (uint16_t i = 0; i < field->length; i++)
+    {
+        value = value << 8 | field->data[i];
+    }
+    if (field->type <= SERIAL_NUMBER)
+    {
+        result->value[field->type] = value;
+    }
+}
+
+void replay_set_keys(const uint8_t *encryption, const uint8_t *authentication)
+{
+    encryption_key = encryption;
+    authentication_key = authentication;
+}
+
+void replay_set_fields(uint32_t fields)
+{
+    subscribed = fields;
+}
+
+dlms_field_callback_t replay_collect(replay_result_t *result)
+{
+    memset(result, 0, sizeof(replay_result_t));
+    dlms_parser_init(&parser);
+    return collect_field;
+}
+
+void replay_run(const replay_stream_t *stream, replay_result_t *result)
+{
+    memset(result, 0, sizeof(replay_result_t));
+
+    dlms_parser_init(&parser);
+    dlms_parser_set_callback(&parser, collect_field, result);
+    dlms_parser_set_keys(&parser, encryption_key, authentication_key);
+    dlms_parser_subscribe(&parser, subscribed);
+    p1_parser_init(&p1_parser);
+    p1_parser_set_callback(&p1_parser, collect_field, result);
+    meter_frontend_init(&frontend, METER_PROTOCOL_AUTO, &parser, &p1_parser);
+
+    for (size_t i = 0; i < stream->length; i++)
+    {
+        meter_frontend_process_byte(&frontend, stream->bytes[i]);
+    }
+    result->protocol = frontend.protocol;
+    dlms_parser_element_counts(&parser, &result->elements_decoded, &result->elements_skipped);
+}
@@ -0,0 +1,55 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "dlms_parser.h"
+#include "meter_frontend.h"
+
+// A byte stream as received on the meter UART
+typedef struct {
+    uint8_t *bytes;
+    size_t length;
+} replay_stream_t;
+
+// Everything the parser reported while replaying a stream
+typedef struct {
+    meter_protocol_t protocol;          // Detected from the stream, DLMS or P1
+    uint32_t frames;                    // END fields
+    uint32_t aborts;                    // ABORT fields
+    uint32_t fcs_errors;                // ABORT fields for an FCS mismatch
+    uint32_t decrypt_errors;            // ABORT fields for a ciphered APDU that did not decrypt
+    uint64_t decrypt_us;                // Time spent decrypting the frames that ended
+    uint32_t fields;                    // fields other than START and END
+    uint32_t count[SERIAL_NUMBER + 1];  // fields seen per type
+    uint32_t value[SERIAL_NUMBER + 1];  // last value per type, big-endian decoded
+    uint32_t timestamp;                 // last DLMS_FIELD_TIMESTAMP, seconds since 2000
+    uint32_t elements_decoded;          // Data elements of the DLMS parser, see dlms_parser_element_counts()
+    uint32_t elements_skipped;
+} replay_result_t;
+
+// Load a hex dump. Whitespace between bytes is ignored and '#' starts a comment.
+// On each line, reading stops at the first token that is not hex, so annotated
+// dumps such as Data.txt can be used as they are.
+bool replay_load_hex(const char *path, replay_stream_t *stream);
+
+// Wrap an in-memory buffer without copying
+void replay_from_buffer(replay_stream_t *stream, const uint8_t *bytes, size_t length);
+
+void replay_free(replay_stream_t *stream);
+
+// Keys given to the parser of the following runs for ciphered APDUs, NULL for none
+void replay_set_keys(const uint8_t *encryption_key, const uint8_t *authentication_key);
+
+// Fields the parser of the following runs decodes, a mask of DLMS_FIELD_BIT()
+void replay_set_fields(uint32_t fields);
+
+// Feed the stream through a fresh front-end and parsers and collect the fields
+void replay_run(const replay_stream_t *stream, replay_result_t *result);
+
+// Clear result and return a callback that collects fields into the result given as its context,
+// for fields from elsewhere such as the DLMS client
+dlms_field_callback_t replay_collect(replay_result_t *result);
+
+#endif // REPLAY_H
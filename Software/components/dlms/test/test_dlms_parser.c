@@ -0,0 +1,1728 @@
+// Replays recorded meter output through the DLMS parser and checks the decoded fields.
+// Exit code is the number of failed checks.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "dlog.h"
+#include "replay.h"
+#include "dlms_client.h"
+#include "meter_sim.h"
+#include "capture.h"
+#include "apdu_forward.h"
+#include "kamstrup_test_data.h"
+
+static int failures = 0;
+
+#define CHECK_EQ(actual, expected)                                                              \
+    do                                                                                          \
+    {                                                                                           \
+        unsigned long long a_ = (unsigned long long)(actual);                                   \
+        unsigned long long e_ = (unsigned long long)(expected);                                 \
+        if (a_ != e_)                                                                           \
+        {                                                                                       \
+            fprintf(stderr, "%s:%d: %s is %llu, expected %llu\n", __FILE__, __LINE__, #actual,   \
+                    a_, e_);                                                                    \
+            failures++;                                                                         \
+        }                                                                                       \
+    } while (0)
+
+static bool load(const char *path, replay_stream_t *stream)
+{
+    if (!replay_load_hex(path, stream))
+    {
+        failures++;
+        return false;
+    }
+    return true;
+}
+
+// Data.txt frame 1, 2025-02-25 20:17:20
+static void check_list2_frame1(const replay_result_t *r)
+{
+    CHECK_EQ(r->timestamp, 793829840);
+    CHECK_EQ(r->value[ACTIVE_ENERGY_IMPORT], 3160039);
+    CHECK_EQ(r->value[ACTIVE_ENERGY_EXPORT], 0);
+    CHECK_EQ(r->value[ACTIVE_POWER_IMPORT], 356);
+    CHECK_EQ(r->value[ACTIVE_POWER_EXPORT], 0);
+    CHECK_EQ(r->value[SERIAL_NUMBER], 30063708);
+    CHECK_EQ(r->value[RMS_VOLTAGE_A], 224);
+    CHECK_EQ(r->value[RMS_VOLTAGE_B], 224);
+    CHECK_EQ(r->value[RMS_VOLTAGE_C], 230);
+    CHECK_EQ(r->value[RMS_CURRENT_A], 102);
+    CHECK_EQ(r->value[RMS_CURRENT_B], 50);
+    CHECK_EQ(r->value[RMS_CURRENT_C], 68);
+    CHECK_EQ(r->value[ACTIVE_POWER_A], 175);
+    CHECK_EQ(r->value[ACTIVE_POWER_B], 60);
+    CHECK_EQ(r->value[ACTIVE_POWER_C], 121);
+    CHECK_EQ(r->value[POWER_FACTOR_A], 90);
+    CHECK_EQ(r->value[POWER_FACTOR_B], 57);
+    CHECK_EQ(r->value[POWER_FACTOR_C], 79);
+}
+
+static void test_list2_frame(void)
+{
+    replay_stream_t stream;
+    replay_result_t r;
+
+    replay_from_buffer(&stream, dlmsFrame, (size_t)dlmsFrameSize);
+    replay_run(&stream, &r);
+
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.fields, 21);
+    for (int type = RMS_VOLTAGE_A; type <= SERIAL_NUMBER; type++)
+    {
+        CHECK_EQ(r.count[type], 1);
+    }
+    check_list2_frame1(&r);
+}
+
+static void test_data_txt(void)
+{
+    replay_stream_t stream;
+    replay_result_t r;
+
+    if (!load(SOFTWARE_DIR "/Data.txt", &stream))
+    {
+        return;
+    }
+    replay_run(&stream, &r);
+
+    // Two frames, the second one at 2025-02-25 22:02:30. A trailing fragment without a flag is ignored.
+    CHECK_EQ(r.frames, 2);
+    CHECK_EQ(r.fields, 42);
+    CHECK_EQ(r.timestamp, 793836150);
+    CHECK_EQ(r.value[ACTIVE_ENERGY_IMPORT], 3160200);
+    CHECK_EQ(r.value[ACTIVE_POWER_IMPORT], 2129);
+    CHECK_EQ(r.value[RMS_VOLTAGE_A], 223);
+    CHECK_EQ(r.value[RMS_VOLTAGE_B], 228);
+    CHECK_EQ(r.value[RMS_VOLTAGE_C], 229);
+    CHECK_EQ(r.value[RMS_CURRENT_A], 933);
+    CHECK_EQ(r.value[ACTIVE_POWER_A], 2083);
+    CHECK_EQ(r.value[ACTIVE_POWER_B], 11);
+    CHECK_EQ(r.value[ACTIVE_POWER_C], 35);
+
+    replay_free(&stream);
+}
+
+static void test_list1_frame(void)
+{
+    replay_stream_t file;
+    replay_stream_t stream;
+    replay_result_t from_file;
+    replay_result_t r;
+
+    replay_from_buffer(&stream, kamstrup_test_data, kamstrup_test_data_size);
+    replay_run(&stream, &r);
+
+    // List 1 carries no per-phase power or serial number, only totals, voltages and currents
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.fields, 11);
+    CHECK_EQ(r.count[ACTIVE_POWER_A], 0);
+    CHECK_EQ(r.count[SERIAL_NUMBER], 0);
+    CHECK_EQ(r.count[ACTIVE_ENERGY_IMPORT], 1);
+    CHECK_EQ(r.timestamp, 556214405);
+
+    // kamstrup_test_data.h and ExampleMessage.txt hold the same frame
+    if (!load(DLMS_DIR "/ExampleMessage.txt", &file))
+    {
+        return;
+    }
+    CHECK_EQ(file.length, kamstrup_test_data_size);
+    replay_run(&file, &from_file);
+    CHECK_EQ(memcmp(&from_file, &r, sizeof(r)), 0);
+
+    replay_free(&file);
+}
+
+static void test_back_to_back(void)
+{
+    replay_stream_t stream;
+    replay_result_t r;
+    replay_result_t again;
+
+    if (!load(TEST_DATA_DIR "/kamstrup_back_to_back.txt", &stream))
+    {
+        return;
+    }
+    replay_run(&stream, &r);
+
+    CHECK_EQ(r.frames, 3);
+    CHECK_EQ(r.fields, 53);
+    CHECK_EQ(r.count[ACTIVE_POWER_A], 2);
+    CHECK_EQ(r.count[ACTIVE_ENERGY_IMPORT], 3);
+    CHECK_EQ(r.value[ACTIVE_ENERGY_IMPORT], 0);
+    CHECK_EQ(r.timestamp, 556214405);
+
+    // A new parser must not see anything left over from the previous run
+    replay_run(&stream, &again);
+    CHECK_EQ(memcmp(&again, &r, sizeof(r)), 0);
+
+    replay_free(&stream);
+}
+
+static void append_pushes(replay_stream_t *stream, meter_sim_t *sim, int pushes)
+{
+    static uint8_t buffer[METER_SIM_BUFFER_SIZE];
+
+    for (int i = 0; i < pushes; i++)
+    {
+        size_t length = meter_sim_next(sim, buffer, sizeof(buffer));
+        stream->bytes = realloc(stream->bytes, stream->length + length);
+        memcpy(stream->bytes + stream->length, buffer, length);
+        stream->length += length;
+    }
+}
+
+// The last decoded frame must carry the values of the last simulated push
+static void check_simulated_reading(const replay_result_t *r, const meter_sim_t *sim)
+{
+    const meter_sim_reading_t *reading = &sim->reading;
+
+    CHECK_EQ(r->timestamp, reading->time);
+    CHECK_EQ(r->value[SERIAL_NUMBER], sim->serial);
+    CHECK_EQ(r->value[ACTIVE_ENERGY_IMPORT], reading->energy_import_wh);
+    CHECK_EQ(r->value[ACTIVE_POWER_IMPORT], reading->power_w[0] + reading->power_w[1] + reading->power_w[2]);
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        CHECK_EQ(r->value[RMS_VOLTAGE_A + p], (reading->voltage_dv[p] + 5) / 10);
+        CHECK_EQ(r->value[RMS_CURRENT_A + p], reading->current_ma[p] / 10);
+        CHECK_EQ(r->value[ACTIVE_POWER_A + p], reading->power_w[p]);
+        CHECK_EQ(r->value[REACTIVE_POWER_A + p], reading->reactive_var[p]);
+        CHECK_EQ(r->value[POWER_FACTOR_A + p], reading->power_factor[p]);
+    }
+}
+
+// A corrupted byte fails the FCS: the frame ends in ABORT, the next one decodes
+static void test_fcs_error(void)
+{
+    uint8_t frames[2 * sizeof(dlmsFrame)];
+    replay_stream_t stream;
+    replay_result_t r;
+
+    memcpy(frames, dlmsFrame, sizeof(dlmsFrame));
+    memcpy(frames + sizeof(dlmsFrame), dlmsFrame, sizeof(dlmsFrame));
+    frames[sizeof(dlmsFrame) / 2] ^= 0x01;
+    replay_from_buffer(&stream, frames, sizeof(frames));
+
+    esp_log_level_set("Parser", ESP_LOG_NONE);
+    replay_run(&stream, &r);
+    esp_log_level_set("Parser", ESP_LOG_VERBOSE);
+
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.aborts, 1);
+    CHECK_EQ(r.fcs_errors, 1);
+}
+
+static void test_simulated_kamstrup(void)
+{
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream = {0};
+    replay_result_t r;
+
+    meter_sim_default_config(&config);
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 100);
+    replay_run(&stream, &r);
+
+    // Every push decodes, with all 20 mapped fields and the timestamp
+    CHECK_EQ(r.frames, 100);
+    CHECK_EQ(r.fields, 100 * 21);
+    check_simulated_reading(&r, &sim);
+
+    replay_free(&stream);
+}
+
+// CRC-16/X.25 for hand-made frames
+static uint16_t fcs16(const uint8_t *data, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc ^ 0xFFFF;
+}
+
+// Aidon sends voltage in V/10, current in A/10 and energy in 10 Wh, the profile scales them
+static void test_simulated_aidon(void)
+{
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream = {0};
+    replay_result_t r;
+
+    meter_sim_default_config(&config);
+    config.format = METER_SIM_AIDON;
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 1);
+    replay_run(&stream, &r);
+
+    // The first push carries the hourly list: 11 values, 2 energies and the clock
+    const meter_sim_reading_t *reading = &sim.reading;
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.fields, 14);
+    CHECK_EQ(r.timestamp, reading->time);
+    CHECK_EQ(r.value[ACTIVE_ENERGY_IMPORT], reading->energy_import_wh / 10 * 10);
+    CHECK_EQ(r.value[ACTIVE_POWER_IMPORT], reading->power_w[0] + reading->power_w[1] + reading->power_w[2]);
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        CHECK_EQ(r.value[RMS_VOLTAGE_A + p], (reading->voltage_dv[p] + 5) / 10);
+        CHECK_EQ(r.value[RMS_CURRENT_A + p], reading->current_ma[p] / 100 * 10);
+        CHECK_EQ(r.value[ACTIVE_POWER_A + p], reading->power_w[p]);
+    }
+
+    append_pushes(&stream, &sim, 99);
+    replay_run(&stream, &r);
+    CHECK_EQ(r.frames, 100);
+    CHECK_EQ(r.aborts, 0);
+
+    replay_free(&stream);
+}
+
+// Kaifa sends plain values in a fixed order, voltage in V/10 and current in mA
+static void test_simulated_kaifa(void)
+{
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream = {0};
+    replay_result_t r;
+
+    meter_sim_default_config(&config);
+    config.format = METER_SIM_KAIFA;
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 1);
+    replay_run(&stream, &r);
+
+    // Header clock, 8 values and the 2 energies of the hourly list
+    const meter_sim_reading_t *reading = &sim.reading;
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.fields, 11);
+    CHECK_EQ(r.timestamp, reading->time);
+    CHECK_EQ(r.value[ACTIVE_ENERGY_IMPORT], reading->energy_import_wh);
+    CHECK_EQ(r.value[ACTIVE_POWER_IMPORT], reading->power_w[0] + reading->power_w[1] + reading->power_w[2]);
+    CHECK_EQ(r.count[ACTIVE_POWER_A], 0);
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        CHECK_EQ(r.value[RMS_VOLTAGE_A + p], (reading->voltage_dv[p] + 5) / 10);
+        CHECK_EQ(r.value[RMS_CURRENT_A + p], (reading->current_ma[p] + 5) / 10);
+    }
+
+    replay_free(&stream);
+}
+
+// A parser that has locked on to one meter follows the list identifier to another
+static void test_profile_switch(void)
+{
+    meter_sim_config_t config;
+    meter_sim_t kamstrup;
+    meter_sim_t aidon;
+    replay_stream_t stream = {0};
+    replay_result_t r;
+
+    meter_sim_default_config(&config);
+    meter_sim_init(&kamstrup, &config);
+    config.format = METER_SIM_AIDON;
+    meter_sim_init(&aidon, &config);
+
+    append_pushes(&stream, &kamstrup, 3);
+    append_pushes(&stream, &aidon, 3);
+    append_pushes(&stream, &kamstrup, 1);
+    replay_run(&stream, &r);
+
+    CHECK_EQ(r.frames, 7);
+    CHECK_EQ(r.count[SERIAL_NUMBER], 4);
+    CHECK_EQ(r.count[RMS_VOLTAGE_A], 7);
+    check_simulated_reading(&r, &kamstrup);
+
+    // An unknown list falls back to the standard OBIS codes, unscaled
+    static const uint8_t kUnknownList[] = {
+        0x7E, 0xA0, 0x2E, 0x41, 0x08, 0x83, 0x13, 0x00, 0x00, 0xE6, 0xE7, 0x00,
+        0x0F, 0x40, 0x00, 0x00, 0x00, 0x00,
+        0x02, 0x02,
+        0x0A, 0x07, 'T', 'E', 'S', 'T', '_', 'V', '1',
+        0x02, 0x02, 0x09, 0x06, 0x01, 0x00, 0x20, 0x07, 0x00, 0xFF, 0x12, 0x09, 0x1B,
+        0x00, 0x00, 0x7E};
+    uint8_t frame[sizeof(kUnknownList)];
+    memcpy(frame, kUnknownList, sizeof(frame));
+    frame[2] = (uint8_t)(sizeof(frame) - 2);
+    uint16_t hcs = fcs16(&frame[1], 6);
+    frame[7] = (uint8_t)hcs;
+    frame[8] = (uint8_t)(hcs >> 8);
+    uint16_t fcs = fcs16(&frame[1], sizeof(frame) - 4);
+    frame[sizeof(frame) - 3] = (uint8_t)fcs;
+    frame[sizeof(frame) - 2] = (uint8_t)(fcs >> 8);
+
+    replay_free(&stream);
+    replay_from_buffer(&stream, frame, sizeof(frame));
+    replay_run(&stream, &r);
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.fields, 1);
+    CHECK_EQ(r.value[RMS_VOLTAGE_A], 2331);
+}
+
+static void finish_test_frame(uint8_t *frame, size_t length)
+{
+    frame[2] = (uint8_t)(length - 2);
+    uint16_t hcs = fcs16(&frame[1], 6);
+    frame[7] = (uint8_t)hcs;
+    frame[8] = (uint8_t)(hcs >> 8);
+    uint16_t fcs = fcs16(&frame[1], length - 4);
+    frame[length - 3] = (uint8_t)fcs;
+    frame[length - 2] = (uint8_t)(fcs >> 8);
+}
+
+// A scaler_unit after a value takes the place of the profile's scaler, relative to the unit of
+// the field. Values beyond the range of the field saturate.
+static void test_scaler_unit(void)
+{
+    // Voltage in V/10 and current in mA with their scaler_unit, then a current without one and a
+    // voltage of 70000 V
+    static const uint8_t kScaledList[] = {
+        0x7E, 0xA0, 0x00, 0x41, 0x08, 0x83, 0x13, 0x00, 0x00, 0xE6, 0xE7, 0x00,
+        0x0F, 0x40, 0x00, 0x00, 0x00, 0x00,
+        0x02, 0x05,
+        0x0A, 0x07, 'T', 'E', 'S', 'T', '_', 'V', '1',
+        0x02, 0x03, 0x09, 0x06, 0x01, 0x00, 0x20, 0x07, 0x00, 0xFF, 0x12, 0x09, 0x1B,
+        0x02, 0x02, 0x0F, 0xFF, 0x16, DLMS_UNIT_V,
+        0x02, 0x03, 0x09, 0x06, 0x01, 0x00, 0x1F, 0x07, 0x00, 0xFF, 0x06, 0x00, 0x00, 0x30, 0x39,
+        0x02, 0x02, 0x0F, 0xFD, 0x16, DLMS_UNIT_A,
+        0x02, 0x02, 0x09, 0x06, 0x01, 0x00, 0x33, 0x07, 0x00, 0xFF, 0x06, 0x00, 0x00, 0x03, 0xE8,
+        0x02, 0x02, 0x09, 0x06, 0x01, 0x00, 0x34, 0x07, 0x00, 0xFF, 0x06, 0x00, 0x01, 0x11, 0x70,
+        0x00, 0x00, 0x7E};
+    uint8_t frame[sizeof(kScaledList)];
+    replay_stream_t stream;
+    replay_result_t r;
+
+    memcpy(frame, kScaledList, sizeof(frame));
+    finish_test_frame(frame, sizeof(frame));
+    replay_from_buffer(&stream, frame, sizeof(frame));
+    replay_run(&stream, &r);
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.aborts, 0);
+    CHECK_EQ(r.fields, 4);
+    CHECK_EQ(r.value[RMS_VOLTAGE_A], 233);
+    CHECK_EQ(r.value[RMS_CURRENT_A], 1235);
+    CHECK_EQ(r.value[RMS_CURRENT_B], 1000);
+    CHECK_EQ(r.value[RMS_VOLTAGE_B], 65535);
+
+    // A unit that does not fit the field leaves the scaler of the profile
+    frame[47] = DLMS_UNIT_A;
+    finish_test_frame(frame, sizeof(frame));
+    replay_run(&stream, &r);
+    CHECK_EQ(r.value[RMS_VOLTAGE_A], 2331);
+    CHECK_EQ(r.value[RMS_CURRENT_A], 1235);
+
+    // The conversion on its own
+    int8_t scaler = 5;
+    CHECK_EQ(dlms_field_scaler(RMS_CURRENT_A, -3, DLMS_UNIT_A, &scaler), true);
+    CHECK_EQ(scaler, -1);
+    CHECK_EQ(dlms_field_scaler(ACTIVE_ENERGY_IMPORT, 3, DLMS_UNIT_WH, &scaler), true);
+    CHECK_EQ(scaler, 3);
+    CHECK_EQ(dlms_field_scaler(ACTIVE_ENERGY_IMPORT, 3, DLMS_UNIT_W, &scaler), false);
+    CHECK_EQ(scaler, 3);
+}
+
+static size_t parse_hex(const char *text, uint8_t *out)
+{
+    size_t length = strlen(text) / 2;
+    for (size_t i = 0; i < length; i++)
+    {
+        unsigned int byte;
+        sscanf(&text[2 * i], "%2x", &byte);
+        out[i] = (uint8_t)byte;
+    }
+    return length;
+}
+
+// AES-128 test cases 1 to 4 of the GCM specification and the general-glo-ciphering example of
+// the DLMS Green Book, whose AAD is the security control byte and the authentication key
+static void test_gcm_vectors(void)
+{
+    static const struct {
+        const char *key;
+        const char *iv;
+        const char *aad;
+        const char *plaintext;
+        const char *ciphertext;
+        const char *tag;
+    } kVectors[] = {
+        {"00000000000000000000000000000000", "000000000000000000000000", "", "", "",
+         "58e2fccefa7e3061367f1d57a4e7455a"},
+        {"00000000000000000000000000000000", "000000000000000000000000", "",
+         "00000000000000000000000000000000", "0388dace60b6a392f328c2b971b2fe78",
+         "ab6e47d42cec13bdf53a67b21257bddf"},
+        {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "",
+         "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+         "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+         "4d5c2af327cd64a62cf35abd2ba6fab4"},
+        {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+         "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+         "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+         "5bc94fbc3221a5db94fae95ae7121a47"},
+        {"000102030405060708090a0b0c0d0e0f", "4d4d4d0000bc614e01234567", "30d0d1d2d3d4d5d6d7d8d9dadbdcdddedf",
+         "c0010000080000010000ff0200", "411312ff935a47566827c467bc", "7d825c3be4a77c3fcc056b6b"},
+    };
+
+    for (size_t v = 0; v < sizeof(kVectors) / sizeof(kVectors[0]); v++)
+    {
+        uint8_t key[DLMS_GCM_KEY_SIZE], iv[DLMS_GCM_IV_SIZE], aad[32], plaintext[64], ciphertext[64], expected_tag[16];
+        uint8_t tag[DLMS_GCM_BLOCK_SIZE];
+        parse_hex(kVectors[v].key, key);
+        parse_hex(kVectors[v].iv, iv);
+        size_t aad_length = parse_hex(kVectors[v].aad, aad);
+        size_t length = parse_hex(kVectors[v].plaintext, plaintext);
+        parse_hex(kVectors[v].ciphertext, ciphertext);
+        size_t tag_length = parse_hex(kVectors[v].tag, expected_tag);
+
+        // Both directions byte by byte, as the parser and the simulator use them
+        dlms_gcm_t gcm;
+        dlms_gcm_init(&gcm);
+        CHECK_EQ(dlms_gcm_set_key(&gcm, key), true);
+        for (int decrypt = 0; decrypt < 2; decrypt++)
+        {
+            dlms_gcm_start(&gcm, iv, aad, aad_length);
+            int mismatches = 0;
+            for (size_t i = 0; i < length; i++)
+            {
+                if (decrypt)
+                {
+                    mismatches += dlms_gcm_decrypt(&gcm, ciphertext[i]) != plaintext[i];
+                }
+                else
+                {
+                    mismatches += dlms_gcm_encrypt(&gcm, plaintext[i]) != ciphertext[i];
+                }
+            }
+            dlms_gcm_finish(&gcm, tag);
+            CHECK_EQ(mismatches, 0);
+            CHECK_EQ(memcmp(tag, expected_tag, tag_length), 0);
+        }
+        dlms_gcm_free(&gcm);
+    }
+}
+
+static const char kTestKeys[] = "000102030405060708090A0B0C0D0E0F:D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF";
+
+// Ciphered pushes decode like plain ones once the parser has the keys, and not at all without
+static void test_ciphered_push(void)
+{
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream = {0};
+    replay_result_t r;
+
+    meter_sim_default_config(&config);
+    CHECK_EQ(meter_sim_parse_keys(kTestKeys, &config), true);
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 100);
+
+    replay_set_keys(config.encryption_key, config.authentication_key);
+    replay_run(&stream, &r);
+    CHECK_EQ(r.frames, 100);
+    CHECK_EQ(r.aborts, 0);
+    CHECK_EQ(r.fields, 100 * 21);
+    check_simulated_reading(&r, &sim);
+
+    // A wrong authentication key fails every tag and no value gets through
+    uint8_t wrong_key[METER_SIM_KEY_SIZE] = {0};
+    esp_log_level_set("Parser", ESP_LOG_NONE);
+    replay_set_keys(config.encryption_key, wrong_key);
+    replay_run(&stream, &r);
+    CHECK_EQ(r.frames, 0);
+    CHECK_EQ(r.decrypt_errors, 100);
+    CHECK_EQ(r.fields, 0);
+
+    replay_set_keys(NULL, NULL);
+    replay_run(&stream, &r);
+    CHECK_EQ(r.decrypt_errors, 100);
+    CHECK_EQ(r.fields, 0);
+    esp_log_level_set("Parser", ESP_LOG_VERBOSE);
+    replay_free(&stream);
+
+    // Encryption only, no tag and no authentication key needed
+    config.format = METER_SIM_AIDON;
+    config.security = METER_SIM_SECURITY_ENCRYPTED;
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 10);
+    replay_set_keys(config.encryption_key, NULL);
+    replay_run(&stream, &r);
+    CHECK_EQ(r.frames, 10);
+    CHECK_EQ(r.aborts, 0);
+    CHECK_EQ(r.count[DLMS_FIELD_TIMESTAMP], 1);
+
+    replay_set_keys(NULL, NULL);
+    replay_free(&stream);
+}
+
+// A flipped ciphertext bit is a line error when the FCS catches it, and an authentication
+// failure when the FCS was made to match
+static void test_ciphered_tamper(void)
+{
+    static uint8_t frame[METER_SIM_BUFFER_SIZE];
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream;
+    replay_result_t r;
+
+    meter_sim_default_config(&config);
+    meter_sim_parse_keys(kTestKeys, &config);
+    meter_sim_init(&sim, &config);
+    size_t length = meter_sim_next(&sim, frame, sizeof(frame));
+    frame[length / 2] ^= 0x01;
+    replay_from_buffer(&stream, frame, length);
+
+    esp_log_level_set("Parser", ESP_LOG_NONE);
+    replay_set_keys(config.encryption_key, config.authentication_key);
+    replay_run(&stream, &r);
+    CHECK_EQ(r.fcs_errors, 1);
+    CHECK_EQ(r.decrypt_errors, 0);
+
+    uint16_t fcs = fcs16(&frame[1], length - 4);
+    frame[length - 3] = (uint8_t)fcs;
+    frame[length - 2] = (uint8_t)(fcs >> 8);
+    replay_run(&stream, &r);
+    CHECK_EQ(r.fcs_errors, 0);
+    CHECK_EQ(r.decrypt_errors, 1);
+    CHECK_EQ(r.fields, 0);
+
+    replay_set_keys(NULL, NULL);
+    esp_log_level_set("Parser", ESP_LOG_VERBOSE);
+}
+
+static void test_simulated_recovery(void)
+{
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream = {0};
+    replay_result_t r;
+
+    // Bit flips, truncated frames and noise, then a clean line again
+    meter_sim_default_config(&config);
+    config.seed = 7;
+    config.bit_flip_rate = 1e-3;
+    config.truncate_rate = 0.1;
+    config.noise_bytes = 32;
+    config.mid_frame_start = true;
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 500);
+
+    sim.config.bit_flip_rate = 0;
+    sim.config.truncate_rate = 0;
+    sim.config.noise_bytes = 0;
+    append_pushes(&stream, &sim, 5);
+
+    esp_log_level_set("Parser", ESP_LOG_NONE);
+    replay_run(&stream, &r);
+    esp_log_level_set("Parser", ESP_LOG_VERBOSE);
+
+    CHECK_EQ(r.frames > 0, 1);
+    CHECK_EQ(r.fcs_errors > 0, 1);
+    CHECK_EQ(r.aborts >= r.fcs_errors, 1);
+    check_simulated_reading(&r, &sim);
+
+    replay_free(&stream);
+}
+
+// Pushes split over segmented HDLC frames decode as one frame each, wherever the segment
+// boundaries fall, plain or ciphered
+static void test_segmented_push(void)
+{
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream = {0};
+    replay_result_t r;
+
+    meter_sim_default_config(&config);
+    for (uint16_t size = METER_SIM_MIN_SEGMENT; size <= 64; size++)
+    {
+        config.segment_size = size;
+        meter_sim_init(&sim, &config);
+        append_pushes(&stream, &sim, 3);
+        replay_run(&stream, &r);
+        CHECK_EQ(r.frames, 3);
+        CHECK_EQ(r.aborts, 0);
+        CHECK_EQ(r.fields, 3 * 21);
+        check_simulated_reading(&r, &sim);
+        replay_free(&stream);
+    }
+
+    CHECK_EQ(meter_sim_parse_keys(kTestKeys, &config), true);
+    replay_set_keys(config.encryption_key, config.authentication_key);
+    for (uint16_t size = METER_SIM_MIN_SEGMENT; size <= 64; size++)
+    {
+        config.segment_size = size;
+        meter_sim_init(&sim, &config);
+        append_pushes(&stream, &sim, 2);
+        replay_run(&stream, &r);
+        CHECK_EQ(r.frames, 2);
+        CHECK_EQ(r.aborts, 0);
+        check_simulated_reading(&r, &sim);
+        replay_free(&stream);
+    }
+    replay_set_keys(NULL, NULL);
+
+    // A corrupted segment drops the push, the segments after it are not taken for a new APDU
+    config.security = 0;
+    config.segment_size = 40;
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 1);
+    stream.bytes[60] ^= 0x01;
+    append_pushes(&stream, &sim, 1);
+
+    esp_log_level_set("Parser", ESP_LOG_NONE);
+    replay_run(&stream, &r);
+    esp_log_level_set("Parser", ESP_LOG_VERBOSE);
+
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.fcs_errors, 1);
+    CHECK_EQ(r.aborts > r.fcs_errors, 1);
+    check_simulated_reading(&r, &sim);
+
+    replay_free(&stream);
+}
+
+// Length of the HDLC frame at a flag of a stream without noise, flags included
+static size_t hdlc_frame_size(const replay_stream_t *stream, size_t at)
+{
+    return (size_t)((stream->bytes[at + 1] & 0x07) << 8 | stream->bytes[at + 2]) + 2;
+}
+
+// Remove a frame, counted from the start of the stream
+static void drop_hdlc_frame(replay_stream_t *stream, int index)
+{
+    size_t at = 0;
+    for (int i = 0; i < index; i++)
+    {
+        at += hdlc_frame_size(stream, at);
+    }
+    size_t size = hdlc_frame_size(stream, at);
+    memmove(&stream->bytes[at], &stream->bytes[at + size], stream->length - at - size);
+    stream->length -= size;
+}
+
+// A lost segment drops its push and not the next one: a continuation that starts with an LLC
+// header is the next push, a gap in the N(S) of I-frames a lost middle segment. A push that
+// stops coming is dropped when the line stays quiet.
+static void test_lost_segment(void)
+{
+    static dlms_parser_t parser;
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream = {0};
+    replay_result_t r;
+
+    meter_sim_default_config(&config);
+    config.segment_size = 40;
+
+    // The last segment of the first push is lost
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 1);
+    size_t segments = 0;
+    for (size_t at = 0; at < stream.length; at += hdlc_frame_size(&stream, at))
+    {
+        segments++;
+    }
+    CHECK_EQ(segments >= 3, 1);
+    drop_hdlc_frame(&stream, (int)segments - 1);
+    append_pushes(&stream, &sim, 1);
+
+    esp_log_level_set("Parser", ESP_LOG_NONE);
+    replay_run(&stream, &r);
+    esp_log_level_set("Parser", ESP_LOG_VERBOSE);
+
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.aborts, 1);
+    check_simulated_reading(&r, &sim);
+    replay_free(&stream);
+
+    // A middle segment is lost, the I-frame after it is out of sequence
+    config.i_frames = true;
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 1);
+    drop_hdlc_frame(&stream, 1);
+    append_pushes(&stream, &sim, 1);
+
+    esp_log_level_set("Parser", ESP_LOG_NONE);
+    replay_run(&stream, &r);
+    esp_log_level_set("Parser", ESP_LOG_VERBOSE);
+
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.aborts >= 2, 1);
+    check_simulated_reading(&r, &sim);
+    replay_free(&stream);
+
+    // The meter stops after the first segment
+    config.i_frames = false;
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 1);
+    dlms_parser_init(&parser);
+    dlms_parser_set_callback(&parser, replay_collect(&r), &r);
+    CHECK_EQ(dlms_parser_poll(&parser, 0), UINT32_MAX);
+    for (size_t i = 0; i < hdlc_frame_size(&stream, 0); i++)
+    {
+        dlms_parser_process_byte(&parser, stream.bytes[i]);
+    }
+    CHECK_EQ(dlms_parser_poll(&parser, 5000), DLMS_SEGMENT_TIMEOUT_MS);
+    CHECK_EQ(dlms_parser_poll(&parser, 5999), 1);
+    CHECK_EQ(r.aborts, 0);
+
+    esp_log_level_set("Parser", ESP_LOG_NONE);
+    CHECK_EQ(dlms_parser_poll(&parser, 6000), UINT32_MAX);
+    esp_log_level_set("Parser", ESP_LOG_VERBOSE);
+    CHECK_EQ(r.aborts, 1);
+
+    // The next push decodes
+    replay_free(&stream);
+    append_pushes(&stream, &sim, 1);
+    for (size_t i = 0; i < stream.length; i++)
+    {
+        dlms_parser_process_byte(&parser, stream.bytes[i]);
+    }
+    CHECK_EQ(r.frames, 1);
+    check_simulated_reading(&r, &sim);
+    replay_free(&stream);
+}
+
+// Values of fields that are not subscribed are skipped by their length; the subscribed ones come
+// out as in a full decode, from OBIS-coded, scaler_unit and positional lists, whole or segmented
+static void test_subscription(void)
+{
+    static const meter_sim_format_t kFormats[] = {METER_SIM_KAMSTRUP, METER_SIM_AIDON, METER_SIM_KAIFA};
+    const uint32_t fields = DLMS_FIELD_BIT(RMS_VOLTAGE_A) | DLMS_FIELD_BIT(RMS_CURRENT_B) | DLMS_FIELD_BIT(ACTIVE_ENERGY_IMPORT);
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream = {0};
+    replay_result_t all;
+    replay_result_t r;
+
+    meter_sim_default_config(&config);
+    for (size_t f = 0; f < sizeof(kFormats) / sizeof(kFormats[0]); f++)
+    {
+        for (uint16_t size = 0; size <= 40; size += size == 0 ? METER_SIM_MIN_SEGMENT : 12)
+        {
+            config.format = kFormats[f];
+            config.segment_size = size;
+            meter_sim_init(&sim, &config);
+            append_pushes(&stream, &sim, 5);
+
+            replay_run(&stream, &all);
+            replay_set_fields(fields);
+            replay_run(&stream, &r);
+            replay_set_fields(DLMS_FIELDS_ALL);
+
+            CHECK_EQ(r.frames, 5);
+            CHECK_EQ(r.aborts, 0);
+            CHECK_EQ(r.fields, all.count[RMS_VOLTAGE_A] + all.count[RMS_CURRENT_B] + all.count[ACTIVE_ENERGY_IMPORT]);
+            CHECK_EQ(r.count[RMS_VOLTAGE_A], 5);
+            CHECK_EQ(r.value[RMS_VOLTAGE_A], all.value[RMS_VOLTAGE_A]);
+            CHECK_EQ(r.value[RMS_CURRENT_B], all.value[RMS_CURRENT_B]);
+            CHECK_EQ(r.value[ACTIVE_ENERGY_IMPORT], all.value[ACTIVE_ENERGY_IMPORT]);
+            CHECK_EQ(r.count[DLMS_FIELD_TIMESTAMP], 0);
+
+            // Every element is either decoded or skipped, the OBIS codes are still decoded
+            CHECK_EQ(r.elements_decoded + r.elements_skipped, all.elements_decoded + all.elements_skipped);
+            CHECK_EQ(r.elements_skipped > all.elements_skipped, 1);
+            replay_free(&stream);
+        }
+    }
+}
+
+// Raw APDUs kept for forwarding, one per frame that ended
+static dlms_parser_t forward_parser;
+static uint8_t forward_buffer[APDU_FORWARD_MAX_APDU];
+static uint8_t forwarded[APDU_FORWARD_MAX_APDU];
+static int forwarded_length;
+
+static void collect_apdu(dlms_field_t *field, void *context)
+{
+    if (field->type == END)
+    {
+        uint16_t length;
+        const uint8_t *apdu = dlms_parser_apdu(&forward_parser, &length);
+        forwarded_length = apdu != NULL ? length : -1;
+        if (apdu != NULL)
+        {
+            memcpy(forwarded, apdu, length);
+        }
+    }
+}
+
+// Run one push of the simulator through the parser, returns the raw APDU length or -1
+static int forward_push(const meter_sim_config_t *config, uint8_t *push, size_t *push_length)
+{
+    meter_sim_t sim;
+    meter_sim_init(&sim, config);
+    *push_length = meter_sim_next(&sim, push, METER_SIM_BUFFER_SIZE);
+
+    forwarded_length = 0;
+    for (size_t i = 0; i < *push_length; i++)
+    {
+        dlms_parser_process_byte(&forward_parser, push[i]);
+    }
+    return forwarded_length;
+}
+
+// The parser keeps the APDU of each frame as received, over all segments and still ciphered, and
+// it survives compression against the OBIS dictionary
+static void test_apdu_forward(void)
+{
+    static uint8_t push[METER_SIM_BUFFER_SIZE];
+    static uint8_t whole[APDU_FORWARD_MAX_APDU];
+    static uint8_t compressed[APDU_FORWARD_BOUND(APDU_FORWARD_MAX_APDU)];
+    static uint8_t restored[APDU_FORWARD_MAX_APDU];
+    meter_sim_config_t config;
+    size_t push_length;
+
+    dlms_parser_init(&forward_parser);
+    dlms_parser_set_callback(&forward_parser, collect_apdu, NULL);
+    dlms_parser_set_apdu_buffer(&forward_parser, forward_buffer, sizeof(forward_buffer));
+    meter_sim_default_config(&config);
+
+    // The information field of a single frame push after the 3 byte LLC header, without the FCS
+    int length = forward_push(&config, push, &push_length);
+    const uint8_t *llc = memchr(push, 0xE6, push_length);
+    CHECK_EQ(llc != NULL && length > 0, true);
+    CHECK_EQ((size_t)length, push_length - 3 - (size_t)(llc + 3 - push));
+    CHECK_EQ(memcmp(forwarded, llc + 3, length), 0);
+    memcpy(whole, forwarded, length);
+
+    size_t size = apdu_forward_compress(forwarded, length, compressed, sizeof(compressed));
+    CHECK_EQ(size > 0 && size < (size_t)length * 3 / 4, true);
+    CHECK_EQ(apdu_forward_decompress(compressed, size, restored, sizeof(restored)), length);
+    CHECK_EQ(memcmp(restored, forwarded, length), 0);
+
+    // Damaged streams are refused
+    CHECK_EQ(apdu_forward_decompress(compressed, size - 1, restored, sizeof(restored)), 0);
+    compressed[0]++;
+    CHECK_EQ(apdu_forward_decompress(compressed, size, restored, sizeof(restored)), 0);
+    CHECK_EQ(apdu_forward_decompress(compressed, 2, restored, sizeof(restored)), 0);
+
+    // The same push in segments gives the same APDU
+    config.segment_size = 40;
+    CHECK_EQ(forward_push(&config, push, &push_length), length);
+    CHECK_EQ(memcmp(forwarded, whole, length), 0);
+
+    // Other formats, ciphered or not, come through compression unchanged
+    static const meter_sim_format_t kFormats[] = {METER_SIM_AIDON, METER_SIM_KAIFA};
+    config.segment_size = 0;
+    for (size_t f = 0; f < sizeof(kFormats) / sizeof(kFormats[0]); f++)
+    {
+        config.format = kFormats[f];
+        length = forward_push(&config, push, &push_length);
+        size = apdu_forward_compress(forwarded, length, compressed, sizeof(compressed));
+        CHECK_EQ(size > 0 && size < (size_t)length, true);
+        CHECK_EQ(apdu_forward_decompress(compressed, size, restored, sizeof(restored)), length);
+        CHECK_EQ(memcmp(restored, forwarded, length), 0);
+    }
+    config.format = METER_SIM_KAMSTRUP;
+    CHECK_EQ(meter_sim_parse_keys(kTestKeys, &config), true);
+    dlms_parser_set_keys(&forward_parser, config.encryption_key, config.authentication_key);
+    length = forward_push(&config, push, &push_length);
+    CHECK_EQ(length > 0 && forwarded[0] == 0xDB, true);
+    size = apdu_forward_compress(forwarded, length, compressed, sizeof(compressed));
+    CHECK_EQ(apdu_forward_decompress(compressed, size, restored, sizeof(restored)), length);
+    CHECK_EQ(memcmp(restored, forwarded, length), 0);
+
+    // An APDU larger than the buffer is not kept
+    config.security = 0;
+    dlms_parser_set_apdu_buffer(&forward_parser, forward_buffer, 64);
+    CHECK_EQ(forward_push(&config, push, &push_length), -1);
+}
+
+static uint16_t undecoded_voltage;
+
+static void collect_undecoded(dlms_field_t *field, void *context)
+{
+    if (field->type == RMS_VOLTAGE_A)
+    {
+        undecoded_voltage = (uint16_t)(field->data[0] << 8 | field->data[1]);
+    }
+    collect_apdu(field, context);
+}
+
+// An element the parser cannot decode, here a compact-array (0x13), drops the frame unless the
+// APDU is kept for forwarding: then the values before it are decoded and the whole APDU forwarded
+static void test_apdu_forward_unknown_type(void)
+{
+    static const uint8_t kUnknownType[] = {
+        0x7E, 0xA0, 0x00, 0x41, 0x08, 0x83, 0x13, 0x00, 0x00, 0xE6, 0xE7, 0x00,
+        0x0F, 0x40, 0x00, 0x00, 0x00, 0x00,
+        0x02, 0x03,
+        0x0A, 0x07, 'T', 'E', 'S', 'T', '_', 'V', '1',
+        0x02, 0x03, 0x09, 0x06, 0x01, 0x00, 0x20, 0x07, 0x00, 0xFF, 0x12, 0x09, 0x1B,
+        0x02, 0x02, 0x0F, 0xFF, 0x16, DLMS_UNIT_V,
+        0x02, 0x02, 0x09, 0x06, 0x01, 0x00, 0x1F, 0x07, 0x00, 0xFF, 0x13, 0x02, 0x12, 0x02, 0x00, 0x01, 0x00, 0x02,
+        0x00, 0x00, 0x7E};
+    uint8_t frame[sizeof(kUnknownType)];
+    const size_t apdu_start = 12;
+    replay_stream_t stream;
+    replay_result_t r;
+
+    memcpy(frame, kUnknownType, sizeof(frame));
+    finish_test_frame(frame, sizeof(frame));
+
+    replay_from_buffer(&stream, frame, sizeof(frame));
+    replay_run(&stream, &r);
+    CHECK_EQ(r.frames, 0);
+    CHECK_EQ(r.aborts, 1);
+
+    dlms_parser_init(&forward_parser);
+    dlms_parser_set_callback(&forward_parser, collect_undecoded, NULL);
+    dlms_parser_set_apdu_buffer(&forward_parser, forward_buffer, sizeof(forward_buffer));
+    forwarded_length = 0;
+    undecoded_voltage = 0;
+    for (size_t i = 0; i < sizeof(frame); i++)
+    {
+        dlms_parser_process_byte(&forward_parser, frame[i]);
+    }
+    CHECK_EQ(undecoded_voltage, 233);
+    CHECK_EQ(forwarded_length, sizeof(frame) - apdu_start - 3);
+    CHECK_EQ(memcmp(forwarded, &frame[apdu_start], sizeof(frame) - apdu_start - 3), 0);
+
+    // The next frame decodes from its start again
+    forwarded_length = 0;
+    undecoded_voltage = 0;
+    for (size_t i = 0; i < sizeof(frame); i++)
+    {
+        dlms_parser_process_byte(&forward_parser, frame[i]);
+    }
+    CHECK_EQ(undecoded_voltage, 233);
+    CHECK_EQ(forwarded_length, sizeof(frame) - apdu_start - 3);
+}
+
+// The example telegram of the DSMR 5.0.2 P1 companion standard. The CRC printed there does not
+// match its text, this one is CRC-16/ARC as meters send it.
+static const char kDsmrTelegram[] =
+    "/ISk5\\2MT382-1000\r\n"
+    "\r\n"
+    "1-3:0.2.8(50)\r\n"
+    "0-0:1.0.0(101209113020W)\r\n"
+    "0-0:96.1.1(4B384547303034303436333935353037)\r\n"
+    "1-0:1.8.1(123456.789*kWh)\r\n"
+    "1-0:1.8.2(123456.789*kWh)\r\n"
+    "1-0:2.8.1(123456.789*kWh)\r\n"
+    "1-0:2.8.2(123456.789*kWh)\r\n"
+    "0-0:96.14.0(0002)\r\n"
+    "1-0:1.7.0(01.193*kW)\r\n"
+    "1-0:2.7.0(00.000*kW)\r\n"
+    "0-0:96.7.21(00004)\r\n"
+    "0-0:96.7.9(00002)\r\n"
+    "1-0:99.97.0(2)(0-0:96.7.19)(101208152415W)(0000000240*s)(101208151004W)(0000000301*s)\r\n"
+    "1-0:32.32.0(00002)\r\n"
+    "1-0:52.32.0(00001)\r\n"
+    "1-0:72.32.0(00000)\r\n"
+    "1-0:32.36.0(00000)\r\n"
+    "1-0:52.36.0(00003)\r\n"
+    "1-0:72.36.0(00000)\r\n"
+    "0-0:96.13.0(303132333435363738393A3B3C3D3E3F303132333435363738393A3B3C3D3E3F303132333435363738393A3B"
+    "3C3D3E3F303132333435363738393A3B3C3D3E3F303132333435363738393A3B3C3D3E3F)\r\n"
+    "1-0:32.7.0(220.1*V)\r\n"
+    "1-0:52.7.0(220.2*V)\r\n"
+    "1-0:72.7.0(220.3*V)\r\n"
+    "1-0:31.7.0(001*A)\r\n"
+    "1-0:51.7.0(002*A)\r\n"
+    "1-0:71.7.0(003*A)\r\n"
+    "1-0:21.7.0(01.111*kW)\r\n"
+    "1-0:41.7.0(02.222*kW)\r\n"
+    "1-0:61.7.0(03.333*kW)\r\n"
+    "1-0:22.7.0(04.444*kW)\r\n"
+    "1-0:42.7.0(05.555*kW)\r\n"
+    "1-0:62.7.0(06.666*kW)\r\n"
+    "0-1:24.1.0(003)\r\n"
+    "0-1:96.1.0(3232323241424344313233343536373839)\r\n"
+    "0-1:24.2.1(101209112500W)(12785.123*m3)\r\n"
+    "!E47C\r\n";
+
+// IEC 62056-21 mode D: short references and no CRC
+static const char kIecTelegram[] =
+    "/LGZ4ZMF100AC.M29\r\n"
+    "\r\n"
+    "F.F(00)\r\n"
+    "1.8.0(001234.5*kWh)\r\n"
+    "1.8.0*12(001000.0*kWh)\r\n"
+    "2.8.0(000000.7*kWh)\r\n"
+    "!\r\n";
+
+static const char kOverRangeTelegram[] =
+    "/ISk5\\2MT382-1000\r\n"
+    "\r\n"
+    "1-0:32.7.0(70000.0*V)\r\n"
+    "1-0:33.7.0(700.00)\r\n"
+    "1-0:31.7.0(99999999*A)\r\n"
+    "1-0:1.7.0(9999999.999*kW)\r\n"
+    "1-0:1.8.1(9999999.999*kWh)\r\n"
+    "1-0:2.8.1(4294967.295*kWh)\r\n"
+    "1-0:2.8.2(000000.001*kWh)\r\n"
+    "!\r\n";
+
+static void test_p1_telegram(void)
+{
+    replay_stream_t stream;
+    replay_result_t r;
+
+    replay_from_buffer(&stream, (const uint8_t *)kDsmrTelegram, strlen(kDsmrTelegram));
+    replay_run(&stream, &r);
+
+    CHECK_EQ(r.protocol, METER_PROTOCOL_P1);
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.aborts, 0);
+    CHECK_EQ(r.fields, 15);
+    CHECK_EQ(r.timestamp, 345209420); // 2010-12-09 11:30:20
+    CHECK_EQ(r.value[SERIAL_NUMBER], 46395507); // K8EG004046395507
+    CHECK_EQ(r.value[ACTIVE_ENERGY_IMPORT], 246913578);
+    CHECK_EQ(r.value[ACTIVE_ENERGY_EXPORT], 246913578);
+    CHECK_EQ(r.value[ACTIVE_POWER_IMPORT], 1193);
+    CHECK_EQ(r.value[ACTIVE_POWER_EXPORT], 0);
+    for (int p = 0; p < 3; p++)
+    {
+        CHECK_EQ(r.value[RMS_VOLTAGE_A + p], 220);
+        CHECK_EQ(r.value[RMS_CURRENT_A + p], 100 * (p + 1));
+        CHECK_EQ(r.value[ACTIVE_POWER_A + p], 1111 * (p + 1));
+    }
+    CHECK_EQ(r.count[REACTIVE_POWER_A], 0);
+
+    // A changed digit fails the CRC, the telegram after it decodes
+    size_t length = strlen(kDsmrTelegram);
+    uint8_t *telegrams = malloc(2 * length);
+    memcpy(telegrams, kDsmrTelegram, length);
+    memcpy(telegrams + length, kDsmrTelegram, length);
+    telegrams[strstr(kDsmrTelegram, "01.193") - kDsmrTelegram] = '2';
+    replay_from_buffer(&stream, telegrams, 2 * length);
+    esp_log_level_set("P1", ESP_LOG_NONE);
+    replay_run(&stream, &r);
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.fcs_errors, 1);
+
+    // Cut before the end: the next telegram start drops it
+    replay_from_buffer(&stream, telegrams + length / 2, length + length / 2);
+    replay_run(&stream, &r);
+    esp_log_level_set("P1", ESP_LOG_VERBOSE);
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.aborts, 0);
+    free(telegrams);
+
+    replay_from_buffer(&stream, (const uint8_t *)kIecTelegram, strlen(kIecTelegram));
+    replay_run(&stream, &r);
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.fields, 2);
+    CHECK_EQ(r.value[ACTIVE_ENERGY_IMPORT], 1234500);
+    CHECK_EQ(r.value[ACTIVE_ENERGY_EXPORT], 700);
+
+    // Values beyond the range of a field saturate as in the DLMS parser instead of wrapping
+    replay_from_buffer(&stream, (const uint8_t *)kOverRangeTelegram, strlen(kOverRangeTelegram));
+    replay_run(&stream, &r);
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.value[RMS_VOLTAGE_A], 65535);
+    CHECK_EQ(r.value[POWER_FACTOR_A], 65535);
+    CHECK_EQ(r.value[RMS_CURRENT_A], 4294967295);
+    CHECK_EQ(r.value[ACTIVE_POWER_IMPORT], 4294967295);
+    CHECK_EQ(r.value[ACTIVE_ENERGY_IMPORT], 4294967295);
+    CHECK_EQ(r.value[ACTIVE_ENERGY_EXPORT], 4294967295);
+
+    // The shared conversion on its own
+    CHECK_EQ(dlms_scale_number(15, -1), 2);
+    CHECK_EQ(dlms_scale_number(-15, -1), -2);
+    CHECK_EQ(dlms_scale_number(14, -1), 1);
+    CHECK_EQ(dlms_scale_number(INT64_MAX, -18), 9);
+    CHECK_EQ(dlms_scale_number(5, -19), 0);
+    CHECK_EQ(dlms_scale_number(10, 18), INT64_MAX);
+    CHECK_EQ(dlms_scale_number(1, 30), INT64_MAX);
+    CHECK_EQ(dlms_scale_number(-1, 30), -INT64_MAX);
+}
+
+// DSMR telegrams from the simulator, after line noise so the protocol has to be detected
+static void test_simulated_dsmr(void)
+{
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream = {0};
+    replay_result_t r;
+
+    meter_sim_default_config(&config);
+    config.format = METER_SIM_DSMR;
+    config.noise_bytes = 16;
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 100);
+
+    esp_log_level_set("P1", ESP_LOG_NONE);
+    replay_run(&stream, &r);
+    esp_log_level_set("P1", ESP_LOG_VERBOSE);
+
+    const meter_sim_reading_t *reading = &sim.reading;
+    CHECK_EQ(r.protocol, METER_PROTOCOL_P1);
+    CHECK_EQ(r.frames, 100);
+    CHECK_EQ(r.timestamp, reading->time);
+    CHECK_EQ(r.value[SERIAL_NUMBER], sim.serial);
+    CHECK_EQ(r.value[ACTIVE_ENERGY_IMPORT], reading->energy_import_wh);
+    CHECK_EQ(r.value[ACTIVE_POWER_IMPORT], reading->power_w[0] + reading->power_w[1] + reading->power_w[2]);
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        CHECK_EQ(r.value[RMS_VOLTAGE_A + p], (reading->voltage_dv[p] + 5) / 10);
+        CHECK_EQ(r.value[RMS_CURRENT_A + p], (reading->current_ma[p] + 500) / 1000 * 100);
+        CHECK_EQ(r.value[ACTIVE_POWER_A + p], reading->power_w[p]);
+    }
+
+    replay_free(&stream);
+}
+
+// Fake meter behind an HDLC client port for the DLMS client: answers SNRM, AARQ and GET requests
+// from a few registers, optionally without multiple references, in short segments or not at all
+typedef struct {
+    bool multiple_references;
+    size_t segment_size;                // Information field per segment, 0 for unsegmented responses
+    bool silent;
+    uint8_t out[1024];                  // Response bytes not yet delivered to the client
+    size_t out_length;
+    uint8_t apdu[512];                  // Response still to be sent in segments
+    size_t apdu_length;
+    size_t apdu_sent;
+    uint8_t send_sequence;
+    uint8_t receive_sequence;
+    int snrm;
+    int get_requests;
+    int list_requests;
+} fake_meter_t;
+
+static fake_meter_t meter;
+
+static const uint8_t kMeterClock[12] = {0x07, 0xE9, 1, 2, 4, 3, 4, 5, 0x00, 0x80, 0x00, 0x00}; // 2025-01-02 03:04:05
+
+// Register value by OBIS group C: data type, value, scaler, unit
+static bool meter_register(uint8_t c, uint8_t *tag, int32_t *value, int8_t *scaler, uint8_t *unit)
+{
+    static const struct {
+        uint8_t c;
+        uint8_t tag;
+        int32_t value;
+        int8_t scaler;
+        uint8_t unit;
+    } kRegisters[] = {
+        {32, DLMS_TAG_LONG_UNSIGNED, 2301, -1, DLMS_UNIT_V}, {52, DLMS_TAG_LONG_UNSIGNED, 2315, -1, DLMS_UNIT_V}, {72, DLMS_TAG_LONG_UNSIGNED, 2296, -1, DLMS_UNIT_V},
+        {31, DLMS_TAG_DOUBLE_LONG_UNSIGNED, 1234, -3, DLMS_UNIT_A}, {51, DLMS_TAG_DOUBLE_LONG_UNSIGNED, 567, -3, DLMS_UNIT_A}, {71, DLMS_TAG_DOUBLE_LONG_UNSIGNED, 8, -3, DLMS_UNIT_A},
+        {21, DLMS_TAG_DOUBLE_LONG, 230, 0, DLMS_UNIT_W}, {41, DLMS_TAG_DOUBLE_LONG, 120, 0, DLMS_UNIT_W}, {61, DLMS_TAG_DOUBLE_LONG, 5, 0, DLMS_UNIT_W},
+        {23, DLMS_TAG_DOUBLE_LONG, 10, 0, DLMS_UNIT_VAR}, {43, DLMS_TAG_DOUBLE_LONG, 20, 0, DLMS_UNIT_VAR}, {63, DLMS_TAG_DOUBLE_LONG, 30, 0, DLMS_UNIT_VAR},
+        {33, DLMS_TAG_LONG, 950, -3, DLMS_UNIT_NONE}, {53, DLMS_TAG_LONG, 800, -3, DLMS_UNIT_NONE}, {73, DLMS_TAG_LONG, 500, -3, DLMS_UNIT_NONE},
+        {1, DLMS_TAG_DOUBLE_LONG_UNSIGNED, 355, 0, DLMS_UNIT_W}, {2, DLMS_TAG_DOUBLE_LONG_UNSIGNED, 0, 0, DLMS_UNIT_W},
+    };
+    for (size_t i = 0; i < sizeof(kRegisters) / sizeof(kRegisters[0]); i++)
+    {
+        if (kRegisters[i].c == c)
+        {
+            *tag = kRegisters[i].tag;
+            *value = kRegisters[i].value;
+            *scaler = kRegisters[i].scaler;
+            *unit = kRegisters[i].unit;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void meter_frame(uint8_t control, const uint8_t *info, size_t length, bool segmented)
+{
+    uint8_t *out = &meter.out[meter.out_length];
+    size_t total = 5 + (length > 0 ? 2 + length : 0) + 2;
+    size_t pos = 0;
+
+    out[pos++] = 0x7E;
+    out[pos++] = (uint8_t)(0xA0 | (segmented ? 0x08 : 0) | total >> 8);
+    out[pos++] = (uint8_t)total;
+    out[pos++] = 0x21; // Client 0x10
+    out[pos++] = 0x03; // Logical device 1
+    out[pos++] = control;
+    if (length > 0)
+    {
+        uint16_t hcs = fcs16(&out[1], pos - 1);
+        out[pos++] = (uint8_t)hcs;
+        out[pos++] = (uint8_t)(hcs >> 8);
+        memcpy(&out[pos], info, length);
+        pos += length;
+    }
+    uint16_t fcs = fcs16(&out[1], pos - 1);
+    out[pos++] = (uint8_t)fcs;
+    out[pos++] = (uint8_t)(fcs >> 8);
+    out[pos++] = 0x7E;
+    meter.out_length += pos;
+}
+
+static void meter_send_segment(void)
+{
+    size_t left = meter.apdu_length - meter.apdu_sent;
+    size_t length = meter.segment_size > 0 && left > meter.segment_size ? meter.segment_size : left;
+    uint8_t control = (uint8_t)(meter.receive_sequence << 5 | 0x10 | meter.send_sequence << 1);
+    meter.send_sequence = (meter.send_sequence + 1) & 0x07;
+    meter_frame(control, &meter.apdu[meter.apdu_sent], length, length < left);
+    meter.apdu_sent += length;
+}
+
+// Encode attribute 2 or 3 of the object at request, class and OBIS code, as a GET result
+static size_t meter_get(const uint8_t *request, uint8_t *out)
+{
+    const uint8_t *obis = &request[2];
+    uint8_t attribute = request[8];
+    size_t pos = 0;
+
+    uint8_t tag;
+    int32_t value;
+    int8_t scaler;
+    uint8_t unit;
+    if (obis[2] == 1 && obis[3] == 0)
+    {
+        out[pos++] = 0x00;
+        out[pos++] = DLMS_TAG_OCTET_STRING;
+        out[pos++] = sizeof(kMeterClock);
+        memcpy(&out[pos], kMeterClock, sizeof(kMeterClock));
+        return pos + sizeof(kMeterClock);
+    }
+    if (obis[3] == 8)
+    {
+        // Energy in 10 Wh
+        tag = DLMS_TAG_DOUBLE_LONG_UNSIGNED;
+        value = obis[2] == 1 ? 12345 : 0;
+        scaler = 1;
+        unit = DLMS_UNIT_WH;
+    }
+    else if (!meter_register(obis[2], &tag, &value, &scaler, &unit))
+    {
+        out[pos++] = 0x01;
+        out[pos++] = 4; // Object undefined
+        return pos;
+    }
+
+    out[pos++] = 0x00;
+    if (attribute == 3)
+    {
+        out[pos++] = DLMS_TAG_STRUCTURE;
+        out[pos++] = 2;
+        out[pos++] = DLMS_TAG_INTEGER;
+        out[pos++] = (uint8_t)scaler;
+        out[pos++] = DLMS_TAG_ENUM;
+        out[pos++] = unit;
+        return pos;
+    }
+    int size = tag == DLMS_TAG_LONG_UNSIGNED || tag == DLMS_TAG_LONG ? 2 : 4;
+    out[pos++] = tag;
+    for (int i = size - 1; i >= 0; i--)
+    {
+        out[pos++] = (uint8_t)((uint32_t)value >> (8 * i));
+    }
+    return pos;
+}
+
+static void meter_respond(const uint8_t *apdu, size_t length)
+{
+    static const uint8_t kLlc[] = {0xE6, 0xE7, 0x00};
+    uint8_t *out = meter.apdu;
+    size_t pos = sizeof(kLlc);
+    memcpy(out, kLlc, sizeof(kLlc));
+
+    if (apdu[0] == 0x60)
+    {
+        const uint8_t aare[] = {
+            0x61, 0x29, 0xA1, 0x09, 0x06, 0x07, 0x60, 0x85, 0x74, 0x05, 0x08, 0x01, 0x01,
+            0xA2, 0x03, 0x02, 0x01, 0x00, 0xA3, 0x05, 0xA1, 0x03, 0x02, 0x01, 0x00,
+            0xBE, 0x10, 0x04, 0x0E, 0x08, 0x00, 0x06, 0x5F, 0x1F, 0x04, 0x00,
+            0x00, meter.multiple_references ? 0x02 : 0x00, 0x10, 0x01, 0x00, 0x00, 0x07};
+        memcpy(&out[pos], aare, sizeof(aare));
+        pos += sizeof(aare);
+    }
+    else if (apdu[0] == 0xC0)
+    {
+        meter.get_requests++;
+        out[pos++] = 0xC4;
+        out[pos++] = apdu[1];
+        out[pos++] = apdu[2];
+        if (apdu[1] == 0x03)
+        {
+            meter.list_requests++;
+            out[pos++] = apdu[3];
+            for (uint8_t i = 0; i < apdu[3]; i++)
+            {
+                pos += meter_get(&apdu[4 + 10 * i], &out[pos]);
+            }
+        }
+        else
+        {
+            pos += meter_get(&apdu[3], &out[pos]);
+        }
+    }
+    (void)length;
+    meter.apdu_length = pos;
+    meter.apdu_sent = 0;
+    meter_send_segment();
+}
+
+// Send function of the client: the meter receives a whole frame and queues its answer
+static int meter_receive(const uint8_t *data, size_t length, void *context)
+{
+    if (meter.silent)
+    {
+        return (int)length;
+    }
+
+    // Flag, format, server, client, control, then HCS and information, FCS, flag
+    uint16_t fcs = fcs16(&data[1], length - 4);
+    CHECK_EQ(data[0], 0x7E);
+    CHECK_EQ(data[3], 0x03);
+    CHECK_EQ(data[4], 0x21);
+    CHECK_EQ(data[length - 3] | data[length - 2] << 8, fcs);
+    uint8_t control = data[5];
+
+    if (control == 0x93)
+    {
+        static const uint8_t kParameters[] = {0x81, 0x80, 0x14, 0x05, 0x02, 0x00, 0x80, 0x06, 0x02, 0x00, 0x80,
+                                              0x07, 0x04, 0x00, 0x00, 0x00, 0x01, 0x08, 0x04, 0x00, 0x00, 0x00, 0x01};
+        meter.snrm++;
+        meter.send_sequence = 0;
+        meter.receive_sequence = 0;
+        meter_frame(0x73, kParameters, sizeof(kParameters), false);
+    }
+    else if ((control & 0x0F) == 0x01)
+    {
+        // RR: the next segment
+        CHECK_EQ(control >> 5, meter.send_sequence);
+        meter_send_segment();
+    }
+    else if ((control & 0x01) == 0)
+    {
+        CHECK_EQ((control >> 1) & 0x07, meter.receive_sequence);
+        meter.receive_sequence = (((control >> 1) & 0x07) + 1) & 0x07;
+        CHECK_EQ(data[8], 0xE6);
+        CHECK_EQ(data[9], 0xE6);
+        meter_respond(&data[11], length - 11 - 3);
+    }
+    return (int)length;
+}
+
+// Run the client against the fake meter with a response time of a millisecond
+static void run_client(dlms_client_t *client, uint32_t *now_ms, uint32_t duration_ms)
+{
+    for (uint32_t end = *now_ms + duration_ms; *now_ms < end; (*now_ms)++)
+    {
+        size_t length = meter.out_length;
+        uint8_t bytes[sizeof(meter.out)];
+        memcpy(bytes, meter.out, length);
+        meter.out_length = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            dlms_client_process_byte(client, bytes[i], *now_ms);
+        }
+        dlms_client_poll(client, *now_ms);
+    }
+}
+
+static void check_client_reading(const replay_result_t *r)
+{
+    CHECK_EQ(r->timestamp, dlms_datetime_to_seconds(kMeterClock));
+    CHECK_EQ(r->value[RMS_VOLTAGE_A], 230);
+    CHECK_EQ(r->value[RMS_VOLTAGE_B], 232);
+    CHECK_EQ(r->value[RMS_VOLTAGE_C], 230);
+    CHECK_EQ(r->value[RMS_CURRENT_A], 123);
+    CHECK_EQ(r->value[RMS_CURRENT_B], 57);
+    CHECK_EQ(r->value[RMS_CURRENT_C], 1);
+    CHECK_EQ(r->value[ACTIVE_POWER_B], 120);
+    CHECK_EQ(r->value[REACTIVE_POWER_C], 30);
+    CHECK_EQ(r->value[POWER_FACTOR_A], 95);
+    CHECK_EQ(r->value[POWER_FACTOR_C], 50);
+    CHECK_EQ(r->value[ACTIVE_POWER_IMPORT], 355);
+    CHECK_EQ(r->value[ACTIVE_ENERGY_IMPORT], 123450);
+}
+
+static void test_dlms_client(void)
+{
+    dlms_client_config_t config = {
+        .server_address = 1,
+        .client_address = 0x10,
+        .interval_ms = 1000,
+        .timeout_ms = 200,
+        .objects = dlms_client_objects,
+        .object_count = (uint8_t)dlms_client_object_count,
+        .send = meter_receive,
+    };
+    dlms_client_t *client = malloc(sizeof(dlms_client_t));
+    replay_result_t r;
+    uint32_t now_ms = 0;
+
+    // One association for all cycles. Scaler_units and values of 19 registers and the clock go in
+    // two lists each; energy is only read every tenth cycle.
+    memset(&meter, 0, sizeof(meter));
+    meter.multiple_references = true;
+    dlms_client_init(client, &config);
+    dlms_client_set_callback(client, replay_collect(&r), &r);
+    run_client(client, &now_ms, 2500);
+    CHECK_EQ(r.frames, 3);
+    CHECK_EQ(r.aborts, 0);
+    CHECK_EQ(meter.snrm, 1);
+    CHECK_EQ(meter.get_requests, 2 + 3 * 2);
+    CHECK_EQ(meter.list_requests, meter.get_requests);
+    CHECK_EQ(r.count[ACTIVE_ENERGY_IMPORT], 1);
+    CHECK_EQ(r.count[RMS_VOLTAGE_A], 3);
+    CHECK_EQ(r.fields, 20 + 2 * 18);
+    check_client_reading(&r);
+
+    // Single GET requests in segments of 8 bytes
+    memset(&meter, 0, sizeof(meter));
+    meter.segment_size = 8;
+    now_ms = 0;
+    dlms_client_init(client, &config);
+    dlms_client_set_callback(client, replay_collect(&r), &r);
+    run_client(client, &now_ms, 500);
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(meter.list_requests, 0);
+    CHECK_EQ(meter.get_requests, 19 + 20);
+    check_client_reading(&r);
+
+    // A meter that stops answering ends the cycle; the client connects again after the retry time
+    memset(&meter, 0, sizeof(meter));
+    meter.multiple_references = true;
+    now_ms = 0;
+    dlms_client_init(client, &config);
+    dlms_client_set_callback(client, replay_collect(&r), &r);
+    run_client(client, &now_ms, 500);
+    meter.silent = true;
+    esp_log_level_set("Client", ESP_LOG_NONE);
+    run_client(client, &now_ms, 1000);
+    esp_log_level_set("Client", ESP_LOG_VERBOSE);
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.aborts, 1);
+    meter.silent = false;
+    run_client(client, &now_ms, DLMS_CLIENT_RETRY_MS);
+    CHECK_EQ(meter.snrm, 2);
+    CHECK_EQ(r.frames, 2);
+    check_client_reading(&r);
+
+    free(client);
+}
+
+// Record a stream in UART sized reads, export the capture and read it back
+static void capture_stream(const replay_stream_t *stream, capture_t *capture, replay_stream_t *replayed, int64_t *first_us)
+{
+    const size_t read_size = 64;
+    const int64_t read_us = 26667; // 64 bytes at 2400 baud
+
+    for (size_t offset = 0; offset < stream->length; offset += read_size)
+    {
+        size_t length = stream->length - offset < read_size ? stream->length - offset : read_size;
+        capture_write(capture, (int64_t)(offset / read_size) * read_us, stream->bytes + offset, length);
+    }
+
+    size_t size = capture_export_size(capture);
+    uint8_t *exported = malloc(size);
+    CHECK_EQ(capture_export(capture, 0, exported, size), size);
+
+    // Export in pieces must give the same bytes
+    uint8_t piece[50];
+    for (size_t offset = 0; offset < size; offset += sizeof(piece))
+    {
+        size_t length = capture_export(capture, offset, piece, sizeof(piece));
+        CHECK_EQ(memcmp(piece, exported + offset, length), 0);
+    }
+
+    capture_reader_t reader;
+    capture_record_t record;
+    CHECK_EQ(capture_reader_init(&reader, exported, size), 1);
+    *first_us = reader.time_us;
+    replayed->bytes = malloc(stream->length);
+    replayed->length = 0;
+    int64_t previous_us = *first_us - read_us;
+    while (capture_reader_next(&reader, &record))
+    {
+        if (replayed->length + record.length > stream->length)
+        {
+            failures++;
+            break;
+        }
+        memcpy(replayed->bytes + replayed->length, record.bytes, record.length);
+        replayed->length += record.length;
+
+        // One record per read, read_us apart
+        CHECK_EQ(record.time_us - previous_us, read_us);
+        previous_us = record.time_us;
+    }
+    CHECK_EQ(reader.pos, size);
+    free(exported);
+}
+
+static void test_capture(void)
+{
+    meter_sim_config_t config;
+    meter_sim_t sim;
+    replay_stream_t stream = {0};
+    replay_stream_t replayed;
+    replay_result_t r;
+    capture_t capture;
+    int64_t first_us;
+
+    meter_sim_default_config(&config);
+    meter_sim_init(&sim, &config);
+    append_pushes(&stream, &sim, 20);
+
+    // Everything fits: the replay is the original stream
+    static uint8_t large[65536];
+    capture_init(&capture, large, sizeof(large));
+    capture_stream(&stream, &capture, &replayed, &first_us);
+    CHECK_EQ(capture.overwritten, 0);
+    CHECK_EQ(first_us, 0);
+    CHECK_EQ(replayed.length, stream.length);
+    CHECK_EQ(memcmp(replayed.bytes, stream.bytes, stream.length), 0);
+    replay_run(&replayed, &r);
+    CHECK_EQ(r.frames, 20);
+    replay_free(&replayed);
+
+    // Small ring: the oldest reads are overwritten, the rest keeps its bytes and timestamps
+    static uint8_t small[4096];
+    capture_init(&capture, small, sizeof(small));
+    capture_stream(&stream, &capture, &replayed, &first_us);
+    size_t skipped = stream.length - replayed.length;
+    CHECK_EQ(capture.overwritten > 0, 1);
+    CHECK_EQ(skipped % 64, 0);
+    CHECK_EQ(first_us, (int64_t)(skipped / 64) * 26667);
+    CHECK_EQ(memcmp(replayed.bytes, stream.bytes + skipped, replayed.length), 0);
+    replay_run(&replayed, &r);
+    CHECK_EQ(r.frames > 0, 1);
+    check_simulated_reading(&r, &sim);
+    replay_free(&replayed);
+
+    // Cleared capture exports just the header
+    capture_clear(&capture);
+    CHECK_EQ(capture_export_size(&capture), CAPTURE_HEADER_SIZE);
+
+    replay_free(&stream);
+}
+
+static uint8_t *export_dlog(size_t *size)
+{
+    *size = dlog_export_size();
+    uint8_t *exported = malloc(*size);
+    for (size_t offset = 0; offset < *size; offset += 64)
+    {
+        dlog_export(offset, &exported[offset], 64);
+    }
+    return exported;
+}
+
+static const dlog_record_t *exported_record(const uint8_t *exported, size_t index)
+{
+    return (const dlog_record_t *)&exported[DLOG_HEADER_SIZE + index * sizeof(dlog_record_t)];
+}
+
+static void test_dlog(void)
+{
+    replay_stream_t stream;
+    replay_result_t r;
+
+    // The parser logs every field it finds
+    uint32_t before = dlog_written();
+    replay_from_buffer(&stream, dlmsFrame, (size_t)dlmsFrameSize);
+    replay_run(&stream, &r);
+    CHECK_EQ(dlog_written() - before >= 21, 1);
+
+    uint64_t big = 1ULL << 40;
+    DLOGI("Test", "value %d %s %" PRIu64 " %02x", -5, DLOG_STR("abc"), DLOG_U64(big), 0xA);
+    uint32_t test_sequence = dlog_written();
+
+    size_t size;
+    uint8_t *exported = export_dlog(&size);
+    CHECK_EQ(size, DLOG_HEADER_SIZE + DLOG_RECORDS * sizeof(dlog_record_t));
+    CHECK_EQ(memcmp(exported, DLOG_MAGIC, 4), 0);
+    CHECK_EQ(exported[5], sizeof(uintptr_t));
+    CHECK_EQ(exported[6] | exported[7] << 8, sizeof(dlog_record_t));
+    CHECK_EQ(exported[8] | exported[9] << 8, DLOG_RECORDS);
+
+    const dlog_record_t *record = exported_record(exported, (test_sequence - 1) % DLOG_RECORDS);
+    CHECK_EQ(atomic_load(&record->sequence), test_sequence);
+    CHECK_EQ(strcmp(record->tag, "Test"), 0);
+    CHECK_EQ(record->site->count, 4);
+    CHECK_EQ(record->site->level, DLOG_INFO);
+    CHECK_EQ((int)record->args[0], -5);
+    CHECK_EQ(strcmp((const char *)record->args[1], "abc"), 0);
+    CHECK_EQ(record->args[2], big);
+
+    // Kept for the decoder test
+    FILE *file = fopen("dlog_test.bin", "wb");
+    if (file == NULL || fwrite(exported, 1, size, file) != size)
+    {
+        failures++;
+    }
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    free(exported);
+
+    // Below the level nothing is recorded
+    dlog_level = DLOG_WARN;
+    before = dlog_written();
+    DLOGI("Test", "dropped");
+    CHECK_EQ(dlog_written(), before);
+    dlog_level = DLOG_DEBUG;
+
+    // After wrapping the ring holds the newest records, one per slot
+    for (int i = 0; i < DLOG_RECORDS + 10; i++)
+    {
+        DLOGD("Test", "wrap %d", i);
+    }
+    exported = export_dlog(&size);
+    uint32_t written = dlog_written();
+    for (size_t i = 0; i < DLOG_RECORDS; i++)
+    {
+        uint32_t sequence = atomic_load(&exported_record(exported, i)->sequence);
+        CHECK_EQ(sequence > written - DLOG_RECORDS && sequence <= written, 1);
+        CHECK_EQ((sequence - 1) % DLOG_RECORDS, i);
+    }
+    free(exported);
+}
+
+static void test_datetime(void)
+{
+    const uint8_t leap_day[12] = {0x07, 0xE8, 0x02, 0x1D, 0x04, 0x17, 0x3B, 0x3B, 0xFF, 0x80, 0x00, 0x00};
+    const uint8_t epoch[12] = {0x07, 0xD0, 0x01, 0x01, 0x06, 0x00, 0x00, 0x00, 0xFF, 0x80, 0x00, 0x00};
+    const uint8_t unspecified[12] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x80, 0x00, 0xFF};
+
+    CHECK_EQ(dlms_datetime_to_seconds(leap_day), 762566399); // 2024-02-29 23:59:59
+    CHECK_EQ(dlms_datetime_to_seconds(epoch), 0);
+    CHECK_EQ(dlms_datetime_to_seconds(unspecified), 0);
+}
+
+int main(void)
+{
+    test_list2_frame();
+    test_data_txt();
+    test_list1_frame();
+    test_back_to_back();
+    test_fcs_error();
+    test_simulated_kamstrup();
+    test_simulated_aidon();
+    test_simulated_kaifa();
+    test_profile_switch();
+    test_scaler_unit();
+    test_gcm_vectors();
+    test_ciphered_push();
+    test_ciphered_tamper();
+    test_simulated_recovery();
+    test_segmented_push();
+    test_lost_segment();
+    test_subscription();
+    test_apdu_forward();
+    test_apdu_forward_unknown_type();
+    test_p1_telegram();
+    test_simulated_dsmr();
+    test_dlms_client();
+    test_capture();
+    test_dlog();
+    test_datetime();
+
+    if (failures == 0)
+    {
+        printf("All DLMS parser tests passed\n");
+    }
+    return failures;
+}
@@ -0,0 +1,115 @@
+#include "include/dlog.h"
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#else
+#include <time.h>
+#endif
+
+dlog_level_t dlog_level = DLOG_DEBUG;
+
+static dlog_record_t records[DLOG_RECORDS];
+static atomic_uint_least32_t written;
+
+static uint32_t now_us(void)
+{
+#ifdef ESP_PLATFORM
+    return (uint32_t)esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u);
+#endif
+}
+
+void dlog_write(const dlog_site_t *site, const char *tag, const uintptr_t *args)
+{
+    uint32_t index = atomic_fetch_add_explicit(&written, 1, memory_order_relaxed);
+    dlog_record_t *record = &records[index % DLOG_RECORDS];
+
+    // Sequence 0 marks the slot as being written until the record is complete
+    atomic_store_explicit(&record->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    record->time_us = now_us();
+    record->site = site;
+    record->tag = tag;
+    for (uint8_t i = 0; i < site->count; i++)
+    {
+        record->args[i] = args[i];
+    }
+    atomic_store_explicit(&record->sequence, index + 1, memory_order_release);
+}
+
+uint32_t dlog_written(void)
+{
+    return atomic_load_explicit(&written, memory_order_relaxed);
+}
+
+static void put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+// Copy a record, zeroing the sequence if a writer touched it meanwhile
+static void snapshot_record(const dlog_record_t *record, dlog_record_t *copy)
+{
+    uint32_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+    memcpy(copy, record, sizeof(dlog_record_t));
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&record->sequence, memory_order_relaxed) != sequence)
+    {
+        sequence = 0;
+    }
+    atomic_store_explicit(&copy->sequence, sequence, memory_order_relaxed);
+}
+
+size_t dlog_export_size(void)
+{
+    return DLOG_HEADER_SIZE + sizeof(records);
+}
+
+size_t dlog_export(size_t offset, uint8_t *out, size_t size)
+{
+    uint8_t header[DLOG_HEADER_SIZE];
+    memcpy(header, DLOG_MAGIC, 4);
+    header[4] = DLOG_VERSION;
+    header[5] = sizeof(uintptr_t);
+    put_u16(&header[6], sizeof(dlog_record_t));
+    put_u16(&header[8], DLOG_RECORDS);
+    put_u16(&header[10], 0);
+    put_u32(&header[12], dlog_written());
+
+    size_t total = dlog_export_size();
+    size_t count = 0;
+    dlog_record_t copy;
+    size_t copied = SIZE_MAX; // Index of the record in copy
+
+    for (; count < size && offset < total; count++, offset++)
+    {
+        if (offset < DLOG_HEADER_SIZE)
+        {
+            out[count] = header[offset];
+            continue;
+        }
+
+        size_t index = (offset - DLOG_HEADER_SIZE) / sizeof(dlog_record_t);
+        if (index != copied)
+        {
+            snapshot_record(&records[index], &copy);
+            copied = index;
+        }
+        out[count] = ((const uint8_t *)&copy)[(offset - DLOG_HEADER_SIZE) % sizeof(dlog_record_t)];
+    }
+    return count;
+}
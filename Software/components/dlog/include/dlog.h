@@ -0,0 +1,127 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+// Deferred binary logging for the frame path. A log call stores the address of its call site,
+// which holds the format string, and the raw arguments in a ring buffer in RAM. Nothing is
+// formatted on the device: tools/dlog_decode looks the call sites up in the firmware ELF.
+// A call costs a level check and a few stores, so debug tracing can stay on in release builds.
+//
+// Arguments are stored as one machine word each. Integers, characters and pointers to strings in
+// flash (literals, constant tables) are supported; %s of a RAM buffer prints garbage and floats
+// are not supported. Pass strings through DLOG_STR() and 64-bit values through DLOG_U64(), print
+// the latter with PRIu64/PRId64.
+//
+// Writers reserve a record with an atomic add, so any task can log without a lock. A writer more
+// than DLOG_RECORDS records behind the others can collide with them, the torn record is then
+// skipped by the export.
+//
+// Export format, all integers little-endian:
+//   header  "WZDL", version (1), word size (4 on the device), U16 record size, U16 record count,
+//           2 reserved bytes, U32 records written since boot
+//   record  U32 sequence (index + 1, 0 for an empty or torn slot), U32 time in us (low 32 bits),
+//           call site address, tag address, DLOG_MAX_ARGS words of arguments
+// The records follow in ring order, the decoder sorts them by sequence.
+
+#define DLOG_MAGIC "WZDL"
+#define DLOG_VERSION 1
+#define DLOG_HEADER_SIZE 16
+#define DLOG_MAX_ARGS 4
+
+#ifndef DLOG_RECORDS
+#define DLOG_RECORDS 256 // 8 KB of RAM on the device
+#endif
+
+// Set to 0 to print through ESP_LOGx instead, e.g. when debugging on the bench
+#ifndef DLOG_DEFERRED
+#define DLOG_DEFERRED 1
+#endif
+
+// Calls above this level are compiled out
+#ifndef DLOG_MAX_LEVEL
+#define DLOG_MAX_LEVEL DLOG_DEBUG
+#endif
+
+// Same values as esp_log_level_t
+typedef enum {
+    DLOG_NONE,
+    DLOG_ERROR,
+    DLOG_WARN,
+    DLOG_INFO,
+    DLOG_DEBUG,
+    DLOG_VERBOSE
+} dlog_level_t;
+
+// One per log call, in flash. The decoder reads it from the ELF, keep the layout in sync.
+typedef struct {
+    const char *format;
+    uint8_t level;
+    uint8_t count;  // Argument words
+} dlog_site_t;
+
+typedef struct {
+    atomic_uint_least32_t sequence;
+    uint32_t time_us;
+    const dlog_site_t *site;
+    const char *tag;
+    uintptr_t args[DLOG_MAX_ARGS];
+} dlog_record_t;
+
+// Calls at or below this level are recorded, DLOG_DEBUG by default
+extern dlog_level_t dlog_level;
+
+void dlog_write(const dlog_site_t *site, const char *tag, const uintptr_t *args);
+uint32_t dlog_written(void);
+
+// Same piecewise export as capture_export: export_size is the total length, dlog_export copies up
+// to size bytes starting at offset and returns the count. Logging goes on during the export.
+size_t dlog_export_size(void);
+size_t dlog_export(size_t offset, uint8_t *out, size_t size);
+
+#if DLOG_DEFERRED
+
+#define DLOG_STR(string) (uintptr_t)(string)
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#define DLOG_U64(value) (uintptr_t)(value)
+#else
+#define DLOG_U64(value) (uintptr_t)(uint32_t)(value), (uintptr_t)((uint64_t)(value) >> 32)
+#endif
+
+#define DLOG(level_, tag, format_, ...)                                            \
+    do                                                                             \
+    {                                                                              \
+        if ((level_) <= DLOG_MAX_LEVEL && (level_) <= dlog_level)                  \
+        {                                                                          \
+            const uintptr_t dlog_args_[] = {0, ##__VA_ARGS__};                     \
+            enum { dlog_count_ = sizeof(dlog_args_) / sizeof(uintptr_t) - 1 };    \
+            _Static_assert(dlog_count_ <= DLOG_MAX_ARGS, "Too many log arguments"); \
+            static const dlog_site_t dlog_site_ = {format_, level_, dlog_count_}; \
+            dlog_write(&dlog_site_, tag, &dlog_args_[1]);                          \
+        }                                                                          \
+    } while (0)
+
+#define DLOGE(tag, format, ...) DLOG(DLOG_ERROR, tag, format, ##__VA_ARGS__)
+#define DLOGW(tag, format, ...) DLOG(DLOG_WARN, tag, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) DLOG(DLOG_INFO, tag, format, ##__VA_ARGS__)
+#define DLOGD(tag, format, ...) DLOG(DLOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define DLOGV(tag, format, ...) DLOG(DLOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#else
+
+#include "esp_log.h"
+
+#define DLOG_STR(string) (string)
+#define DLOG_U64(value) (value)
+
+#define DLOGE(tag, format, ...) ESP_LOGE(tag, format, ##__VA_ARGS__)
+#define DLOGW(tag, format, ...) ESP_LOGW(tag, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#define DLOGD(tag, format, ...) ESP_LOGD(tag, format, ##__VA_ARGS__)
+#define DLOGV(tag, format, ...) ESP_LOGV(tag, format, ##__VA_ARGS__)
+
+#endif
+
+#endif // DLOG_H
@@ -0,0 +1,57 @@
+#include "include/energy_integrator.h"
+#include <string.h>
+
+#define DOUBLE_WMS_PER_WH (2ULL * 3600ULL * 1000ULL)
+
+void energy_integrator_init(energy_integrator_t *integrator)
+{
+    memset(integrator, 0, sizeof(energy_integrator_t));
+}
+
+void energy_integrator_anchor(energy_integrator_t *integrator, uint64_t energy)
+{
+    if (integrator->anchored && energy == integrator->anchor)
+    {
+        return;
+    }
+
+    integrator->anchor = energy;
+    integrator->integrated = 0;
+    integrator->anchored = true;
+}
+
+void energy_integrator_add_power(energy_integrator_t *integrator, int64_t time_ms, uint32_t power)
+{
+    if (integrator->has_sample)
+    {
+        int64_t elapsed = time_ms - integrator->last_time;
+        if (elapsed > 0 && elapsed <= ENERGY_INTEGRATOR_MAX_GAP_MS)
+        {
+            // Trapezoid: (p0 + p1) / 2 * dt, kept doubled to stay exact in integers
+            integrator->integrated += ((uint64_t)integrator->last_power + power) * (uint64_t)elapsed;
+        }
+    }
+
+    integrator->last_time = time_ms;
+    integrator->last_power = power;
+    integrator->has_sample = true;
+}
+
+bool energy_integrator_value(energy_integrator_t *integrator, uint64_t *energy)
+{
+    if (!integrator->anchored)
+    {
+        return false;
+    }
+
+    uint64_t estimate = integrator->anchor + integrator->integrated / DOUBLE_WMS_PER_WH;
+
+    // After an overshoot the new anchor is below what was reported; hold until it catches up
+    if (estimate > integrator->reported)
+    {
+        integrator->reported = estimate;
+    }
+
+    *energy = integrator->reported;
+    return true;
+}
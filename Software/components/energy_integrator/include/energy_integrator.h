@@ -0,0 +1,33 @@
+#ifndef ENERGY_INTEGRATOR_H
+#define ENERGY_INTEGRATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ENERGY_INTEGRATOR_MAX_GAP_MS 300000 // Longer gaps between power samples are not integrated
+
+// Estimates an energy register between meter updates by integrating power.
+// The estimate restarts from every new register value and never decreases.
+typedef struct {
+    uint64_t anchor;            // Wh, last register value received from the meter
+    uint64_t reported;          // Wh, highest value returned so far
+    uint64_t integrated;        // Twice the energy since the anchor, in W*ms (trapezoid sums)
+    int64_t last_time;          // ms, time of the previous power sample
+    uint32_t last_power;        // W
+    bool anchored;
+    bool has_sample;
+} energy_integrator_t;
+
+void energy_integrator_init(energy_integrator_t *integrator);
+
+// A register value arrived from the meter. Re-anchors when the value changed. Add the power
+// sample of the same frame first: the new value already holds the interval that sample closes.
+void energy_integrator_anchor(energy_integrator_t *integrator, uint64_t energy);
+
+// Add a power sample (W) taken at time_ms on a monotonic clock
+void energy_integrator_add_power(energy_integrator_t *integrator, int64_t time_ms, uint32_t power);
+
+// Current estimate in Wh. Returns false until the first register value has arrived.
+bool energy_integrator_value(energy_integrator_t *integrator, uint64_t *energy);
+
+#endif // ENERGY_INTEGRATOR_H
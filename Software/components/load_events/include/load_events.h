@@ -0,0 +1,60 @@
+#ifndef LOAD_EVENTS_H
+#define LOAD_EVENTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "meter_snapshot.h"
+
+#define LOAD_EVENTS_SIGNATURES 8    // Signature table size, shared by all phases
+#define LOAD_EVENTS_NO_SIGNATURE 0xFF
+
+typedef struct {
+    uint16_t min_step;          // W, smallest step reported
+    uint8_t noise_factor;       // Step must also exceed noise_factor times the noise floor
+    uint8_t settle_count;       // Snapshots a new level must hold before it counts as a step
+    uint8_t tolerance_pct;      // Steps within this % of a signature belong to it
+} load_events_config_t;
+
+// Edge detector state of one phase. Noise floor is Q4 fixed point.
+typedef struct {
+    int32_t baseline;           // W, steady-state level
+    int32_t previous;           // W, last sample
+    uint32_t noise_q4;          // Mean absolute sample-to-sample change while steady, W * 16
+    int32_t pending_sum;        // W, sum of samples at the candidate new level
+    uint8_t pending_count;
+    bool initialized;
+} load_events_phase_t;
+
+// Appliance signature: a step size seen repeatedly on one phase
+typedef struct {
+    uint16_t magnitude;         // W, running mean of matched steps
+    uint16_t count;             // Matched steps, saturating
+    uint8_t phase;
+    bool on;                    // Last matched step was switching on
+} load_signature_t;
+
+typedef struct {
+    load_events_config_t config;
+    load_events_phase_t phases[METER_PHASE_COUNT];
+    load_signature_t signatures[LOAD_EVENTS_SIGNATURES];
+} load_events_t;
+
+// Compact load event record
+typedef struct {
+    uint32_t timestamp;         // Meter clock, seconds since 2000-01-01
+    int16_t delta;              // W, positive when a load switched on
+    uint8_t phase;
+    uint8_t signature;          // Index in the signature table
+} load_event_t;
+
+#define LOAD_EVENT_RECORD_SIZE 8 // Serialized load_event_t, little endian
+
+void load_events_init(load_events_t *events, const load_events_config_t *config);
+
+// Feed one snapshot. Writes detected steps to out (room for METER_PHASE_COUNT) and returns the count.
+uint8_t load_events_update(load_events_t *events, const meter_snapshot_t *snapshot, load_event_t *out);
+
+// Serialize an event to LOAD_EVENT_RECORD_SIZE bytes
+void load_event_serialize(const load_event_t *event, uint8_t *buffer);
+
+#endif // LOAD_EVENTS_H
@@ -0,0 +1,165 @@
+#include "include/load_events.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define NOISE_SHIFT 4           // noise_q4 fractional bits
+#define NOISE_SMOOTHING 16      // EWMA weight of the noise floor
+#define BASELINE_SMOOTHING 8    // EWMA weight of the steady-state baseline
+#define SIGNATURE_AVERAGE_MAX 15
+
+static const dlms_field_type_t kPowerFields[METER_PHASE_COUNT] = {ACTIVE_POWER_A, ACTIVE_POWER_B, ACTIVE_POWER_C};
+
+// Match a step against the signature table, learning a new signature if nothing fits
+static uint8_t classify_step(load_events_t *events, uint8_t phase, int32_t delta)
+{
+    uint32_t magnitude = (uint32_t)abs(delta);
+    if (magnitude > UINT16_MAX)
+    {
+        magnitude = UINT16_MAX;
+    }
+
+    uint8_t best = LOAD_EVENTS_NO_SIGNATURE;
+    uint32_t best_diff = UINT32_MAX;
+    uint8_t victim = 0;
+
+    for (uint8_t i = 0; i < LOAD_EVENTS_SIGNATURES; i++)
+    {
+        const load_signature_t *signature = &events->signatures[i];
+
+        if (signature->count < events->signatures[victim].count)
+        {
+            victim = i;
+        }
+        if (signature->count == 0 || signature->phase != phase)
+        {
+            continue;
+        }
+
+        uint32_t diff = (uint32_t)abs((int32_t)signature->magnitude - (int32_t)magnitude);
+        uint32_t tolerance = (uint32_t)signature->magnitude * events->config.tolerance_pct / 100;
+        if (diff <= tolerance && diff < best_diff)
+        {
+            best = i;
+            best_diff = diff;
+        }
+    }
+
+    if (best == LOAD_EVENTS_NO_SIGNATURE)
+    {
+        // Replace the least seen signature
+        load_signature_t *signature = &events->signatures[victim];
+        signature->magnitude = (uint16_t)magnitude;
+        signature->count = 1;
+        signature->phase = phase;
+        signature->on = delta > 0;
+        return victim;
+    }
+
+    load_signature_t *signature = &events->signatures[best];
+    uint16_t weight = signature->count < SIGNATURE_AVERAGE_MAX ? signature->count : SIGNATURE_AVERAGE_MAX;
+    signature->magnitude = (uint16_t)((int32_t)signature->magnitude + ((int32_t)magnitude - (int32_t)signature->magnitude) / (weight + 1));
+    if (signature->count < UINT16_MAX)
+    {
+        signature->count++;
+    }
+    signature->on = delta > 0;
+    return best;
+}
+
+// Run the edge detector of one phase. Returns true and the step size when a new level settled.
+static bool detect_step(load_events_t *events, load_events_phase_t *ph, int32_t power, int32_t *step)
+{
+    const load_events_config_t *config = &events->config;
+
+    if (!ph->initialized)
+    {
+        ph->baseline = power;
+        ph->previous = power;
+        ph->initialized = true;
+        return false;
+    }
+
+    int32_t threshold = (int32_t)((config->noise_factor * ph->noise_q4) >> NOISE_SHIFT);
+    if (threshold < config->min_step)
+    {
+        threshold = config->min_step;
+    }
+
+    bool detected = false;
+
+    if (abs(power - ph->baseline) > threshold)
+    {
+        // Candidate new level. Restart if the level is still moving.
+        if (ph->pending_count > 0 && abs(power - ph->pending_sum / ph->pending_count) > threshold)
+        {
+            ph->pending_count = 0;
+            ph->pending_sum = 0;
+        }
+        ph->pending_sum += power;
+        ph->pending_count++;
+
+        if (ph->pending_count >= (config->settle_count ? config->settle_count : 1))
+        {
+            int32_t level = ph->pending_sum / ph->pending_count;
+            *step = level - ph->baseline;
+            ph->baseline = level;
+            ph->pending_count = 0;
+            ph->pending_sum = 0;
+            detected = true;
+        }
+    }
+    else
+    {
+        // Steady: learn the noise floor and follow slow drift
+        ph->pending_count = 0;
+        ph->pending_sum = 0;
+
+        int32_t change_q4 = abs(power - ph->previous) << NOISE_SHIFT;
+        ph->noise_q4 = (uint32_t)((int32_t)ph->noise_q4 + (change_q4 - (int32_t)ph->noise_q4) / NOISE_SMOOTHING);
+        ph->baseline += (power - ph->baseline) / BASELINE_SMOOTHING;
+    }
+
+    ph->previous = power;
+    return detected;
+}
+
+void load_events_init(load_events_t *events, const load_events_config_t *config)
+{
+    memset(events, 0, sizeof(load_events_t));
+    events->config = *config;
+}
+
+uint8_t load_events_update(load_events_t *events, const meter_snapshot_t *snapshot, load_event_t *out)
+{
+    uint8_t count = 0;
+
+    for (uint8_t p = 0; p < METER_PHASE_COUNT; p++)
+    {
+        int32_t step;
+
+        if (!meter_snapshot_has(snapshot, kPowerFields[p]) || !detect_step(events, &events->phases[p], snapshot->active_power[p], &step))
+        {
+            continue;
+        }
+
+        load_event_t *event = &out[count++];
+        event->timestamp = snapshot->timestamp;
+        event->delta = (int16_t)(step > INT16_MAX ? INT16_MAX : step < INT16_MIN ? INT16_MIN : step);
+        event->phase = p;
+        event->signature = classify_step(events, p, step);
+    }
+
+    return count;
+}
+
+void load_event_serialize(const load_event_t *event, uint8_t *buffer)
+{
+    buffer[0] = (uint8_t)(event->timestamp);
+    buffer[1] = (uint8_t)(event->timestamp >> 8);
+    buffer[2] = (uint8_t)(event->timestamp >> 16);
+    buffer[3] = (uint8_t)(event->timestamp >> 24);
+    buffer[4] = (uint8_t)((uint16_t)event->delta);
+    buffer[5] = (uint8_t)((uint16_t)event->delta >> 8);
+    buffer[6] = event->phase;
+    buffer[7] = event->signature;
+}
@@ -0,0 +1,118 @@
+// Checks the load step detection, settling and signature matching. Exit code is the number of
+// failed checks.
+
+#include <stdio.h>
+#include <string.h>
+#include "load_events.h"
+
+static int failures = 0;
+
+#define CHECK_EQ(actual, expected)                                                              \
+    do                                                                                          \
+    {                                                                                           \
+        unsigned long long a_ = (unsigned long long)(actual);                                   \
+        unsigned long long e_ = (unsigned long long)(expected);                                 \
+        if (a_ != e_)                                                                           \
+        {                                                                                       \
+            fprintf(stderr, "%s:%d: %s is %llu, expected %llu\n", __FILE__, __LINE__, #actual,   \
+                    a_, e_);                                                                    \
+            failures++;                                                                         \
+        }                                                                                       \
+    } while (0)
+
+// Feed the same power on one phase count times. Returns the number of steps detected, the last
+// one in event.
+static int feed_load(load_events_t *events, meter_phase_t phase, int32_t power, int count, load_event_t *event)
+{
+    static const dlms_field_type_t power_fields[METER_PHASE_COUNT] = {ACTIVE_POWER_A, ACTIVE_POWER_B, ACTIVE_POWER_C};
+    static uint32_t timestamp = 791679600;
+    load_event_t out[METER_PHASE_COUNT];
+    meter_snapshot_t snapshot;
+    int steps = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        meter_snapshot_reset(&snapshot);
+        snapshot.timestamp = timestamp;
+        timestamp += 10;
+        snapshot.active_power[phase] = power;
+        meter_snapshot_mark(&snapshot, power_fields[phase]);
+
+        uint8_t n = load_events_update(events, &snapshot, out);
+        if (n > 0)
+        {
+            *event = out[n - 1];
+            steps += n;
+        }
+    }
+    return steps;
+}
+
+static void test_load_events(void)
+{
+    const load_events_config_t config = {.min_step = 50, .noise_factor = 4, .settle_count = 2, .tolerance_pct = 10};
+    load_events_t events;
+    load_event_t event;
+    uint8_t record[LOAD_EVENT_RECORD_SIZE];
+
+    load_events_init(&events, &config);
+    CHECK_EQ(feed_load(&events, METER_PHASE_A, 300, 10, &event), 0);
+
+    // A new level counts once it held settle_count snapshots, and teaches a signature
+    CHECK_EQ(feed_load(&events, METER_PHASE_A, 2300, 1, &event), 0);
+    CHECK_EQ(feed_load(&events, METER_PHASE_A, 2300, 5, &event), 1);
+    CHECK_EQ(event.phase, METER_PHASE_A);
+    CHECK_EQ(event.delta, 2000);
+    uint8_t kettle = event.signature;
+    CHECK_EQ(events.signatures[kettle].magnitude, 2000);
+    CHECK_EQ(events.signatures[kettle].on, 1);
+
+    // Switching off, and on again within the tolerance, match the same signature
+    CHECK_EQ(feed_load(&events, METER_PHASE_A, 300, 5, &event), 1);
+    CHECK_EQ(event.delta, -2000);
+    CHECK_EQ(event.signature, kettle);
+    CHECK_EQ(events.signatures[kettle].on, 0);
+    CHECK_EQ(feed_load(&events, METER_PHASE_A, 2250, 5, &event), 1);
+    CHECK_EQ(event.delta, 1950);
+    CHECK_EQ(event.signature, kettle);
+    CHECK_EQ(events.signatures[kettle].count, 3);
+    CHECK_EQ(events.signatures[kettle].magnitude, 2000 - 50 / 3);
+    CHECK_EQ(feed_load(&events, METER_PHASE_A, 300, 5, &event), 1);
+    CHECK_EQ(event.signature, kettle);
+
+    // A single spike does not settle
+    CHECK_EQ(feed_load(&events, METER_PHASE_A, 1300, 1, &event), 0);
+    CHECK_EQ(feed_load(&events, METER_PHASE_A, 300, 5, &event), 0);
+
+    // Another step size, or the same step on another phase, is a new signature
+    CHECK_EQ(feed_load(&events, METER_PHASE_A, 800, 5, &event), 1);
+    CHECK_EQ(event.delta, 500);
+    CHECK_EQ(event.signature != kettle, 1);
+    CHECK_EQ(feed_load(&events, METER_PHASE_B, 100, 5, &event), 0);
+    CHECK_EQ(feed_load(&events, METER_PHASE_B, 2100, 5, &event), 1);
+    CHECK_EQ(event.phase, METER_PHASE_B);
+    CHECK_EQ(event.signature != kettle, 1);
+    CHECK_EQ(events.signatures[kettle].count, 4);
+
+    // Changes below min_step are followed as drift, not reported
+    CHECK_EQ(feed_load(&events, METER_PHASE_C, 300, 5, &event), 0);
+    CHECK_EQ(feed_load(&events, METER_PHASE_C, 340, 5, &event), 0);
+    CHECK_EQ(feed_load(&events, METER_PHASE_C, 300, 5, &event), 0);
+
+    // Little endian timestamp and delta, then phase and signature
+    event = (load_event_t){.timestamp = 0x12345678, .delta = -2, .phase = 2, .signature = 5};
+    load_event_serialize(&event, record);
+    const uint8_t expected[LOAD_EVENT_RECORD_SIZE] = {0x78, 0x56, 0x34, 0x12, 0xFE, 0xFF, 0x02, 0x05};
+    CHECK_EQ(memcmp(record, expected, sizeof(expected)), 0);
+}
+
+int main(void)
+{
+    test_load_events();
+
+    if (failures == 0)
+    {
+        printf("All load_events tests passed\n");
+    }
+    return failures;
+}
@@ -0,0 +1,45 @@
+#ifndef PEAK_DEMAND_H
+#define PEAK_DEMAND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PEAK_DEMAND_BLOCK_SECONDS 900   // 15-minute demand blocks, aligned to the meter clock
+#define PEAK_DEMAND_MAX_GAP_SECONDS 60  // Longer gaps between samples are not integrated
+// Blocks covered by samples for less than this, e.g. after a reboot, do not count toward the
+// month maximum: their average rests on too little of the block to be billed
+#define PEAK_DEMAND_MIN_COVERED_SECONDS (PEAK_DEMAND_BLOCK_SECONDS * 9 / 10)
+#define PEAK_DEMAND_STATE_VERSION 1
+
+// Block demand state. Plain data so it can be persisted as a blob and restored after reboot.
+typedef struct {
+    uint8_t version;
+    uint16_t month;             // year * 12 + month of the tracked billing month
+
+    // Month-to-date maximum of completed blocks with PEAK_DEMAND_MIN_COVERED_SECONDS of samples
+    uint32_t max_demand;        // W
+    uint32_t max_demand_time;   // Block start, seconds since 2000-01-01
+
+    // Block in progress
+    uint32_t block_start;       // Seconds since 2000-01-01
+    uint32_t block_covered;     // Seconds of the block covered by samples
+    uint64_t block_energy;      // W*s
+    uint32_t last_time;         // Time of the previous sample, 0 if none
+    uint32_t last_power;        // W
+} peak_demand_t;
+
+void peak_demand_init(peak_demand_t *demand);
+
+// Returns false if the state was not created by peak_demand_init of this version or is not
+// consistent, e.g. a restored blob with its block outside the tracked month
+bool peak_demand_is_valid(const peak_demand_t *demand);
+
+// Add a power sample taken at the given meter time (seconds since 2000-01-01).
+// Power is held from the previous sample until this one. Returns true when a block
+// was closed, which is a good moment to persist the state.
+bool peak_demand_update(peak_demand_t *demand, uint32_t timestamp, uint32_t power);
+
+// Average power of the block in progress so far, in W
+uint32_t peak_demand_running_average(const peak_demand_t *demand);
+
+#endif // PEAK_DEMAND_H
@@ -0,0 +1,126 @@
+#include "include/peak_demand.h"
+#include <string.h>
+
+#define SECONDS_PER_DAY 86400u
+#define DAYS_1970_TO_2000 10957
+
+// year * 12 + (month - 1) of a time in seconds since 2000-01-01
+static uint16_t month_of(uint32_t timestamp)
+{
+    const uint32_t z = timestamp / SECONDS_PER_DAY + DAYS_1970_TO_2000 + 719468;
+    const uint32_t era = z / 146097;
+    const uint32_t doe = z - era * 146097;
+    const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const uint32_t mp = (5 * doy + 2) / 153;
+    const uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+    const uint32_t year = yoe + era * 400 + (month <= 2);
+
+    return (uint16_t)(year * 12 + month - 1);
+}
+
+// Close the block in progress and start the one beginning at block_start
+static bool roll_block(peak_demand_t *demand, uint32_t block_start)
+{
+    bool changed = false;
+
+    if (demand->block_covered > 0)
+    {
+        uint32_t average = (uint32_t)(demand->block_energy / demand->block_covered);
+        if (demand->block_covered >= PEAK_DEMAND_MIN_COVERED_SECONDS &&
+            (demand->max_demand_time == 0 || average > demand->max_demand))
+        {
+            demand->max_demand = average;
+            demand->max_demand_time = demand->block_start;
+        }
+        changed = true;
+    }
+
+    demand->block_start = block_start;
+    demand->block_energy = 0;
+    demand->block_covered = 0;
+
+    uint16_t month = month_of(block_start);
+    if (month != demand->month)
+    {
+        demand->month = month;
+        demand->max_demand = 0;
+        demand->max_demand_time = 0;
+        changed = true;
+    }
+
+    return changed;
+}
+
+void peak_demand_init(peak_demand_t *demand)
+{
+    memset(demand, 0, sizeof(peak_demand_t));
+    demand->version = PEAK_DEMAND_STATE_VERSION;
+}
+
+bool peak_demand_is_valid(const peak_demand_t *demand)
+{
+    if (demand->version != PEAK_DEMAND_STATE_VERSION)
+    {
+        return false;
+    }
+
+    // A fresh state has no block yet, otherwise the block and the maximum lie in the tracked month
+    if (demand->block_start == 0)
+    {
+        return demand->block_covered == 0 && demand->max_demand_time == 0;
+    }
+    return demand->block_start % PEAK_DEMAND_BLOCK_SECONDS == 0 &&
+           demand->block_covered <= PEAK_DEMAND_BLOCK_SECONDS &&
+           month_of(demand->block_start) == demand->month &&
+           (demand->max_demand_time == 0 || month_of(demand->max_demand_time) == demand->month);
+}
+
+bool peak_demand_update(peak_demand_t *demand, uint32_t timestamp, uint32_t power)
+{
+    bool closed = false;
+
+    if (demand->last_time != 0 && timestamp > demand->last_time && timestamp - demand->last_time <= PEAK_DEMAND_MAX_GAP_SECONDS)
+    {
+        // Hold the previous power until now, splitting the interval at block boundaries
+        uint32_t from = demand->last_time;
+        while (from < timestamp)
+        {
+            uint32_t from_block = from - from % PEAK_DEMAND_BLOCK_SECONDS;
+            uint32_t to = from_block + PEAK_DEMAND_BLOCK_SECONDS;
+            if (to > timestamp)
+            {
+                to = timestamp;
+            }
+
+            if (from_block != demand->block_start)
+            {
+                closed |= roll_block(demand, from_block);
+            }
+
+            demand->block_energy += (uint64_t)demand->last_power * (to - from);
+            demand->block_covered += to - from;
+            from = to;
+        }
+    }
+
+    uint32_t block = timestamp - timestamp % PEAK_DEMAND_BLOCK_SECONDS;
+    if (block != demand->block_start)
+    {
+        closed |= roll_block(demand, block);
+    }
+
+    demand->last_time = timestamp;
+    demand->last_power = power;
+
+    return closed;
+}
+
+uint32_t peak_demand_running_average(const peak_demand_t *demand)
+{
+    if (demand->block_covered == 0)
+    {
+        return demand->last_power;
+    }
+    return (uint32_t)(demand->block_energy / demand->block_covered);
+}
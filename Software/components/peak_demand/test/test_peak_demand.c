@@ -0,0 +1,121 @@
+// Checks the 15-minute block demand, the month rollover and the validation of restored state. Exit
+// code is the number of failed checks.
+
+#include <stdio.h>
+#include <string.h>
+#include "peak_demand.h"
+
+static int failures = 0;
+
+#define CHECK_EQ(actual, expected)                                                              \
+    do                                                                                          \
+    {                                                                                           \
+        unsigned long long a_ = (unsigned long long)(actual);                                   \
+        unsigned long long e_ = (unsigned long long)(expected);                                 \
+        if (a_ != e_)                                                                           \
+        {                                                                                       \
+            fprintf(stderr, "%s:%d: %s is %llu, expected %llu\n", __FILE__, __LINE__, #actual,   \
+                    a_, e_);                                                                    \
+            failures++;                                                                         \
+        }                                                                                       \
+    } while (0)
+
+// Samples of one power level every step seconds from from up to, not including, to
+static void feed_demand(peak_demand_t *demand, uint32_t from, uint32_t to, uint32_t step, uint32_t power)
+{
+    for (uint32_t t = from; t < to; t += step)
+    {
+        peak_demand_update(demand, t, power);
+    }
+}
+
+static void test_peak_demand(void)
+{
+    const uint32_t jan31_2300 = 791679600; // 2025-01-31 23:00:00, seconds since 2000-01-01
+    peak_demand_t demand;
+    peak_demand_t restored;
+
+    peak_demand_init(&demand);
+    CHECK_EQ(peak_demand_is_valid(&demand), 1);
+
+    // Power is held from one sample to the next, the block average weights it by time
+    feed_demand(&demand, jan31_2300, jan31_2300 + 450, 10, 1000);
+    feed_demand(&demand, jan31_2300 + 450, jan31_2300 + 601, 10, 3000);
+    CHECK_EQ(peak_demand_running_average(&demand), 1500);
+    feed_demand(&demand, jan31_2300 + 610, jan31_2300 + 900, 10, 3000);
+    CHECK_EQ(demand.max_demand_time, 0);
+
+    // The first sample of the next block closes this one
+    CHECK_EQ(peak_demand_update(&demand, jan31_2300 + 900, 2500), 1);
+    CHECK_EQ(demand.max_demand, 2000);
+    CHECK_EQ(demand.max_demand_time, jan31_2300);
+
+    // A higher block replaces the maximum, a lower one does not
+    feed_demand(&demand, jan31_2300 + 910, jan31_2300 + 1800, 10, 2500);
+    feed_demand(&demand, jan31_2300 + 1800, jan31_2300 + 2700, 10, 1000);
+    CHECK_EQ(demand.max_demand, 2500);
+    CHECK_EQ(demand.max_demand_time, jan31_2300 + 900);
+    feed_demand(&demand, jan31_2300 + 2700, jan31_2300 + 3600, 10, 500);
+    CHECK_EQ(demand.max_demand, 2500);
+
+    // The state survives a save and restore while the month lasts
+    restored = demand;
+    CHECK_EQ(peak_demand_is_valid(&restored), 1);
+
+    // The first block of February starts a new month maximum
+    CHECK_EQ(peak_demand_update(&demand, jan31_2300 + 3600, 1500), 1);
+    CHECK_EQ(demand.max_demand, 0);
+    CHECK_EQ(demand.max_demand_time, 0);
+
+    // Gaps longer than PEAK_DEMAND_MAX_GAP_SECONDS are not covered
+    feed_demand(&demand, jan31_2300 + 3610, jan31_2300 + 4050, 10, 1500);
+    feed_demand(&demand, jan31_2300 + 4050 + PEAK_DEMAND_MAX_GAP_SECONDS + 1, jan31_2300 + 4500, 1, 1500);
+    CHECK_EQ(demand.block_covered, 440 + 449 - PEAK_DEMAND_MAX_GAP_SECONDS - 1);
+    CHECK_EQ(peak_demand_running_average(&demand), 1500);
+    CHECK_EQ(peak_demand_update(&demand, jan31_2300 + 4500, 0), 1);
+    CHECK_EQ(demand.max_demand, 1500);
+    CHECK_EQ(demand.max_demand_time, jan31_2300 + 3600);
+    CHECK_EQ(peak_demand_is_valid(&demand), 1);
+
+    // Restored blobs that do not hold together are rejected
+    restored = demand;
+    restored.version = PEAK_DEMAND_STATE_VERSION + 1;
+    CHECK_EQ(peak_demand_is_valid(&restored), 0);
+    memset(&restored, 0, sizeof(restored));
+    CHECK_EQ(peak_demand_is_valid(&restored), 0);
+    restored = demand;
+    restored.block_start += 1;
+    CHECK_EQ(peak_demand_is_valid(&restored), 0);
+    restored = demand;
+    restored.block_covered = PEAK_DEMAND_BLOCK_SECONDS + 1;
+    CHECK_EQ(peak_demand_is_valid(&restored), 0);
+    restored = demand;
+    restored.month--;
+    CHECK_EQ(peak_demand_is_valid(&restored), 0);
+    restored = demand;
+    restored.max_demand_time = jan31_2300;
+    CHECK_EQ(peak_demand_is_valid(&restored), 0);
+
+    // A block with a few seconds of samples after a gap closes without becoming the maximum
+    feed_demand(&demand, jan31_2300 + 5370, jan31_2300 + 5400, 10, 9000);
+    CHECK_EQ(peak_demand_update(&demand, jan31_2300 + 5400, 2000), 1);
+    CHECK_EQ(demand.max_demand, 1500);
+    CHECK_EQ(demand.max_demand_time, jan31_2300 + 3600);
+
+    // PEAK_DEMAND_MIN_COVERED_SECONDS of samples are enough
+    feed_demand(&demand, jan31_2300 + 5410, jan31_2300 + 6211, 10, 2000);
+    CHECK_EQ(peak_demand_update(&demand, jan31_2300 + 6300, 0), 1);
+    CHECK_EQ(demand.max_demand, 2000);
+    CHECK_EQ(demand.max_demand_time, jan31_2300 + 5400);
+}
+
+int main(void)
+{
+    test_peak_demand();
+
+    if (failures == 0)
+    {
+        printf("All peak_demand tests passed\n");
+    }
+    return failures;
+}
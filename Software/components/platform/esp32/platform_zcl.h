@@ -0,0 +1,8 @@
+#ifndef PLATFORM_ZCL_H
+#define PLATFORM_ZCL_H
+
+// ZCL identifiers come straight from the Zigbee SDK on real hardware
+#include "esp_zigbee_core.h"
+#include "ha/esp_zigbee_ha_standard.h"
+
+#endif // PLATFORM_ZCL_H
@@ -0,0 +1,97 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "platform_zcl.h"
+
+// Hardware abstraction for everything the application touches outside of plain C: UART, GPIO,
+// the button, secret storage and the Zigbee stack. platform_esp32.c drives the real hardware, platform_linux.c
+// runs the same application on ESP-IDF's linux target with a pty per meter UART and an
+// in-memory attribute store in place of the Zigbee stack.
+
+#define PLATFORM_WAIT_FOREVER UINT32_MAX
+#define PLATFORM_ZB_TASK_STACK_SIZE 4096 /* Bytes */
+#define PLATFORM_UART_MAX 2              /* Meter UARTs */
+
+typedef struct {
+    int port;
+    int tx_pin;
+    int rx_pin;
+    uint32_t baud_rate;
+    size_t buffer_size;
+} platform_uart_config_t;
+
+typedef struct {
+    int gpio;
+    uint16_t long_press_ms;
+    void (*on_long_press)(void);
+    void (*on_double_click)(void);
+} platform_button_config_t;
+
+typedef struct {
+    const uint8_t *endpoints;       // One endpoint per meter, must stay valid
+    uint8_t endpoint_count;
+    uint16_t manufacturer_code;     // Used for manufacturer-specific attributes and reports
+    void *(*create_clusters)(uint8_t endpoint); // ESP32 only: returns the esp_zb_cluster_list_t of the endpoint
+    void (*on_commissioning)(void); // Factory new device started network steering
+    void (*on_joined)(void);        // Device is on a network, after steering or a reboot
+    // Custom cluster command received, called from the Zigbee task with the stack locked
+    void (*on_command)(uint16_t cluster_id, uint8_t command_id, const uint8_t *payload, uint16_t length);
+    // Attribute written by a remote device, called from the Zigbee task with the stack locked
+    void (*on_attribute_write)(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, const uint8_t *value, uint16_t size);
+    // Zigbee task storage for static allocation: a StackType_t array of PLATFORM_ZB_TASK_STACK_SIZE
+    // bytes and a StaticTask_t. Both are taken from the heap when NULL.
+    void *task_stack;
+    void *task_buffer;
+} platform_zb_config_t;
+
+// Board
+void platform_init(void);
+void platform_restart(void);
+const char *platform_version(void);
+int64_t platform_time_us(void);
+uint32_t platform_heap_free(void); // Free heap in bytes, 0 where the platform does not track it
+uint32_t platform_heap_min(void);  // Lowest free heap since boot, 0 where not tracked
+uint32_t platform_heap_total(void); // Size of the heap, 0 where not tracked
+uint32_t platform_static_ram(void); // Bytes of .data and .bss, 0 where not tracked
+uint32_t platform_cycle_count(void); // CPU cycle counter, wraps; 0 where there is none
+
+// GPIO
+void platform_gpio_output(int pin);
+void platform_gpio_set_level(int pin, uint32_t level);
+void platform_button_init(const platform_button_config_t *config);
+
+// Meter UARTs. Init returns the number the UART goes by in read and write, -1 on failure. Read
+// waits on all of them and returns the number of bytes read and which UART they came from, 0 on
+// timeout or a discarded overflow.
+int platform_uart_init(const platform_uart_config_t *config);
+int platform_uart_read(uint8_t *buffer, size_t size, uint32_t timeout_ms, int *uart);
+int platform_uart_write(int uart, const uint8_t *data, size_t length);
+
+// Secrets such as meter keys. The ESP32 keeps them in an encrypted NVS partition whose key is
+// derived from an eFuse HMAC key, linux in memory. Read succeeds only for a value of exactly
+// size bytes; writing NULL erases the value.
+bool platform_secure_init(void);
+bool platform_secure_read(const char *name, void *value, size_t size);
+bool platform_secure_write(const char *name, const void *value, size_t size);
+
+// Zigbee. Attribute access must happen between platform_zb_lock() and platform_zb_unlock().
+// attr_type is the ZCL data type of the value, which the fake store needs to know its size.
+// Attributes, reports and commands belong to one of the endpoints in platform_zb_config_t.
+void platform_zb_start(const platform_zb_config_t *config);
+void platform_zb_factory_reset(void);
+void platform_zb_lock(void);
+void platform_zb_unlock(void);
+void platform_zb_set_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, uint8_t attr_type, void *value);
+void platform_zb_set_manufacturer_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, uint8_t attr_type, void *value);
+const void *platform_zb_get_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id);
+void platform_zb_report_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, bool manufacturer);
+// Whether a remote device takes reports of the attribute: its reporting configuration, the default
+// one or one set by a Configure Reporting command, is not disabled.
+bool platform_zb_attribute_reported(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id);
+void platform_zb_send_command(uint8_t endpoint, uint16_t cluster_id, uint8_t command_id, uint8_t data_type, void *value);
+uint32_t platform_zb_stack_free(void); // Zigbee task stack never used, in bytes, 0 where not tracked
+
+#endif // PLATFORM_H
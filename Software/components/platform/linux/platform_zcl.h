@@ -0,0 +1,53 @@
+#ifndef PLATFORM_ZCL_H
+#define PLATFORM_ZCL_H
+
+// The Zigbee SDK is not available on the linux target. These are the ZCL identifiers the
+// application uses, with the names and values of the SDK headers.
+
+// Clusters
+#define ESP_ZB_ZCL_CLUSTER_ID_ALARMS 0x0009U
+#define ESP_ZB_ZCL_CLUSTER_ID_METERING 0x0702U
+#define ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT 0x0B04U
+#define ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS 0x0B05U
+
+// Data types
+#define ESP_ZB_ZCL_ATTR_TYPE_8BITMAP 0x18U
+#define ESP_ZB_ZCL_ATTR_TYPE_16BITMAP 0x19U
+#define ESP_ZB_ZCL_ATTR_TYPE_U8 0x20U
+#define ESP_ZB_ZCL_ATTR_TYPE_U16 0x21U
+#define ESP_ZB_ZCL_ATTR_TYPE_U24 0x22U
+#define ESP_ZB_ZCL_ATTR_TYPE_U32 0x23U
+#define ESP_ZB_ZCL_ATTR_TYPE_U48 0x25U
+#define ESP_ZB_ZCL_ATTR_TYPE_U64 0x27U
+#define ESP_ZB_ZCL_ATTR_TYPE_S8 0x28U
+#define ESP_ZB_ZCL_ATTR_TYPE_S16 0x29U
+#define ESP_ZB_ZCL_ATTR_TYPE_S24 0x2AU
+#define ESP_ZB_ZCL_ATTR_TYPE_S32 0x2BU
+#define ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM 0x30U
+#define ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING 0x41U
+#define ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING 0x42U
+#define ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME 0xE2U
+
+// Electrical Measurement
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_ID 0x0505U
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_ID 0x0508U
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_ID 0x050BU
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_ID 0x050EU
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_ID 0x0510U
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_PHB_ID 0x0905U
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_PHB_ID 0x0908U
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_PHB_ID 0x090BU
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_PH_B_ID 0x090EU
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_PH_B_ID 0x0910U
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_PHC_ID 0x0A05U
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_PHC_ID 0x0A08U
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_PHC_ID 0x0A0BU
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_PH_C_ID 0x0A0EU
+#define ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_PH_C_ID 0x0A10U
+
+// Metering
+#define ESP_ZB_ZCL_ATTR_METERING_CURRENT_SUMMATION_DELIVERED_ID 0x0000U
+#define ESP_ZB_ZCL_ATTR_METERING_CURRENT_SUMMATION_RECEIVED_ID 0x0001U
+#define ESP_ZB_ZCL_ATTR_METERING_METER_SERIAL_NUMBER_ID 0x0308U
+
+#endif // PLATFORM_ZCL_H
@@ -0,0 +1,625 @@
+#include "include/platform.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_cpu.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "driver/gpio.h"
+#include <esp_app_desc.h>
+#include <iot_button.h>
+
+#include "esp_pm.h"
+#include "esp_err.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "diagnostics.h"
+
+#ifdef CONFIG_PM_ENABLE
+#include "esp_private/esp_clk.h"
+#include "esp_sleep.h"
+#endif
+
+/* The role follows the Zigbee device type in menuconfig: End Device (ZB_ZED), the default for
+ * units that sleep between frames, or Router (ZB_ZCZR, see sdkconfig.defaults.router) for units on
+ * a permanent supply that extend the mesh. Both expose the same endpoints and clusters. */
+#if !defined ZB_ED_ROLE && !CONFIG_ZB_ZCZR
+#error Select the End Device or Router Zigbee device type in idf.py menuconfig.
+#endif
+
+/* Zigbee configuration */
+#define INSTALLCODE_POLICY_ENABLE false /* enable the install code policy for security */
+#define ESP_ZB_PRIMARY_CHANNEL_MASK ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK /* Zigbee primary channel mask use in the example */
+
+/* Secrets, see platform_secure_init() */
+#define SECURE_PARTITION "meter_keys"
+#define SECURE_NAMESPACE "secure"
+
+#define ED_AGING_TIMEOUT ESP_ZB_ED_AGING_TIMEOUT_64MIN
+#define ED_KEEP_ALIVE 3000 /* 3000 millisecond */
+
+#define ZR_MAX_CHILDREN 10 /* end devices a router keeps as children */
+
+#define ESP_ZB_ZED_CONFIG()                               \
+    {                                                     \
+        .esp_zb_role = ESP_ZB_DEVICE_TYPE_ED,             \
+        .install_code_policy = INSTALLCODE_POLICY_ENABLE, \
+        .nwk_cfg.zed_cfg = {                              \
+            .ed_timeout = ED_AGING_TIMEOUT,               \
+            .keep_alive = ED_KEEP_ALIVE,                  \
+        },                                                \
+    }
+
+#define ESP_ZB_ZR_CONFIG()                                \
+    {                                                     \
+        .esp_zb_role = ESP_ZB_DEVICE_TYPE_ROUTER,         \
+        .install_code_policy = INSTALLCODE_POLICY_ENABLE, \
+        .nwk_cfg.zczr_cfg = {                             \
+            .max_children = ZR_MAX_CHILDREN,              \
+        },                                                \
+    }
+
+#define ESP_ZB_DEFAULT_RADIO_CONFIG()       \
+    {                                       \
+        .radio_mode = ZB_RADIO_MODE_NATIVE, \
+    }
+
+#define ESP_ZB_DEFAULT_HOST_CONFIG()                          \
+    {                                                         \
+        .host_connection_mode = ZB_HOST_CONNECTION_MODE_NONE, \
+    }
+
+#define UART_EVENT_QUEUE_SIZE 20
+
+static const char *TAG = "Platform";
+
+typedef struct {
+    int port;
+    QueueHandle_t queue;
+} uart_t;
+
+static uart_t uarts[PLATFORM_UART_MAX];
+static int uart_count;
+static QueueSetHandle_t uart_set; // Event queues of all UARTs, so one task can wait on them together
+static platform_zb_config_t zb_config;
+static platform_button_config_t button_config;
+static TaskHandle_t zb_task_handle;
+static bool secure_ready;
+
+void platform_init(void)
+{
+    const esp_app_desc_t *app_desc = esp_app_get_description();
+
+    ESP_LOGI(TAG, "Build Date: %s", app_desc->date);
+    ESP_LOGI(TAG, "Build Time: %s", app_desc->time);
+    ESP_LOGI(TAG, "Project Name: %s", app_desc->project_name);
+}
+
+void platform_restart(void)
+{
+    esp_restart();
+}
+
+const char *platform_version(void)
+{
+    return esp_app_get_description()->version;
+}
+
+int64_t platform_time_us(void)
+{
+    return esp_timer_get_time();
+}
+
+uint32_t platform_heap_free(void)
+{
+    return esp_get_free_heap_size();
+}
+
+uint32_t platform_heap_min(void)
+{
+    return esp_get_minimum_free_heap_size();
+}
+
+uint32_t platform_heap_total(void)
+{
+    return heap_caps_get_total_size(MALLOC_CAP_DEFAULT);
+}
+
+uint32_t platform_static_ram(void)
+{
+    extern char _data_start, _data_end, _bss_start, _bss_end;
+    return (uint32_t)((&_data_end - &_data_start) + (&_bss_end - &_bss_start));
+}
+
+uint32_t platform_cycle_count(void)
+{
+    return esp_cpu_get_cycle_count();
+}
+
+void platform_gpio_output(int pin)
+{
+    gpio_reset_pin(pin);
+    gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+    gpio_set_level(pin, 0);
+}
+
+void platform_gpio_set_level(int pin, uint32_t level)
+{
+    gpio_set_level(pin, level);
+}
+
+static void button_long_press_cb(void *arg, void *usr_data)
+{
+    if (button_config.on_long_press != NULL)
+    {
+        button_config.on_long_press();
+    }
+}
+
+static void button_double_click_cb(void *arg, void *usr_data)
+{
+    if (button_config.on_double_click != NULL)
+    {
+        button_config.on_double_click();
+    }
+}
+
+void platform_button_init(const platform_button_config_t *config)
+{
+    button_config = *config;
+
+    button_config_t gpio_btn_cfg = {
+        .type = BUTTON_TYPE_GPIO,
+        .long_press_time = config->long_press_ms,
+        .short_press_time = CONFIG_BUTTON_SHORT_PRESS_TIME_MS,
+        .gpio_button_config = {
+            .gpio_num = config->gpio,
+            .active_level = 1,
+        },
+    };
+    button_handle_t gpio_btn = iot_button_create(&gpio_btn_cfg);
+    if (NULL == gpio_btn)
+    {
+        ESP_LOGE(TAG, "Button create failed");
+        return;
+    }
+
+    iot_button_register_cb(gpio_btn, BUTTON_LONG_PRESS_START, button_long_press_cb, NULL);
+    iot_button_register_cb(gpio_btn, BUTTON_DOUBLE_CLICK, button_double_click_cb, NULL);
+}
+
+int platform_uart_init(const platform_uart_config_t *config)
+{
+    if (uart_count == PLATFORM_UART_MAX)
+    {
+        ESP_LOGE(TAG, "No UART left for port %d", config->port);
+        return -1;
+    }
+    if (uart_set == NULL)
+    {
+        uart_set = xQueueCreateSet(PLATFORM_UART_MAX * UART_EVENT_QUEUE_SIZE);
+    }
+
+    uart_t *uart = &uarts[uart_count];
+    uart->port = config->port;
+
+    uart_config_t uart_cfg = {
+        .baud_rate = config->baud_rate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_XTAL,
+    };
+
+    // Install UART driver and set pins. The event queue must still be empty when added to the set.
+    if (uart_set == NULL ||
+        uart_driver_install(config->port, config->buffer_size * 2, config->buffer_size * 2, UART_EVENT_QUEUE_SIZE, &uart->queue, 0) != ESP_OK ||
+        xQueueAddToSet(uart->queue, uart_set) != pdPASS ||
+        uart_param_config(config->port, &uart_cfg) != ESP_OK ||
+        uart_set_pin(config->port, config->tx_pin, config->rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "UART%d initialization failed", config->port);
+        return -1;
+    }
+
+    ESP_LOGI(TAG, "UART%d initialized successfully", config->port);
+    return uart_count++;
+}
+
+int platform_uart_read(uint8_t *buffer, size_t size, uint32_t timeout_ms, int *uart)
+{
+    uart_event_t event;
+    TickType_t timeout = timeout_ms == PLATFORM_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+
+    QueueSetMemberHandle_t queue = xQueueSelectFromSet(uart_set, timeout);
+    int index = 0;
+    while (index < uart_count && uarts[index].queue != queue)
+    {
+        index++;
+    }
+
+    // The set still names the queue for events dropped when it was reset after an overflow
+    if (index == uart_count || !xQueueReceive(queue, (void *)&event, 0))
+    {
+        return 0;
+    }
+
+    int port = uarts[index].port;
+    *uart = index;
+
+    switch (event.type)
+    {
+    case UART_DATA:
+        return uart_read_bytes(port, buffer, event.size < size ? event.size : size, portMAX_DELAY);
+    case UART_FIFO_OVF:
+        ESP_LOGW(TAG, "UART%d FIFO Overflow", port);
+        diag_increment(DIAG_UART_FIFO_OVERFLOWS);
+        uart_flush_input(port);
+        xQueueReset(queue);
+        break;
+    case UART_BUFFER_FULL:
+        ESP_LOGW(TAG, "UART%d Ring Buffer Full", port);
+        diag_increment(DIAG_UART_BUFFER_FULL);
+        uart_flush_input(port);
+        xQueueReset(queue);
+        break;
+    case UART_BREAK:
+        ESP_LOGW(TAG, "UART%d Break", port);
+        break;
+    case UART_PARITY_ERR:
+        ESP_LOGW(TAG, "UART%d Parity Error", port);
+        break;
+    case UART_FRAME_ERR:
+        ESP_LOGW(TAG, "UART%d Frame Error", port);
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+int platform_uart_write(int uart, const uint8_t *data, size_t length)
+{
+    if (uart < 0 || uart >= uart_count)
+    {
+        return -1;
+    }
+    return uart_write_bytes(uarts[uart].port, (const char *)data, length);
+}
+
+static void bdb_start_top_level_commissioning_cb(uint8_t mode_mask)
+{
+    ESP_RETURN_ON_FALSE(esp_zb_bdb_start_top_level_commissioning(mode_mask) == ESP_OK, , TAG, "Failed to start Zigbee commissioning");
+}
+
+void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct)
+{
+    uint32_t *p_sg_p = signal_struct->p_app_signal;
+    esp_err_t err_status = signal_struct->esp_err_status;
+    esp_zb_app_signal_type_t sig_type = *p_sg_p;
+    switch (sig_type)
+    {
+    case ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP:
+        ESP_LOGI(TAG, "Initialize Zigbee stack");
+        esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_INITIALIZATION);
+        break;
+    case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START:
+    case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT:
+        if (err_status == ESP_OK)
+        {
+            ESP_LOGI(TAG, "Device started up in %s factory-reset mode", esp_zb_bdb_is_factory_new() ? "" : "non");
+            if (esp_zb_bdb_is_factory_new())
+            {
+                ESP_LOGI(TAG, "Start network steering");
+                esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_NETWORK_STEERING);
+
+                if (zb_config.on_commissioning != NULL)
+                {
+                    zb_config.on_commissioning();
+                }
+            }
+            else
+            {
+                ESP_LOGI(TAG, "Device rebooted");
+
+                if (zb_config.on_joined != NULL)
+                {
+                    zb_config.on_joined();
+                }
+            }
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Failed to initialize Zigbee stack (status: %s)", esp_err_to_name(err_status));
+        }
+        break;
+
+    case ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE:
+        ESP_LOGI(TAG, "Device announce received");
+        break;
+
+    case ESP_ZB_BDB_SIGNAL_STEERING:
+        if (err_status == ESP_OK)
+        {
+            esp_zb_ieee_addr_t extended_pan_id;
+            esp_zb_get_extended_pan_id(extended_pan_id);
+            ESP_LOGI(TAG, "Joined network successfully (Extended PAN ID: %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x, PAN ID: 0x%04hx, Channel:%d, Short Address: 0x%04hx)",
+                     extended_pan_id[7], extended_pan_id[6], extended_pan_id[5], extended_pan_id[4],
+                     extended_pan_id[3], extended_pan_id[2], extended_pan_id[1], extended_pan_id[0],
+                     esp_zb_get_pan_id(), esp_zb_get_current_channel(), esp_zb_get_short_address());
+
+            if (zb_config.on_joined != NULL)
+            {
+                zb_config.on_joined();
+            }
+        }
+        else
+        {
+            ESP_LOGI(TAG, "Network steering was not successful (status: %s)", esp_err_to_name(err_status));
+            esp_zb_scheduler_alarm((esp_zb_callback_t)bdb_start_top_level_commissioning_cb, ESP_ZB_BDB_MODE_NETWORK_STEERING, 1000);
+        }
+        break;
+
+    case ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS:
+        if (err_status == ESP_OK)
+        {
+            if (*(uint8_t *)esp_zb_app_signal_get_params(p_sg_p))
+            {
+                ESP_LOGI(TAG, "Network(0x%04hx) is open for %d seconds", esp_zb_get_pan_id(), *(uint8_t *)esp_zb_app_signal_get_params(p_sg_p));
+            }
+            else
+            {
+                ESP_LOGW(TAG, "Network(0x%04hx) closed, devices joining not allowed.", esp_zb_get_pan_id());
+            }
+        }
+        break;
+
+#if defined ZB_ED_ROLE
+    case ESP_ZB_COMMON_SIGNAL_CAN_SLEEP:
+        esp_zb_sleep_now();
+        break;
+#endif
+
+    default:
+        ESP_LOGI(TAG, "ZDO signal: %s (0x%x), status: %s", esp_zb_zdo_signal_to_string(sig_type), sig_type, esp_err_to_name(err_status));
+        break;
+    }
+}
+
+static esp_err_t zb_action_handler(esp_zb_core_action_callback_id_t callback_id, const void *message)
+{
+    if (callback_id == ESP_ZB_CORE_CMD_CUSTOM_CLUSTER_REQ_CB_ID && zb_config.on_command != NULL)
+    {
+        const esp_zb_zcl_custom_cluster_command_message_t *command = message;
+        zb_config.on_command(command->info.cluster, command->info.command.id, command->data.value, command->data.size);
+    }
+    else if (callback_id == ESP_ZB_CORE_SET_ATTR_VALUE_CB_ID && zb_config.on_attribute_write != NULL)
+    {
+        const esp_zb_zcl_set_attr_value_message_t *write = message;
+        zb_config.on_attribute_write(write->info.dst_endpoint, write->info.cluster, write->attribute.id, write->attribute.data.value, write->attribute.data.size);
+    }
+    return ESP_OK;
+}
+
+static void esp_zb_task(void *pvParameters)
+{
+    /* initialize Zigbee stack */
+#if defined ZB_ED_ROLE
+    esp_zb_cfg_t zb_nwk_cfg = ESP_ZB_ZED_CONFIG();
+    esp_zb_sleep_enable(true);
+#else
+    /* A router relays for its neighbours and keeps the radio on */
+    esp_zb_cfg_t zb_nwk_cfg = ESP_ZB_ZR_CONFIG();
+#endif
+    esp_zb_init(&zb_nwk_cfg);
+    esp_zb_ep_list_t *esp_zb_sensor_ep = esp_zb_ep_list_create();
+
+    for (uint8_t i = 0; i < zb_config.endpoint_count; i++)
+    {
+        esp_zb_endpoint_config_t endpoint_config = {
+            .endpoint = zb_config.endpoints[i],
+            .app_profile_id = ESP_ZB_AF_HA_PROFILE_ID,
+            .app_device_id = ESP_ZB_HA_COMBINED_INTERFACE_DEVICE_ID,
+            .app_device_version = 0};
+
+        esp_zb_cluster_list_t *cluster_list = (esp_zb_cluster_list_t *)zb_config.create_clusters(zb_config.endpoints[i]);
+        esp_zb_ep_list_add_ep(esp_zb_sensor_ep, cluster_list, endpoint_config);
+    }
+    esp_zb_device_register(esp_zb_sensor_ep);
+    esp_zb_core_action_handler_register(zb_action_handler);
+
+    esp_zb_set_primary_network_channel_set(ESP_ZB_PRIMARY_CHANNEL_MASK);
+    ESP_ERROR_CHECK(esp_zb_start(false));
+
+    esp_zb_stack_main_loop();
+}
+
+static esp_err_t esp_zb_power_save_init(void)
+{
+    esp_err_t rc = ESP_OK;
+#if defined CONFIG_PM_ENABLE && defined ZB_ED_ROLE
+    int cur_cpu_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = cur_cpu_freq_mhz,
+        .min_freq_mhz = cur_cpu_freq_mhz,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true
+#endif
+    };
+    rc = esp_pm_configure(&pm_config);
+#endif
+    return rc;
+}
+
+void platform_zb_start(const platform_zb_config_t *config)
+{
+    zb_config = *config;
+
+    esp_zb_platform_config_t platform_config = {
+        .radio_config = ESP_ZB_DEFAULT_RADIO_CONFIG(),
+        .host_config = ESP_ZB_DEFAULT_HOST_CONFIG(),
+    };
+    ESP_ERROR_CHECK(esp_zb_power_save_init());
+    ESP_ERROR_CHECK(esp_zb_platform_config(&platform_config));
+
+    if (config->task_stack != NULL && config->task_buffer != NULL)
+    {
+        zb_task_handle = xTaskCreateStatic(esp_zb_task, "Zigbee_main", PLATFORM_ZB_TASK_STACK_SIZE, NULL, 5, config->task_stack, config->task_buffer);
+    }
+    else
+    {
+        xTaskCreate(esp_zb_task, "Zigbee_main", PLATFORM_ZB_TASK_STACK_SIZE, NULL, 5, &zb_task_handle);
+    }
+}
+
+void platform_zb_factory_reset(void)
+{
+    esp_zb_factory_reset();
+}
+
+void platform_zb_lock(void)
+{
+    esp_zb_lock_acquire(portMAX_DELAY);
+}
+
+void platform_zb_unlock(void)
+{
+    esp_zb_lock_release();
+}
+
+void platform_zb_set_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, uint8_t attr_type, void *value)
+{
+    esp_zb_zcl_set_attribute_val(endpoint, cluster_id, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attr_id, value, false);
+}
+
+void platform_zb_set_manufacturer_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, uint8_t attr_type, void *value)
+{
+    esp_zb_zcl_set_manufacturer_attribute_val(endpoint, cluster_id, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, zb_config.manufacturer_code, attr_id, value, false);
+}
+
+const void *platform_zb_get_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id)
+{
+    esp_zb_zcl_attr_t *attr = esp_zb_zcl_get_attribute(endpoint, cluster_id, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, attr_id);
+    return attr != NULL ? attr->data_p : NULL;
+}
+
+void platform_zb_report_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, bool manufacturer)
+{
+    esp_zb_zcl_report_attr_cmd_t report_attr_cmd = {0};
+    report_attr_cmd.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
+    report_attr_cmd.attributeID = attr_id;
+    report_attr_cmd.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI;
+    report_attr_cmd.clusterID = cluster_id;
+    if (manufacturer)
+    {
+        report_attr_cmd.manuf_specific = 1;
+        report_attr_cmd.manuf_code = zb_config.manufacturer_code;
+    }
+    report_attr_cmd.zcl_basic_cmd.src_endpoint = endpoint;
+
+    esp_zb_zcl_report_attr_cmd_req(&report_attr_cmd);
+}
+
+bool platform_zb_attribute_reported(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id)
+{
+    esp_zb_zcl_attr_location_info_t location = {
+        .endpoint_id = endpoint,
+        .cluster_id = cluster_id,
+        .cluster_role = ESP_ZB_ZCL_CLUSTER_SERVER_ROLE,
+        .manuf_code = ESP_ZB_ZCL_ATTR_NON_MANUFACTURER_SPECIFIC,
+        .attr_id = attr_id,
+    };
+    const esp_zb_zcl_reporting_info_t *info = esp_zb_zcl_find_reporting_info(location);
+
+    // A maximum interval of 0xFFFF switches reporting off
+    return info != NULL && info->u.send_info.max_interval != 0xFFFF;
+}
+
+void platform_zb_send_command(uint8_t endpoint, uint16_t cluster_id, uint8_t command_id, uint8_t data_type, void *value)
+{
+    esp_zb_zcl_custom_cluster_cmd_req_t cmd = {0};
+    cmd.zcl_basic_cmd.src_endpoint = endpoint;
+    cmd.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
+    cmd.profile_id = ESP_ZB_AF_HA_PROFILE_ID;
+    cmd.cluster_id = cluster_id;
+    cmd.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI;
+    cmd.custom_cmd_id = command_id;
+    cmd.data.type = data_type;
+    cmd.data.value = value;
+
+    esp_zb_zcl_custom_cluster_cmd_req(&cmd);
+}
+
+uint32_t platform_zb_stack_free(void)
+{
+    return zb_task_handle != NULL ? uxTaskGetStackHighWaterMark(zb_task_handle) : 0;
+}
+
+bool platform_secure_init(void)
+{
+#if CONFIG_NVS_ENCRYPTION
+    nvs_sec_scheme_t *scheme = nvs_flash_get_default_security_scheme();
+    nvs_sec_cfg_t cfg;
+    esp_err_t err = scheme != NULL ? nvs_flash_read_security_cfg_v2(scheme, &cfg) : ESP_ERR_INVALID_STATE;
+    if (err != ESP_OK && scheme != NULL)
+    {
+        // First boot: the HMAC key is generated and burned into the eFuse key block
+        ESP_LOGW(TAG, "No NVS encryption key (%s), generating one", esp_err_to_name(err));
+        err = nvs_flash_generate_keys_v2(scheme, &cfg);
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_flash_secure_init_partition(SECURE_PARTITION, &cfg);
+    }
+#else
+    ESP_LOGW(TAG, "NVS encryption is off, secrets are stored in plain text");
+    esp_err_t err = nvs_flash_init_partition(SECURE_PARTITION);
+#endif
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Secure storage unavailable: %s", esp_err_to_name(err));
+        return false;
+    }
+    secure_ready = true;
+    return true;
+}
+
+bool platform_secure_read(const char *name, void *value, size_t size)
+{
+    nvs_handle_t handle;
+    if (!secure_ready || nvs_open_from_partition(SECURE_PARTITION, SECURE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    size_t stored = size;
+    esp_err_t err = nvs_get_blob(handle, name, value, &stored);
+    nvs_close(handle);
+    return err == ESP_OK && stored == size;
+}
+
+bool platform_secure_write(const char *name, const void *value, size_t size)
+{
+    nvs_handle_t handle;
+    if (!secure_ready || nvs_open_from_partition(SECURE_PARTITION, SECURE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    esp_err_t err = value != NULL ? nvs_set_blob(handle, name, value, size) : nvs_erase_key(handle, name);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        err = ESP_OK;
+    }
+    if (err == ESP_OK)
+    {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err == ESP_OK;
+}
@@ -0,0 +1,613 @@
+#define _GNU_SOURCE // posix_openpt(), ptsname(), cfmakeraw()
+#include "include/platform.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Linux target: each meter UART is a pseudo terminal and the Zigbee stack is replaced by an
+// in-memory attribute store that records every set, report and command.
+//
+// Environment:
+//   WATTZIG_UART_LINK   Create a symlink to the pty slave, e.g. /tmp/wattzig-uart, for the meter simulator.
+//                       Further UARTs get the link with their number appended, /tmp/wattzig-uart1.
+//   WATTZIG_ZB_RECORD   Append every attribute set, report and command to this file
+//   WATTZIG_GPIO_LOG    Log GPIO level changes when set
+//   WATTZIG_ZB_UNREPORTED  Treat every attribute as not reported, otherwise all of them are
+//   WATTZIG_SECURE_<NAME>  Hex value of a secret not yet written, e.g. WATTZIG_SECURE_METER_EK
+
+#define FAKE_MAX_ATTRIBUTES 320
+#define FAKE_MAX_VALUE_SIZE 33      // Octet strings: length byte + 32 bytes
+#define BURST_GAP_US 100000         // Silence that separates two meter pushes
+#define LATENCY_SUMMARY_FRAMES 60   // Frames between latency summaries
+#define SECURE_MAX_ENTRIES 8
+#define SECURE_MAX_NAME 16
+#define SECURE_MAX_SIZE 32
+
+static const char *TAG = "Platform";
+
+typedef struct {
+    uint8_t endpoint;
+    uint16_t cluster_id;
+    uint16_t attr_id;
+    bool manufacturer;
+    uint8_t type;
+    uint8_t size;
+    uint8_t value[FAKE_MAX_VALUE_SIZE];
+    uint32_t sets;
+    uint32_t reports;
+} fake_attribute_t;
+
+// Latency from the first byte of a push to the first attribute set, the first report or
+// command, and the end of the frame (lock released)
+typedef struct {
+    uint32_t count;
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+} latency_t;
+
+static fake_attribute_t attributes[FAKE_MAX_ATTRIBUTES];
+static int attribute_count = 0;
+static SemaphoreHandle_t zb_mutex;
+static platform_zb_config_t zb_config;
+static FILE *record_file;
+static bool gpio_log;
+static uint32_t gpio_levels;
+
+typedef struct {
+    int master;
+    int slave;
+    int64_t last_byte_time;
+    int64_t burst_start;
+} uart_t;
+
+static uart_t uarts[PLATFORM_UART_MAX];
+static int uart_count = 0;
+static int uart_next = 0;          // First UART to check for data, so a busy one cannot starve the others
+
+static int64_t burst_start = 0;    // Of the UART read last
+static int64_t frame_first_byte = 0;
+static int64_t frame_first_set = 0;
+static int64_t frame_first_report = 0;
+static int lock_depth = 0;
+static uint32_t frames = 0;
+static latency_t latency_set;
+static latency_t latency_report;
+static latency_t latency_frame;
+
+void platform_init(void)
+{
+    const char *record_path = getenv("WATTZIG_ZB_RECORD");
+    if (record_path != NULL)
+    {
+        record_file = fopen(record_path, "a");
+        if (record_file == NULL)
+        {
+            ESP_LOGE(TAG, "Cannot open %s: %s", record_path, strerror(errno));
+        }
+    }
+    gpio_log = getenv("WATTZIG_GPIO_LOG") != NULL;
+
+    zb_mutex = xSemaphoreCreateRecursiveMutex();
+}
+
+void platform_restart(void)
+{
+    ESP_LOGW(TAG, "Restart requested, exiting");
+    exit(0);
+}
+
+const char *platform_version(void)
+{
+    return "linux";
+}
+
+int64_t platform_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t platform_heap_free(void)
+{
+    return 0; // The host heap is not the constraint being measured
+}
+
+uint32_t platform_heap_min(void)
+{
+    return 0;
+}
+
+uint32_t platform_heap_total(void)
+{
+    return 0;
+}
+
+uint32_t platform_static_ram(void)
+{
+    return 0;
+}
+
+uint32_t platform_cycle_count(void)
+{
+    return 0; // Host timings say nothing about the device
+}
+
+void platform_gpio_output(int pin)
+{
+    platform_gpio_set_level(pin, 0);
+}
+
+void platform_gpio_set_level(int pin, uint32_t level)
+{
+    uint32_t bit = 1UL << pin;
+    bool changed = ((gpio_levels & bit) != 0) != (level != 0);
+
+    gpio_levels = level ? gpio_levels | bit : gpio_levels & ~bit;
+    if (gpio_log && changed)
+    {
+        ESP_LOGI(TAG, "GPIO %d = %" PRIu32, pin, level);
+    }
+}
+
+void platform_button_init(const platform_button_config_t *config)
+{
+    // No button on the workstation
+    (void)config;
+}
+
+int platform_uart_init(const platform_uart_config_t *config)
+{
+    if (uart_count == PLATFORM_UART_MAX)
+    {
+        ESP_LOGE(TAG, "No UART left for port %d", config->port);
+        return -1;
+    }
+    uart_t *uart = &uarts[uart_count];
+
+    uart->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (uart->master < 0 || grantpt(uart->master) != 0 || unlockpt(uart->master) != 0)
+    {
+        ESP_LOGE(TAG, "Cannot create pty: %s", strerror(errno));
+        return -1;
+    }
+
+    const char *slave_name = ptsname(uart->master);
+
+    // Keep the slave open so reads do not fail while no simulator is connected, and make it raw
+    uart->slave = open(slave_name, O_RDWR | O_NOCTTY);
+    if (uart->slave < 0)
+    {
+        ESP_LOGE(TAG, "Cannot open %s: %s", slave_name, strerror(errno));
+        return -1;
+    }
+
+    struct termios tio;
+    tcgetattr(uart->slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(uart->slave, TCSANOW, &tio);
+
+    char link[256];
+    const char *link_base = getenv("WATTZIG_UART_LINK");
+    if (link_base != NULL)
+    {
+        if (uart_count == 0)
+        {
+            snprintf(link, sizeof(link), "%s", link_base);
+        }
+        else
+        {
+            snprintf(link, sizeof(link), "%s%d", link_base, uart_count);
+        }
+        unlink(link);
+        if (symlink(slave_name, link) != 0)
+        {
+            ESP_LOGW(TAG, "Cannot link %s: %s", link, strerror(errno));
+        }
+    }
+
+    ESP_LOGI(TAG, "Meter UART %d on %s%s%s", uart_count, slave_name, link_base != NULL ? ", linked from " : "", link_base != NULL ? link : "");
+    return uart_count++;
+}
+
+int platform_uart_read(uint8_t *buffer, size_t size, uint32_t timeout_ms, int *uart)
+{
+    struct pollfd pfd[PLATFORM_UART_MAX];
+    int timeout = timeout_ms == PLATFORM_WAIT_FOREVER ? -1 : (int)timeout_ms;
+
+    for (int i = 0; i < uart_count; i++)
+    {
+        pfd[i] = (struct pollfd){.fd = uarts[i].master, .events = POLLIN};
+    }
+
+    int ready = poll(pfd, uart_count, timeout);
+    if (ready <= 0)
+    {
+        return 0; // Timeout, or interrupted by the FreeRTOS tick signal
+    }
+
+    int index = uart_next;
+    while (!(pfd[index].revents & POLLIN))
+    {
+        index = (index + 1) % uart_count;
+        if (index == uart_next)
+        {
+            return 0;
+        }
+    }
+    uart_next = (index + 1) % uart_count;
+
+    ssize_t length = read(uarts[index].master, buffer, size);
+    if (length <= 0)
+    {
+        return 0;
+    }
+
+    int64_t now = platform_time_us();
+    if (now - uarts[index].last_byte_time > BURST_GAP_US)
+    {
+        uarts[index].burst_start = now;
+    }
+    uarts[index].last_byte_time = now;
+    burst_start = uarts[index].burst_start;
+
+    *uart = index;
+    return (int)length;
+}
+
+int platform_uart_write(int uart, const uint8_t *data, size_t length)
+{
+    if (uart < 0 || uart >= uart_count)
+    {
+        return -1;
+    }
+    return (int)write(uarts[uart].master, data, length);
+}
+
+void platform_zb_start(const platform_zb_config_t *config)
+{
+    zb_config = *config;
+
+    ESP_LOGI(TAG, "Fake Zigbee stack started, %d endpoints from %d", config->endpoint_count, config->endpoints[0]);
+
+    if (zb_config.on_joined != NULL)
+    {
+        zb_config.on_joined();
+    }
+}
+
+void platform_zb_factory_reset(void)
+{
+    ESP_LOGW(TAG, "Factory reset, clearing attribute store");
+
+    xSemaphoreTakeRecursive(zb_mutex, portMAX_DELAY);
+    attribute_count = 0;
+    xSemaphoreGiveRecursive(zb_mutex);
+}
+
+static void latency_add(latency_t *latency, int64_t value)
+{
+    if (latency->count == 0 || value < latency->min)
+    {
+        latency->min = value;
+    }
+    if (value > latency->max)
+    {
+        latency->max = value;
+    }
+    latency->sum += value;
+    latency->count++;
+}
+
+static void latency_log(const char *name, const latency_t *latency)
+{
+    if (latency->count == 0)
+    {
+        return;
+    }
+    ESP_LOGI(TAG, "  %-24s min %8" PRId64 " us  mean %8" PRId64 " us  max %8" PRId64 " us",
+             name, latency->min, latency->sum / latency->count, latency->max);
+}
+
+void platform_zb_lock(void)
+{
+    xSemaphoreTakeRecursive(zb_mutex, portMAX_DELAY);
+
+    if (lock_depth++ == 0)
+    {
+        frame_first_byte = burst_start;
+        frame_first_set = 0;
+        frame_first_report = 0;
+    }
+}
+
+void platform_zb_unlock(void)
+{
+    if (--lock_depth == 0 && frame_first_byte != 0 && (frame_first_set != 0 || frame_first_report != 0))
+    {
+        int64_t now = platform_time_us();
+
+        if (frame_first_set != 0)
+        {
+            latency_add(&latency_set, frame_first_set - frame_first_byte);
+        }
+        if (frame_first_report != 0)
+        {
+            latency_add(&latency_report, frame_first_report - frame_first_byte);
+        }
+        latency_add(&latency_frame, now - frame_first_byte);
+
+        if (++frames % LATENCY_SUMMARY_FRAMES == 0)
+        {
+            ESP_LOGI(TAG, "Latency after %" PRIu32 " frames, %d attributes:", frames, attribute_count);
+            latency_log("first byte to set", &latency_set);
+            latency_log("first byte to report", &latency_report);
+            latency_log("first byte to frame end", &latency_frame);
+        }
+    }
+
+    xSemaphoreGiveRecursive(zb_mutex);
+}
+
+static uint8_t value_size(uint8_t attr_type, const void *value)
+{
+    switch (attr_type)
+    {
+    case ESP_ZB_ZCL_ATTR_TYPE_U16:
+    case ESP_ZB_ZCL_ATTR_TYPE_S16:
+    case ESP_ZB_ZCL_ATTR_TYPE_16BITMAP:
+        return 2;
+    case ESP_ZB_ZCL_ATTR_TYPE_U24:
+    case ESP_ZB_ZCL_ATTR_TYPE_S24:
+    case ESP_ZB_ZCL_ATTR_TYPE_U32:
+    case ESP_ZB_ZCL_ATTR_TYPE_S32:
+    case ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME:
+        return 4;
+    case ESP_ZB_ZCL_ATTR_TYPE_U48:
+    case ESP_ZB_ZCL_ATTR_TYPE_U64:
+        return 8;
+    case ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING:
+    case ESP_ZB_ZCL_ATTR_TYPE_CHAR_STRING:
+    {
+        uint8_t length = *(const uint8_t *)value;
+        return (uint8_t)(length < FAKE_MAX_VALUE_SIZE ? length + 1 : FAKE_MAX_VALUE_SIZE);
+    }
+    default:
+        return 1;
+    }
+}
+
+static void record(const char *kind, uint8_t endpoint, uint16_t cluster_id, uint16_t id, bool manufacturer, const uint8_t *value, uint8_t size)
+{
+    if (record_file == NULL)
+    {
+        return;
+    }
+
+    fprintf(record_file, "%" PRId64 " %s %d 0x%04X %s0x%04X", platform_time_us(), kind, endpoint, cluster_id, manufacturer ? "M" : "", id);
+    for (uint8_t i = 0; i < size; i++)
+    {
+        fprintf(record_file, "%s%02X", i == 0 ? " " : "", value[i]);
+    }
+    fputc('\n', record_file);
+    fflush(record_file);
+}
+
+static fake_attribute_t *find_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, bool manufacturer)
+{
+    for (int i = 0; i < attribute_count; i++)
+    {
+        fake_attribute_t *attr = &attributes[i];
+        if (attr->endpoint == endpoint && attr->cluster_id == cluster_id && attr->attr_id == attr_id && attr->manufacturer == manufacturer)
+        {
+            return attr;
+        }
+    }
+    return NULL;
+}
+
+static void set_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, bool manufacturer, uint8_t attr_type, const void *value)
+{
+    fake_attribute_t *attr = find_attribute(endpoint, cluster_id, attr_id, manufacturer);
+
+    if (attr == NULL)
+    {
+        if (attribute_count == FAKE_MAX_ATTRIBUTES)
+        {
+            ESP_LOGE(TAG, "Attribute store full, dropping %d/0x%04X/0x%04X", endpoint, cluster_id, attr_id);
+            return;
+        }
+        attr = &attributes[attribute_count++];
+        memset(attr, 0, sizeof(fake_attribute_t));
+        attr->endpoint = endpoint;
+        attr->cluster_id = cluster_id;
+        attr->attr_id = attr_id;
+        attr->manufacturer = manufacturer;
+    }
+
+    attr->type = attr_type;
+    attr->size = value_size(attr_type, value);
+    memcpy(attr->value, value, attr->size);
+    attr->sets++;
+
+    if (frame_first_set == 0)
+    {
+        frame_first_set = platform_time_us();
+    }
+    record("SET", endpoint, cluster_id, attr_id, manufacturer, attr->value, attr->size);
+}
+
+void platform_zb_set_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, uint8_t attr_type, void *value)
+{
+    set_attribute(endpoint, cluster_id, attr_id, false, attr_type, value);
+}
+
+void platform_zb_set_manufacturer_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, uint8_t attr_type, void *value)
+{
+    set_attribute(endpoint, cluster_id, attr_id, true, attr_type, value);
+}
+
+const void *platform_zb_get_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id)
+{
+    fake_attribute_t *attr = find_attribute(endpoint, cluster_id, attr_id, false);
+    return attr != NULL ? attr->value : NULL;
+}
+
+void platform_zb_report_attribute(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, bool manufacturer)
+{
+    fake_attribute_t *attr = find_attribute(endpoint, cluster_id, attr_id, manufacturer);
+
+    if (frame_first_report == 0)
+    {
+        frame_first_report = platform_time_us();
+    }
+
+    if (attr == NULL)
+    {
+        ESP_LOGW(TAG, "Report of unset attribute %d/0x%04X/0x%04X", endpoint, cluster_id, attr_id);
+        record("REPORT", endpoint, cluster_id, attr_id, manufacturer, NULL, 0);
+        return;
+    }
+
+    attr->reports++;
+    record("REPORT", endpoint, cluster_id, attr_id, manufacturer, attr->value, attr->size);
+}
+
+bool platform_zb_attribute_reported(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id)
+{
+    return getenv("WATTZIG_ZB_UNREPORTED") == NULL;
+}
+
+void platform_zb_send_command(uint8_t endpoint, uint16_t cluster_id, uint8_t command_id, uint8_t data_type, void *value)
+{
+    uint8_t size = value_size(data_type, value);
+
+    if (frame_first_report == 0)
+    {
+        frame_first_report = platform_time_us();
+    }
+
+    ESP_LOGI(TAG, "Command 0x%02X on cluster 0x%04X of endpoint %d", command_id, cluster_id, endpoint);
+    record("COMMAND", endpoint, cluster_id, command_id, false, value, size);
+}
+
+uint32_t platform_zb_stack_free(void)
+{
+    return 0; // No Zigbee task
+}
+
+typedef struct {
+    char name[SECURE_MAX_NAME];
+    uint8_t value[SECURE_MAX_SIZE];
+    size_t size;
+    bool erased;
+} secure_entry_t;
+
+static secure_entry_t secure_entries[SECURE_MAX_ENTRIES];
+
+static secure_entry_t *secure_find(const char *name, bool create)
+{
+    secure_entry_t *free_entry = NULL;
+    for (size_t i = 0; i < SECURE_MAX_ENTRIES; i++)
+    {
+        if (strcmp(secure_entries[i].name, name) == 0)
+        {
+            return &secure_entries[i];
+        }
+        if (free_entry == NULL && secure_entries[i].name[0] == '\0')
+        {
+            free_entry = &secure_entries[i];
+        }
+    }
+    if (!create || free_entry == NULL || strlen(name) >= SECURE_MAX_NAME)
+    {
+        return NULL;
+    }
+    strcpy(free_entry->name, name);
+    free_entry->erased = true;
+    return free_entry;
+}
+
+// WATTZIG_SECURE_<NAME> as hex, used until the value is first written or erased
+static bool secure_from_env(const char *name, uint8_t *value, size_t size)
+{
+    char variable[64] = "WATTZIG_SECURE_";
+    size_t length = strlen(variable);
+    for (; *name != '\0' && length < sizeof(variable) - 1; name++)
+    {
+        variable[length++] = (char)toupper((unsigned char)*name);
+    }
+    variable[length] = '\0';
+
+    const char *hex = getenv(variable);
+    if (hex == NULL || strlen(hex) != size * 2)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+        {
+            return false;
+        }
+        value[i] = (uint8_t)byte;
+    }
+    return true;
+}
+
+bool platform_secure_init(void)
+{
+    return true;
+}
+
+bool platform_secure_read(const char *name, void *value, size_t size)
+{
+    const secure_entry_t *entry = secure_find(name, false);
+    if (entry == NULL)
+    {
+        return size <= SECURE_MAX_SIZE && secure_from_env(name, value, size);
+    }
+    if (entry->erased || entry->size != size)
+    {
+        return false;
+    }
+    memcpy(value, entry->value, size);
+    return true;
+}
+
+bool platform_secure_write(const char *name, const void *value, size_t size)
+{
+    if (size > SECURE_MAX_SIZE)
+    {
+        return false;
+    }
+    secure_entry_t *entry = secure_find(name, true);
+    if (entry == NULL)
+    {
+        return false;
+    }
+
+    entry->erased = value == NULL;
+    entry->size = value != NULL ? size : 0;
+    memset(entry->value, 0, sizeof(entry->value));
+    if (value != NULL)
+    {
+        memcpy(entry->value, value, size);
+    }
+    ESP_LOGI(TAG, "Secret %s %s", name, value != NULL ? "stored" : "erased");
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef POWER_EVENTS_H
+#define POWER_EVENTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "meter_snapshot.h"
+
+typedef enum {
+    POWER_EVENT_SAG,
+    POWER_EVENT_SWELL,
+    POWER_EVENT_PHASE_LOSS,
+    POWER_EVENT_OVERCURRENT,
+    POWER_EVENT_TYPE_COUNT
+} power_event_type_t;
+
+// Bit of an event in power_events_active()
+#define POWER_EVENT_BIT(phase, type) (1U << ((phase) * POWER_EVENT_TYPE_COUNT + (type)))
+
+#define POWER_EVENTS_MAX_TRANSITIONS (METER_PHASE_COUNT * POWER_EVENT_TYPE_COUNT)
+
+// Thresholds for one phase
+typedef struct {
+    uint16_t sag_voltage;       // V, below this is a sag
+    uint16_t swell_voltage;     // V, above this is a swell
+    uint16_t loss_voltage;      // V, below this the phase is lost (reported instead of a sag)
+    uint16_t hysteresis;        // V, distance back inside a threshold before a voltage event may clear
+    uint32_t max_current;       // A/100, above this is an over-current
+    uint8_t raise_count;        // Consecutive snapshots in violation before an event is raised
+    uint8_t clear_count;        // Consecutive snapshots back in range before it is cleared
+} power_events_config_t;
+
+typedef struct {
+    power_events_config_t config[METER_PHASE_COUNT];
+    uint8_t counter[METER_PHASE_COUNT][POWER_EVENT_TYPE_COUNT];
+    uint16_t active;            // POWER_EVENT_BIT() of every raised event
+} power_events_t;
+
+// A raised or cleared event
+typedef struct {
+    meter_phase_t phase;
+    power_event_type_t type;
+    bool active;
+} power_event_t;
+
+void power_events_init(power_events_t *events, const power_events_config_t *config);
+
+// Evaluate one snapshot. Writes every raised or cleared event to transitions
+// (room for POWER_EVENTS_MAX_TRANSITIONS) and returns how many there were.
+uint8_t power_events_update(power_events_t *events, const meter_snapshot_t *snapshot, power_event_t *transitions);
+
+static inline uint16_t power_events_active(const power_events_t *events)
+{
+    return events->active;
+}
+
+#endif // POWER_EVENTS_H
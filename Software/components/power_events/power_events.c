@@ -0,0 +1,85 @@
+#include "include/power_events.h"
+#include <string.h>
+
+static const dlms_field_type_t kVoltageFields[METER_PHASE_COUNT] = {RMS_VOLTAGE_A, RMS_VOLTAGE_B, RMS_VOLTAGE_C};
+static const dlms_field_type_t kCurrentFields[METER_PHASE_COUNT] = {RMS_CURRENT_A, RMS_CURRENT_B, RMS_CURRENT_C};
+
+// Debounce one condition. Returns true if the event changed state.
+static bool debounce(power_events_t *events, meter_phase_t phase, power_event_type_t type, bool violation)
+{
+    const power_events_config_t *config = &events->config[phase];
+    uint16_t bit = POWER_EVENT_BIT(phase, type);
+    bool active = (events->active & bit) != 0;
+    uint8_t *counter = &events->counter[phase][type];
+
+    if (violation == active)
+    {
+        *counter = 0;
+        return false;
+    }
+
+    uint8_t needed = active ? config->clear_count : config->raise_count;
+    if (++(*counter) < (needed ? needed : 1))
+    {
+        return false;
+    }
+
+    *counter = 0;
+    events->active ^= bit;
+    return true;
+}
+
+void power_events_init(power_events_t *events, const power_events_config_t *config)
+{
+    memset(events, 0, sizeof(power_events_t));
+    memcpy(events->config, config, sizeof(events->config));
+}
+
+uint8_t power_events_update(power_events_t *events, const meter_snapshot_t *snapshot, power_event_t *transitions)
+{
+    uint8_t count = 0;
+
+    for (int p = 0; p < METER_PHASE_COUNT; p++)
+    {
+        const power_events_config_t *config = &events->config[p];
+        bool violation[POWER_EVENT_TYPE_COUNT];
+        bool evaluate[POWER_EVENT_TYPE_COUNT] = {false};
+
+        if (meter_snapshot_has(snapshot, kVoltageFields[p]))
+        {
+            uint16_t voltage = snapshot->rms_voltage[p];
+            bool sag_active = (events->active & POWER_EVENT_BIT(p, POWER_EVENT_SAG)) != 0;
+            bool swell_active = (events->active & POWER_EVENT_BIT(p, POWER_EVENT_SWELL)) != 0;
+            bool loss_active = (events->active & POWER_EVENT_BIT(p, POWER_EVENT_PHASE_LOSS)) != 0;
+
+            // An active event only clears once the value is back past the threshold by the hysteresis
+            uint32_t loss_limit = config->loss_voltage + (loss_active ? config->hysteresis : 0);
+            uint32_t sag_limit = config->sag_voltage + (sag_active ? config->hysteresis : 0);
+            int32_t swell_limit = (int32_t)config->swell_voltage - (swell_active ? config->hysteresis : 0);
+
+            violation[POWER_EVENT_PHASE_LOSS] = voltage < loss_limit;
+            violation[POWER_EVENT_SAG] = !violation[POWER_EVENT_PHASE_LOSS] && voltage < sag_limit;
+            violation[POWER_EVENT_SWELL] = voltage > swell_limit;
+            evaluate[POWER_EVENT_PHASE_LOSS] = evaluate[POWER_EVENT_SAG] = evaluate[POWER_EVENT_SWELL] = true;
+        }
+
+        if (meter_snapshot_has(snapshot, kCurrentFields[p]))
+        {
+            violation[POWER_EVENT_OVERCURRENT] = snapshot->rms_current[p] > config->max_current;
+            evaluate[POWER_EVENT_OVERCURRENT] = true;
+        }
+
+        for (int t = 0; t < POWER_EVENT_TYPE_COUNT; t++)
+        {
+            if (evaluate[t] && debounce(events, p, t, violation[t]))
+            {
+                transitions[count].phase = p;
+                transitions[count].type = t;
+                transitions[count].active = (events->active & POWER_EVENT_BIT(p, t)) != 0;
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
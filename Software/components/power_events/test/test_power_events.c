@@ -0,0 +1,142 @@
+// Checks the power quality thresholds, hysteresis and debounce. Exit code is the number of failed
+// checks.
+
+#include <stdio.h>
+#include "power_events.h"
+
+static int failures = 0;
+
+#define CHECK_EQ(actual, expected)                                                              \
+    do                                                                                          \
+    {                                                                                           \
+        unsigned long long a_ = (unsigned long long)(actual);                                   \
+        unsigned long long e_ = (unsigned long long)(expected);                                 \
+        if (a_ != e_)                                                                           \
+        {                                                                                       \
+            fprintf(stderr, "%s:%d: %s is %llu, expected %llu\n", __FILE__, __LINE__, #actual,   \
+                    a_, e_);                                                                    \
+            failures++;                                                                         \
+        }                                                                                       \
+    } while (0)
+
+// One snapshot with the voltage of phase A, or the current of phase B when current is non-zero.
+// Returns the number of transitions, the first one in transition.
+static uint8_t update_events(power_events_t *events, uint16_t voltage, uint32_t current, power_event_t *transition)
+{
+    power_event_t transitions[POWER_EVENTS_MAX_TRANSITIONS];
+    meter_snapshot_t snapshot;
+
+    meter_snapshot_reset(&snapshot);
+    if (current != 0)
+    {
+        snapshot.rms_current[METER_PHASE_B] = current;
+        meter_snapshot_mark(&snapshot, RMS_CURRENT_B);
+    }
+    else
+    {
+        snapshot.rms_voltage[METER_PHASE_A] = voltage;
+        meter_snapshot_mark(&snapshot, RMS_VOLTAGE_A);
+    }
+
+    uint8_t count = power_events_update(events, &snapshot, transitions);
+    if (count > 0)
+    {
+        *transition = transitions[0];
+    }
+    return count;
+}
+
+static void test_power_events(void)
+{
+    const power_events_config_t phase_config = {
+        .sag_voltage = 207,
+        .swell_voltage = 253,
+        .loss_voltage = 100,
+        .hysteresis = 4,
+        .max_current = 1600,
+        .raise_count = 3,
+        .clear_count = 2,
+    };
+    power_events_config_t config[METER_PHASE_COUNT] = {phase_config, phase_config, phase_config};
+    power_events_t events;
+    power_event_t transition;
+
+    power_events_init(&events, config);
+    CHECK_EQ(update_events(&events, 230, 0, &transition), 0);
+
+    // A sag is raised after raise_count snapshots in a row, an interruption starts over
+    CHECK_EQ(update_events(&events, 200, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 200, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 230, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 200, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 200, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 200, 0, &transition), 1);
+    CHECK_EQ(transition.phase, METER_PHASE_A);
+    CHECK_EQ(transition.type, POWER_EVENT_SAG);
+    CHECK_EQ(transition.active, 1);
+    CHECK_EQ(power_events_active(&events), POWER_EVENT_BIT(METER_PHASE_A, POWER_EVENT_SAG));
+
+    // It only clears above the threshold plus the hysteresis, after clear_count snapshots
+    CHECK_EQ(update_events(&events, 209, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 210, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 211, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 200, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 211, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 211, 0, &transition), 1);
+    CHECK_EQ(transition.type, POWER_EVENT_SAG);
+    CHECK_EQ(transition.active, 0);
+    CHECK_EQ(power_events_active(&events), 0);
+
+    // Below the loss voltage the phase is lost instead of sagging
+    for (int i = 0; i < 2; i++)
+    {
+        CHECK_EQ(update_events(&events, 50, 0, &transition), 0);
+    }
+    CHECK_EQ(update_events(&events, 50, 0, &transition), 1);
+    CHECK_EQ(transition.type, POWER_EVENT_PHASE_LOSS);
+    CHECK_EQ(power_events_active(&events), POWER_EVENT_BIT(METER_PHASE_A, POWER_EVENT_PHASE_LOSS));
+    update_events(&events, 230, 0, &transition);
+    CHECK_EQ(update_events(&events, 230, 0, &transition), 1);
+    CHECK_EQ(transition.type, POWER_EVENT_PHASE_LOSS);
+    CHECK_EQ(transition.active, 0);
+
+    // Swells clear below the threshold minus the hysteresis
+    for (int i = 0; i < 3; i++)
+    {
+        update_events(&events, 260, 0, &transition);
+    }
+    CHECK_EQ(power_events_active(&events), POWER_EVENT_BIT(METER_PHASE_A, POWER_EVENT_SWELL));
+    CHECK_EQ(update_events(&events, 250, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 250, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 249, 0, &transition), 0);
+    CHECK_EQ(update_events(&events, 249, 0, &transition), 1);
+    CHECK_EQ(transition.type, POWER_EVENT_SWELL);
+    CHECK_EQ(transition.active, 0);
+
+    // Over-current on phase B; snapshots without a voltage leave the voltage events alone
+    CHECK_EQ(update_events(&events, 0, 1601, &transition), 0);
+    CHECK_EQ(update_events(&events, 0, 1601, &transition), 0);
+    CHECK_EQ(update_events(&events, 0, 1601, &transition), 1);
+    CHECK_EQ(transition.phase, METER_PHASE_B);
+    CHECK_EQ(transition.type, POWER_EVENT_OVERCURRENT);
+    CHECK_EQ(power_events_active(&events), POWER_EVENT_BIT(METER_PHASE_B, POWER_EVENT_OVERCURRENT));
+    CHECK_EQ(update_events(&events, 0, 1600, &transition), 0);
+    CHECK_EQ(update_events(&events, 0, 1600, &transition), 1);
+    CHECK_EQ(transition.active, 0);
+
+    // A count of 0 acts as 1
+    config[METER_PHASE_A].raise_count = 0;
+    power_events_init(&events, config);
+    CHECK_EQ(update_events(&events, 200, 0, &transition), 1);
+}
+
+int main(void)
+{
+    test_power_events();
+
+    if (failures == 0)
+    {
+        printf("All power_events tests passed\n");
+    }
+    return failures;
+}
@@ -0,0 +1,55 @@
+#ifndef POWER_STATS_H
+#define POWER_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "meter_snapshot.h"
+
+// Largest supported window in samples (ring slots are stored as uint8_t)
+#define POWER_STATS_MAX_WINDOW 90
+
+// Quantities tracked per phase
+typedef enum {
+    POWER_STATS_VOLTAGE,
+    POWER_STATS_CURRENT,
+    POWER_STATS_ACTIVE_POWER,
+    POWER_STATS_POWER_FACTOR,
+    POWER_STATS_QUANTITY_COUNT
+} power_stats_quantity_t;
+
+// Sliding window of one quantity on one phase.
+// min_q/max_q are monotonic deques of ring slots, so min and max are always at the front.
+typedef struct {
+    int32_t values[POWER_STATS_MAX_WINDOW];
+    uint8_t min_q[POWER_STATS_MAX_WINDOW];
+    uint8_t max_q[POWER_STATS_MAX_WINDOW];
+    uint8_t min_head;
+    uint8_t min_len;
+    uint8_t max_head;
+    uint8_t max_len;
+    uint8_t next_slot;
+    uint8_t count;
+    int64_t sum;
+} power_stats_channel_t;
+
+typedef struct {
+    power_stats_channel_t channels[POWER_STATS_QUANTITY_COUNT][METER_PHASE_COUNT];
+    uint8_t window;             // Window length in samples (meter pushes)
+} power_stats_t;
+
+typedef struct {
+    int32_t min;
+    int32_t max;
+    int32_t mean;
+} power_stats_result_t;
+
+// Initialize with a window of 1..POWER_STATS_MAX_WINDOW samples
+void power_stats_init(power_stats_t *stats, uint8_t window);
+
+// Feed one snapshot. Only quantities present in the snapshot are updated. O(1) amortized.
+void power_stats_update(power_stats_t *stats, const meter_snapshot_t *snapshot);
+
+// Get min/max/mean over the current window. Returns false if no samples yet.
+bool power_stats_get(const power_stats_t *stats, power_stats_quantity_t quantity, meter_phase_t phase, power_stats_result_t *result);
+
+#endif // POWER_STATS_H
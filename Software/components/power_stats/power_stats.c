@@ -0,0 +1,132 @@
+#include "include/power_stats.h"
+#include <string.h>
+
+// Field type carrying each quantity on phase A, B and C
+static const dlms_field_type_t kQuantityFields[POWER_STATS_QUANTITY_COUNT][METER_PHASE_COUNT] = {
+    [POWER_STATS_VOLTAGE] = {RMS_VOLTAGE_A, RMS_VOLTAGE_B, RMS_VOLTAGE_C},
+    [POWER_STATS_CURRENT] = {RMS_CURRENT_A, RMS_CURRENT_B, RMS_CURRENT_C},
+    [POWER_STATS_ACTIVE_POWER] = {ACTIVE_POWER_A, ACTIVE_POWER_B, ACTIVE_POWER_C},
+    [POWER_STATS_POWER_FACTOR] = {POWER_FACTOR_A, POWER_FACTOR_B, POWER_FACTOR_C},
+};
+
+static int32_t snapshot_value(const meter_snapshot_t *snapshot, power_stats_quantity_t quantity, meter_phase_t phase)
+{
+    switch (quantity)
+    {
+    case POWER_STATS_VOLTAGE:
+        return snapshot->rms_voltage[phase];
+    case POWER_STATS_CURRENT:
+        return (int32_t)snapshot->rms_current[phase];
+    case POWER_STATS_ACTIVE_POWER:
+        return snapshot->active_power[phase];
+    case POWER_STATS_POWER_FACTOR:
+        return snapshot->power_factor[phase];
+    default:
+        return 0;
+    }
+}
+
+static inline uint8_t deque_at(uint8_t head, uint8_t offset)
+{
+    return (uint8_t)((head + offset) % POWER_STATS_MAX_WINDOW);
+}
+
+static void channel_push(power_stats_channel_t *ch, uint8_t window, int32_t value)
+{
+    uint8_t slot = ch->next_slot;
+
+    if (ch->count == window)
+    {
+        // Window full: the sample in this slot is the oldest one and leaves the window.
+        // Deques are in arrival order, so it can only be sitting at the front.
+        ch->sum -= ch->values[slot];
+
+        if (ch->min_len > 0 && ch->min_q[ch->min_head] == slot)
+        {
+            ch->min_head = deque_at(ch->min_head, 1);
+            ch->min_len--;
+        }
+
+        if (ch->max_len > 0 && ch->max_q[ch->max_head] == slot)
+        {
+            ch->max_head = deque_at(ch->max_head, 1);
+            ch->max_len--;
+        }
+    }
+    else
+    {
+        ch->count++;
+    }
+
+    ch->values[slot] = value;
+    ch->sum += value;
+
+    // Drop entries that can never be the minimum (maximum) again
+    while (ch->min_len > 0 && ch->values[ch->min_q[deque_at(ch->min_head, ch->min_len - 1)]] >= value)
+    {
+        ch->min_len--;
+    }
+    ch->min_q[deque_at(ch->min_head, ch->min_len)] = slot;
+    ch->min_len++;
+
+    while (ch->max_len > 0 && ch->values[ch->max_q[deque_at(ch->max_head, ch->max_len - 1)]] <= value)
+    {
+        ch->max_len--;
+    }
+    ch->max_q[deque_at(ch->max_head, ch->max_len)] = slot;
+    ch->max_len++;
+
+    ch->next_slot = (uint8_t)((slot + 1) % window);
+}
+
+void power_stats_init(power_stats_t *stats, uint8_t window)
+{
+    memset(stats, 0, sizeof(power_stats_t));
+
+    if (window == 0)
+    {
+        window = 1;
+    }
+    if (window > POWER_STATS_MAX_WINDOW)
+    {
+        window = POWER_STATS_MAX_WINDOW;
+    }
+    stats->window = window;
+}
+
+void power_stats_update(power_stats_t *stats, const meter_snapshot_t *snapshot)
+{
+    for (int q = 0; q < POWER_STATS_QUANTITY_COUNT; q++)
+    {
+        for (int p = 0; p < METER_PHASE_COUNT; p++)
+        {
+            if (meter_snapshot_has(snapshot, kQuantityFields[q][p]))
+            {
+                channel_push(&stats->channels[q][p], stats->window, snapshot_value(snapshot, q, p));
+            }
+        }
+    }
+}
+
+bool power_stats_get(const power_stats_t *stats, power_stats_quantity_t quantity, meter_phase_t phase, power_stats_result_t *result)
+{
+    if (quantity >= POWER_STATS_QUANTITY_COUNT || phase >= METER_PHASE_COUNT)
+    {
+        return false;
+    }
+
+    const power_stats_channel_t *ch = &stats->channels[quantity][phase];
+    if (ch->count == 0)
+    {
+        return false;
+    }
+
+    result->min = ch->values[ch->min_q[ch->min_head]];
+    result->max = ch->values[ch->max_q[ch->max_head]];
+
+    // Round half away from zero
+    int64_t half = ch->count / 2;
+    result->mean = (int32_t)((ch->sum >= 0 ? ch->sum + half : ch->sum - half) / ch->count);
+
+    return true;
+}
@@ -0,0 +1,108 @@
+// Checks the sliding window statistics against a brute force over the same window. Exit code is
+// the number of failed checks.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "power_stats.h"
+
+static int failures = 0;
+
+#define CHECK_EQ(actual, expected)                                                              \
+    do                                                                                          \
+    {                                                                                           \
+        unsigned long long a_ = (unsigned long long)(actual);                                   \
+        unsigned long long e_ = (unsigned long long)(expected);                                 \
+        if (a_ != e_)                                                                           \
+        {                                                                                       \
+            fprintf(stderr, "%s:%d: %s is %llu, expected %llu\n", __FILE__, __LINE__, #actual,   \
+                    a_, e_);                                                                    \
+            failures++;                                                                         \
+        }                                                                                       \
+    } while (0)
+
+static void check_window(const power_stats_t *stats, power_stats_quantity_t quantity, meter_phase_t phase,
+                         const int32_t *history, int count)
+{
+    power_stats_result_t result;
+    int first = count > stats->window ? count - stats->window : 0;
+    int32_t min = history[first];
+    int32_t max = history[first];
+    int64_t sum = 0;
+
+    for (int i = first; i < count; i++)
+    {
+        min = history[i] < min ? history[i] : min;
+        max = history[i] > max ? history[i] : max;
+        sum += history[i];
+    }
+
+    CHECK_EQ(power_stats_get(stats, quantity, phase, &result), 1);
+    CHECK_EQ(result.min, min);
+    CHECK_EQ(result.max, max);
+    // Rounded half away from zero
+    int64_t samples = count - first;
+    CHECK_EQ(result.mean, (sum >= 0 ? sum + samples / 2 : sum - samples / 2) / samples);
+}
+
+static void test_power_stats(void)
+{
+    static power_stats_t stats;
+    static int32_t history[500];
+    const uint8_t windows[] = {1, 5, POWER_STATS_MAX_WINDOW};
+    power_stats_result_t result;
+    meter_snapshot_t snapshot;
+
+    // Against a brute force over the same window, with runs of equal values and wrap-around
+    for (size_t w = 0; w < sizeof(windows); w++)
+    {
+        srand(42);
+        power_stats_init(&stats, windows[w]);
+        CHECK_EQ(power_stats_get(&stats, POWER_STATS_ACTIVE_POWER, METER_PHASE_B, &result), 0);
+
+        for (int i = 0; i < 500; i++)
+        {
+            history[i] = (rand() % 4 == 0 && i > 0) ? history[i - 1] : rand() % 2001 - 1000;
+
+            meter_snapshot_reset(&snapshot);
+            snapshot.active_power[METER_PHASE_B] = history[i];
+            meter_snapshot_mark(&snapshot, ACTIVE_POWER_B);
+            power_stats_update(&stats, &snapshot);
+            check_window(&stats, POWER_STATS_ACTIVE_POWER, METER_PHASE_B, history, i + 1);
+        }
+
+        // Only the quantities in a snapshot are updated
+        CHECK_EQ(power_stats_get(&stats, POWER_STATS_ACTIVE_POWER, METER_PHASE_A, &result), 0);
+        CHECK_EQ(power_stats_get(&stats, POWER_STATS_VOLTAGE, METER_PHASE_B, &result), 0);
+    }
+
+    // Monotonic sequences keep the whole window in one deque
+    power_stats_init(&stats, 4);
+    for (int i = 0; i < 10; i++)
+    {
+        meter_snapshot_reset(&snapshot);
+        snapshot.rms_voltage[METER_PHASE_C] = (uint16_t)(220 + i);
+        meter_snapshot_mark(&snapshot, RMS_VOLTAGE_C);
+        power_stats_update(&stats, &snapshot);
+    }
+    CHECK_EQ(power_stats_get(&stats, POWER_STATS_VOLTAGE, METER_PHASE_C, &result), 1);
+    CHECK_EQ(result.min, 226);
+    CHECK_EQ(result.max, 229);
+    CHECK_EQ(result.mean, 228); // 227.5 rounded up
+
+    // Windows are clamped to 1..POWER_STATS_MAX_WINDOW
+    power_stats_init(&stats, 0);
+    CHECK_EQ(stats.window, 1);
+    power_stats_init(&stats, 255);
+    CHECK_EQ(stats.window, POWER_STATS_MAX_WINDOW);
+}
+
+int main(void)
+{
+    test_power_stats();
+
+    if (failures == 0)
+    {
+        printf("All power_stats tests passed\n");
+    }
+    return failures;
+}
@@ -0,0 +1,72 @@
+#ifndef STRESS_H
+#define STRESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define STRESS_MAX_STEPS 24
+
+// Per-frame measurements
+typedef enum {
+    STRESS_PARSE,           // Parsing and attribute updates, lock wait and commit excluded
+    STRESS_COMMIT,          // END handling: events, statistics, demand and summation
+    STRESS_LOCK_WAIT,       // Waiting for the Zigbee lock at START
+    STRESS_QUEUE_DELAY,     // Injection to start of processing
+    STRESS_METRIC_COUNT
+} stress_metric_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t sum_us;
+    uint32_t max_us;
+} stress_timing_t;
+
+// One rate step of the stress run
+typedef struct {
+    uint32_t rate_hz;           // Offered frame rate
+    uint32_t offered;
+    uint32_t processed;
+    uint32_t dropped;           // Injection queue was full
+    uint16_t queue_max;         // Deepest injection queue seen by the consumer
+    uint32_t heap_min;          // Lowest free heap seen, 0 if the platform does not track it
+    int64_t duration_us;
+    stress_timing_t timing[STRESS_METRIC_COUNT];
+} stress_step_t;
+
+typedef struct {
+    uint32_t start_rate_hz;
+    uint32_t max_rate_hz;
+    uint16_t growth_pct;        // Rate increase from one step to the next
+    uint16_t step_frames;       // Frames offered per step
+    uint16_t queue_size;        // Depth of the injection queue
+} stress_config_t;
+
+typedef struct {
+    stress_config_t config;
+    stress_step_t steps[STRESS_MAX_STEPS];
+    uint8_t step_count;
+} stress_t;
+
+void stress_init(stress_t *stress, const stress_config_t *config);
+
+// Start the next rate step. Returns NULL when the run is over: the previous step saturated,
+// the maximum rate was passed or all step slots are used.
+stress_step_t *stress_next_step(stress_t *stress);
+
+void stress_record(stress_step_t *step, stress_metric_t metric, uint32_t us);
+void stress_record_heap(stress_step_t *step, uint32_t free_bytes);
+void stress_record_queue(stress_step_t *step, uint16_t depth);
+
+uint32_t stress_mean_us(const stress_step_t *step, stress_metric_t metric);
+
+// A step is saturated when frames were dropped, fewer than 95% of the offered rate was
+// processed, or the backlog reached half the injection queue.
+bool stress_step_saturated(const stress_t *stress, const stress_step_t *step);
+
+// The last step before the first saturated one, NULL if even the first step saturated
+const stress_step_t *stress_knee(const stress_t *stress);
+
+// Mean CPU time per frame (parse and commit) of a step
+uint32_t stress_frame_cost_us(const stress_step_t *step);
+
+#endif // STRESS_H
@@ -0,0 +1,100 @@
+#include "include/stress.h"
+#include <string.h>
+
+void stress_init(stress_t *stress, const stress_config_t *config)
+{
+    memset(stress, 0, sizeof(stress_t));
+    stress->config = *config;
+}
+
+stress_step_t *stress_next_step(stress_t *stress)
+{
+    uint32_t rate = stress->config.start_rate_hz ? stress->config.start_rate_hz : 1;
+
+    if (stress->step_count > 0)
+    {
+        const stress_step_t *previous = &stress->steps[stress->step_count - 1];
+        if (stress_step_saturated(stress, previous) || stress->step_count >= STRESS_MAX_STEPS)
+        {
+            return NULL;
+        }
+
+        // Always move up by at least 1 Hz so low start rates make progress
+        uint32_t increase = previous->rate_hz * stress->config.growth_pct / 100;
+        rate = previous->rate_hz + (increase > 0 ? increase : 1);
+    }
+    if (rate > stress->config.max_rate_hz)
+    {
+        return NULL;
+    }
+
+    stress_step_t *step = &stress->steps[stress->step_count++];
+    memset(step, 0, sizeof(stress_step_t));
+    step->rate_hz = rate;
+    step->heap_min = UINT32_MAX;
+    return step;
+}
+
+void stress_record(stress_step_t *step, stress_metric_t metric, uint32_t us)
+{
+    stress_timing_t *timing = &step->timing[metric];
+    timing->count++;
+    timing->sum_us += us;
+    if (us > timing->max_us)
+    {
+        timing->max_us = us;
+    }
+}
+
+void stress_record_heap(stress_step_t *step, uint32_t free_bytes)
+{
+    if (free_bytes < step->heap_min)
+    {
+        step->heap_min = free_bytes;
+    }
+}
+
+void stress_record_queue(stress_step_t *step, uint16_t depth)
+{
+    if (depth > step->queue_max)
+    {
+        step->queue_max = depth;
+    }
+}
+
+uint32_t stress_mean_us(const stress_step_t *step, stress_metric_t metric)
+{
+    const stress_timing_t *timing = &step->timing[metric];
+    return timing->count ? (uint32_t)(timing->sum_us / timing->count) : 0;
+}
+
+bool stress_step_saturated(const stress_t *stress, const stress_step_t *step)
+{
+    if (step->dropped > 0 || step->queue_max * 2 >= stress->config.queue_size)
+    {
+        return true;
+    }
+
+    // Achieved rate below 95% of the offered one
+    return step->duration_us > 0 && (uint64_t)step->processed * 1000000 * 100 < (uint64_t)step->rate_hz * step->duration_us * 95;
+}
+
+const stress_step_t *stress_knee(const stress_t *stress)
+{
+    const stress_step_t *knee = NULL;
+
+    for (uint8_t i = 0; i < stress->step_count; i++)
+    {
+        if (stress_step_saturated(stress, &stress->steps[i]))
+        {
+            break;
+        }
+        knee = &stress->steps[i];
+    }
+    return knee;
+}
+
+uint32_t stress_frame_cost_us(const stress_step_t *step)
+{
+    return stress_mean_us(step, STRESS_PARSE) + stress_mean_us(step, STRESS_COMMIT);
+}
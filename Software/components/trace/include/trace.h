@@ -0,0 +1,65 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Latency tracing of the frame path, from the UART read holding the frame start to the last
+// report queued for it. Tracepoints store a timestamp, trace_frame_end() turns them into spans
+// kept in log2 histograms.
+
+#define TRACE_BUCKETS 24            // Bucket 0 holds 0 us, bucket i holds [2^(i-1), 2^i) us, the last is open
+#define TRACE_HISTOGRAM_SIZE 60     // Serialized histogram, see trace_histogram_serialize()
+
+typedef enum {
+    TRACE_POINT_UART_EVENT,         // UART read holding the frame start returned
+    TRACE_POINT_LOCKED,             // Zigbee lock acquired at START
+    TRACE_POINT_FRAME_COMPLETE,     // END decoded, all fields applied to attributes
+    TRACE_POINT_APPLIED,            // Events, statistics, demand and summation updated
+    TRACE_POINT_REPORTED,           // Last report or command of the frame queued
+    TRACE_POINT_COUNT
+} trace_point_t;
+
+typedef enum {
+    TRACE_SPAN_UART_READ,           // Parsing one UART read, recorded directly with trace_span()
+    TRACE_SPAN_LOCK,                // UART event to lock acquired
+    TRACE_SPAN_DECODE,              // Lock acquired to frame complete, mostly line time
+    TRACE_SPAN_APPLY,               // Frame complete to attributes applied
+    TRACE_SPAN_REPORT,              // Frame complete to last report queued, frames with reports only
+    TRACE_SPAN_TOTAL,               // UART event to attributes applied
+    TRACE_SPAN_COUNT
+} trace_span_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[TRACE_BUCKETS];
+} trace_histogram_t;
+
+typedef struct {
+    int64_t points[TRACE_POINT_COUNT];  // 0 when not reached in the current frame
+    trace_histogram_t spans[TRACE_SPAN_COUNT];
+    uint32_t frames;
+} trace_t;
+
+void trace_init(trace_t *trace);
+void trace_point(trace_t *trace, trace_point_t point, int64_t now_us);
+void trace_span(trace_t *trace, trace_span_t span, uint32_t us);
+
+// Close the frame: spans between the points reached are added, the points are cleared
+void trace_frame_end(trace_t *trace);
+
+void trace_histogram_add(trace_histogram_t *histogram, uint32_t us);
+uint32_t trace_histogram_mean(const trace_histogram_t *histogram);
+
+// Upper bound of the bucket holding the given percentile, 0 when empty
+uint32_t trace_histogram_percentile(const trace_histogram_t *histogram, uint8_t percent);
+
+// ZCL octet string: length byte, then little-endian U32 count, mean and max, and the buckets
+// as U16 saturating at 0xFFFF. out must hold TRACE_HISTOGRAM_SIZE + 1 bytes.
+void trace_histogram_serialize(const trace_histogram_t *histogram, uint8_t *out);
+
+const char *trace_span_name(trace_span_t span);
+
+#endif // TRACE_H
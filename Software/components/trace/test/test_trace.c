@@ -0,0 +1,109 @@
+// Checks the latency histograms, their percentiles and the frame spans. Exit code is the number of
+// failed checks.
+
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+static int failures = 0;
+
+#define CHECK_EQ(actual, expected)                                                              \
+    do                                                                                          \
+    {                                                                                           \
+        unsigned long long a_ = (unsigned long long)(actual);                                   \
+        unsigned long long e_ = (unsigned long long)(expected);                                 \
+        if (a_ != e_)                                                                           \
+        {                                                                                       \
+            fprintf(stderr, "%s:%d: %s is %llu, expected %llu\n", __FILE__, __LINE__, #actual,   \
+                    a_, e_);                                                                    \
+            failures++;                                                                         \
+        }                                                                                       \
+    } while (0)
+
+static void test_trace(void)
+{
+    trace_histogram_t histogram;
+    trace_t trace;
+    uint8_t serialized[TRACE_HISTOGRAM_SIZE + 1];
+
+    memset(&histogram, 0, sizeof(histogram));
+    CHECK_EQ(trace_histogram_percentile(&histogram, 50), 0);
+    CHECK_EQ(trace_histogram_mean(&histogram), 0);
+
+    // Bucket 0 holds 0 us, bucket i holds [2^(i-1), 2^i) us
+    trace_histogram_add(&histogram, 0);
+    trace_histogram_add(&histogram, 1);
+    trace_histogram_add(&histogram, 2);
+    trace_histogram_add(&histogram, 3);
+    trace_histogram_add(&histogram, 4);
+    CHECK_EQ(histogram.buckets[0], 1);
+    CHECK_EQ(histogram.buckets[1], 1);
+    CHECK_EQ(histogram.buckets[2], 2);
+    CHECK_EQ(histogram.buckets[3], 1);
+    CHECK_EQ(trace_histogram_mean(&histogram), 2);
+
+    // Percentiles give the upper bound of the bucket holding the rank, at most the maximum
+    memset(&histogram, 0, sizeof(histogram));
+    for (int i = 0; i < 90; i++)
+    {
+        trace_histogram_add(&histogram, 100);
+    }
+    for (int i = 0; i < 9; i++)
+    {
+        trace_histogram_add(&histogram, 1000);
+    }
+    trace_histogram_add(&histogram, 50000);
+    CHECK_EQ(trace_histogram_percentile(&histogram, 50), 127);
+    CHECK_EQ(trace_histogram_percentile(&histogram, 90), 127);
+    CHECK_EQ(trace_histogram_percentile(&histogram, 91), 1023);
+    CHECK_EQ(trace_histogram_percentile(&histogram, 99), 1023);
+    CHECK_EQ(trace_histogram_percentile(&histogram, 100), 50000);
+    CHECK_EQ(histogram.max_us, 50000);
+    CHECK_EQ(trace_histogram_mean(&histogram), (90 * 100 + 9 * 1000 + 50000) / 100);
+
+    // The last bucket is open
+    trace_histogram_add(&histogram, UINT32_MAX);
+    CHECK_EQ(histogram.buckets[TRACE_BUCKETS - 1], 1);
+    CHECK_EQ(trace_histogram_percentile(&histogram, 100), UINT32_MAX);
+
+    // Count, mean and max as U32, then the buckets as U16, all little endian
+    trace_histogram_serialize(&histogram, serialized);
+    CHECK_EQ(serialized[0], TRACE_HISTOGRAM_SIZE);
+    CHECK_EQ(serialized[1], 101);
+    CHECK_EQ(serialized[9] | serialized[10] << 8 | serialized[11] << 16 | (uint32_t)serialized[12] << 24, UINT32_MAX);
+    CHECK_EQ(serialized[13 + 2 * 7], 90);
+    CHECK_EQ(serialized[13 + 2 * 10], 9);
+    CHECK_EQ(serialized[13 + 2 * (TRACE_BUCKETS - 1)], 1);
+
+    // Spans between the points reached in a frame; a frame without reports has no report span
+    trace_init(&trace);
+    trace_point(&trace, TRACE_POINT_UART_EVENT, 1000);
+    trace_point(&trace, TRACE_POINT_LOCKED, 1050);
+    trace_point(&trace, TRACE_POINT_FRAME_COMPLETE, 90000);
+    trace_point(&trace, TRACE_POINT_APPLIED, 90400);
+    trace_frame_end(&trace);
+    CHECK_EQ(trace.frames, 1);
+    CHECK_EQ(trace.spans[TRACE_SPAN_LOCK].max_us, 50);
+    CHECK_EQ(trace.spans[TRACE_SPAN_DECODE].max_us, 88950);
+    CHECK_EQ(trace.spans[TRACE_SPAN_APPLY].max_us, 400);
+    CHECK_EQ(trace.spans[TRACE_SPAN_TOTAL].max_us, 89400);
+    CHECK_EQ(trace.spans[TRACE_SPAN_REPORT].count, 0);
+    CHECK_EQ(trace.points[TRACE_POINT_UART_EVENT], 0);
+
+    trace_point(&trace, TRACE_POINT_FRAME_COMPLETE, 200000);
+    trace_point(&trace, TRACE_POINT_REPORTED, 200300);
+    trace_frame_end(&trace);
+    CHECK_EQ(trace.spans[TRACE_SPAN_REPORT].count, 1);
+    CHECK_EQ(trace.spans[TRACE_SPAN_LOCK].count, 1);
+}
+
+int main(void)
+{
+    test_trace();
+
+    if (failures == 0)
+    {
+        printf("All trace tests passed\n");
+    }
+    return failures;
+}
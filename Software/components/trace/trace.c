@@ -0,0 +1,116 @@
+#include "include/trace.h"
+#include <string.h>
+
+static const char *kSpanNames[TRACE_SPAN_COUNT] = {"uart read", "lock", "decode", "apply", "report", "total"};
+
+// Spans closed by trace_frame_end: span, from, to
+static const uint8_t kFrameSpans[][3] = {
+    {TRACE_SPAN_LOCK, TRACE_POINT_UART_EVENT, TRACE_POINT_LOCKED},
+    {TRACE_SPAN_DECODE, TRACE_POINT_LOCKED, TRACE_POINT_FRAME_COMPLETE},
+    {TRACE_SPAN_APPLY, TRACE_POINT_FRAME_COMPLETE, TRACE_POINT_APPLIED},
+    {TRACE_SPAN_REPORT, TRACE_POINT_FRAME_COMPLETE, TRACE_POINT_REPORTED},
+    {TRACE_SPAN_TOTAL, TRACE_POINT_UART_EVENT, TRACE_POINT_APPLIED},
+};
+
+void trace_init(trace_t *trace)
+{
+    memset(trace, 0, sizeof(trace_t));
+}
+
+void trace_point(trace_t *trace, trace_point_t point, int64_t now_us)
+{
+    trace->points[point] = now_us;
+}
+
+void trace_span(trace_t *trace, trace_span_t span, uint32_t us)
+{
+    trace_histogram_add(&trace->spans[span], us);
+}
+
+void trace_frame_end(trace_t *trace)
+{
+    for (size_t i = 0; i < sizeof(kFrameSpans) / sizeof(kFrameSpans[0]); i++)
+    {
+        int64_t from = trace->points[kFrameSpans[i][1]];
+        int64_t to = trace->points[kFrameSpans[i][2]];
+        if (from != 0 && to >= from)
+        {
+            int64_t us = to - from;
+            trace_histogram_add(&trace->spans[kFrameSpans[i][0]], us > UINT32_MAX ? UINT32_MAX : (uint32_t)us);
+        }
+    }
+
+    memset(trace->points, 0, sizeof(trace->points));
+    trace->frames++;
+}
+
+void trace_histogram_add(trace_histogram_t *histogram, uint32_t us)
+{
+    uint8_t bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+    if (bucket >= TRACE_BUCKETS)
+    {
+        bucket = TRACE_BUCKETS - 1;
+    }
+
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum_us += us;
+    if (us > histogram->max_us)
+    {
+        histogram->max_us = us;
+    }
+}
+
+uint32_t trace_histogram_mean(const trace_histogram_t *histogram)
+{
+    return histogram->count > 0 ? (uint32_t)(histogram->sum_us / histogram->count) : 0;
+}
+
+uint32_t trace_histogram_percentile(const trace_histogram_t *histogram, uint8_t percent)
+{
+    if (histogram->count == 0)
+    {
+        return 0;
+    }
+
+    uint64_t rank = ((uint64_t)histogram->count * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (uint8_t i = 0; i < TRACE_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+        {
+            // The last bucket is open, the maximum is the best bound there
+            uint32_t bound = i == 0 ? 0 : i == TRACE_BUCKETS - 1 ? histogram->max_us : (1u << i) - 1;
+            return bound < histogram->max_us ? bound : histogram->max_us;
+        }
+    }
+    return histogram->max_us;
+}
+
+static void put_u32(uint8_t *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+void trace_histogram_serialize(const trace_histogram_t *histogram, uint8_t *out)
+{
+    out[0] = TRACE_HISTOGRAM_SIZE;
+    put_u32(&out[1], histogram->count);
+    put_u32(&out[5], trace_histogram_mean(histogram));
+    put_u32(&out[9], histogram->max_us);
+    for (uint8_t i = 0; i < TRACE_BUCKETS; i++)
+    {
+        uint16_t count = histogram->buckets[i] > UINT16_MAX ? UINT16_MAX : (uint16_t)histogram->buckets[i];
+        out[13 + 2 * i] = (uint8_t)count;
+        out[14 + 2 * i] = (uint8_t)(count >> 8);
+    }
+}
+
+const char *trace_span_name(trace_span_t span)
+{
+    return span < TRACE_SPAN_COUNT ? kSpanNames[span] : "?";
+}
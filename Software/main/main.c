@@ -1,44 +1,59 @@
 #include "esp_check.h"
 #include "esp_log.h"
 #include "nvs_flash.h"
+#include "nvs.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "ha/esp_zigbee_ha_standard.h"
+#include "freertos/semphr.h"
+#include "platform.h"
 #include "main.h"
-#include "driver/uart.h"
 #include "kamstrup_test_data.h"
-#include <esp_app_desc.h>
 
-#include "esp_random.h"
 #include "dlms_parser.h"
-
-#include "esp_timer.h"
-#include "esp_zigbee_attribute.h"
+#include "p1_parser.h"
+#include "meter_frontend.h"
+#include "dlms_client.h"
+#include "meter_snapshot.h"
+#include "power_stats.h"
+#include "peak_demand.h"
+#include "power_events.h"
+#include "load_events.h"
+#include "energy_integrator.h"
+#include "stress.h"
+#include "capture.h"
+#include "apdu_forward.h"
+#include "trace.h"
+#include "diagnostics.h"
+#include "dlog.h"
 
 #include <stdio.h>
 #include <stdint.h>
 #include <time.h>
 #include <inttypes.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
 
-#include "driver/gpio.h"
-#include <iot_button.h>
-
-#include "esp_pm.h"
 #include "esp_err.h"
 
+#if !CONFIG_IDF_TARGET_LINUX
+#include <esp_app_desc.h>
+
 #include "esp_adc/adc_oneshot.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
-
-#ifdef CONFIG_PM_ENABLE
-#include "esp_pm.h"
-#include "esp_private/esp_clk.h"
-#include "esp_sleep.h"
 #endif
 
-#if !defined ZB_ED_ROLE
-#error Define ZB_ED_ROLE in idf.py menuconfig to compile light (End Device) source code.
+// The frame path in this file: conversions, commit and attribute updates. With
+// CONFIG_WATTZIG_HOT_PATH_IRAM it runs from IRAM at -O2 like the components in hot_path.lf, and
+// the tables it reads are kept in DRAM.
+#if CONFIG_WATTZIG_HOT_PATH_IRAM
+#include "esp_attr.h"
+#define HOT_PATH IRAM_ATTR __attribute__((optimize("O2")))
+#define HOT_PATH_DATA DRAM_ATTR
+#else
+#define HOT_PATH
+#define HOT_PATH_DATA
 #endif
 
 #if DATA_SIMULATION
@@ -47,11 +62,149 @@
 
 static const char *TAG = "WattZig";
 
-static QueueHandle_t uart_queue;
-static dlms_parser_t parser;
-static int64_t lastReceived = 0;
-static bool waitingForSilence = true;
+typedef struct {
+    int port;
+    int tx_pin;
+    int rx_pin;
+    uint32_t baud_rate;
+    uint8_t endpoint;
+} meter_channel_config_t;
+
+static const meter_channel_config_t kChannelConfigs[] = {
+    {UART_NUM, UART_TX_PIN, UART_RX_PIN, UART_BAUD_RATE, ENDPOINT_ID},
+    {METER2_UART_NUM, METER2_TX_PIN, METER2_RX_PIN, METER2_BAUD_RATE, METER2_ENDPOINT_ID},
+};
+_Static_assert(METER_CHANNEL_COUNT >= 1 && METER_CHANNEL_COUNT <= sizeof(kChannelConfigs) / sizeof(kChannelConfigs[0]) &&
+                   METER_CHANNEL_COUNT <= PLATFORM_UART_MAX,
+               "METER_CHANNEL_COUNT out of range");
+#if METER_CHANNEL_COUNT > 1 && CONFIG_ESP_CONSOLE_UART && CONFIG_ESP_CONSOLE_UART_NUM == METER2_UART_NUM
+#error "The second meter channel needs the console on another port, e.g. CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG"
+#endif
+
+// Everything that belongs to one meter: its UART, parsers, endpoint and the state behind the frame
+// level attributes
+typedef struct {
+    uint8_t index;
+    uint8_t endpoint;
+    int uart;                       // Platform UART number, -1 if it failed to start
+    dlms_parser_t parser;
+    p1_parser_t p1_parser;
+    meter_frontend_t frontend;
+#if DLMS_CLIENT_ENABLE
+    dlms_client_t client;
+#endif
+    int64_t last_received;
+    bool waiting_for_silence;
+    meter_snapshot_t snapshot;
+    power_stats_t power_stats;
+    peak_demand_t peak_demand;
+    power_events_t power_events;
+    uint32_t event_latency_max_us;
+    load_events_t load_events;
+    uint32_t load_event_count;
+    energy_integrator_t energy_import;
+    energy_integrator_t energy_export;
+    uint64_t summation_delivered;
+    uint64_t summation_received;
+    uint8_t meter_keys_status;      // METER_KEYS_* stored
+    uint32_t fields;                // DLMS_FIELD_BIT of the fields to decode, see subscribed_fields()
+#if APDU_FORWARD_ENABLE
+    uint8_t apdu[APDU_FORWARD_MAX_APDU];    // Raw APDU of the frame in progress
+    uint8_t apdu_sequence;
+    uint32_t apdus_forwarded;
+#endif
+    uint32_t cpu_us;                // Parsing, commit and client schedule in the current CPU window
+} meter_channel_t;
+
+static meter_channel_t channels[METER_CHANNEL_COUNT];
+static uint8_t channel_endpoints[METER_CHANNEL_COUNT];
+
 static TaskHandle_t task_handle = NULL;
+static atomic_uint meter_keys_changed = 0;       // Channel bits, set by the Zigbee task, keys reloaded by the parser task
+static int64_t cpu_window_start = 0;
+
+#if TRACE_ENABLE
+static trace_t trace;
+static int64_t uart_event_us; // The UART read being parsed returned
+#define TRACE_POINT(point) trace_point(&trace, (point), platform_time_us())
+#else
+#define TRACE_POINT(point)
+#endif
+
+#if CAPTURE_ENABLE
+static capture_t capture;
+static uint8_t capture_buffer[CAPTURE_BUFFER_SIZE];
+static SemaphoreHandle_t capture_mutex;
+static bool capture_paused = false; // While being read out, so the pieces fit together
+#endif
+
+#if STRESS_MODE
+static stress_t stress;
+static QueueHandle_t stress_queue;
+static uint32_t stress_lock_wait_us;
+static uint32_t stress_commit_us;
+#endif
+
+// Task stacks and control blocks are reserved here with STATIC_ALLOCATION and taken from the heap
+// when the task starts otherwise
+#if STATIC_ALLOCATION
+#if !configSUPPORT_STATIC_ALLOCATION
+#error "STATIC_ALLOCATION needs configSUPPORT_STATIC_ALLOCATION"
+#endif
+#define TASK_STORAGE(task, stack_size)                                                   \
+    _Static_assert((stack_size) >= configMINIMAL_STACK_SIZE, #task " stack too small"); \
+    static StackType_t task##_stack[(stack_size) / sizeof(StackType_t)];                 \
+    static StaticTask_t task##_tcb
+#define START_TASK(task, name, priority) \
+    xTaskCreateStatic(task, name, sizeof(task##_stack), NULL, priority, task##_stack, &task##_tcb)
+#else
+#define TASK_STORAGE(task, stack_size)                                                   \
+    _Static_assert((stack_size) >= configMINIMAL_STACK_SIZE, #task " stack too small"); \
+    enum { task##_stack_size = (stack_size) }
+#define START_TASK(task, name, priority) start_task(task, name, task##_stack_size, priority)
+#endif
+
+TASK_STORAGE(uart_event_task, UART_TASK_STACK_SIZE);
+TASK_STORAGE(initLedFlash, LED_TASK_STACK_SIZE);
+TASK_STORAGE(zb_task, PLATFORM_ZB_TASK_STACK_SIZE);
+#if STRESS_MODE
+TASK_STORAGE(stress_task, STRESS_TASK_STACK_SIZE);
+TASK_STORAGE(stress_frame_task, STRESS_TASK_STACK_SIZE);
+#endif
+#if CAPTURE_ENABLE || DLOG_DEFERRED
+TASK_STORAGE(dump_task, DUMP_TASK_STACK_SIZE);
+static TaskHandle_t dump_task_handle = NULL;
+#endif
+
+#if STATIC_ALLOCATION
+static uint8_t uart_rx_buffer[UART_RX_BUFFER_SIZE];
+#if STRESS_MODE
+static StaticQueue_t stress_queue_buffer;
+static uint8_t stress_queue_storage[STRESS_QUEUE_SIZE * sizeof(int64_t)];
+#endif
+#if CAPTURE_ENABLE
+static StaticSemaphore_t capture_mutex_buffer;
+#endif
+#if DATA_SIMULATION
+static StaticTimer_t dlms_timer_buffer;
+#endif
+#endif
+
+// RAM that STATIC_ALLOCATION moves from the heap to .bss
+#define TASK_RAM(stack_size) ((stack_size) + sizeof(StaticTask_t))
+#define STATIC_ALLOCATION_SIZE                                                                  \
+    (TASK_RAM(UART_TASK_STACK_SIZE) + UART_RX_BUFFER_SIZE + TASK_RAM(LED_TASK_STACK_SIZE) +     \
+     TASK_RAM(PLATFORM_ZB_TASK_STACK_SIZE) +                                                    \
+     (STRESS_MODE ? 2 * TASK_RAM(STRESS_TASK_STACK_SIZE) + sizeof(StaticQueue_t) +              \
+                        STRESS_QUEUE_SIZE * sizeof(int64_t)                                     \
+                  : 0) +                                                                        \
+     (CAPTURE_ENABLE || DLOG_DEFERRED ? TASK_RAM(DUMP_TASK_STACK_SIZE) : 0) +                   \
+     (CAPTURE_ENABLE ? sizeof(StaticSemaphore_t) : 0) + (DATA_SIMULATION ? sizeof(StaticTimer_t) : 0))
+_Static_assert(STATIC_ALLOCATION_SIZE <= STATIC_ALLOCATION_BUDGET, "Task stacks and buffers exceed STATIC_ALLOCATION_BUDGET");
+
+// Sent in a single octet string attribute or command
+_Static_assert(CAPTURE_CHUNK_SIZE + 8 <= UINT8_MAX, "CAPTURE_CHUNK_SIZE too large");
+_Static_assert(LOG_CHUNK_SIZE + 8 <= UINT8_MAX, "LOG_CHUNK_SIZE too large");
 
 // static int adc_raw[2][10];
 // static int voltage[2][10];
@@ -88,32 +241,605 @@ static TaskHandle_t task_handle = NULL;
 //     return seconds_since_2000;
 // }
 
-int8_t convert_to_int8(uint8_t *bytes)
+HOT_PATH int8_t convert_to_int8(uint8_t *bytes)
 {
     return (int8_t)(bytes[0]);
 }
 
-uint16_t convert_to_uint16(uint8_t *bytes)
+HOT_PATH uint16_t convert_to_uint16(uint8_t *bytes)
 {
     return (uint16_t)(bytes[0] << 8 | bytes[1]);
 }
 
-int16_t convert_to_int16(uint8_t *bytes)
+HOT_PATH int16_t convert_to_int16(uint8_t *bytes)
 {
     return (int16_t)(bytes[0] << 8 | bytes[1]);
 }
 
-uint32_t convert_to_uint32(uint8_t *bytes)
+HOT_PATH uint32_t convert_to_uint32(uint8_t *bytes)
 {
     return (uint32_t)(bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3]);
 }
 
-static void handle_dlms_field(dlms_field_t *field)
+// Standard Electrical Measurement min/max attributes per quantity. Offset 0 means none exists.
+typedef struct {
+    uint8_t min_offset;
+    uint8_t max_offset;
+    uint8_t attr_type;
+} power_stats_attr_t;
+
+static const power_stats_attr_t HOT_PATH_DATA kPowerStatsAttrs[POWER_STATS_QUANTITY_COUNT] = {
+    [POWER_STATS_VOLTAGE] = {EM_ATTR_RMSVOLTAGE_MIN_OFFSET, EM_ATTR_RMSVOLTAGE_MAX_OFFSET, ESP_ZB_ZCL_ATTR_TYPE_U16},
+    [POWER_STATS_CURRENT] = {EM_ATTR_RMSCURRENT_MIN_OFFSET, EM_ATTR_RMSCURRENT_MAX_OFFSET, ESP_ZB_ZCL_ATTR_TYPE_U16},
+    [POWER_STATS_ACTIVE_POWER] = {EM_ATTR_ACTIVE_POWER_MIN_OFFSET, EM_ATTR_ACTIVE_POWER_MAX_OFFSET, ESP_ZB_ZCL_ATTR_TYPE_S16},
+    [POWER_STATS_POWER_FACTOR] = {0, 0, ESP_ZB_ZCL_ATTR_TYPE_S8},
+};
+
+static const uint16_t HOT_PATH_DATA kPhaseAttrBase[METER_PHASE_COUNT] = {EM_ATTR_PHASE_A_BASE, EM_ATTR_PHASE_B_BASE, EM_ATTR_PHASE_C_BASE};
+
+// Range of the numeric attribute types values are reported in
+typedef struct {
+    uint8_t attr_type;
+    int64_t min;
+    int64_t max;
+} attr_range_t;
+
+static const attr_range_t HOT_PATH_DATA kAttrRanges[] = {
+    {ESP_ZB_ZCL_ATTR_TYPE_U8, 0, UINT8_MAX},
+    {ESP_ZB_ZCL_ATTR_TYPE_S8, INT8_MIN, INT8_MAX},
+    {ESP_ZB_ZCL_ATTR_TYPE_U16, 0, UINT16_MAX},
+    {ESP_ZB_ZCL_ATTR_TYPE_S16, INT16_MIN, INT16_MAX},
+    {ESP_ZB_ZCL_ATTR_TYPE_U24, 0, 0xFFFFFF},
+    {ESP_ZB_ZCL_ATTR_TYPE_S24, -0x800000, 0x7FFFFF},
+    {ESP_ZB_ZCL_ATTR_TYPE_U32, 0, UINT32_MAX},
+    {ESP_ZB_ZCL_ATTR_TYPE_U48, 0, 0xFFFFFFFFFFFF},
+};
+
+// Set a numeric attribute, saturated at the range of its type instead of wrapping: 40 kW on an S16
+// power attribute reads 32767 W, not a negative value. Both targets are little-endian, so the
+// attribute takes its bytes from the start of the 64-bit value.
+static HOT_PATH void set_number_attr(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, bool manufacturer, uint8_t attr_type, int64_t value)
+{
+    for (size_t i = 0; i < sizeof(kAttrRanges) / sizeof(kAttrRanges[0]); i++)
+    {
+        if (kAttrRanges[i].attr_type == attr_type)
+        {
+            value = value > kAttrRanges[i].max ? kAttrRanges[i].max : value < kAttrRanges[i].min ? kAttrRanges[i].min : value;
+            break;
+        }
+    }
+
+    if (manufacturer)
+    {
+        platform_zb_set_manufacturer_attribute(endpoint, cluster_id, attr_id, attr_type, &value);
+    }
+    else
+    {
+        platform_zb_set_attribute(endpoint, cluster_id, attr_id, attr_type, &value);
+    }
+}
+
+#if POWER_STATS_ENABLE
+static HOT_PATH void set_power_stats_attr(uint8_t endpoint, uint16_t attr_id, bool manufacturer, uint8_t attr_type, int32_t value)
+{
+    set_number_attr(endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, attr_id, manufacturer, attr_type, value);
+}
+
+// Push the sliding window min/max/mean of every phase to the Electrical Measurement cluster
+static HOT_PATH void apply_power_stats(meter_channel_t *channel)
+{
+    for (int q = 0; q < POWER_STATS_QUANTITY_COUNT; q++)
+    {
+        const power_stats_attr_t *attrs = &kPowerStatsAttrs[q];
+
+        for (int p = 0; p < METER_PHASE_COUNT; p++)
+        {
+            power_stats_result_t result;
+            if (!power_stats_get(&channel->power_stats, q, p, &result))
+            {
+                continue;
+            }
+
+            if (attrs->min_offset != 0)
+            {
+                set_power_stats_attr(channel->endpoint, kPhaseAttrBase[p] + attrs->min_offset, false, attrs->attr_type, result.min);
+                set_power_stats_attr(channel->endpoint, kPhaseAttrBase[p] + attrs->max_offset, false, attrs->attr_type, result.max);
+            }
+            else
+            {
+                set_power_stats_attr(channel->endpoint, EM_MANUF_ATTR_STATS(q, p, EM_STATS_KIND_MIN), true, attrs->attr_type, result.min);
+                set_power_stats_attr(channel->endpoint, EM_MANUF_ATTR_STATS(q, p, EM_STATS_KIND_MAX), true, attrs->attr_type, result.max);
+            }
+            set_power_stats_attr(channel->endpoint, EM_MANUF_ATTR_STATS(q, p, EM_STATS_KIND_MEAN), true, attrs->attr_type, result.mean);
+        }
+    }
+}
+#endif
+
+// NVS key or secret name of a channel: the first channel keeps the name it had before there were
+// channels, the others get their number appended
+static const char *channel_name(const meter_channel_t *channel, const char *base, char *name, size_t size)
+{
+    if (channel->index == 0)
+    {
+        return base;
+    }
+    snprintf(name, size, "%s%u", base, channel->index);
+    return name;
+}
+
+static meter_channel_t *channel_by_endpoint(uint8_t endpoint)
+{
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+        if (channels[i].endpoint == endpoint)
+        {
+            return &channels[i];
+        }
+    }
+    return NULL;
+}
+
+#if PEAK_DEMAND_ENABLE
+static void load_peak_demand(meter_channel_t *channel)
+{
+    nvs_handle_t handle;
+    size_t size = sizeof(channel->peak_demand);
+    char name[NVS_KEY_NAME_MAX_SIZE];
+    const char *key = channel_name(channel, NVS_KEY_PEAK_DEMAND, name, sizeof(name));
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK)
+    {
+        esp_err_t err = nvs_get_blob(handle, key, &channel->peak_demand, &size);
+        nvs_close(handle);
+
+        if (err == ESP_OK && size == sizeof(channel->peak_demand) && peak_demand_is_valid(&channel->peak_demand))
+        {
+            ESP_LOGI(TAG, "Restored peak demand of meter %u: %" PRIu32 " W at %" PRIu32, channel->index, channel->peak_demand.max_demand,
+                     channel->peak_demand.max_demand_time);
+            return;
+        }
+    }
+
+    peak_demand_init(&channel->peak_demand);
+}
+
+static void save_peak_demand(const meter_channel_t *channel)
+{
+    nvs_handle_t handle;
+    char name[NVS_KEY_NAME_MAX_SIZE];
+    const char *key = channel_name(channel, NVS_KEY_PEAK_DEMAND, name, sizeof(name));
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to open NVS for peak demand");
+        return;
+    }
+
+    if (nvs_set_blob(handle, key, &channel->peak_demand, sizeof(channel->peak_demand)) != ESP_OK || nvs_commit(handle) != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to store peak demand");
+    }
+    nvs_close(handle);
+}
+#endif
+
+// Overwrite key material on the stack, the compiler may not drop it as a dead store
+static void wipe(void *buffer, size_t size)
+{
+    volatile uint8_t *bytes = buffer;
+    while (size--)
+    {
+        *bytes++ = 0;
+    }
+}
+
+// Hands the stored keys to the parser. Runs in the parser task, so no frame is being decrypted.
+static void load_meter_keys(meter_channel_t *channel)
+{
+    uint8_t encryption_key[DLMS_GCM_KEY_SIZE];
+    uint8_t authentication_key[DLMS_GCM_KEY_SIZE];
+    char ek_name[16];
+    char ak_name[16];
+    bool has_encryption = platform_secure_read(channel_name(channel, SECURE_NAME_METER_EK, ek_name, sizeof(ek_name)), encryption_key, sizeof(encryption_key));
+    bool has_authentication = platform_secure_read(channel_name(channel, SECURE_NAME_METER_AK, ak_name, sizeof(ak_name)), authentication_key, sizeof(authentication_key));
+
+    if (!dlms_parser_set_keys(&channel->parser, has_encryption ? encryption_key : NULL, has_authentication ? authentication_key : NULL))
+    {
+        ESP_LOGE(TAG, "Meter %u encryption key rejected", channel->index);
+        has_encryption = false;
+    }
+    wipe(encryption_key, sizeof(encryption_key));
+    wipe(authentication_key, sizeof(authentication_key));
+
+    channel->meter_keys_status = (has_encryption ? METER_KEYS_ENCRYPTION : 0) | (has_authentication ? METER_KEYS_AUTHENTICATION : 0);
+    ESP_LOGI(TAG, "Meter %u keys: encryption %s, authentication %s", channel->index, has_encryption ? "set" : "none", has_authentication ? "set" : "none");
+}
+
+// After a key write: drop the written value from the attribute table and publish the new status
+static void reload_meter_keys(meter_channel_t *channel)
+{
+    load_meter_keys(channel);
+
+    uint8_t cleared[1 + DLMS_GCM_KEY_SIZE] = {DLMS_GCM_KEY_SIZE};
+    platform_zb_lock();
+    platform_zb_set_attribute(channel->endpoint, WATTZIG_CLUSTER_ID, WATTZIG_ATTR_METER_ENCRYPTION_KEY_ID, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, cleared);
+    platform_zb_set_attribute(channel->endpoint, WATTZIG_CLUSTER_ID, WATTZIG_ATTR_METER_AUTHENTICATION_KEY_ID, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, cleared);
+    platform_zb_set_attribute(channel->endpoint, WATTZIG_CLUSTER_ID, WATTZIG_ATTR_METER_KEYS_ID, ESP_ZB_ZCL_ATTR_TYPE_8BITMAP, &channel->meter_keys_status);
+    platform_zb_unlock();
+}
+
+#if PEAK_DEMAND_ENABLE
+// Update instantaneous demand, the running block average and the month-to-date maximum
+static HOT_PATH void apply_peak_demand(meter_channel_t *channel)
+{
+    const meter_snapshot_t *snapshot = &channel->snapshot;
+    peak_demand_t *peak_demand = &channel->peak_demand;
+
+    if (!meter_snapshot_has(snapshot, ACTIVE_POWER_IMPORT))
+    {
+        return;
+    }
+
+    int64_t instantaneous = (int64_t)snapshot->active_power_import - (int64_t)snapshot->active_power_export;
+    set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_METERING, METERING_ATTR_INSTANTANEOUS_DEMAND_ID, false, ESP_ZB_ZCL_ATTR_TYPE_S24, instantaneous);
+
+    if (snapshot->timestamp == 0)
+    {
+        return;
+    }
+
+    bool closed = peak_demand_update(peak_demand, snapshot->timestamp, snapshot->active_power_import);
+
+    set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_METERING, METERING_MANUF_ATTR_BLOCK_DEMAND_ID, true, ESP_ZB_ZCL_ATTR_TYPE_U24, peak_demand_running_average(peak_demand));
+
+    if (closed)
+    {
+        DLOGI(TAG, "Meter %u demand block closed. Month max: %" PRIu32 " W", channel->index, peak_demand->max_demand);
+
+        uint32_t max_demand_time = peak_demand->max_demand_time;
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_METERING, METERING_ATTR_CURRENT_MAX_DEMAND_DELIVERED_ID, false, ESP_ZB_ZCL_ATTR_TYPE_U48, peak_demand->max_demand);
+        platform_zb_set_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_METERING, METERING_ATTR_CURRENT_MAX_DEMAND_DELIVERED_TIME_ID, ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME, &max_demand_time);
+
+        platform_zb_report_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_METERING, METERING_ATTR_CURRENT_MAX_DEMAND_DELIVERED_ID, false);
+        TRACE_POINT(TRACE_POINT_REPORTED);
+
+        save_peak_demand(channel);
+    }
+}
+#endif
+
+#if POWER_EVENTS_ENABLE
+static const uint8_t HOT_PATH_DATA kPowerEventAlarmCodes[POWER_EVENT_TYPE_COUNT] = {
+    [POWER_EVENT_SAG] = EM_ALARM_CODE_VOLTAGE_SAG,
+    [POWER_EVENT_SWELL] = EM_ALARM_CODE_VOLTAGE_SWELL,
+    [POWER_EVENT_PHASE_LOSS] = EM_ALARM_CODE_EXTREME_UNDER_VOLTAGE,
+    [POWER_EVENT_OVERCURRENT] = EM_ALARM_CODE_CURRENT_OVERLOAD,
+};
+
+static void send_power_alarm(const meter_channel_t *channel, const power_event_t *event)
+{
+    // Alarm payload is the alarm code (uint8) followed by the cluster ID (uint16), little endian.
+    // Packed as a 24-bit value the stack serializes exactly these three bytes.
+    uint8_t alarm_code = kPowerEventAlarmCodes[event->type] + event->phase * EM_ALARM_PHASE_OFFSET;
+    uint32_t payload = alarm_code | ((uint32_t)ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT << 8);
+
+    platform_zb_send_command(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ALARMS, ZCL_CMD_ALARMS_ALARM, ESP_ZB_ZCL_ATTR_TYPE_U24, &payload);
+    TRACE_POINT(TRACE_POINT_REPORTED);
+}
+
+// Detect voltage and current events and notify them right away, ahead of any other attribute work.
+// detected_at is when the frame completed, so the measured latency covers all work until the alarm is queued.
+static HOT_PATH void apply_power_events(meter_channel_t *channel, int64_t detected_at)
+{
+    power_event_t transitions[POWER_EVENTS_MAX_TRANSITIONS];
+    uint8_t count = power_events_update(&channel->power_events, &channel->snapshot, transitions);
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        DLOGW(TAG, "Meter %u power event %d on phase %d %s", channel->index, transitions[i].type, transitions[i].phase, DLOG_STR(transitions[i].active ? "raised" : "cleared"));
+        if (transitions[i].active)
+        {
+            send_power_alarm(channel, &transitions[i]);
+        }
+    }
+
+    uint16_t active_events = power_events_active(&channel->power_events);
+    platform_zb_set_manufacturer_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, EM_MANUF_ATTR_ACTIVE_EVENTS_ID, ESP_ZB_ZCL_ATTR_TYPE_16BITMAP, &active_events);
+    platform_zb_report_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, EM_MANUF_ATTR_ACTIVE_EVENTS_ID, true);
+    TRACE_POINT(TRACE_POINT_REPORTED);
+
+    uint32_t latency = (uint32_t)(platform_time_us() - detected_at);
+    if (latency > channel->event_latency_max_us)
+    {
+        channel->event_latency_max_us = latency;
+    }
+    if (latency > POWER_EVENTS_LATENCY_BUDGET_US)
+    {
+        DLOGW(TAG, "Meter %u power event latency %" PRIu32 " us exceeds budget", channel->index, latency);
+    }
+
+    platform_zb_set_manufacturer_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, EM_MANUF_ATTR_EVENT_LATENCY_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &latency);
+    platform_zb_set_manufacturer_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, EM_MANUF_ATTR_EVENT_LATENCY_MAX_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &channel->event_latency_max_us);
+}
+#endif
+
+#if LOAD_EVENTS_ENABLE
+// Send detected appliance switching events as one command on the WattZig cluster
+static HOT_PATH void apply_load_events(meter_channel_t *channel)
+{
+    load_event_t events[METER_PHASE_COUNT];
+    uint8_t count = load_events_update(&channel->load_events, &channel->snapshot, events);
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Octet string: length byte followed by the records
+    uint8_t payload[1 + METER_PHASE_COUNT * LOAD_EVENT_RECORD_SIZE];
+    payload[0] = count * LOAD_EVENT_RECORD_SIZE;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        DLOGI(TAG, "Meter %u load event phase %d: %d W (signature %d)", channel->index, events[i].phase, events[i].delta, events[i].signature);
+        load_event_serialize(&events[i], &payload[1 + i * LOAD_EVENT_RECORD_SIZE]);
+    }
+
+    platform_zb_send_command(channel->endpoint, WATTZIG_CLUSTER_ID, WATTZIG_CMD_LOAD_EVENTS, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, payload);
+    TRACE_POINT(TRACE_POINT_REPORTED);
+
+    channel->load_event_count += count;
+    platform_zb_set_attribute(channel->endpoint, WATTZIG_CLUSTER_ID, WATTZIG_ATTR_LOAD_EVENT_COUNT_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &channel->load_event_count);
+}
+#endif
+
+#if ENERGY_INTEGRATOR_ENABLE
+static HOT_PATH void update_summation(uint8_t endpoint, energy_integrator_t *integrator, uint16_t attr_id, uint64_t *last_value)
+{
+    uint64_t value;
+
+    if (!energy_integrator_value(integrator, &value) || value == *last_value)
+    {
+        return;
+    }
+
+    *last_value = value;
+    platform_zb_set_attribute(endpoint, ESP_ZB_ZCL_CLUSTER_ID_METERING, attr_id, ESP_ZB_ZCL_ATTR_TYPE_U48, &value);
+    platform_zb_report_attribute(endpoint, ESP_ZB_ZCL_CLUSTER_ID_METERING, attr_id, false);
+    TRACE_POINT(TRACE_POINT_REPORTED);
+}
+
+// Energy registers may only arrive hourly. In between, the summations are estimated from power
+// and re-anchored whenever the meter sends a new register value.
+static HOT_PATH void apply_energy_summation(meter_channel_t *channel)
+{
+    const meter_snapshot_t *snapshot = &channel->snapshot;
+    int64_t now_ms = platform_time_us() / 1000;
+
+    // A+ is what the import register counts. The phases only stand in for lists without it: their
+    // net sum matches A+ while it is positive, but not when one phase exports into another.
+    if (meter_snapshot_has(snapshot, ACTIVE_POWER_IMPORT))
+    {
+        energy_integrator_add_power(&channel->energy_import, now_ms, snapshot->active_power_import);
+    }
+    else if (meter_snapshot_has(snapshot, ACTIVE_POWER_A) && meter_snapshot_has(snapshot, ACTIVE_POWER_B) && meter_snapshot_has(snapshot, ACTIVE_POWER_C))
+    {
+        int64_t power = 0;
+        for (int p = 0; p < METER_PHASE_COUNT; p++)
+        {
+            power += snapshot->active_power[p];
+        }
+        energy_integrator_add_power(&channel->energy_import, now_ms, power > 0 ? (uint32_t)power : 0);
+    }
+
+    if (meter_snapshot_has(snapshot, ACTIVE_POWER_EXPORT))
+    {
+        energy_integrator_add_power(&channel->energy_export, now_ms, snapshot->active_power_export);
+    }
+
+    // After the power samples: a new register value already covers the interval they closed
+    if (meter_snapshot_has(snapshot, ACTIVE_ENERGY_IMPORT))
+    {
+        energy_integrator_anchor(&channel->energy_import, snapshot->active_energy_import);
+    }
+    if (meter_snapshot_has(snapshot, ACTIVE_ENERGY_EXPORT))
+    {
+        energy_integrator_anchor(&channel->energy_export, snapshot->active_energy_export);
+    }
+
+    update_summation(channel->endpoint, &channel->energy_import, ESP_ZB_ZCL_ATTR_METERING_CURRENT_SUMMATION_DELIVERED_ID, &channel->summation_delivered);
+    update_summation(channel->endpoint, &channel->energy_export, ESP_ZB_ZCL_ATTR_METERING_CURRENT_SUMMATION_RECEIVED_ID, &channel->summation_received);
+}
+#endif
+
+#if APDU_FORWARD_ENABLE
+// Send the raw APDU of the frame that just ended to the coordinator, compressed and cut into
+// chunks that each fit a ZCL command. The backend puts the chunks of one sequence number together.
+// Called after the Zigbee lock is released at END, as the compression takes a few ms; the lock is
+// only taken to send. The parser keeps the APDU until the callback returns.
+static void forward_apdu(meter_channel_t *channel)
+{
+    static uint8_t compressed[APDU_FORWARD_BOUND(APDU_FORWARD_MAX_APDU)];
+    uint16_t length;
+
+    if (channel->frontend.protocol != METER_PROTOCOL_DLMS)
+    {
+        return;
+    }
+    const uint8_t *apdu = dlms_parser_apdu(&channel->parser, &length);
+    if (apdu == NULL)
+    {
+        DLOGW(TAG, "APDU too long to forward");
+        diag_increment(DIAG_APDU_FORWARD_ERRORS);
+        return;
+    }
+
+    size_t size = apdu_forward_compress(apdu, length, compressed, sizeof(compressed));
+    if (size == 0)
+    {
+        DLOGW(TAG, "APDU of %u bytes not compressed, not forwarded", length);
+        diag_increment(DIAG_APDU_FORWARD_ERRORS);
+        return;
+    }
+
+    platform_zb_lock();
+    uint8_t count = (uint8_t)((size + APDU_FORWARD_CHUNK_SIZE - 1) / APDU_FORWARD_CHUNK_SIZE);
+    for (uint8_t i = 0; i < count; i++)
+    {
+        // Octet string: length byte, sequence, chunk index and count, compressed bytes
+        uint8_t payload[1 + 3 + APDU_FORWARD_CHUNK_SIZE];
+        size_t offset = (size_t)i * APDU_FORWARD_CHUNK_SIZE;
+        size_t chunk = size - offset < APDU_FORWARD_CHUNK_SIZE ? size - offset : APDU_FORWARD_CHUNK_SIZE;
+
+        payload[0] = (uint8_t)(3 + chunk);
+        payload[1] = channel->apdu_sequence;
+        payload[2] = i;
+        payload[3] = count;
+        memcpy(&payload[4], &compressed[offset], chunk);
+        platform_zb_send_command(channel->endpoint, WATTZIG_CLUSTER_ID, WATTZIG_CMD_APDU_DATA, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, payload);
+    }
+    DLOGI(TAG, "APDU of %u bytes forwarded as %u", length, (unsigned)size);
+
+    channel->apdu_sequence++;
+    channel->apdus_forwarded++;
+    platform_zb_set_attribute(channel->endpoint, WATTZIG_CLUSTER_ID, WATTZIG_ATTR_APDUS_FORWARDED_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, &channel->apdus_forwarded);
+    platform_zb_unlock();
+}
+#endif
+
+typedef struct {
+    uint16_t attr_id;
+    diag_counter_t counter;
+} diag_attr_t;
+
+static const diag_attr_t HOT_PATH_DATA kDiagCounterAttrs[] = {
+    {DIAG_MANUF_ATTR_FRAMES_OK_ID, DIAG_FRAMES_OK},
+    {DIAG_MANUF_ATTR_FCS_ERRORS_ID, DIAG_FCS_ERRORS},
+    {DIAG_MANUF_ATTR_RESYNCS_ID, DIAG_RESYNCS},
+    {DIAG_MANUF_ATTR_UART_FIFO_OVERFLOWS_ID, DIAG_UART_FIFO_OVERFLOWS},
+    {DIAG_MANUF_ATTR_UART_BUFFER_FULL_ID, DIAG_UART_BUFFER_FULL},
+    {DIAG_MANUF_ATTR_SILENCE_DISCARDED_ID, DIAG_SILENCE_DISCARDED},
+    {DIAG_MANUF_ATTR_DECRYPT_ERRORS_ID, DIAG_DECRYPT_ERRORS},
+    {DIAG_MANUF_ATTR_CLIENT_ERRORS_ID, DIAG_CLIENT_ERRORS},
+    {DIAG_MANUF_ATTR_APDU_FORWARD_ERRORS_ID, DIAG_APDU_FORWARD_ERRORS},
+};
+
+static HOT_PATH void set_diag_attr(uint16_t attr_id, uint32_t value)
+{
+    platform_zb_set_manufacturer_attribute(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, attr_id, ESP_ZB_ZCL_ATTR_TYPE_U32, &value);
+}
+
+// Runs at the end of every frame of a channel, complete or not, with the Zigbee lock held
+static HOT_PATH void apply_diagnostics(const meter_channel_t *channel)
+{
+    for (size_t i = 0; i < sizeof(kDiagCounterAttrs) / sizeof(kDiagCounterAttrs[0]); i++)
+    {
+        set_diag_attr(kDiagCounterAttrs[i].attr_id, diag_get(kDiagCounterAttrs[i].counter));
+    }
+
+    uint32_t frames = diag_get(DIAG_FRAMES_OK) + diag_get(DIAG_FCS_ERRORS) + diag_get(DIAG_RESYNCS) + diag_get(DIAG_DECRYPT_ERRORS) +
+                      diag_get(DIAG_CLIENT_ERRORS);
+    set_diag_attr(DIAG_MANUF_ATTR_PARSE_TIME_AVG_ID, frames > 0 ? diag_get(DIAG_PARSE_US) / frames : 0);
+    set_diag_attr(DIAG_MANUF_ATTR_HEAP_MIN_ID, platform_heap_min());
+    set_diag_attr(DIAG_MANUF_ATTR_PARSER_STACK_FREE_ID, uxTaskGetStackHighWaterMark(NULL) * sizeof(StackType_t));
+    set_diag_attr(DIAG_MANUF_ATTR_ZIGBEE_STACK_FREE_ID, platform_zb_stack_free());
+    set_diag_attr(DIAG_MANUF_ATTR_DECRYPT_TIME_ID, dlms_parser_decrypt_us(&channel->parser));
+
+    uint32_t decoded = 0;
+    uint32_t skipped = 0;
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+        uint32_t channel_decoded;
+        uint32_t channel_skipped;
+        dlms_parser_element_counts(&channels[i].parser, &channel_decoded, &channel_skipped);
+        decoded += channel_decoded;
+        skipped += channel_skipped;
+    }
+    set_diag_attr(DIAG_MANUF_ATTR_ELEMENTS_DECODED_ID, decoded);
+    set_diag_attr(DIAG_MANUF_ATTR_ELEMENTS_SKIPPED_ID, skipped);
+}
+
+// Share of the CPU each channel took over the window that just ended, in 1/100 %. Returns the
+// time in ms until the current window ends.
+static uint32_t publish_cpu_load(int64_t now)
+{
+    int64_t elapsed = now - cpu_window_start;
+    if (elapsed < (int64_t)METER_CPU_WINDOW_MS * 1000)
+    {
+        return METER_CPU_WINDOW_MS - (uint32_t)(elapsed / 1000);
+    }
+
+    platform_zb_lock();
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+        uint32_t load = (uint32_t)((uint64_t)channels[i].cpu_us * 10000 / (uint64_t)elapsed);
+        ESP_LOGI(TAG, "Meter %d CPU load %" PRIu32 ".%02" PRIu32 " %%", i, load / 100, load % 100);
+        set_diag_attr(DIAG_MANUF_ATTR_CHANNEL_CPU_LOAD(i), load);
+        channels[i].cpu_us = 0;
+    }
+    platform_zb_unlock();
+
+    cpu_window_start = now;
+    return METER_CPU_WINDOW_MS;
+}
+
+#if TRACE_ENABLE
+static void publish_trace(void)
+{
+    uint8_t histogram[TRACE_HISTOGRAM_SIZE + 1];
+    char buckets[TRACE_BUCKETS * 12];
+
+    for (int span = 0; span < TRACE_SPAN_COUNT; span++)
+    {
+        const trace_histogram_t *h = &trace.spans[span];
+
+        // Non-empty buckets as "upper bound:count"
+        int length = 0;
+        for (int i = 0; i < TRACE_BUCKETS; i++)
+        {
+            if (h->buckets[i] > 0)
+            {
+                length += snprintf(&buckets[length], sizeof(buckets) - length, " <%" PRIu32 ":%" PRIu32, (uint32_t)1 << i, h->buckets[i]);
+            }
+        }
+        buckets[length] = '\0';
+
+        ESP_LOGI(TAG, "Trace %-9s n=%" PRIu32 " mean=%" PRIu32 " p50=%" PRIu32 " p99=%" PRIu32 " max=%" PRIu32 " us,%s",
+                 trace_span_name(span), h->count, trace_histogram_mean(h), trace_histogram_percentile(h, 50),
+                 trace_histogram_percentile(h, 99), h->max_us, buckets);
+
+        trace_histogram_serialize(h, histogram);
+        platform_zb_set_manufacturer_attribute(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, DIAG_MANUF_ATTR_TRACE_HISTOGRAM(span), ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, histogram);
+    }
+}
+#endif
+
+typedef struct {
+    const char *name;
+    diag_counter_t counter;
+} abort_reason_t;
+
+// Indexed by dlms_abort_reason_t
+static const abort_reason_t HOT_PATH_DATA kAbortReasons[] = {
+    [DLMS_ABORT_RESYNC] = {"resync", DIAG_RESYNCS},
+    [DLMS_ABORT_FCS] = {"FCS", DIAG_FCS_ERRORS},
+    [DLMS_ABORT_DECRYPT] = {"decrypt", DIAG_DECRYPT_ERRORS},
+    [DLMS_ABORT_CLIENT] = {"no response", DIAG_CLIENT_ERRORS},
+};
+
+// Context is the meter channel of the parser or client
+static HOT_PATH void handle_dlms_field(dlms_field_t *field, void *context)
 {
+    meter_channel_t *channel = context;
 
     if (field == NULL)
     {
-        ESP_LOGW(TAG, "Received null field");
+        DLOGW(TAG, "Received null field");
         return;
     }
 
@@ -121,315 +847,861 @@ static void handle_dlms_field(dlms_field_t *field)
     {
 
     case START:
-        ESP_LOGI(TAG, "Start received. Acquiring lock");
-        esp_zb_lock_acquire(portMAX_DELAY);
-        gpio_set_level(LED_PIN, 0);
-        gpio_set_level(LED_PIN2, 1); // Green LED on
+        DLOGI(TAG, "Start received. Acquiring lock");
+#if STRESS_MODE
+        int64_t lock_start = platform_time_us();
+        platform_zb_lock();
+        stress_lock_wait_us = (uint32_t)(platform_time_us() - lock_start);
+#else
+        platform_zb_lock();
+#endif
+#if TRACE_ENABLE
+        trace_point(&trace, TRACE_POINT_UART_EVENT, uart_event_us);
+        TRACE_POINT(TRACE_POINT_LOCKED);
+#endif
+        meter_snapshot_reset(&channel->snapshot);
+        platform_gpio_set_level(LED_PIN, 0);
+        platform_gpio_set_level(LED_PIN2, 1); // Green LED on
         break;
 
     case END:
-        ESP_LOGI(TAG, "End received. Releasing lock");
-        esp_zb_lock_release();
-        gpio_set_level(LED_PIN, 0);
-        gpio_set_level(LED_PIN2, 0);
+        DLOGI(TAG, "End received. Releasing lock");
+        int64_t commit_start = platform_time_us();
+#if TRACE_ENABLE
+        trace_point(&trace, TRACE_POINT_FRAME_COMPLETE, commit_start);
+#endif
+#if POWER_EVENTS_ENABLE
+        apply_power_events(channel, commit_start);
+#endif
+#if POWER_STATS_ENABLE
+        power_stats_update(&channel->power_stats, &channel->snapshot);
+        apply_power_stats(channel);
+#endif
+#if PEAK_DEMAND_ENABLE
+        apply_peak_demand(channel);
+#endif
+#if LOAD_EVENTS_ENABLE
+        apply_load_events(channel);
+#endif
+#if ENERGY_INTEGRATOR_ENABLE
+        apply_energy_summation(channel);
+#endif
+        diag_increment(DIAG_FRAMES_OK);
+        apply_diagnostics(channel);
+#if TRACE_ENABLE
+        TRACE_POINT(TRACE_POINT_APPLIED);
+        trace_frame_end(&trace);
+        if (trace.frames % TRACE_PUBLISH_FRAMES == 0)
+        {
+            publish_trace();
+        }
+#endif
+        platform_zb_unlock();
+#if STRESS_MODE
+        stress_commit_us = (uint32_t)(platform_time_us() - commit_start);
+#endif
+#if APDU_FORWARD_ENABLE
+        forward_apdu(channel);
+#endif
+        platform_gpio_set_level(LED_PIN, 0);
+        platform_gpio_set_level(LED_PIN2, 0);
+        break;
+
+    case ABORT:
+        // Attributes set from this frame stay, the frame level updates are skipped
+        DLOGW(TAG, "Frame dropped (%s). Releasing lock", DLOG_STR(kAbortReasons[field->data[0]].name));
+        diag_increment(kAbortReasons[field->data[0]].counter);
+        apply_diagnostics(channel);
+        platform_zb_unlock();
+        platform_gpio_set_level(LED_PIN2, 0);
         break;
 
     case RMS_VOLTAGE_A:
         uint16_t valueA = convert_to_uint16(field->data);
-        ESP_LOGI(TAG, "Received RMS Voltage A: %d", valueA);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_ID, &valueA, false); //!< Represents the most recent RMS voltage reading in @e Volts (V).
+        channel->snapshot.rms_voltage[METER_PHASE_A] = valueA;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received RMS Voltage A: %d", valueA);
+        platform_zb_set_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, &valueA); //!< Represents the most recent RMS voltage reading in @e Volts (V).
         break;
 
     case RMS_VOLTAGE_B:
         uint16_t valueB = convert_to_uint16(field->data);
-        ESP_LOGI(TAG, "Received RMS Voltage B: %d", valueB);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_PHB_ID, &valueB, false); //!< Represents the most recent RMS voltage reading in @e Volts (V).
+        channel->snapshot.rms_voltage[METER_PHASE_B] = valueB;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received RMS Voltage B: %d", valueB);
+        platform_zb_set_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_PHB_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, &valueB); //!< Represents the most recent RMS voltage reading in @e Volts (V).
         break;
 
     case RMS_VOLTAGE_C:
         uint16_t valueC = convert_to_uint16(field->data);
-        ESP_LOGI(TAG, "Received RMS Voltage C: %d", valueC);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_PHC_ID, &valueC, false); //!< Represents the most recent RMS voltage reading in @e Volts (V).
+        channel->snapshot.rms_voltage[METER_PHASE_C] = valueC;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received RMS Voltage C: %d", valueC);
+        platform_zb_set_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_PHC_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, &valueC); //!< Represents the most recent RMS voltage reading in @e Volts (V).
         break;
 
     case POWER_FACTOR_A:
         uint16_t factorA = convert_to_uint16(field->data);
-        uint8_t factorA_8 = (uint8_t)(factorA);
-        ESP_LOGI(TAG, "Received factor A: %d", factorA);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_ID, &factorA_8, false);
+        channel->snapshot.power_factor[METER_PHASE_A] = factorA;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received factor A: %d", factorA);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_ID, false, ESP_ZB_ZCL_ATTR_TYPE_U8, factorA);
         break;
 
     case POWER_FACTOR_B:
         uint16_t factorB = convert_to_uint16(field->data);
-        uint8_t factorB_8 = (uint8_t)(factorB);
-        ESP_LOGI(TAG, "Received factor B: %d", factorB);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_PH_B_ID, &factorB_8, false);
+        channel->snapshot.power_factor[METER_PHASE_B] = factorB;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received factor B: %d", factorB);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_PH_B_ID, false, ESP_ZB_ZCL_ATTR_TYPE_U8, factorB);
         break;
 
     case POWER_FACTOR_C:
         uint16_t factorC = convert_to_uint16(field->data);
-        uint8_t factorC_8 = (uint8_t)(factorC);
-        ESP_LOGI(TAG, "Received factor C: %d", factorC);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_PH_C_ID, &factorC_8, false);
+        channel->snapshot.power_factor[METER_PHASE_C] = factorC;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received factor C: %d", factorC);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_PH_C_ID, false, ESP_ZB_ZCL_ATTR_TYPE_U8, factorC);
         break;
 
     case RMS_CURRENT_A:
         uint32_t currentA = convert_to_uint32(field->data);
-        uint16_t currentA_16 = (uint16_t)(currentA);
-        ESP_LOGI(TAG, "Received RMS current A: %u", currentA);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_ID, &currentA_16, false);
+        channel->snapshot.rms_current[METER_PHASE_A] = currentA;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received RMS current A: %u", currentA);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_ID, false, ESP_ZB_ZCL_ATTR_TYPE_U16, currentA);
         break;
 
     case RMS_CURRENT_B:
         uint32_t currentB = convert_to_uint32(field->data);
-        uint16_t currentB_16 = (uint16_t)(currentB);
-        ESP_LOGI(TAG, "Received RMS current B: %u", currentB);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_PHB_ID, &currentB_16, false);
+        channel->snapshot.rms_current[METER_PHASE_B] = currentB;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received RMS current B: %u", currentB);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_PHB_ID, false, ESP_ZB_ZCL_ATTR_TYPE_U16, currentB);
         break;
 
     case RMS_CURRENT_C:
         uint32_t currentC = convert_to_uint32(field->data);
-        uint16_t currentC_16 = (uint16_t)(currentC);
-        ESP_LOGI(TAG, "Received RMS current C: %u", currentC);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_PHC_ID, &currentC_16, false);
+        channel->snapshot.rms_current[METER_PHASE_C] = currentC;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received RMS current C: %u", currentC);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_PHC_ID, false, ESP_ZB_ZCL_ATTR_TYPE_U16, currentC);
         break;
 
     case ACTIVE_POWER_A:
         uint32_t powerA = convert_to_uint32(field->data);
-        int16_t powerA_16 = (int16_t)(powerA);
-        ESP_LOGI(TAG, "Received ACTIVE_POWER_A: %u", powerA);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_ID, &powerA_16, false);
+        channel->snapshot.active_power[METER_PHASE_A] = (int32_t)powerA;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received ACTIVE_POWER_A: %u", powerA);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_ID, false, ESP_ZB_ZCL_ATTR_TYPE_S16, (int32_t)powerA);
         break;
 
     case ACTIVE_POWER_B:
         uint32_t powerB = convert_to_uint32(field->data);
-        int16_t powerB_16 = (int16_t)(powerB);
-        ESP_LOGI(TAG, "Received ACTIVE_POWER_B: %u", powerB);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_PHB_ID, &powerB_16, false);
+        channel->snapshot.active_power[METER_PHASE_B] = (int32_t)powerB;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received ACTIVE_POWER_B: %u", powerB);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_PHB_ID, false, ESP_ZB_ZCL_ATTR_TYPE_S16, (int32_t)powerB);
         break;
 
     case ACTIVE_POWER_C:
         uint32_t powerC = convert_to_uint32(field->data);
-        int16_t powerC_16 = (int16_t)(powerC);
-        ESP_LOGI(TAG, "Received ACTIVE_POWER_C: %u", powerC);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_PHC_ID, &powerC_16, false);
+        channel->snapshot.active_power[METER_PHASE_C] = (int32_t)powerC;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received ACTIVE_POWER_C: %u", powerC);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_PHC_ID, false, ESP_ZB_ZCL_ATTR_TYPE_S16, (int32_t)powerC);
         break;
 
     case REACTIVE_POWER_A:
         uint32_t rePowerA = convert_to_uint32(field->data);
-        int16_t rePowerA_16 = (int16_t)(rePowerA);
+        channel->snapshot.reactive_power[METER_PHASE_A] = (int32_t)rePowerA;
+        meter_snapshot_mark(&channel->snapshot, field->type);
         // ESP_LOGI(TAG, "Received REACTIVE A: %u", rePowerA);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_ID, &rePowerA_16, false);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_ID, false, ESP_ZB_ZCL_ATTR_TYPE_S16, (int32_t)rePowerA);
         break;
 
     case REACTIVE_POWER_B:
         uint32_t rePowerB = convert_to_uint32(field->data);
-        int16_t rePowerB_16 = (int16_t)(rePowerB);
+        channel->snapshot.reactive_power[METER_PHASE_B] = (int32_t)rePowerB;
+        meter_snapshot_mark(&channel->snapshot, field->type);
         // ESP_LOGI(TAG, "Received REACTIVE B: %u", rePowerB);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_PH_B_ID, &rePowerB_16, false);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_PH_B_ID, false, ESP_ZB_ZCL_ATTR_TYPE_S16, (int32_t)rePowerB);
         break;
 
     case REACTIVE_POWER_C:
         uint32_t rePowerC = convert_to_uint32(field->data);
-        int16_t rePowerC_16 = (int16_t)(rePowerC);
+        channel->snapshot.reactive_power[METER_PHASE_C] = (int32_t)rePowerC;
+        meter_snapshot_mark(&channel->snapshot, field->type);
         // ESP_LOGI(TAG, "Received REACTIVE C: %u", rePowerC);
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_PH_C_ID, &rePowerC_16, false);
+        set_number_attr(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_PH_C_ID, false, ESP_ZB_ZCL_ATTR_TYPE_S16, (int32_t)rePowerC);
         break;
 
     case ACTIVE_ENERGY_IMPORT:
         uint64_t powerImport = convert_to_uint32(field->data);
-        ESP_LOGI(TAG, "Received ACTIVE_ENERGY_IMPORT: %" PRIu64, powerImport);
+        channel->snapshot.active_energy_import = powerImport;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received ACTIVE_ENERGY_IMPORT: %" PRIu64, DLOG_U64(powerImport));
+        break;
+
+    case ACTIVE_ENERGY_EXPORT:
+        uint64_t powerExport = convert_to_uint32(field->data);
+        channel->snapshot.active_energy_export = powerExport;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received ACTIVE_ENERGY_EXPORT: %" PRIu64, DLOG_U64(powerExport));
+        break;
+
+    case ACTIVE_POWER_IMPORT:
+        channel->snapshot.active_power_import = convert_to_uint32(field->data);
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received ACTIVE_POWER_IMPORT: %" PRIu32, channel->snapshot.active_power_import);
+        break;
+
+    case ACTIVE_POWER_EXPORT:
+        channel->snapshot.active_power_export = convert_to_uint32(field->data);
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Received ACTIVE_POWER_EXPORT: %" PRIu32, channel->snapshot.active_power_export);
+        break;
+
+    case DLMS_FIELD_TIMESTAMP:
+        channel->snapshot.timestamp = dlms_datetime_to_seconds(field->data);
+        meter_snapshot_mark(&channel->snapshot, field->type);
+        DLOGI(TAG, "Timestamp: %" PRIu32, channel->snapshot.timestamp);
+        break;
+
+    case SERIAL_NUMBER:
+        uint32_t serial = (field->data[0] << 24) |
+                          (field->data[1] << 16) |
+                          (field->data[2] << 8) |
+                          field->data[3];
+
+        DLOGI(TAG, "Serial Number: %u", serial);
+        channel->snapshot.serial_number = serial;
+        meter_snapshot_mark(&channel->snapshot, field->type);
+
+        const uint8_t *cur = platform_zb_get_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_ATTR_METERING_METER_SERIAL_NUMBER_ID);
+        bool should_set = true;
+        if (cur != NULL)
+        {
+            if (cur[0] != 0)
+            {
+                DLOGI(TAG, "Meter serial already set, skipping update");
+                should_set = false;
+            }
+        }
+
+        if (should_set)
+        {
+            uint8_t serial_octstr[5] = {
+                4, // Length byte
+                field->data[0],
+                field->data[1],
+                field->data[2],
+                field->data[3]};
+
+            platform_zb_set_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_ATTR_METERING_METER_SERIAL_NUMBER_ID, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, &serial_octstr);
+            DLOGI(TAG, "Meter serial attribute set");
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+#if !STATIC_ALLOCATION
+static TaskHandle_t start_task(TaskFunction_t function, const char *name, uint32_t stack_size, UBaseType_t priority)
+{
+    TaskHandle_t handle = NULL;
+    xTaskCreate(function, name, stack_size, NULL, priority, &handle);
+    return handle;
+}
+#endif
+
+static void log_memory_report(void)
+{
+    uint32_t heap_total = platform_heap_total();
+    if (heap_total == 0)
+    {
+        return;
+    }
+
+    uint32_t heap_free = platform_heap_free();
+    ESP_LOGI(TAG, "Memory: %" PRIu32 " bytes static (.data and .bss), heap %" PRIu32 " of %" PRIu32 " bytes in use, lowest free %" PRIu32,
+             platform_static_ram(), heap_total - heap_free, heap_total, platform_heap_min());
+    ESP_LOGI(TAG, "Task stacks and buffers: %u bytes %s", (unsigned)STATIC_ALLOCATION_SIZE, STATIC_ALLOCATION ? "static" : "on the heap");
+}
+
+static void initLedFlash(void *pvParameters)
+{
+    platform_gpio_set_level(LED_PIN, 0);
+    platform_gpio_set_level(LED_PIN2, 0);
+
+    bool on = false;
+    while (1)
+    {
+        if (on)
+        {
+            platform_gpio_set_level(LED_PIN, 1);
+            vTaskDelay(50 / portTICK_PERIOD_MS);
+        }
+        else
+        {
+            platform_gpio_set_level(LED_PIN, 0);
+            vTaskDelay(1000 / portTICK_PERIOD_MS);
+        }
+
+        on = !on;
+    }
+}
+
+#if CAPTURE_ENABLE || DLOG_DEFERRED
+static void put_u32(uint8_t *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+#endif
+
+#if CAPTURE_ENABLE
+static void capture_rx(int64_t time_us, const uint8_t *data, int length)
+{
+    xSemaphoreTake(capture_mutex, portMAX_DELAY);
+    if (!capture_paused)
+    {
+        capture_write(&capture, time_us, data, length);
+    }
+    xSemaphoreGive(capture_mutex);
+}
+
+static void send_capture_chunk(uint32_t offset)
+{
+    // Octet string: length byte, offset, capture size, capture bytes
+    uint8_t payload[1 + 8 + CAPTURE_CHUNK_SIZE];
+
+    xSemaphoreTake(capture_mutex, portMAX_DELAY);
+    capture_paused = true;
+    uint32_t size = capture_export_size(&capture);
+    size_t length = capture_export(&capture, offset, &payload[9], CAPTURE_CHUNK_SIZE);
+    xSemaphoreGive(capture_mutex);
+
+    payload[0] = 8 + length;
+    put_u32(&payload[1], offset);
+    put_u32(&payload[5], size);
+    platform_zb_send_command(ENDPOINT_ID, WATTZIG_CLUSTER_ID, WATTZIG_CMD_CAPTURE_DATA, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, payload);
+}
+
+static void capture_dump(void)
+{
+    uint8_t bytes[32];
+    char hex[2 * sizeof(bytes) + 1];
 
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_METERING_CURRENT_SUMMATION_DELIVERED_ID, &powerImport, false);
+    xSemaphoreTake(capture_mutex, portMAX_DELAY);
+    capture_paused = true;
+    uint32_t size = capture_export_size(&capture);
+    ESP_LOGI(TAG, "Capture dump: %" PRIu32 " bytes, %" PRIu32 " reads, %" PRIu32 " overwritten", size, capture.records, capture.overwritten);
+    xSemaphoreGive(capture_mutex);
 
-        esp_zb_zcl_report_attr_cmd_t report_attr_cmd = {0};
-        report_attr_cmd.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
-        report_attr_cmd.attributeID = ESP_ZB_ZCL_ATTR_METERING_CURRENT_SUMMATION_DELIVERED_ID;
-        report_attr_cmd.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI;
-        report_attr_cmd.clusterID = ESP_ZB_ZCL_CLUSTER_ID_METERING;
-        // report_attr_cmd.cluster_role = ESP_ZB_ZCL_CLUSTER_SERVER_ROLE;
-        report_attr_cmd.zcl_basic_cmd.src_endpoint = ENDPOINT_ID;
+    for (uint32_t offset = 0; offset < size; offset += sizeof(bytes))
+    {
+        xSemaphoreTake(capture_mutex, portMAX_DELAY);
+        size_t length = capture_export(&capture, offset, bytes, sizeof(bytes));
+        xSemaphoreGive(capture_mutex);
 
-        esp_zb_zcl_report_attr_cmd_req(&report_attr_cmd);
+        for (size_t i = 0; i < length; i++)
+        {
+            snprintf(&hex[2 * i], 3, "%02X", bytes[i]);
+        }
+        hex[2 * length] = '\0';
+        ESP_LOGI(TAG, "CAP %06" PRIx32 " %s", offset, hex);
+    }
+
+    ESP_LOGI(TAG, "Capture dump done, recording paused until the capture is cleared");
+}
+#endif
+
+#if DLOG_DEFERRED
+static void send_log_chunk(uint32_t offset)
+{
+    // Octet string: length byte, offset, log size, log bytes
+    uint8_t payload[1 + 8 + LOG_CHUNK_SIZE];
+
+    size_t length = dlog_export(offset, &payload[9], LOG_CHUNK_SIZE);
+    payload[0] = 8 + length;
+    put_u32(&payload[1], offset);
+    put_u32(&payload[5], dlog_export_size());
+    platform_zb_send_command(ENDPOINT_ID, WATTZIG_CLUSTER_ID, WATTZIG_CMD_LOG_DATA, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, payload);
+}
+
+// printf rather than ESP_LOGI, the dump is needed most on release builds without console logging
+static void log_dump(void)
+{
+    uint8_t bytes[32];
+    char hex[2 * sizeof(bytes) + 1];
+    uint32_t size = dlog_export_size();
+
+    printf("Log dump: %" PRIu32 " bytes, %" PRIu32 " records written\n", size, dlog_written());
+    for (uint32_t offset = 0; offset < size; offset += sizeof(bytes))
+    {
+        size_t length = dlog_export(offset, bytes, sizeof(bytes));
+        for (size_t i = 0; i < length; i++)
+        {
+            snprintf(&hex[2 * i], 3, "%02X", bytes[i]);
+        }
+        hex[2 * length] = '\0';
+        printf("DLOG %06" PRIx32 " %s\n", offset, hex);
+    }
+
+    printf("Log dump done\n");
+}
+#endif
 
+#if CAPTURE_ENABLE || DLOG_DEFERRED
+// Printing a dump takes seconds at console speed, so it runs in its own task. The task is started
+// by the first dump and then waits for the next one, its storage may be static.
+static void dump_task(void *pvParameters)
+{
+    while (1)
+    {
+        uint32_t command;
+        xTaskNotifyWait(0, 0, &command, portMAX_DELAY);
+        switch (command)
+        {
+#if CAPTURE_ENABLE
+        case WATTZIG_CMD_CAPTURE_DUMP:
+            capture_dump();
+            break;
+#endif
+#if DLOG_DEFERRED
+        case WATTZIG_CMD_LOG_DUMP:
+            log_dump();
+            break;
+#endif
+        default:
+            break;
+        }
+    }
+}
+
+static void start_dump(uint8_t command_id)
+{
+    if (dump_task_handle == NULL)
+    {
+        dump_task_handle = START_TASK(dump_task, "dump", 5);
+    }
+    xTaskNotify(dump_task_handle, command_id, eSetValueWithOverwrite);
+}
+
+static void on_command(uint16_t cluster_id, uint8_t command_id, const uint8_t *payload, uint16_t length)
+{
+    if (cluster_id != WATTZIG_CLUSTER_ID)
+    {
+        return;
+    }
+
+    switch (command_id)
+    {
+#if CAPTURE_ENABLE
+    case WATTZIG_CMD_CAPTURE_READ:
+        if (length >= 4)
+        {
+            send_capture_chunk(payload[0] | payload[1] << 8 | payload[2] << 16 | (uint32_t)payload[3] << 24);
+        }
+        break;
+    case WATTZIG_CMD_CAPTURE_CLEAR:
+        ESP_LOGI(TAG, "Capture cleared");
+        xSemaphoreTake(capture_mutex, portMAX_DELAY);
+        capture_clear(&capture);
+        capture_paused = false;
+        xSemaphoreGive(capture_mutex);
         break;
+    case WATTZIG_CMD_CAPTURE_DUMP:
+        start_dump(command_id);
+        break;
+#endif
+#if DLOG_DEFERRED
+    case WATTZIG_CMD_LOG_READ:
+        if (length >= 4)
+        {
+            send_log_chunk(payload[0] | payload[1] << 8 | payload[2] << 16 | (uint32_t)payload[3] << 24);
+        }
+        break;
+    case WATTZIG_CMD_LOG_DUMP:
+        start_dump(command_id);
+        break;
+#endif
+    default:
+        break;
+    }
+}
+#endif
+
+// Meter keys arrive as writes to the write-only key attributes on the endpoint of the meter. They
+// go straight to secure storage; the parser task picks them up between UART reads.
+static void on_attribute_write(uint8_t endpoint, uint16_t cluster_id, uint16_t attr_id, const uint8_t *value, uint16_t size)
+{
+    meter_channel_t *channel = channel_by_endpoint(endpoint);
+    if (channel == NULL || cluster_id != WATTZIG_CLUSTER_ID ||
+        (attr_id != WATTZIG_ATTR_METER_ENCRYPTION_KEY_ID && attr_id != WATTZIG_ATTR_METER_AUTHENTICATION_KEY_ID))
+    {
+        return;
+    }
+
+    bool encryption = attr_id == WATTZIG_ATTR_METER_ENCRYPTION_KEY_ID;
+    uint8_t length = size > 0 ? value[0] : 0;
+    if (length != 0 && (length != DLMS_GCM_KEY_SIZE || size < 1 + DLMS_GCM_KEY_SIZE))
+    {
+        ESP_LOGW(TAG, "Meter %s key ignored, %u bytes instead of %d", encryption ? "encryption" : "authentication", length, DLMS_GCM_KEY_SIZE);
+        return;
+    }
+
+    uint8_t set = 0;
+    for (int i = 0; i < length; i++)
+    {
+        set |= value[1 + i];
+    }
+    char buffer[16];
+    const char *name = channel_name(channel, encryption ? SECURE_NAME_METER_EK : SECURE_NAME_METER_AK, buffer, sizeof(buffer));
+    if (!platform_secure_write(name, set != 0 ? value + 1 : NULL, DLMS_GCM_KEY_SIZE))
+    {
+        ESP_LOGE(TAG, "Failed to store the meter %u %s key", channel->index, encryption ? "encryption" : "authentication");
+        return;
+    }
+    ESP_LOGI(TAG, "Meter %u %s key %s", channel->index, encryption ? "encryption" : "authentication", set != 0 ? "stored" : "removed");
+    atomic_fetch_or(&meter_keys_changed, 1U << channel->index);
+}
+
+#if CYCLE_BUDGET_CHECK
+static void discard_field(dlms_field_t *field, void *context)
+{
+    (void)field;
+}
 
-    case ACTIVE_ENERGY_EXPORT:
-        uint64_t powerExport = convert_to_uint32(field->data);
-        ESP_LOGI(TAG, "Received ACTIVE_ENERGY_EXPORT: %" PRIu64, powerExport);
+// Runs the built-in frame through a parser of its own, so nothing reaches the attributes, NVS or
+// the statistics of the meter channels. With HOT_PATH_CYCLE_BUDGET set, aborts when the slowest
+// frame exceeds it, which fails a test run on the board.
+static void check_cycle_budget(void)
+{
+    static dlms_parser_t parser;
+    uint32_t max_cycles = 0;
+    uint64_t total_cycles = 0;
 
-        esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_METERING_CURRENT_SUMMATION_RECEIVED_ID, &powerExport, false);
+    dlms_parser_init(&parser);
+    dlms_parser_set_callback(&parser, discard_field, NULL);
 
-        esp_zb_zcl_report_attr_cmd_t report_attr_cmd_export = {0};
-        report_attr_cmd_export.address_mode = ESP_ZB_APS_ADDR_MODE_DST_ADDR_ENDP_NOT_PRESENT;
-        report_attr_cmd_export.attributeID = ESP_ZB_ZCL_ATTR_METERING_CURRENT_SUMMATION_RECEIVED_ID;
-        report_attr_cmd_export.direction = ESP_ZB_ZCL_CMD_DIRECTION_TO_CLI;
-        report_attr_cmd_export.clusterID = ESP_ZB_ZCL_CLUSTER_ID_METERING;
-        // report_attr_cmd.cluster_role = ESP_ZB_ZCL_CLUSTER_SERVER_ROLE;
-        report_attr_cmd_export.zcl_basic_cmd.src_endpoint = ENDPOINT_ID;
+    for (int frame = 0; frame < CYCLE_BUDGET_FRAMES; frame++)
+    {
+        uint32_t start = platform_cycle_count();
+        for (int i = 0; i < dlmsFrameSize; i++)
+        {
+            dlms_parser_process_byte(&parser, dlmsFrame[i]);
+        }
+        uint32_t cycles = platform_cycle_count() - start;
 
-        esp_zb_zcl_report_attr_cmd_req(&report_attr_cmd_export);
+        total_cycles += cycles;
+        if (cycles > max_cycles)
+        {
+            max_cycles = cycles;
+        }
+    }
 
-        break;
+    if (max_cycles == 0)
+    {
+        ESP_LOGW(TAG, "Cycle budget: no cycle counter on this platform, skipped");
+        return;
+    }
 
-    case DLMS_FIELD_TIMESTAMP:
-        ESP_LOGI(TAG, "Received timestamp");
+    // Printed like the dumps, so release builds with logging off report it too
+    bool over = HOT_PATH_CYCLE_BUDGET != 0 && max_cycles > HOT_PATH_CYCLE_BUDGET;
+    printf("CYCLES mean %" PRIu32 " max %" PRIu32 " budget %" PRIu32 " %s\n", (uint32_t)(total_cycles / CYCLE_BUDGET_FRAMES),
+           max_cycles, (uint32_t)HOT_PATH_CYCLE_BUDGET, HOT_PATH_CYCLE_BUDGET == 0 ? "UNSET" : over ? "FAIL" : "PASS");
+    if (over)
+    {
+        abort();
+    }
+}
+#endif
 
-        ESP_LOGI(TAG, "Timestamp: %s", (const char *)field->data);
+static meter_channel_t *channel_by_uart(int uart)
+{
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+        if (channels[i].uart == uart)
+        {
+            return &channels[i];
+        }
+    }
+    return NULL;
+}
 
-        // uint32_t timestamp = convert_timestamp_to_seconds_since_2000((const char *)field->data);
-        // ESP_LOGI(TAG, "Timestamp: %u", timestamp);
-        break;
+#if DLMS_CLIENT_ENABLE
+// Requests of the DLMS client go to the meter of the channel it runs for, the context
+static int send_to_meter(const uint8_t *data, size_t length, void *context)
+{
+    const meter_channel_t *channel = context;
+    return platform_uart_write(channel->uart, data, length);
+}
 
-    case SERIAL_NUMBER:
-        uint32_t serial = (field->data[0] << 24) |
-                          (field->data[1] << 16) |
-                          (field->data[2] << 8) |
-                          field->data[3];
+// Runs the client schedule of every channel, returns the time in ms until the next one is due
+static uint32_t poll_clients(void)
+{
+    uint32_t wait_ms = PLATFORM_WAIT_FOREVER;
 
-        ESP_LOGI(TAG, "Serial Number: %u", serial);
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+        meter_channel_t *channel = &channels[i];
+        int64_t start = platform_time_us();
+        uint32_t channel_wait_ms = dlms_client_poll(&channel->client, (uint32_t)(start / 1000));
+        channel->cpu_us += (uint32_t)(platform_time_us() - start);
 
-        esp_zb_zcl_attr_t *attr = esp_zb_zcl_get_attribute(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_METERING_METER_SERIAL_NUMBER_ID);
-        bool should_set = true;
-        if (attr && attr->data_p != NULL)
+        if (channel_wait_ms < wait_ms)
         {
-            uint8_t *cur = (uint8_t *)attr->data_p;
-            if (cur[0] != 0)
-            {
-                ESP_LOGI(TAG, "Meter serial already set, skipping update");
-                should_set = false;
-            }
+            wait_ms = channel_wait_ms;
         }
+    }
+    return wait_ms;
+}
+#else
+// Drops a frame, or segmented push, the meter stopped sending in the middle of, which also lets go
+// of the Zigbee lock taken at its start. Returns the time in ms until the next check is due.
+static uint32_t poll_frontends(void)
+{
+    uint32_t wait_ms = PLATFORM_WAIT_FOREVER;
+    uint32_t now_ms = (uint32_t)(platform_time_us() / 1000);
 
-        if (should_set)
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+        uint32_t channel_wait_ms = meter_frontend_poll(&channels[i].frontend, now_ms);
+        if (channel_wait_ms < wait_ms)
         {
-            uint8_t serial_octstr[5] = {
-                4, // Length byte
-                field->data[0],
-                field->data[1],
-                field->data[2],
-                field->data[3]};
+            wait_ms = channel_wait_ms;
+        }
+    }
+    return wait_ms;
+}
+#endif
+
+// Fields each frame level update takes whether their attributes are reported or not. Only the
+// enabled ones are decoded for it; energy_integrator falls back on the phases for lists without A+.
+#define PHASE_FIELDS(quantity) (DLMS_FIELD_BIT(quantity##_A) | DLMS_FIELD_BIT(quantity##_B) | DLMS_FIELD_BIT(quantity##_C))
+#define POWER_STATS_FIELDS (PHASE_FIELDS(RMS_VOLTAGE) | PHASE_FIELDS(RMS_CURRENT) | PHASE_FIELDS(ACTIVE_POWER) | PHASE_FIELDS(POWER_FACTOR))
+#define PEAK_DEMAND_FIELDS (DLMS_FIELD_BIT(ACTIVE_POWER_IMPORT) | DLMS_FIELD_BIT(ACTIVE_POWER_EXPORT) | DLMS_FIELD_BIT(DLMS_FIELD_TIMESTAMP))
+#define POWER_EVENTS_FIELDS (PHASE_FIELDS(RMS_VOLTAGE) | PHASE_FIELDS(RMS_CURRENT))
+#define LOAD_EVENTS_FIELDS (PHASE_FIELDS(ACTIVE_POWER) | DLMS_FIELD_BIT(DLMS_FIELD_TIMESTAMP))
+#define ENERGY_INTEGRATOR_FIELDS                                                                         \
+    (DLMS_FIELD_BIT(ACTIVE_ENERGY_IMPORT) | DLMS_FIELD_BIT(ACTIVE_ENERGY_EXPORT) | DLMS_FIELD_BIT(ACTIVE_POWER_IMPORT) | \
+     DLMS_FIELD_BIT(ACTIVE_POWER_EXPORT) | PHASE_FIELDS(ACTIVE_POWER))
+#define ANALYTICS_FIELDS                                                                                 \
+    ((POWER_STATS_ENABLE ? POWER_STATS_FIELDS : 0) | (PEAK_DEMAND_ENABLE ? PEAK_DEMAND_FIELDS : 0) |     \
+     (POWER_EVENTS_ENABLE ? POWER_EVENTS_FIELDS : 0) | (LOAD_EVENTS_ENABLE ? LOAD_EVENTS_FIELDS : 0) |   \
+     (ENERGY_INTEGRATOR_ENABLE ? ENERGY_INTEGRATOR_FIELDS : 0))
+
+// Electrical Measurement attribute set from each field, see handle_dlms_field(), and the ZCL
+// invalid value it reads while the field is not decoded
+typedef struct {
+    uint8_t field; // dlms_field_type_t
+    uint16_t attr_id;
+    uint8_t attr_type;
+    uint16_t invalid;
+} field_attr_t;
+
+static const field_attr_t kFieldAttrs[] = {
+    {RMS_VOLTAGE_A, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, 0xFFFF},
+    {RMS_VOLTAGE_B, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_PHB_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, 0xFFFF},
+    {RMS_VOLTAGE_C, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_PHC_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, 0xFFFF},
+    {RMS_CURRENT_A, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, 0xFFFF},
+    {RMS_CURRENT_B, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_PHB_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, 0xFFFF},
+    {RMS_CURRENT_C, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSCURRENT_PHC_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, 0xFFFF},
+    {ACTIVE_POWER_A, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_ID, ESP_ZB_ZCL_ATTR_TYPE_S16, 0x8000},
+    {ACTIVE_POWER_B, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_PHB_ID, ESP_ZB_ZCL_ATTR_TYPE_S16, 0x8000},
+    {ACTIVE_POWER_C, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACTIVE_POWER_PHC_ID, ESP_ZB_ZCL_ATTR_TYPE_S16, 0x8000},
+    {REACTIVE_POWER_A, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_ID, ESP_ZB_ZCL_ATTR_TYPE_S16, 0x8000},
+    {REACTIVE_POWER_B, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_PH_B_ID, ESP_ZB_ZCL_ATTR_TYPE_S16, 0x8000},
+    {REACTIVE_POWER_C, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_REACTIVE_POWER_PH_C_ID, ESP_ZB_ZCL_ATTR_TYPE_S16, 0x8000},
+    {POWER_FACTOR_A, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_ID, ESP_ZB_ZCL_ATTR_TYPE_U8, 0xFF},
+    {POWER_FACTOR_B, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_PH_B_ID, ESP_ZB_ZCL_ATTR_TYPE_U8, 0xFF},
+    {POWER_FACTOR_C, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_PH_C_ID, ESP_ZB_ZCL_ATTR_TYPE_U8, 0xFF},
+};
+
+static int64_t subscription_refresh_at = 0;
+
+// Fields a channel has a use for, with the stack locked
+static uint32_t subscribed_fields(const meter_channel_t *channel)
+{
+    uint32_t fields = ANALYTICS_FIELDS;
 
-            esp_zb_zcl_set_attribute_val(ENDPOINT_ID, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE, ESP_ZB_ZCL_ATTR_METERING_METER_SERIAL_NUMBER_ID, &serial_octstr, false);
-            ESP_LOGI(TAG, "Meter serial attribute set");
+    for (size_t i = 0; i < sizeof(kFieldAttrs) / sizeof(kFieldAttrs[0]); i++)
+    {
+        if (platform_zb_attribute_reported(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, kFieldAttrs[i].attr_id))
+        {
+            fields |= DLMS_FIELD_BIT(kFieldAttrs[i].field);
         }
-        break;
+    }
 
-    default:
-        break;
+    // Set once, from the first push that carries it
+    const uint8_t *serial = platform_zb_get_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_ATTR_METERING_METER_SERIAL_NUMBER_ID);
+    if (serial == NULL || serial[0] == 0)
+    {
+        fields |= DLMS_FIELD_BIT(SERIAL_NUMBER);
     }
+    return fields & METER_DECODABLE_FIELDS;
 }
 
-static void initLedFlash(void *pvParameters)
+// Attributes of fields that are no longer decoded would keep their last value for Read
+// Attributes. They read as invalid instead until the field is decoded again.
+static void invalidate_fields(const meter_channel_t *channel, uint32_t fields)
 {
-    gpio_set_level(LED_PIN, 0);
-    gpio_set_level(LED_PIN2, 0);
-
-    bool on = false;
-    while (1)
+    for (size_t i = 0; i < sizeof(kFieldAttrs) / sizeof(kFieldAttrs[0]); i++)
     {
-        if (on)
+        if (fields & DLMS_FIELD_BIT(kFieldAttrs[i].field))
         {
-            gpio_set_level(LED_PIN, 1);
-            vTaskDelay(50 / portTICK_PERIOD_MS);
+            uint16_t invalid = kFieldAttrs[i].invalid;
+            platform_zb_set_attribute(channel->endpoint, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, kFieldAttrs[i].attr_id, kFieldAttrs[i].attr_type, &invalid);
         }
-        else
+    }
+}
+
+// Follows the reporting configuration with the fields each parser decodes. A changed mask waits
+// for the parser to be between frames and segments, so no push is decoded with two of them.
+// Returns the time in ms until the next refresh is due.
+static uint32_t refresh_subscriptions(int64_t now)
+{
+    if (now >= subscription_refresh_at)
+    {
+        subscription_refresh_at = now + (int64_t)METER_SUBSCRIPTION_REFRESH_MS * 1000;
+        platform_zb_lock();
+        for (int i = 0; i < METER_CHANNEL_COUNT; i++)
         {
-            gpio_set_level(LED_PIN, 0);
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
+            channels[i].fields = subscribed_fields(&channels[i]);
         }
+        platform_zb_unlock();
+    }
 
-        on = !on;
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+        meter_channel_t *channel = &channels[i];
+        if (channel->fields != channel->parser.subscribed && channel->parser.state == DLMS_STATE_WAITING_START &&
+            !channel->parser.segment_pending)
+        {
+            ESP_LOGI(TAG, "Meter %u decodes fields 0x%08" PRIx32, channel->index, channel->fields);
+            uint32_t dropped = channel->parser.subscribed & ~channel->fields;
+            dlms_parser_subscribe(&channel->parser, channel->fields);
+            platform_zb_lock();
+            invalidate_fields(channel, dropped);
+            platform_zb_unlock();
+        }
     }
+    return (uint32_t)((subscription_refresh_at - now) / 1000);
 }
 
+// Serves every meter channel: waits for bytes from any of the UARTs, or for the next DLMS client
+// request, CPU window or subscription refresh to be due, and hands the bytes to the parsers of
+// their channel
 static void uart_event_task(void *pvParameters)
 {
+#if CYCLE_BUDGET_CHECK
+    check_cycle_budget();
+#endif
 
-    lastReceived = esp_timer_get_time();
+    int64_t now = platform_time_us();
+    cpu_window_start = now;
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+        channels[i].last_received = now;
+#if DLMS_CLIENT_ENABLE
+        // The meter only talks when asked
+        channels[i].waiting_for_silence = false;
+#else
+        channels[i].waiting_for_silence = true;
+#endif
+    }
 
-    uart_event_t event;
+#if STATIC_ALLOCATION
+    uint8_t *data = uart_rx_buffer;
+#else
     uint8_t *data = (uint8_t *)malloc(UART_RX_BUFFER_SIZE);
+#endif
 
     while (1)
     {
-        if (xQueueReceive(uart_queue, (void *)&event, portMAX_DELAY))
+        int64_t loop_start = platform_time_us();
+        uint32_t wait_ms = publish_cpu_load(loop_start);
+        uint32_t subscription_wait_ms = refresh_subscriptions(loop_start);
+        if (subscription_wait_ms < wait_ms)
+        {
+            wait_ms = subscription_wait_ms;
+        }
+#if DLMS_CLIENT_ENABLE
+        uint32_t client_wait_ms = poll_clients();
+        if (client_wait_ms < wait_ms)
+        {
+            wait_ms = client_wait_ms;
+        }
+#else
+        uint32_t frontend_wait_ms = poll_frontends();
+        if (frontend_wait_ms < wait_ms)
+        {
+            wait_ms = frontend_wait_ms;
+        }
+#endif
+
+        // Overflows and line errors are handled and logged by the platform
+        int uart = -1;
+        int length = platform_uart_read(data, UART_RX_BUFFER_SIZE, wait_ms, &uart);
+        uint32_t keys_changed = atomic_exchange(&meter_keys_changed, 0);
+        for (int i = 0; i < METER_CHANNEL_COUNT; i++)
         {
-            switch (event.type)
+            if (keys_changed & (1U << i))
             {
-            case UART_DATA:
+                reload_meter_keys(&channels[i]);
+            }
+        }
 
-                // Read the received data
-                int length = uart_read_bytes(UART_NUM, data, event.size, portMAX_DELAY);
-                if (length > 0)
-                {
+        meter_channel_t *channel = length > 0 ? channel_by_uart(uart) : NULL;
+        if (channel != NULL)
+        {
 
-                    int64_t currentTime = esp_timer_get_time();
-
-                    if (waitingForSilence && (currentTime - lastReceived) < 3000000)
-                    {
-                        ESP_LOGI(TAG, "Waiting for silence...");
-                        lastReceived = currentTime;
-                        continue;
-                    }
-
-                    waitingForSilence = false;
-
-                    for (int i = 0; i < length; i++)
-                    {
-                        if (!dlms_parser_process_byte(&parser, data[i]))
-                        {
-                            ESP_LOGW(TAG, "Parser error at byte %d", i);
-                            dlms_parser_init(&parser);
-                        }
-                    }
-                }
-                break;
-            case UART_FIFO_OVF:
-                ESP_LOGW(TAG, "UART FIFO Overflow");
-                uart_flush_input(UART_NUM);
-                xQueueReset(uart_queue);
-                break;
-            case UART_BUFFER_FULL:
-                ESP_LOGW(TAG, "UART Ring Buffer Full");
-                uart_flush_input(UART_NUM);
-                xQueueReset(uart_queue);
-                break;
-            case UART_BREAK:
-                ESP_LOGW(TAG, "UART Break");
-                break;
-            case UART_PARITY_ERR:
-                ESP_LOGW(TAG, "UART Parity Error");
-                break;
-            case UART_FRAME_ERR:
-                ESP_LOGW(TAG, "UART Frame Error");
-                break;
-            default:
-                break;
+            int64_t currentTime = platform_time_us();
+
+#if CAPTURE_ENABLE
+            capture_rx(currentTime, data, length);
+#endif
+
+            if (channel->waiting_for_silence && (currentTime - channel->last_received) < 3000000)
+            {
+                ESP_LOGI(TAG, "Meter %u waiting for silence...", channel->index);
+                diag_add(DIAG_SILENCE_DISCARDED, length);
+                channel->last_received = currentTime;
+                continue;
             }
-        }
-    }
-    free(data);
-}
 
-// Initialize UART
-void uart_init(void)
-{
-    uart_config_t uart_config = {
-        .baud_rate = UART_BAUD_RATE,
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-        .source_clk = UART_SCLK_XTAL,
-    };
+            channel->waiting_for_silence = false;
 
-    // Install UART driver and set pins
-    uart_driver_install(UART_NUM, BUF_SIZE * 2, BUF_SIZE * 2, 20, &uart_queue, 0);
-    uart_param_config(UART_NUM, &uart_config);
-    uart_set_pin(UART_NUM, UART_TX_PIN, UART_RX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+#if TRACE_ENABLE
+            uart_event_us = currentTime;
+#endif
+            // The parser drops the frame and waits for the next frame start by itself on an error
+            for (int i = 0; i < length; i++)
+            {
+#if DLMS_CLIENT_ENABLE
+                if (!dlms_client_process_byte(&channel->client, data[i], (uint32_t)(currentTime / 1000)))
+#else
+                if (!meter_frontend_process_byte(&channel->frontend, data[i]))
+#endif
+                {
+                    DLOGW(TAG, "Meter %u parser error at byte %d", channel->index, i);
+                }
+            }
 
-    ESP_LOGI(TAG, "UART initialized successfully");
+            uint32_t parse_us = (uint32_t)(platform_time_us() - currentTime);
+            channel->cpu_us += parse_us;
+            diag_add(DIAG_PARSE_US, parse_us);
+#if TRACE_ENABLE
+            trace_span(&trace, TRACE_SPAN_UART_READ, parse_us);
+#endif
+        }
+    }
 }
 
 #if DATA_SIMULATION
@@ -437,122 +1709,164 @@ void uart_init(void)
 void dlms_data_timer_callback(TimerHandle_t xTimer)
 {
     // ESP_LOGI(TAG, "Sending DLMS test data...");
-    uart_write_bytes(UART_NUM, (const char *)dlmsFrame, dlmsFrameSize);
-    // uart_write_bytes(UART_NUM, (const char *)kamstrup_test_data, kamstrup_test_data_size);
+    platform_uart_write(channels[0].uart, dlmsFrame, dlmsFrameSize);
+    // platform_uart_write(channels[0].uart, kamstrup_test_data, kamstrup_test_data_size);
 }
 #endif
 
-static void bdb_start_top_level_commissioning_cb(uint8_t mode_mask)
+#if STRESS_MODE
+// Consumer side of the stress run, takes the place of uart_event_task
+static void stress_frame_task(void *pvParameters)
 {
-    ESP_RETURN_ON_FALSE(esp_zb_bdb_start_top_level_commissioning(mode_mask) == ESP_OK, , TAG, "Failed to start Zigbee commissioning");
-}
-void esp_zb_app_signal_handler(esp_zb_app_signal_t *signal_struct)
-{
-    uint32_t *p_sg_p = signal_struct->p_app_signal;
-    esp_err_t err_status = signal_struct->esp_err_status;
-    esp_zb_app_signal_type_t sig_type = *p_sg_p;
-    switch (sig_type)
+    int64_t injected;
+
+    while (1)
     {
-    case ESP_ZB_ZDO_SIGNAL_SKIP_STARTUP:
-        ESP_LOGI(TAG, "Initialize Zigbee stack");
-        esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_INITIALIZATION);
-        break;
-    case ESP_ZB_BDB_SIGNAL_DEVICE_FIRST_START:
-    case ESP_ZB_BDB_SIGNAL_DEVICE_REBOOT:
-        if (err_status == ESP_OK)
+        if (!xQueueReceive(stress_queue, &injected, portMAX_DELAY))
         {
+            continue;
+        }
 
-            // ESP_LOGI(TAG, "Deferred driver initialization %s", deferred_driver_init() ? "failed" : "successful");
-
-            ESP_LOGI(TAG, "Device started up in %s factory-reset mode", esp_zb_bdb_is_factory_new() ? "" : "non");
-            if (esp_zb_bdb_is_factory_new())
-            {
-                ESP_LOGI(TAG, "Start network steering");
-                esp_zb_bdb_start_top_level_commissioning(ESP_ZB_BDB_MODE_NETWORK_STEERING);
-
-                xTaskCreate(initLedFlash, "initLedFlash", 2048, NULL, 12, &task_handle);
-            }
-            else
-            {
-                ESP_LOGI(TAG, "Device rebooted");
+        stress_step_t *step = &stress.steps[stress.step_count - 1];
+        int64_t start = platform_time_us();
+        stress_record_queue(step, (uint16_t)(uxQueueMessagesWaiting(stress_queue) + 1));
+        stress_record(step, STRESS_QUEUE_DELAY, (uint32_t)(start - injected));
 
-                xTaskCreate(uart_event_task, "uart_event_task", 2048, NULL, 12, NULL);
-            }
-        }
-        else
+        stress_lock_wait_us = 0;
+        stress_commit_us = 0;
+        for (int i = 0; i < dlmsFrameSize; i++)
         {
-            ESP_LOGW(TAG, "Failed to initialize Zigbee stack (status: %s)", esp_err_to_name(err_status));
+            dlms_parser_process_byte(&channels[0].parser, dlmsFrame[i]);
         }
-        break;
+        uint32_t total = (uint32_t)(platform_time_us() - start);
 
-    case ESP_ZB_ZDO_SIGNAL_DEVICE_ANNCE:
-        ESP_LOGI(TAG, "Device announce received");
-        break;
+        stress_record(step, STRESS_LOCK_WAIT, stress_lock_wait_us);
+        stress_record(step, STRESS_COMMIT, stress_commit_us);
+        stress_record(step, STRESS_PARSE, total - stress_lock_wait_us - stress_commit_us);
+        stress_record_heap(step, platform_heap_free());
+        step->processed++;
+    }
+}
 
-    case ESP_ZB_BDB_SIGNAL_STEERING:
-        if (err_status == ESP_OK)
-        {
-            esp_zb_ieee_addr_t extended_pan_id;
-            esp_zb_get_extended_pan_id(extended_pan_id);
-            ESP_LOGI(TAG, "Joined network successfully (Extended PAN ID: %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x, PAN ID: 0x%04hx, Channel:%d, Short Address: 0x%04hx)",
-                     extended_pan_id[7], extended_pan_id[6], extended_pan_id[5], extended_pan_id[4],
-                     extended_pan_id[3], extended_pan_id[2], extended_pan_id[1], extended_pan_id[0],
-                     esp_zb_get_pan_id(), esp_zb_get_current_channel(), esp_zb_get_short_address());
+static void log_stress_step(const stress_step_t *step)
+{
+    ESP_LOGW(TAG, "Stress %" PRIu32 " Hz: %" PRIu32 "/%" PRIu32 " frames in %" PRId64 " ms, %" PRIu32 " dropped, queue max %u",
+             step->rate_hz, step->processed, step->offered, step->duration_us / 1000, step->dropped, step->queue_max);
+    if (step->heap_min != 0 && step->heap_min != UINT32_MAX)
+    {
+        ESP_LOGW(TAG, "  heap min %" PRIu32 " bytes", step->heap_min);
+    }
+    ESP_LOGW(TAG, "  mean/max us: parse %" PRIu32 "/%" PRIu32 ", commit %" PRIu32 "/%" PRIu32 ", lock wait %" PRIu32 "/%" PRIu32 ", queue delay %" PRIu32 "/%" PRIu32,
+             stress_mean_us(step, STRESS_PARSE), step->timing[STRESS_PARSE].max_us,
+             stress_mean_us(step, STRESS_COMMIT), step->timing[STRESS_COMMIT].max_us,
+             stress_mean_us(step, STRESS_LOCK_WAIT), step->timing[STRESS_LOCK_WAIT].max_us,
+             stress_mean_us(step, STRESS_QUEUE_DELAY), step->timing[STRESS_QUEUE_DELAY].max_us);
+}
 
-            vTaskDelete(task_handle);
-            task_handle = NULL;
-            xTaskCreate(uart_event_task, "uart_event_task", 2048, NULL, 12, NULL);
-        }
-        else
-        {
-            ESP_LOGI(TAG, "Network steering was not successful (status: %s)", esp_err_to_name(err_status));
-            esp_zb_scheduler_alarm((esp_zb_callback_t)bdb_start_top_level_commissioning_cb, ESP_ZB_BDB_MODE_NETWORK_STEERING, 1000);
-        }
-        break;
+// Producer side: offers STRESS_STEP_FRAMES frames per step at rising rates until a step saturates
+static void stress_task(void *pvParameters)
+{
+    stress_config_t config = {
+        .start_rate_hz = STRESS_START_RATE_HZ,
+        .max_rate_hz = STRESS_MAX_RATE_HZ,
+        .growth_pct = STRESS_GROWTH_PCT,
+        .step_frames = STRESS_STEP_FRAMES,
+        .queue_size = STRESS_QUEUE_SIZE,
+    };
+    stress_init(&stress, &config);
+#if STATIC_ALLOCATION
+    stress_queue = xQueueCreateStatic(STRESS_QUEUE_SIZE, sizeof(int64_t), stress_queue_storage, &stress_queue_buffer);
+#else
+    stress_queue = xQueueCreate(STRESS_QUEUE_SIZE, sizeof(int64_t));
+#endif
+    START_TASK(stress_frame_task, "stress_frame", 12);
 
-    case ESP_ZB_NWK_SIGNAL_PERMIT_JOIN_STATUS:
-        if (err_status == ESP_OK)
+    ESP_LOGW(TAG, "Stress mode: %d frames per step from %d Hz up to %d Hz", STRESS_STEP_FRAMES, STRESS_START_RATE_HZ, STRESS_MAX_RATE_HZ);
+
+    stress_step_t *step;
+    while ((step = stress_next_step(&stress)) != NULL)
+    {
+        int64_t start = platform_time_us();
+
+        while (step->offered < STRESS_STEP_FRAMES)
         {
-            if (*(uint8_t *)esp_zb_app_signal_get_params(p_sg_p))
-            {
-                ESP_LOGI(TAG, "Network(0x%04hx) is open for %d seconds", esp_zb_get_pan_id(), *(uint8_t *)esp_zb_app_signal_get_params(p_sg_p));
-            }
-            else
+            vTaskDelay(1);
+
+            // Offer every frame that is due by now, in bursts when the rate exceeds the tick rate
+            uint64_t due = (uint64_t)(platform_time_us() - start) * step->rate_hz / 1000000;
+            while (step->offered < due && step->offered < STRESS_STEP_FRAMES)
             {
-                ESP_LOGW(TAG, "Network(0x%04hx) closed, devices joining not allowed.", esp_zb_get_pan_id());
+                int64_t now = platform_time_us();
+                if (xQueueSend(stress_queue, &now, 0) != pdTRUE)
+                {
+                    step->dropped++;
+                }
+                step->offered++;
             }
         }
-        break;
 
-    case ESP_ZB_COMMON_SIGNAL_CAN_SLEEP:
-        esp_zb_sleep_now();
-        break;
+        // Let the consumer drain the queue before closing the step
+        while (step->processed + step->dropped < step->offered)
+        {
+            vTaskDelay(1);
+        }
+        step->duration_us = platform_time_us() - start;
+        log_stress_step(step);
+    }
 
-    default:
-        ESP_LOGI(TAG, "ZDO signal: %s (0x%x), status: %s", esp_zb_zdo_signal_to_string(sig_type), sig_type, esp_err_to_name(err_status));
-        break;
+    const stress_step_t *knee = stress_knee(&stress);
+    if (knee == NULL)
+    {
+        ESP_LOGW(TAG, "Stress knee: saturated already at %" PRIu32 " Hz", stress.steps[0].rate_hz);
+    }
+    else
+    {
+        // CPU share of one frame per push interval, in hundredths of a percent
+        uint32_t cost_us = stress_frame_cost_us(knee);
+        uint32_t share = (uint32_t)((uint64_t)cost_us * 10000 / ((uint64_t)METER_PUSH_INTERVAL_MS * 1000));
+
+        ESP_LOGW(TAG, "Stress knee: %" PRIu32 " Hz sustained, %" PRIu32 " us CPU per frame (parse %" PRIu32 ", commit %" PRIu32 ")",
+                 knee->rate_hz, cost_us, stress_mean_us(knee, STRESS_PARSE), stress_mean_us(knee, STRESS_COMMIT));
+        ESP_LOGW(TAG, "At the %d ms push interval the pipeline uses %" PRIu32 ".%02" PRIu32 " %% of the CPU, %" PRIu32 "x headroom",
+                 METER_PUSH_INTERVAL_MS, share / 100, share % 100, (uint32_t)((uint64_t)knee->rate_hz * METER_PUSH_INTERVAL_MS / 1000));
     }
+
+    vTaskDelete(NULL);
 }
+#endif
 
-static void esp_zb_task(void *pvParameters)
+static void on_commissioning(void)
 {
+    task_handle = START_TASK(initLedFlash, "initLedFlash", 12);
+}
 
-    /* initialize Zigbee stack */
-    esp_zb_cfg_t zb_nwk_cfg = ESP_ZB_ZED_CONFIG();
-    esp_zb_sleep_enable(true);
-    esp_zb_init(&zb_nwk_cfg);
-    esp_zb_configuration_tool_cfg_t sensor_cfg = ESP_ZB_DEFAULT_CONFIGURATION_TOOL_CONFIG();
-    esp_zb_ep_list_t *esp_zb_sensor_ep = esp_zb_ep_list_create();
+static void on_joined(void)
+{
+    if (task_handle != NULL)
+    {
+        vTaskDelete(task_handle);
+        task_handle = NULL;
+    }
+#if STRESS_MODE
+    START_TASK(stress_task, "stress", 13);
+#else
+    START_TASK(uart_event_task, "uart_event_task", 12);
+#endif
+    log_memory_report();
+}
 
-    esp_zb_endpoint_config_t endpoint_config = {
-        .endpoint = ENDPOINT_ID,
-        .app_profile_id = ESP_ZB_AF_HA_PROFILE_ID,
-        .app_device_id = ESP_ZB_HA_COMBINED_INTERFACE_DEVICE_ID,
-        .app_device_version = 0};
+#if !CONFIG_IDF_TARGET_LINUX
+// Basic and Identify, on the first endpoint only
+static void add_device_clusters(esp_zb_cluster_list_t *cluster_list)
+{
+    esp_zb_configuration_tool_cfg_t sensor_cfg = ESP_ZB_DEFAULT_CONFIGURATION_TOOL_CONFIG();
 
+#if CONFIG_ZB_ZCZR
+    // Router builds are for units on a permanent supply
+    sensor_cfg.basic_cfg.power_source = ESP_ZB_ZCL_BASIC_POWER_SOURCE_MAINS_SINGLE_PHASE;
+#else
     sensor_cfg.basic_cfg.power_source = 0x04; // DC source
-
-    esp_zb_cluster_list_t *cluster_list = esp_zb_zcl_cluster_list_create();
+#endif
 
     // Basic cluster
     esp_zb_attribute_list_t *basic_cluster = esp_zb_basic_cluster_create(&(sensor_cfg.basic_cfg));
@@ -595,6 +1909,56 @@ static void esp_zb_task(void *pvParameters)
     // Identity attributes
     ESP_ERROR_CHECK(esp_zb_cluster_list_add_identify_cluster(cluster_list, esp_zb_identify_cluster_create(&(sensor_cfg.identify_cfg)), ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
     ESP_ERROR_CHECK(esp_zb_cluster_list_add_identify_cluster(cluster_list, esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_IDENTIFY), ESP_ZB_ZCL_CLUSTER_CLIENT_ROLE));
+}
+
+// Health counters and trace histograms of the whole device, on the first endpoint only
+static void add_diagnostics_cluster(esp_zb_cluster_list_t *cluster_list)
+{
+    esp_zb_attribute_list_t *diagnostics_cluster = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS);
+    uint32_t zero = 0;
+    for (uint16_t attr_id = DIAG_MANUF_ATTR_FRAMES_OK_ID; attr_id <= DIAG_MANUF_ATTR_APDU_FORWARD_ERRORS_ID; attr_id++)
+    {
+        esp_zb_cluster_add_manufacturer_attr(diagnostics_cluster, ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, attr_id, WATTZIG_MANUFACTURER_CODE, ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &zero);
+    }
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+        esp_zb_cluster_add_manufacturer_attr(diagnostics_cluster, ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, DIAG_MANUF_ATTR_CHANNEL_CPU_LOAD(i), WATTZIG_MANUFACTURER_CODE, ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &zero);
+    }
+#if TRACE_ENABLE
+    uint8_t empty_histogram[TRACE_HISTOGRAM_SIZE + 1] = {TRACE_HISTOGRAM_SIZE};
+    for (int span = 0; span < TRACE_SPAN_COUNT; span++)
+    {
+        esp_zb_cluster_add_manufacturer_attr(diagnostics_cluster, ESP_ZB_ZCL_CLUSTER_ID_DIAGNOSTICS, DIAG_MANUF_ATTR_TRACE_HISTOGRAM(span), WATTZIG_MANUFACTURER_CODE, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, empty_histogram);
+    }
+#endif
+    ESP_ERROR_CHECK(esp_zb_cluster_list_add_diagnostics_cluster(cluster_list, diagnostics_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
+}
+
+// Endpoint clusters, created by the platform once the Zigbee stack is initialized. Every meter
+// channel has Electrical Measurement, Metering, WattZig and Alarms on its own endpoint.
+// Electrical Measurement multiplier/divisor pairs, from the units of meter_snapshot_t. The values
+// go out as the meter reported them; these tell a client how to read them.
+typedef struct {
+    uint16_t multiplier_id;
+    uint16_t divisor_id;
+    uint16_t divisor;
+} em_scale_attr_t;
+
+static const em_scale_attr_t kEmScaleAttrs[] = {
+    {ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACVOLTAGE_MULTIPLIER_ID, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACVOLTAGE_DIVISOR_ID, 1},   // V
+    {ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACCURRENT_MULTIPLIER_ID, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACCURRENT_DIVISOR_ID, 100}, // A/100
+    {ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACPOWER_MULTIPLIER_ID, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACPOWER_DIVISOR_ID, 1},       // W, var
+};
+
+static void *create_clusters(uint8_t endpoint)
+{
+    const meter_channel_t *channel = channel_by_endpoint(endpoint);
+    esp_zb_cluster_list_t *cluster_list = esp_zb_zcl_cluster_list_create();
+
+    if (endpoint == ENDPOINT_ID)
+    {
+        add_device_clusters(cluster_list);
+    }
 
     uint8_t undefined_value_uint8 = (uint8_t)0x80;
     uint16_t undefined_value_uint16 = (uint16_t)0xFFFF;
@@ -626,8 +1990,43 @@ static void esp_zb_task(void *pvParameters)
     esp_zb_electrical_meas_cluster_add_attr(metering_attr_list, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_RMSVOLTAGE_PHC_ID, &undefined_value_uint16); /*!< Represents the single phase or Phase A, current demand of active power delivered or received at the premises, in @e Watts (W). */
     esp_zb_electrical_meas_cluster_add_attr(metering_attr_list, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_POWER_FACTOR_PH_C_ID, &undefined_value_uint8);
 
-    uint16_t divisor = (uint16_t)(100);
-    esp_zb_electrical_meas_cluster_add_attr(metering_attr_list, ESP_ZB_ZCL_ATTR_ELECTRICAL_MEASUREMENT_ACCURRENT_DIVISOR_ID, &divisor);
+    // Multiplier and divisor of every measured quantity, so a client reads the units without knowing the device
+    for (size_t i = 0; i < sizeof(kEmScaleAttrs) / sizeof(kEmScaleAttrs[0]); i++)
+    {
+        uint16_t multiplier = 1;
+        uint16_t divisor = kEmScaleAttrs[i].divisor;
+        esp_zb_electrical_meas_cluster_add_attr(metering_attr_list, kEmScaleAttrs[i].multiplier_id, &multiplier);
+        esp_zb_electrical_meas_cluster_add_attr(metering_attr_list, kEmScaleAttrs[i].divisor_id, &divisor);
+    }
+
+    // Sliding window statistics (see apply_power_stats)
+    for (int q = 0; q < POWER_STATS_QUANTITY_COUNT; q++)
+    {
+        const power_stats_attr_t *attrs = &kPowerStatsAttrs[q];
+        void *undefined_value = attrs->attr_type == ESP_ZB_ZCL_ATTR_TYPE_U16 ? (void *)&undefined_value_uint16 : attrs->attr_type == ESP_ZB_ZCL_ATTR_TYPE_S16 ? (void *)&undefined_value_int16 : (void *)&undefined_value_uint8;
+
+        for (int p = 0; p < METER_PHASE_COUNT; p++)
+        {
+            if (attrs->min_offset != 0)
+            {
+                esp_zb_electrical_meas_cluster_add_attr(metering_attr_list, kPhaseAttrBase[p] + attrs->min_offset, undefined_value);
+                esp_zb_electrical_meas_cluster_add_attr(metering_attr_list, kPhaseAttrBase[p] + attrs->max_offset, undefined_value);
+            }
+            else
+            {
+                esp_zb_cluster_add_manufacturer_attr(metering_attr_list, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, EM_MANUF_ATTR_STATS(q, p, EM_STATS_KIND_MIN), WATTZIG_MANUFACTURER_CODE, attrs->attr_type, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, undefined_value);
+                esp_zb_cluster_add_manufacturer_attr(metering_attr_list, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, EM_MANUF_ATTR_STATS(q, p, EM_STATS_KIND_MAX), WATTZIG_MANUFACTURER_CODE, attrs->attr_type, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, undefined_value);
+            }
+            esp_zb_cluster_add_manufacturer_attr(metering_attr_list, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, EM_MANUF_ATTR_STATS(q, p, EM_STATS_KIND_MEAN), WATTZIG_MANUFACTURER_CODE, attrs->attr_type, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, undefined_value);
+        }
+    }
+
+    // Power events
+    uint16_t no_events = 0;
+    uint32_t no_latency = 0;
+    esp_zb_cluster_add_manufacturer_attr(metering_attr_list, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, EM_MANUF_ATTR_ACTIVE_EVENTS_ID, WATTZIG_MANUFACTURER_CODE, ESP_ZB_ZCL_ATTR_TYPE_16BITMAP, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &no_events);
+    esp_zb_cluster_add_manufacturer_attr(metering_attr_list, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, EM_MANUF_ATTR_EVENT_LATENCY_ID, WATTZIG_MANUFACTURER_CODE, ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &no_latency);
+    esp_zb_cluster_add_manufacturer_attr(metering_attr_list, ESP_ZB_ZCL_CLUSTER_ID_ELECTRICAL_MEASUREMENT, EM_MANUF_ATTR_EVENT_LATENCY_MAX_ID, WATTZIG_MANUFACTURER_CODE, ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &no_latency);
 
     ESP_ERROR_CHECK(esp_zb_cluster_list_add_electrical_meas_cluster(cluster_list, metering_attr_list, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
 
@@ -650,45 +2049,80 @@ static void esp_zb_task(void *pvParameters)
     uint8_t unit = (uint8_t)(0);
     esp_zb_cluster_add_attr(meteringCluster, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_ATTR_METERING_UNIT_OF_MEASURE_ID, ESP_ZB_ZCL_ATTR_TYPE_8BIT_ENUM, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &unit);
 
-    esp_zb_cluster_add_attr(meteringCluster, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_ATTR_METERING_DIVISOR_ID, ESP_ZB_ZCL_ATTR_TYPE_U16, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &divisor);
+    // Summation in Wh and demand in W, read as kWh and kW
+    uint32_t metering_multiplier = 1;
+    uint32_t metering_divisor = METERING_DIVISOR;
+    esp_zb_cluster_add_attr(meteringCluster, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_ATTR_METERING_MULTIPLIER_ID, ESP_ZB_ZCL_ATTR_TYPE_U24, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &metering_multiplier);
+    esp_zb_cluster_add_attr(meteringCluster, ESP_ZB_ZCL_CLUSTER_ID_METERING, ESP_ZB_ZCL_ATTR_METERING_DIVISOR_ID, ESP_ZB_ZCL_ATTR_TYPE_U24, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &metering_divisor);
+
+    // Demand, 15-minute block average and month-to-date maximum (restored from NVS)
+    int32_t undefined_value_int24 = (int32_t)0x800000;
+    uint32_t undefined_value_uint24 = (uint32_t)0xFFFFFF;
+    uint64_t max_demand = channel->peak_demand.max_demand_time != 0 ? (uint64_t)channel->peak_demand.max_demand : undefined_value_uint64;
+    uint32_t max_demand_time = channel->peak_demand.max_demand_time;
+    esp_zb_cluster_add_attr(meteringCluster, ESP_ZB_ZCL_CLUSTER_ID_METERING, METERING_ATTR_INSTANTANEOUS_DEMAND_ID, ESP_ZB_ZCL_ATTR_TYPE_S24, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &undefined_value_int24);
+    esp_zb_cluster_add_attr(meteringCluster, ESP_ZB_ZCL_CLUSTER_ID_METERING, METERING_ATTR_CURRENT_MAX_DEMAND_DELIVERED_ID, ESP_ZB_ZCL_ATTR_TYPE_U48, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &max_demand);
+    esp_zb_cluster_add_attr(meteringCluster, ESP_ZB_ZCL_CLUSTER_ID_METERING, METERING_ATTR_CURRENT_MAX_DEMAND_DELIVERED_TIME_ID, ESP_ZB_ZCL_ATTR_TYPE_UTC_TIME, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &max_demand_time);
+    esp_zb_cluster_add_manufacturer_attr(meteringCluster, ESP_ZB_ZCL_CLUSTER_ID_METERING, METERING_MANUF_ATTR_BLOCK_DEMAND_ID, WATTZIG_MANUFACTURER_CODE, ESP_ZB_ZCL_ATTR_TYPE_U24, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &undefined_value_uint24);
 
     ESP_ERROR_CHECK(esp_zb_cluster_list_add_metering_cluster(cluster_list, meteringCluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
 
-    //---------------------------------------------------------------------------------------------------------------------------------------
-    esp_zb_ep_list_add_ep(esp_zb_sensor_ep, cluster_list, endpoint_config);
-    esp_zb_device_register(esp_zb_sensor_ep);
+    if (endpoint == ENDPOINT_ID)
+    {
+        add_diagnostics_cluster(cluster_list);
+    }
+
+    // WattZig cluster for load events, the meter keys and forwarded APDUs
+    esp_zb_attribute_list_t *wattzig_cluster = esp_zb_zcl_attr_list_create(WATTZIG_CLUSTER_ID);
+    uint32_t load_event_count = channel->load_event_count;
+    uint8_t meter_keys_status = channel->meter_keys_status;
+    esp_zb_custom_cluster_add_custom_attr(wattzig_cluster, WATTZIG_ATTR_LOAD_EVENT_COUNT_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &load_event_count);
+    uint8_t no_key[1 + DLMS_GCM_KEY_SIZE] = {DLMS_GCM_KEY_SIZE};
+    esp_zb_custom_cluster_add_custom_attr(wattzig_cluster, WATTZIG_ATTR_METER_ENCRYPTION_KEY_ID, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, ESP_ZB_ZCL_ATTR_ACCESS_WRITE_ONLY, no_key);
+    esp_zb_custom_cluster_add_custom_attr(wattzig_cluster, WATTZIG_ATTR_METER_AUTHENTICATION_KEY_ID, ESP_ZB_ZCL_ATTR_TYPE_OCTET_STRING, ESP_ZB_ZCL_ATTR_ACCESS_WRITE_ONLY, no_key);
+    esp_zb_custom_cluster_add_custom_attr(wattzig_cluster, WATTZIG_ATTR_METER_KEYS_ID, ESP_ZB_ZCL_ATTR_TYPE_8BITMAP, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY, &meter_keys_status);
+#if APDU_FORWARD_ENABLE
+    uint32_t apdus_forwarded = channel->apdus_forwarded;
+    esp_zb_custom_cluster_add_custom_attr(wattzig_cluster, WATTZIG_ATTR_APDUS_FORWARDED_ID, ESP_ZB_ZCL_ATTR_TYPE_U32, ESP_ZB_ZCL_ATTR_ACCESS_READ_ONLY | ESP_ZB_ZCL_ATTR_ACCESS_REPORTING, &apdus_forwarded);
+#endif
+    ESP_ERROR_CHECK(esp_zb_cluster_list_add_custom_cluster(cluster_list, wattzig_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
 
-    esp_zb_set_primary_network_channel_set(ESP_ZB_PRIMARY_CHANNEL_MASK);
-    ESP_ERROR_CHECK(esp_zb_start(false));
+    // Alarms cluster, used to notify power events without waiting for attribute reporting
+    esp_zb_attribute_list_t *alarms_cluster = esp_zb_zcl_attr_list_create(ESP_ZB_ZCL_CLUSTER_ID_ALARMS);
+    ESP_ERROR_CHECK(esp_zb_cluster_list_add_alarms_cluster(cluster_list, alarms_cluster, ESP_ZB_ZCL_CLUSTER_SERVER_ROLE));
 
-    esp_zb_stack_main_loop();
+    return cluster_list;
 }
+#endif
 
-static void button_long_press_cb(void *arg, void *usr_data)
+static void button_long_press_cb(void)
 {
     ESP_LOGI(TAG, "LLong press detected - factory reset");
-    esp_zb_factory_reset();
+    platform_zb_factory_reset();
 }
 
-static void button_press_cb(void *arg, void *usr_data)
+static void button_press_cb(void)
 {
     ESP_LOGI(TAG, "Press detected");
 
     for (int i = 0; i < 10; i++)
     {
-        gpio_set_level(LED_PIN, 1);
+        platform_gpio_set_level(LED_PIN, 1);
         vTaskDelay(100 / portTICK_PERIOD_MS);
-        gpio_set_level(LED_PIN, 0);
+        platform_gpio_set_level(LED_PIN, 0);
         vTaskDelay(100 / portTICK_PERIOD_MS);
     }
 
-    esp_restart();
+    platform_restart();
 }
 
 #if DATA_SIMULATION
 void simulateData()
 {
     // Create a periodic timer for sending DLMS data
+#if STATIC_ALLOCATION
+    TimerHandle_t dlms_timer = xTimerCreateStatic("DLMSTimer", pdMS_TO_TICKS(10000), pdTRUE, (void *)0, dlms_data_timer_callback, &dlms_timer_buffer);
+#else
     TimerHandle_t dlms_timer = xTimerCreate(
         "DLMSTimer",             // Timer name
         pdMS_TO_TICKS(10000),    // 10 seconds
@@ -696,6 +2130,7 @@ void simulateData()
         (void *)0,               // Timer ID
         dlms_data_timer_callback // Callback function
     );
+#endif
 
     if (xTimerStart(dlms_timer, 0) != pdPASS)
     {
@@ -708,61 +2143,106 @@ void simulateData()
 }
 #endif
 
-static esp_err_t esp_zb_power_save_init(void)
+// UART, parsers and the frame level state of one meter
+static void init_channel(meter_channel_t *channel, int index)
 {
-    esp_err_t rc = ESP_OK;
-#ifdef CONFIG_PM_ENABLE
-    int cur_cpu_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
-    esp_pm_config_t pm_config = {
-        .max_freq_mhz = cur_cpu_freq_mhz,
-        .min_freq_mhz = cur_cpu_freq_mhz,
-#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
-        .light_sleep_enable = true
+    const meter_channel_config_t *config = &kChannelConfigs[index];
+
+    channel->index = (uint8_t)index;
+    channel->endpoint = config->endpoint;
+    channel_endpoints[index] = config->endpoint;
+
+    platform_uart_config_t uart_config = {
+        .port = config->port,
+        .tx_pin = config->tx_pin,
+        .rx_pin = config->rx_pin,
+        .baud_rate = config->baud_rate,
+        .buffer_size = BUF_SIZE * 2,
+    };
+    channel->uart = platform_uart_init(&uart_config);
+    if (channel->uart < 0)
+    {
+        ESP_LOGE(TAG, "UART init failed for meter %d", index);
+    }
+
+    dlms_parser_init(&channel->parser);
+    dlms_parser_set_callback(&channel->parser, handle_dlms_field, channel);
+    // Narrowed to subscribed_fields() once the Zigbee stack runs
+    channel->fields = METER_DECODABLE_FIELDS;
+    dlms_parser_subscribe(&channel->parser, channel->fields);
+#if APDU_FORWARD_ENABLE
+    dlms_parser_set_apdu_buffer(&channel->parser, channel->apdu, sizeof(channel->apdu));
 #endif
+    p1_parser_init(&channel->p1_parser);
+    p1_parser_set_callback(&channel->p1_parser, handle_dlms_field, channel);
+    meter_frontend_init(&channel->frontend, METER_PROTOCOL, &channel->parser, &channel->p1_parser);
+#if DLMS_CLIENT_ENABLE
+    dlms_client_config_t client_config = {
+        .server_address = DLMS_CLIENT_SERVER_ADDRESS,
+        .physical_address = DLMS_CLIENT_PHYSICAL_ADDRESS,
+        .client_address = DLMS_CLIENT_SAP,
+        .password = DLMS_CLIENT_PASSWORD,
+        .interval_ms = DLMS_CLIENT_INTERVAL_MS,
+        .timeout_ms = DLMS_CLIENT_TIMEOUT_MS,
+        .objects = dlms_client_objects,
+        .object_count = (uint8_t)dlms_client_object_count,
+        .send = send_to_meter,
+        .send_context = channel,
     };
-    rc = esp_pm_configure(&pm_config);
+    dlms_client_init(&channel->client, &client_config);
+    dlms_client_set_callback(&channel->client, handle_dlms_field, channel);
 #endif
-    return rc;
+
+    power_stats_init(&channel->power_stats, POWER_STATS_WINDOW);
+
+    power_events_config_t events_config = {
+        .sag_voltage = POWER_EVENTS_SAG_VOLTAGE,
+        .swell_voltage = POWER_EVENTS_SWELL_VOLTAGE,
+        .loss_voltage = POWER_EVENTS_LOSS_VOLTAGE,
+        .hysteresis = POWER_EVENTS_HYSTERESIS,
+        .max_current = POWER_EVENTS_MAX_CURRENT,
+        .raise_count = POWER_EVENTS_RAISE_COUNT,
+        .clear_count = POWER_EVENTS_CLEAR_COUNT,
+    };
+    power_events_config_t phase_events_config[METER_PHASE_COUNT] = {events_config, events_config, events_config};
+    power_events_init(&channel->power_events, phase_events_config);
+
+    load_events_config_t load_config = {
+        .min_step = LOAD_EVENTS_MIN_STEP,
+        .noise_factor = LOAD_EVENTS_NOISE_FACTOR,
+        .settle_count = LOAD_EVENTS_SETTLE_COUNT,
+        .tolerance_pct = LOAD_EVENTS_TOLERANCE_PCT,
+    };
+    load_events_init(&channel->load_events, &load_config);
+
+    energy_integrator_init(&channel->energy_import);
+    energy_integrator_init(&channel->energy_export);
+    channel->summation_delivered = UINT64_MAX;
+    channel->summation_received = UINT64_MAX;
 }
 
 void app_main(void)
 {
-    const esp_app_desc_t *app_desc = esp_app_get_description();
-    
     ESP_LOGI(TAG, "========================================");
     ESP_LOGI(TAG, "WattZig Started");
-    ESP_LOGI(TAG, "Version: %s", app_desc->version);
-    ESP_LOGI(TAG, "Build Date: %s", app_desc->date);
-    ESP_LOGI(TAG, "Build Time: %s", app_desc->time);
-    ESP_LOGI(TAG, "Project Name: %s", app_desc->project_name);
+    ESP_LOGI(TAG, "Version: %s", platform_version());
+    platform_init();
     ESP_LOGI(TAG, "========================================");
 
     esp_log_level_set("Parser", ESP_LOG_NONE);
 
-    gpio_reset_pin(LED_PIN);
-    gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
-    gpio_reset_pin(LED_PIN2);
-    gpio_set_direction(LED_PIN2, GPIO_MODE_OUTPUT);
-    gpio_set_level(LED_PIN, 0);
-    gpio_set_level(LED_PIN2, 0);
-
-    button_config_t gpio_btn_cfg = {
-        .type = BUTTON_TYPE_GPIO,
-        .long_press_time = 4000,
-        .short_press_time = CONFIG_BUTTON_SHORT_PRESS_TIME_MS,
-        .gpio_button_config = {
-            .gpio_num = 4,
-            .active_level = 1,
-        },
-    };
-    button_handle_t gpio_btn = iot_button_create(&gpio_btn_cfg);
-    if (NULL == gpio_btn)
-    {
-        ESP_LOGE(TAG, "Button create failed");
-    }
+    platform_gpio_output(LED_PIN);
+    platform_gpio_output(LED_PIN2);
+    platform_gpio_set_level(LED_PIN, 0);
+    platform_gpio_set_level(LED_PIN2, 0);
 
-    iot_button_register_cb(gpio_btn, BUTTON_LONG_PRESS_START, button_long_press_cb, NULL);
-    iot_button_register_cb(gpio_btn, BUTTON_DOUBLE_CLICK, button_press_cb, NULL);
+    platform_button_config_t button_config = {
+        .gpio = BUTTON_PIN,
+        .long_press_ms = BUTTON_LONG_PRESS_MS,
+        .on_long_press = button_long_press_cb,
+        .on_double_click = button_press_cb,
+    };
+    platform_button_init(&button_config);
 
     // //-------------ADC1 Init---------------//
     // adc_oneshot_unit_handle_t adc1_handle;
@@ -802,17 +2282,17 @@ void app_main(void)
     //     {
     //         power_on = true;
 
-    //         gpio_set_level(LED_PIN, 1);
+    //         platform_gpio_set_level(LED_PIN, 1);
     //         vTaskDelay(1000 / portTICK_PERIOD_MS);
-    //         gpio_set_level(LED_PIN, 0);
+    //         platform_gpio_set_level(LED_PIN, 0);
 
     //         ESP_LOGI(TAG, "Power detected - starting application");
     //         vTaskDelay(pdMS_TO_TICKS(10000));
     //         ESP_LOGI(TAG, "Power detected - started");
 
-    //         gpio_set_level(LED_PIN2, 1);
+    //         platform_gpio_set_level(LED_PIN2, 1);
     //         vTaskDelay(2000 / portTICK_PERIOD_MS);
-    //         gpio_set_level(LED_PIN2, 0);
+    //         platform_gpio_set_level(LED_PIN2, 0);
     //     }
     //     else
     //     {
@@ -823,36 +2303,71 @@ void app_main(void)
 
     // adc_digi_stop(void);
 
-    // Initialize UART
-    uart_init();
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+        init_channel(&channels[i], i);
+    }
+
+#if TRACE_ENABLE
+    trace_init(&trace);
+#endif
 
-    // Initialize DLMS parser
-    dlms_parser_init(&parser);
-    dlms_parser_set_callback(&parser, handle_dlms_field);
+#if CAPTURE_ENABLE
+#if STATIC_ALLOCATION
+    capture_mutex = xSemaphoreCreateMutexStatic(&capture_mutex_buffer);
+#else
+    capture_mutex = xSemaphoreCreateMutex();
+#endif
+    capture_init(&capture, capture_buffer, sizeof(capture_buffer));
+#endif
 
 #if DATA_SIMULATION
     simulateData();
 #endif
 
-    esp_zb_platform_config_t config = {
-        .radio_config = ESP_ZB_DEFAULT_RADIO_CONFIG(),
-        .host_config = ESP_ZB_DEFAULT_HOST_CONFIG(),
-    };
-    ESP_ERROR_CHECK(nvs_flash_init());
-    ESP_ERROR_CHECK(esp_zb_power_save_init());
-    ESP_ERROR_CHECK(esp_zb_platform_config(&config));
+    // The default partition stays plain, only the meter keys partition is encrypted
+    ESP_ERROR_CHECK(nvs_flash_init_partition(NVS_DEFAULT_PART_NAME));
+    bool secure = platform_secure_init();
+    for (int i = 0; i < METER_CHANNEL_COUNT; i++)
+    {
+#if PEAK_DEMAND_ENABLE
+        load_peak_demand(&channels[i]);
+#endif
+        if (secure)
+        {
+            load_meter_keys(&channels[i]);
+        }
+    }
 
-    gpio_set_level(LED_PIN, 1);
+    platform_gpio_set_level(LED_PIN, 1);
     vTaskDelay(1000 / portTICK_PERIOD_MS);
-    gpio_set_level(LED_PIN, 0);
+    platform_gpio_set_level(LED_PIN, 0);
 
     ESP_LOGI(TAG, "Power detected - starting application");
     vTaskDelay(pdMS_TO_TICKS(10000));
     ESP_LOGI(TAG, "Power detected - started");
 
-    gpio_set_level(LED_PIN2, 1);
+    platform_gpio_set_level(LED_PIN2, 1);
     vTaskDelay(2000 / portTICK_PERIOD_MS);
-    gpio_set_level(LED_PIN2, 0);
-
-    xTaskCreate(esp_zb_task, "Zigbee_main", 4096, NULL, 5, NULL);
+    platform_gpio_set_level(LED_PIN2, 0);
+
+    platform_zb_config_t zb_config = {
+        .endpoints = channel_endpoints,
+        .endpoint_count = METER_CHANNEL_COUNT,
+        .manufacturer_code = WATTZIG_MANUFACTURER_CODE,
+#if !CONFIG_IDF_TARGET_LINUX
+        .create_clusters = create_clusters,
+#endif
+        .on_commissioning = on_commissioning,
+        .on_joined = on_joined,
+#if CAPTURE_ENABLE || DLOG_DEFERRED
+        .on_command = on_command,
+#endif
+        .on_attribute_write = on_attribute_write,
+#if STATIC_ALLOCATION
+        .task_stack = zb_task_stack,
+        .task_buffer = &zb_task_tcb,
+#endif
+    };
+    platform_zb_start(&zb_config);
 }
@@ -1,50 +1,229 @@
-#include "esp_zigbee_core.h"
+#include "platform_zcl.h"
 
-/* Zigbee configuration */
-#define INSTALLCODE_POLICY_ENABLE false /* enable the install code policy for security */
-#define ENDPOINT_ID 10
-#define ESP_ZB_PRIMARY_CHANNEL_MASK ESP_ZB_TRANSCEIVER_ALL_CHANNELS_MASK /* Zigbee primary channel mask use in the example */
-
-#define ED_AGING_TIMEOUT ESP_ZB_ED_AGING_TIMEOUT_64MIN
-#define ED_KEEP_ALIVE 3000 /* 3000 millisecond */
+/* Zigbee configuration, the stack configuration itself lives in the platform component */
+#define ENDPOINT_ID 10 /* First meter, also carries the device-wide clusters */
 
 #define MANUFACTURER_NAME "\x10" \
                           "Peer Bech Hansen"
 #define MODEL_IDENTIFIER "\x07" \
                          "WattZig"
 
+#define WATTZIG_MANUFACTURER_CODE 0x131B /* Manufacturer code used for manufacturer-specific attributes */
+
 // UART configuration
-#define UART_NUM UART_NUM_1 // Use UART1
+#define UART_NUM 1 // Use UART1
 
 #define UART_TX_PIN 0 // TX pin (adjust as needed)
 #define UART_RX_PIN 1 // RX pin (adjust as needed)
 
-#define UART_BAUD_RATE 2400 // Baud rate
+#define UART_BAUD_RATE 2400 // Baud rate, 115200 for a DSMR 5 P1 port
 #define BUF_SIZE 1024       // Buffer size
 #define UART_RX_BUFFER_SIZE 1024
 #define UART_QUEUE_SIZE 10
 
+// Meter channels for sub-metering: every meter has its own UART, parser state and endpoint with
+// Electrical Measurement and Metering clusters. The first channel uses UART_NUM and ENDPOINT_ID,
+// the second the METER2_* settings. All channels are parsed by one task.
+#define METER_CHANNEL_COUNT 1
+#define METER2_UART_NUM 0  /* UART0, the console must be on the USB Serial/JTAG port */
+#define METER2_TX_PIN 2
+#define METER2_RX_PIN 3
+#define METER2_BAUD_RATE 2400
+#define METER2_ENDPOINT_ID 11
+#define METER_CPU_WINDOW_MS 60000 /* Period of the per-channel CPU load */
+
+// Meter protocol, see meter_frontend.h: METER_PROTOCOL_DLMS (HDLC push frames), METER_PROTOCOL_P1
+// (DSMR / IEC 62056-21 ASCII telegrams) or METER_PROTOCOL_AUTO to go by the first frame start.
+// Detection works within one baud rate, so UART_BAUD_RATE must still match the meter.
+#define METER_PROTOCOL METER_PROTOCOL_AUTO
+
+// Fields decoded from DLMS pushes: those the analytics need, those whose attribute is reported
+// and the serial number until it is set. The values of the others are skipped by their length.
+// The reporting configuration is read back every METER_SUBSCRIPTION_REFRESH_MS, the stack does
+// not tell when a coordinator changes it. METER_DECODABLE_FIELDS, a mask of DLMS_FIELD_BIT(),
+// limits the decoded fields further.
+#define METER_SUBSCRIPTION_REFRESH_MS 60000
+#define METER_DECODABLE_FIELDS DLMS_FIELDS_ALL
+
+// Raw APDU forwarding for meters the decoder does not know yet: the APDU of every DLMS frame that
+// passes its FCS, and authenticates if it is ciphered, goes to the coordinator compressed against
+// the OBIS dictionary of apdu_forward.h, in WATTZIG_CMD_APDU_DATA chunks. With
+// METER_DECODABLE_FIELDS 0 decoding is left to the backend altogether.
+#define APDU_FORWARD_ENABLE false
+#define APDU_FORWARD_CHUNK_SIZE 64 /* Compressed bytes per WATTZIG_CMD_APDU_DATA */
+
+// DLMS client for meters with an HDLC client port: instead of waiting for pushes the device
+// connects over UART_TX_PIN, opens an association and reads dlms_client_objects[] with GET
+// requests every DLMS_CLIENT_INTERVAL_MS, see dlms_client.h. METER_PROTOCOL is not used then.
+#define DLMS_CLIENT_ENABLE false
+#define DLMS_CLIENT_INTERVAL_MS 2000   /* From the start of one read cycle to the next */
+#define DLMS_CLIENT_TIMEOUT_MS 1000    /* Silence after a request before the cycle is given up */
+#define DLMS_CLIENT_SERVER_ADDRESS 1   /* Logical device, 1 for the management logical device */
+#define DLMS_CLIENT_PHYSICAL_ADDRESS 0 /* Lower HDLC address, 0 to leave it out */
+#define DLMS_CLIENT_SAP 0x10           /* 0x10 public client, 0x01 management client */
+#define DLMS_CLIENT_PASSWORD NULL      /* Low level security password, NULL for none */
+
 #define LED_PIN 5
 #define LED_PIN2 6
 
+#define BUTTON_PIN 4
+#define BUTTON_LONG_PRESS_MS 4000 /* Long press factory resets the device */
+
 #define DATA_SIMULATION false
 
-#define ESP_ZB_ZED_CONFIG()                               \
-    {                                                     \
-        .esp_zb_role = ESP_ZB_DEVICE_TYPE_ED,             \
-        .install_code_policy = INSTALLCODE_POLICY_ENABLE, \
-        .nwk_cfg.zed_cfg = {                              \
-            .ed_timeout = ED_AGING_TIMEOUT,               \
-            .keep_alive = ED_KEEP_ALIVE,                  \
-        },                                                \
-    }
-
-#define ESP_ZB_DEFAULT_RADIO_CONFIG()       \
-    {                                       \
-        .radio_mode = ZB_RADIO_MODE_NATIVE, \
-    }
-
-#define ESP_ZB_DEFAULT_HOST_CONFIG()                          \
-    {                                                         \
-        .host_connection_mode = ZB_HOST_CONNECTION_MODE_NONE, \
-    }
+// Allocate the firmware's own task stacks, queues, timers and buffers at build time instead of
+// from the heap. Drivers and the Zigbee stack still allocate their internals from the heap.
+#define STATIC_ALLOCATION false
+#define STATIC_ALLOCATION_BUDGET 32768 /* Bytes of RAM the option may reserve, checked at compile time */
+
+// Task stacks in bytes
+#define UART_TASK_STACK_SIZE 2048
+#define LED_TASK_STACK_SIZE 2048
+#define DUMP_TASK_STACK_SIZE 3072
+#define STRESS_TASK_STACK_SIZE 4096
+
+// Cycle budget check: before reading the UART, the built-in frame is parsed CYCLE_BUDGET_FRAMES
+// times by a scratch parser whose fields go nowhere, and the mean and maximum cycles are printed.
+// The first frame runs with a cold cache and counts too. Set HOT_PATH_CYCLE_BUDGET to the maximum
+// logged by a reference board plus a margin and the firmware aborts when a frame takes longer, so
+// a test run on the board fails on a hot path regression. 0 only reports.
+#define CYCLE_BUDGET_CHECK false
+#define CYCLE_BUDGET_FRAMES 16
+#define HOT_PATH_CYCLE_BUDGET 0
+
+#define METER_PUSH_INTERVAL_MS 10000 /* Kamstrup list 2 push interval */
+
+// Stress mode: instead of reading the UART, frames are injected internally at rising rates
+// until the pipeline saturates. Each step and the knee point are logged.
+#define STRESS_MODE false
+#define STRESS_START_RATE_HZ 1
+#define STRESS_MAX_RATE_HZ 2000
+#define STRESS_GROWTH_PCT 50   /* Rate increase per step */
+#define STRESS_STEP_FRAMES 100 /* Frames offered per step */
+#define STRESS_QUEUE_SIZE 32
+
+// Frame level analytics. A disabled one is not run, and the fields only it takes are not decoded
+// unless their attributes are reported, see subscribed_fields() in main.c.
+#define POWER_STATS_ENABLE true
+#define PEAK_DEMAND_ENABLE true
+#define POWER_EVENTS_ENABLE true
+#define LOAD_EVENTS_ENABLE true
+#define ENERGY_INTEGRATOR_ENABLE true
+
+// Power quality statistics
+#define POWER_STATS_WINDOW 90 /* Samples per sliding window, 15 minutes at the 10 s push interval */
+
+// Electrical Measurement min/max attributes are laid out per phase as base + offset
+#define EM_ATTR_PHASE_A_BASE 0x0500
+#define EM_ATTR_PHASE_B_BASE 0x0900
+#define EM_ATTR_PHASE_C_BASE 0x0A00
+#define EM_ATTR_RMSVOLTAGE_MIN_OFFSET 0x06
+#define EM_ATTR_RMSVOLTAGE_MAX_OFFSET 0x07
+#define EM_ATTR_RMSCURRENT_MIN_OFFSET 0x09
+#define EM_ATTR_RMSCURRENT_MAX_OFFSET 0x0A
+#define EM_ATTR_ACTIVE_POWER_MIN_OFFSET 0x0C
+#define EM_ATTR_ACTIVE_POWER_MAX_OFFSET 0x0D
+
+// Statistics without a standard attribute (means, power factor min/max) are manufacturer-specific
+#define EM_STATS_KIND_MIN 0
+#define EM_STATS_KIND_MAX 1
+#define EM_STATS_KIND_MEAN 2
+#define EM_MANUF_ATTR_STATS(quantity, phase, kind) (uint16_t)(0xF000 | ((quantity) << 4) | ((phase) << 2) | (kind))
+
+// Metering demand attributes
+#define METERING_ATTR_CURRENT_MAX_DEMAND_DELIVERED_ID 0x0002
+#define METERING_ATTR_CURRENT_MAX_DEMAND_DELIVERED_TIME_ID 0x0008
+#define METERING_ATTR_INSTANTANEOUS_DEMAND_ID 0x0400
+#define METERING_MANUF_ATTR_BLOCK_DEMAND_ID 0xF000 /* Running average of the 15-minute block in progress */
+#define METERING_DIVISOR 1000                     /* Summation in Wh and demand in W, UnitOfMeasure kWh/kW */
+
+// Power event detection, thresholds apply to every phase
+#define POWER_EVENTS_SAG_VOLTAGE 207   /* V, -10 % of 230 V */
+#define POWER_EVENTS_SWELL_VOLTAGE 253 /* V, +10 % of 230 V */
+#define POWER_EVENTS_LOSS_VOLTAGE 50   /* V */
+#define POWER_EVENTS_HYSTERESIS 3      /* V */
+#define POWER_EVENTS_MAX_CURRENT 2500  /* A/100 */
+#define POWER_EVENTS_RAISE_COUNT 1     /* Raise on the first push in violation */
+#define POWER_EVENTS_CLEAR_COUNT 3
+#define POWER_EVENTS_LATENCY_BUDGET_US 50000 /* Detection to alarm queued */
+
+// Alarm codes for the Alarms cluster Alarm command, sent with the Electrical Measurement cluster ID.
+// Phase A uses the ZCL AC alarm codes, phases B and C add EM_ALARM_PHASE_OFFSET per phase.
+#define ZCL_CMD_ALARMS_ALARM 0x00
+#define EM_ALARM_CODE_CURRENT_OVERLOAD 0x11
+#define EM_ALARM_CODE_EXTREME_UNDER_VOLTAGE 0x17
+#define EM_ALARM_CODE_VOLTAGE_SAG 0x18
+#define EM_ALARM_CODE_VOLTAGE_SWELL 0x19
+#define EM_ALARM_PHASE_OFFSET 0x20
+
+#define EM_MANUF_ATTR_ACTIVE_EVENTS_ID 0xF100     /* 16-bit bitmap of POWER_EVENT_BIT(phase, type) */
+#define EM_MANUF_ATTR_EVENT_LATENCY_ID 0xF101     /* Last detection-to-transmit latency in us */
+#define EM_MANUF_ATTR_EVENT_LATENCY_MAX_ID 0xF102 /* Highest detection-to-transmit latency in us */
+
+// Appliance step detection on per-phase active power
+#define LOAD_EVENTS_MIN_STEP 150      /* W */
+#define LOAD_EVENTS_NOISE_FACTOR 4
+#define LOAD_EVENTS_SETTLE_COUNT 2    /* Pushes a new level must hold */
+#define LOAD_EVENTS_TOLERANCE_PCT 15
+
+// Health counters on the Diagnostics cluster, manufacturer-specific, U32
+#define DIAG_MANUF_ATTR_FRAMES_OK_ID 0xF100
+#define DIAG_MANUF_ATTR_FCS_ERRORS_ID 0xF101
+#define DIAG_MANUF_ATTR_RESYNCS_ID 0xF102
+#define DIAG_MANUF_ATTR_UART_FIFO_OVERFLOWS_ID 0xF103
+#define DIAG_MANUF_ATTR_UART_BUFFER_FULL_ID 0xF104
+#define DIAG_MANUF_ATTR_SILENCE_DISCARDED_ID 0xF105 /* Bytes */
+#define DIAG_MANUF_ATTR_PARSE_TIME_AVG_ID 0xF106    /* us of parsing per frame */
+#define DIAG_MANUF_ATTR_HEAP_MIN_ID 0xF107          /* Lowest free heap since boot in bytes */
+#define DIAG_MANUF_ATTR_PARSER_STACK_FREE_ID 0xF108 /* Bytes of the parser task stack never used */
+#define DIAG_MANUF_ATTR_ZIGBEE_STACK_FREE_ID 0xF109 /* Bytes of the Zigbee task stack never used */
+#define DIAG_MANUF_ATTR_DECRYPT_ERRORS_ID 0xF10A    /* Ciphered frames rejected: no key, bad header or tag */
+#define DIAG_MANUF_ATTR_DECRYPT_TIME_ID 0xF10B      /* us of AES-GCM work in the last frame, 0 if plain */
+#define DIAG_MANUF_ATTR_CLIENT_ERRORS_ID 0xF10C     /* DLMS client read cycles without a usable response */
+#define DIAG_MANUF_ATTR_ELEMENTS_DECODED_ID 0xF10D  /* Push data elements decoded, all meters */
+#define DIAG_MANUF_ATTR_ELEMENTS_SKIPPED_ID 0xF10E  /* Push data elements skipped by length, see METER_DECODABLE_FIELDS */
+#define DIAG_MANUF_ATTR_APDU_FORWARD_ERRORS_ID 0xF10F /* APDUs not forwarded, see APDU_FORWARD_ENABLE */
+#define DIAG_MANUF_ATTR_CHANNEL_CPU_LOAD(channel) (uint16_t)(0xF110 + (channel)) /* 1/100 % of the CPU over METER_CPU_WINDOW_MS */
+
+// Frame path latency tracing. The histograms are logged and published on the Diagnostics cluster.
+#define TRACE_ENABLE true
+#define TRACE_PUBLISH_FRAMES 60 /* 10 minutes of 10 s pushes */
+#define DIAG_MANUF_ATTR_TRACE_HISTOGRAM(span) (uint16_t)(0xF000 | (span)) /* Octet string, see trace_histogram_serialize() */
+
+// Manufacturer-specific WattZig cluster
+#define WATTZIG_CLUSTER_ID 0xFC00
+#define WATTZIG_ATTR_LOAD_EVENT_COUNT_ID 0x0000 /* U32, load events sent since boot */
+#define WATTZIG_ATTR_APDUS_FORWARDED_ID 0x0001  /* U32, APDUs forwarded since boot, see APDU_FORWARD_ENABLE */
+#define WATTZIG_ATTR_METER_ENCRYPTION_KEY_ID 0x0010     /* Write-only octet string of 16, empty or zeros removes the key */
+#define WATTZIG_ATTR_METER_AUTHENTICATION_KEY_ID 0x0011 /* Write-only octet string of 16, empty or zeros removes the key */
+#define WATTZIG_ATTR_METER_KEYS_ID 0x0012               /* 8-bit bitmap of METER_KEYS_* stored */
+#define WATTZIG_CMD_LOAD_EVENTS 0x01            /* Octet string of LOAD_EVENT_RECORD_SIZE byte records */
+#define WATTZIG_CMD_CAPTURE_DATA 0x02           /* Octet string: U32 offset, U32 capture size, capture bytes */
+#define WATTZIG_CMD_LOG_DATA 0x03               /* Octet string: U32 offset, U32 log size, log bytes */
+#define WATTZIG_CMD_APDU_DATA 0x04              /* Octet string: U8 APDU sequence, U8 chunk index, U8 chunk count, compressed bytes */
+
+// Commands received on the WattZig cluster
+#define WATTZIG_CMD_CAPTURE_READ 0x00  /* U32 offset, answered with WATTZIG_CMD_CAPTURE_DATA. Pauses recording */
+#define WATTZIG_CMD_CAPTURE_CLEAR 0x01 /* Clear the capture and resume recording */
+#define WATTZIG_CMD_CAPTURE_DUMP 0x02  /* Print the capture to the console as "CAP" lines. Pauses recording */
+#define WATTZIG_CMD_LOG_READ 0x03      /* U32 offset, answered with WATTZIG_CMD_LOG_DATA */
+#define WATTZIG_CMD_LOG_DUMP 0x04      /* Print the deferred log to the console as "DLOG" lines */
+
+// Raw UART capture, see tools/capture_replay
+#define CAPTURE_ENABLE false
+#define CAPTURE_BUFFER_SIZE 16384 /* Bytes of RAM, about 20 Kamstrup pushes */
+#define CAPTURE_CHUNK_SIZE 64     /* Capture bytes per WATTZIG_CMD_CAPTURE_DATA */
+
+// Deferred log of the frame path, see components/dlog and tools/dlog_decode
+#define LOG_CHUNK_SIZE 64 /* Log bytes per WATTZIG_CMD_LOG_DATA */
+
+// Meter keys for general-glo-ciphering, kept with platform_secure_write(). Names and NVS keys of
+// the second channel get a "1" appended.
+#define METER_KEYS_ENCRYPTION 0x01
+#define METER_KEYS_AUTHENTICATION 0x02
+#define SECURE_NAME_METER_EK "meter_ek"
+#define SECURE_NAME_METER_AK "meter_ak"
+
+// NVS storage
+#define NVS_NAMESPACE "wattzig"
+#define NVS_KEY_PEAK_DEMAND "peak_demand"
@@ -0,0 +1,336 @@
+// Replays a UART capture taken on the device through the DLMS parser.
+//
+// Usage: capture_replay [options] FILE
+//   -r, --realtime       reproduce the original timing between reads
+//   -S, --speed FACTOR   with -r, play faster (2) or slower (0.5), default 1
+//   -o, --output PATH    also write the bytes to a file, serial device or pty, e.g. the UART of
+//                        the linux build, paced like the original with -r
+//   -v, --verbose        list every record and parsed frame
+//
+// FILE is either a binary capture as read over the WattZig cluster, or a console log holding the
+// "CAP <offset> <hex>" lines of a capture dump; other log lines are ignored.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+#include "dlms_parser.h"
+#include "esp_log.h"
+
+typedef struct {
+    uint32_t frames;
+    uint32_t fields;
+    uint32_t errors;
+    uint32_t fcs_errors;
+    uint32_t resyncs;
+    int64_t frame_start_us;     // Capture time of the read holding the current START
+    int64_t frame_min_us;
+    int64_t frame_max_us;
+} replay_stats_t;
+
+static replay_stats_t stats;
+static int64_t record_time_us;
+static bool verbose;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline_ns)
+{
+    struct timespec ts = {(time_t)(deadline_ns / 1000000000ULL), (long)(deadline_ns % 1000000000ULL)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    {
+    }
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool load_file(const char *path, uint8_t **data, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    size_t capacity = 65536;
+    *data = malloc(capacity);
+    *length = 0;
+    size_t n;
+    while ((n = fread(*data + *length, 1, capacity - *length, file)) > 0)
+    {
+        *length += n;
+        if (*length == capacity)
+        {
+            capacity *= 2;
+            *data = realloc(*data, capacity);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// Reassemble a capture from the "CAP <offset> <hex>" lines of a console log
+static bool load_console_dump(const char *text, size_t text_length, uint8_t **data, size_t *length)
+{
+    size_t capacity = 65536;
+    *data = calloc(capacity, 1);
+    *length = 0;
+
+    const char *end = text + text_length;
+    for (const char *line = text; line < end;)
+    {
+        const char *next = memchr(line, '\n', (size_t)(end - line));
+        next = next != NULL ? next + 1 : end;
+
+        const char *tag = memmem(line, (size_t)(next - line), "CAP ", 4);
+        if (tag != NULL)
+        {
+            char *p;
+            size_t offset = strtoul(tag + 4, &p, 16);
+            while (*p == ' ') p++;
+
+            for (; p + 1 < next && hex_value(p[0]) >= 0 && hex_value(p[1]) >= 0; p += 2, offset++)
+            {
+                if (offset >= capacity)
+                {
+                    *data = realloc(*data, offset * 2);
+                    memset(*data + capacity, 0, offset * 2 - capacity);
+                    capacity = offset * 2;
+                }
+                (*data)[offset] = (uint8_t)(hex_value(p[0]) << 4 | hex_value(p[1]));
+                if (offset + 1 > *length)
+                {
+                    *length = offset + 1;
+                }
+            }
+        }
+        line = next;
+    }
+    return *length > 0;
+}
+
+static void on_field(dlms_field_t *field, void *context)
+{
+    if (field->type == START)
+    {
+        stats.frame_start_us = record_time_us;
+        return;
+    }
+    if (field->type == ABORT)
+    {
+        if (field->data[0] == DLMS_ABORT_FCS)
+        {
+            stats.fcs_errors++;
+        }
+        else
+        {
+            stats.resyncs++;
+        }
+        return;
+    }
+    if (field->type != END)
+    {
+        stats.fields++;
+        return;
+    }
+
+    int64_t duration = record_time_us - stats.frame_start_us;
+    if (stats.frames == 0 || duration < stats.frame_min_us)
+    {
+        stats.frame_min_us = duration;
+    }
+    if (duration > stats.frame_max_us)
+    {
+        stats.frame_max_us = duration;
+    }
+    stats.frames++;
+
+    if (verbose)
+    {
+        printf("%12.6f s  frame %u, %lld us on the line\n", record_time_us / 1e6, stats.frames, (long long)duration);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-r] [-S speed] [-o path] [-v] FILE\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option kOptions[] = {
+        {"realtime", no_argument, NULL, 'r'},
+        {"speed", required_argument, NULL, 'S'},
+        {"output", required_argument, NULL, 'o'},
+        {"verbose", no_argument, NULL, 'v'},
+        {NULL, 0, NULL, 0},
+    };
+
+    bool realtime = false;
+    double speed = 1.0;
+    const char *output = NULL;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "rS:o:v", kOptions, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            realtime = true;
+            break;
+        case 'S':
+            speed = strtod(optarg, NULL);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || speed <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint8_t *file;
+    size_t file_length;
+    if (!load_file(argv[optind], &file, &file_length))
+    {
+        return 1;
+    }
+
+    uint8_t *data = file;
+    size_t length = file_length;
+    capture_reader_t reader;
+    if (!capture_reader_init(&reader, data, length))
+    {
+        if (!load_console_dump((const char *)file, file_length, &data, &length) || !capture_reader_init(&reader, data, length))
+        {
+            fprintf(stderr, "%s: no capture found\n", argv[optind]);
+            return 1;
+        }
+    }
+
+    int fd = -1;
+    if (output != NULL)
+    {
+        fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_NOCTTY, 0644);
+        if (fd < 0)
+        {
+            perror(output);
+            return 1;
+        }
+    }
+
+    // Parser errors are counted here, not logged
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    static dlms_parser_t parser;
+    dlms_parser_init(&parser);
+    dlms_parser_set_callback(&parser, on_field, NULL);
+
+    capture_record_t record;
+    uint32_t records = 0;
+    uint64_t bytes = 0;
+    int64_t first_us = reader.time_us;
+    int64_t previous_us = first_us;
+    int64_t gap_max_us = 0;
+    uint64_t parse_ns = 0;
+    uint64_t parse_max_ns = 0;
+    uint64_t start_ns = now_ns();
+
+    while (capture_reader_next(&reader, &record))
+    {
+        if (realtime)
+        {
+            sleep_until(start_ns + (uint64_t)((double)(record.time_us - first_us) * 1000.0 / speed));
+        }
+        if (fd >= 0 && write(fd, record.bytes, record.length) != record.length)
+        {
+            perror(output);
+            return 1;
+        }
+        if (verbose)
+        {
+            printf("%12.6f s  %3u bytes, +%lld us\n", record.time_us / 1e6, record.length, (long long)(record.time_us - previous_us));
+        }
+
+        if (record.time_us - previous_us > gap_max_us)
+        {
+            gap_max_us = record.time_us - previous_us;
+        }
+        previous_us = record.time_us;
+        record_time_us = record.time_us;
+
+        uint64_t parse_start = now_ns();
+        for (uint8_t i = 0; i < record.length; i++)
+        {
+            if (!dlms_parser_process_byte(&parser, record.bytes[i]))
+            {
+                stats.errors++;
+            }
+        }
+        uint64_t elapsed = now_ns() - parse_start;
+        parse_ns += elapsed;
+        if (elapsed > parse_max_ns)
+        {
+            parse_max_ns = elapsed;
+        }
+
+        records++;
+        bytes += record.length;
+    }
+
+    if (reader.pos != reader.length)
+    {
+        fprintf(stderr, "Capture truncated after %zu of %zu bytes\n", reader.pos, reader.length);
+    }
+
+    printf("Capture: %u reads, %llu bytes over %.3f s, longest gap %.3f s\n",
+           records, (unsigned long long)bytes, (previous_us - first_us) / 1e6, gap_max_us / 1e6);
+    printf("Parsed:  %u frames, %u fields, %u parser errors (%u FCS, %u resyncs)\n",
+           stats.frames, stats.fields, stats.errors, stats.fcs_errors, stats.resyncs);
+    if (stats.frames > 0)
+    {
+        printf("Frames:  %.1f to %.1f ms from START to END on the line\n", stats.frame_min_us / 1e3, stats.frame_max_us / 1e3);
+    }
+    if (records > 0)
+    {
+        printf("Parse:   %.2f us per read on average, %.2f us at most\n", parse_ns / 1e3 / records, parse_max_ns / 1e3);
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    if (data != file)
+    {
+        free(data);
+    }
+    free(file);
+    return 0;
+}
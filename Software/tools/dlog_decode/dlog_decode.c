@@ -0,0 +1,494 @@
+// Formats a deferred log read from the device, see components/dlog.
+//
+// Usage: dlog_decode [options] ELF FILE
+//   -l, --level LEVEL    print only records up to LEVEL: E, W, I, D or V, default V
+//
+// ELF is the firmware the log was recorded with: call sites, format strings and string arguments
+// are read from it by address, a different build prints garbage. FILE is either a binary export as
+// read over the WattZig cluster, or a console log holding the "DLOG <offset> <hex>" lines of a
+// log dump; other log lines are ignored.
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dlog.h"
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    int word_size;
+} elf_image_t;
+
+typedef struct {
+    uint32_t sequence;
+    uint32_t time_us;
+    uint64_t site;
+    uint64_t tag;
+    uint64_t args[DLOG_MAX_ARGS * 2];
+} log_record_t;
+
+static const char kLevelLetters[] = "NEWIDV";
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool load_file(const char *path, uint8_t **data, size_t *length)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    size_t capacity = 65536;
+    *data = malloc(capacity);
+    *length = 0;
+    size_t n;
+    while ((n = fread(*data + *length, 1, capacity - *length, file)) > 0)
+    {
+        *length += n;
+        if (*length == capacity)
+        {
+            capacity *= 2;
+            *data = realloc(*data, capacity);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// Reassemble an export from the "DLOG <offset> <hex>" lines of a console log
+static bool load_console_dump(const char *text, size_t text_length, uint8_t **data, size_t *length)
+{
+    size_t capacity = 65536;
+    *data = calloc(capacity, 1);
+    *length = 0;
+
+    const char *end = text + text_length;
+    for (const char *line = text; line < end;)
+    {
+        const char *next = memchr(line, '\n', (size_t)(end - line));
+        next = next != NULL ? next + 1 : end;
+
+        const char *tag = memmem(line, (size_t)(next - line), "DLOG ", 5);
+        if (tag != NULL)
+        {
+            char *p;
+            size_t offset = strtoul(tag + 5, &p, 16);
+            while (*p == ' ') p++;
+
+            for (; p + 1 < next && hex_value(p[0]) >= 0 && hex_value(p[1]) >= 0; p += 2, offset++)
+            {
+                if (offset >= capacity)
+                {
+                    *data = realloc(*data, offset * 2);
+                    memset(*data + capacity, 0, offset * 2 - capacity);
+                    capacity = offset * 2;
+                }
+                (*data)[offset] = (uint8_t)(hex_value(p[0]) << 4 | hex_value(p[1]));
+                if (offset + 1 > *length)
+                {
+                    *length = offset + 1;
+                }
+            }
+        }
+        line = next;
+    }
+    return *length > 0;
+}
+
+static uint64_t get_le(const uint8_t *data, int size)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++)
+    {
+        value |= (uint64_t)data[i] << (8 * i);
+    }
+    return value;
+}
+
+static bool elf_init(elf_image_t *elf, const uint8_t *data, size_t length)
+{
+    if (length < EI_NIDENT || memcmp(data, ELFMAG, SELFMAG) != 0 || data[EI_DATA] != ELFDATA2LSB)
+    {
+        return false;
+    }
+    elf->data = data;
+    elf->length = length;
+    elf->word_size = data[EI_CLASS] == ELFCLASS64 ? 8 : 4;
+    return true;
+}
+
+// File contents at a load address, NULL outside the initialised sections
+static const uint8_t *elf_at(const elf_image_t *elf, uint64_t address, size_t *available)
+{
+    uint64_t shoff, count, entsize;
+    if (elf->word_size == 8)
+    {
+        const Elf64_Ehdr *header = (const Elf64_Ehdr *)elf->data;
+        shoff = header->e_shoff, count = header->e_shnum, entsize = header->e_shentsize;
+    }
+    else
+    {
+        const Elf32_Ehdr *header = (const Elf32_Ehdr *)elf->data;
+        shoff = header->e_shoff, count = header->e_shnum, entsize = header->e_shentsize;
+    }
+
+    for (uint64_t i = 0; i < count && shoff + (i + 1) * entsize <= elf->length; i++)
+    {
+        const uint8_t *section = elf->data + shoff + i * entsize;
+        uint64_t type, flags, addr, offset, size;
+        if (elf->word_size == 8)
+        {
+            const Elf64_Shdr *s = (const Elf64_Shdr *)section;
+            type = s->sh_type, flags = s->sh_flags, addr = s->sh_addr, offset = s->sh_offset, size = s->sh_size;
+        }
+        else
+        {
+            const Elf32_Shdr *s = (const Elf32_Shdr *)section;
+            type = s->sh_type, flags = s->sh_flags, addr = s->sh_addr, offset = s->sh_offset, size = s->sh_size;
+        }
+
+        if ((flags & SHF_ALLOC) && type != SHT_NOBITS && address >= addr && address < addr + size &&
+            offset + size <= elf->length)
+        {
+            *available = (size_t)(addr + size - address);
+            return elf->data + offset + (address - addr);
+        }
+    }
+    return NULL;
+}
+
+static const char *elf_string(const elf_image_t *elf, uint64_t address)
+{
+    size_t available;
+    const char *string = (const char *)elf_at(elf, address, &available);
+    return string != NULL && memchr(string, '\0', available) != NULL ? string : NULL;
+}
+
+static void print_string(const elf_image_t *elf, uint64_t address, const char *spec)
+{
+    const char *string = elf_string(elf, address);
+    if (string == NULL)
+    {
+        printf(address == 0 ? "(null)" : "<%#llx>", (unsigned long long)address);
+        return;
+    }
+    printf(spec, string);
+}
+
+// Print one conversion. spec is the conversion without its length modifier, bits the width of the
+// argument on the device.
+static void print_value(const char *spec, char conversion, uint64_t value, int bits)
+{
+    char format[32];
+    snprintf(format, sizeof(format), "%.*sll%c", (int)strlen(spec) - 1, spec, conversion);
+
+    if (bits < 64)
+    {
+        value &= (1ULL << bits) - 1;
+    }
+    switch (conversion)
+    {
+    case 'd':
+    case 'i':
+        if (bits < 64 && (value >> (bits - 1)) & 1)
+        {
+            value |= ~0ULL << bits;
+        }
+        printf(format, (long long)value);
+        break;
+    case 'c':
+        printf("%c", (int)value);
+        break;
+    case 'p':
+        printf("%#llx", (unsigned long long)value);
+        break;
+    default:
+        printf(format, (unsigned long long)value);
+        break;
+    }
+}
+
+static void print_message(const elf_image_t *elf, const char *format, const log_record_t *record, int count)
+{
+    int word = 0;
+    for (const char *p = format; *p != '\0'; p++)
+    {
+        if (*p != '%')
+        {
+            putchar(*p);
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            putchar('%');
+            p++;
+            continue;
+        }
+
+        // Flags, width and precision are passed on, the length modifier sets the argument width
+        char spec[24];
+        size_t length = 0;
+        const char *start = p++;
+        while (*p != '\0' && strchr("-+ #0123456789.*", *p) != NULL)
+        {
+            p++;
+        }
+        if ((size_t)(p - start) >= sizeof(spec) - 1 || memchr(start, '*', (size_t)(p - start)) != NULL)
+        {
+            printf("<unsupported format>");
+            return;
+        }
+        memcpy(spec, start, (size_t)(p - start));
+        length = (size_t)(p - start);
+
+        int bits = 32;
+        if (p[0] == 'h' && p[1] == 'h')
+        {
+            bits = 8, p += 2;
+        }
+        else if (p[0] == 'h')
+        {
+            bits = 16, p++;
+        }
+        else if ((p[0] == 'l' && p[1] == 'l') || p[0] == 'j')
+        {
+            bits = 64, p += p[0] == 'j' ? 1 : 2;
+        }
+        else if (p[0] == 'l' || p[0] == 'z' || p[0] == 't')
+        {
+            bits = elf->word_size * 8, p++;
+        }
+        if (*p == '\0')
+        {
+            return;
+        }
+
+        char conversion = *p;
+        spec[length++] = conversion;
+        spec[length] = '\0';
+
+        int words = bits > elf->word_size * 8 ? 2 : 1;
+        if (word + words > count)
+        {
+            printf("<missing argument>");
+            continue;
+        }
+        uint64_t value = record->args[word];
+        if (words == 2)
+        {
+            value |= record->args[word + 1] << 32;
+        }
+        word += words;
+
+        if (conversion == 's')
+        {
+            print_string(elf, value, spec);
+        }
+        else
+        {
+            print_value(spec, conversion, value, conversion == 'p' ? elf->word_size * 8 : bits);
+        }
+    }
+}
+
+static int compare_records(const void *a, const void *b)
+{
+    uint32_t sa = ((const log_record_t *)a)->sequence;
+    uint32_t sb = ((const log_record_t *)b)->sequence;
+    return sa < sb ? -1 : sa > sb;
+}
+
+static int parse_level(const char *text)
+{
+    const char *letter = strchr(kLevelLetters, text[0]);
+    return text[0] != '\0' && text[1] == '\0' && letter != NULL ? (int)(letter - kLevelLetters) : -1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-l E|W|I|D|V] ELF FILE\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option kOptions[] = {
+        {"level", required_argument, NULL, 'l'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int max_level = DLOG_VERBOSE;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:", kOptions, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'l':
+            max_level = parse_level(optarg);
+            if (max_level < 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint8_t *elf_data;
+    size_t elf_length;
+    elf_image_t elf;
+    if (!load_file(argv[optind], &elf_data, &elf_length))
+    {
+        return 1;
+    }
+    if (!elf_init(&elf, elf_data, elf_length))
+    {
+        fprintf(stderr, "%s: not a little-endian ELF file\n", argv[optind]);
+        return 1;
+    }
+
+    uint8_t *file;
+    size_t file_length;
+    if (!load_file(argv[optind + 1], &file, &file_length))
+    {
+        return 1;
+    }
+    uint8_t *data = file;
+    size_t length = file_length;
+    if (length < DLOG_HEADER_SIZE || memcmp(data, DLOG_MAGIC, 4) != 0)
+    {
+        if (!load_console_dump((const char *)file, file_length, &data, &length) ||
+            length < DLOG_HEADER_SIZE || memcmp(data, DLOG_MAGIC, 4) != 0)
+        {
+            fprintf(stderr, "%s: no log found\n", argv[optind + 1]);
+            return 1;
+        }
+    }
+
+    int word_size = data[5];
+    size_t record_size = (size_t)get_le(&data[6], 2);
+    size_t record_count = (size_t)get_le(&data[8], 2);
+    uint32_t written = (uint32_t)get_le(&data[12], 4);
+    size_t args_offset = 8 + 2 * (size_t)word_size;
+    if (data[4] != DLOG_VERSION || word_size != elf.word_size || record_size < args_offset)
+    {
+        fprintf(stderr, "Log version %u with %d byte words does not match %s\n", data[4], word_size, argv[optind]);
+        return 1;
+    }
+
+    int max_args = (int)((record_size - args_offset) / (size_t)word_size);
+    if (max_args > DLOG_MAX_ARGS * 2)
+    {
+        max_args = DLOG_MAX_ARGS * 2;
+    }
+
+    log_record_t *records = calloc(record_count, sizeof(log_record_t));
+    size_t count = 0;
+    for (size_t i = 0; i < record_count; i++)
+    {
+        size_t offset = DLOG_HEADER_SIZE + i * record_size;
+        if (offset + record_size > length)
+        {
+            break;
+        }
+
+        const uint8_t *raw = &data[offset];
+        log_record_t *record = &records[count];
+        record->sequence = (uint32_t)get_le(raw, 4);
+        if (record->sequence == 0)
+        {
+            continue;
+        }
+        record->time_us = (uint32_t)get_le(raw + 4, 4);
+        record->site = get_le(raw + 8, word_size);
+        record->tag = get_le(raw + 8 + word_size, word_size);
+        for (int j = 0; j < max_args; j++)
+        {
+            record->args[j] = get_le(raw + args_offset + (size_t)j * word_size, word_size);
+        }
+        count++;
+    }
+    qsort(records, count, sizeof(log_record_t), compare_records);
+
+    printf("%zu records, %u written since boot\n", count, written);
+
+    // Times are stored modulo 2^32 us, records more than 71 minutes apart lose the difference
+    uint64_t time_us = 0;
+    uint32_t previous_time = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const log_record_t *record = &records[i];
+        if (i > 0)
+        {
+            time_us += (uint32_t)(record->time_us - previous_time);
+            if (record->sequence != records[i - 1].sequence + 1)
+            {
+                printf("... %u records lost\n", record->sequence - records[i - 1].sequence - 1);
+            }
+        }
+        else
+        {
+            time_us = record->time_us;
+        }
+        previous_time = record->time_us;
+
+        size_t available;
+        const uint8_t *site = elf_at(&elf, record->site, &available);
+        if (site == NULL || available < (size_t)word_size + 2)
+        {
+            printf("? (%llu.%03llu) <unknown call site %#llx>\n", (unsigned long long)(time_us / 1000),
+                   (unsigned long long)(time_us % 1000), (unsigned long long)record->site);
+            continue;
+        }
+        const char *format = elf_string(&elf, get_le(site, word_size));
+        int level = site[word_size];
+        int args = site[word_size + 1];
+        if (level > max_level)
+        {
+            continue;
+        }
+
+        const char *tag = elf_string(&elf, record->tag);
+        printf("%c (%llu.%03llu) %s: ", level < (int)sizeof(kLevelLetters) - 1 ? kLevelLetters[level] : '?',
+               (unsigned long long)(time_us / 1000), (unsigned long long)(time_us % 1000), tag != NULL ? tag : "?");
+        if (format != NULL)
+        {
+            print_message(&elf, format, record, args < max_args ? args : max_args);
+        }
+        else
+        {
+            printf("<unknown format %#llx>", (unsigned long long)get_le(site, word_size));
+        }
+        putchar('\n');
+    }
+
+    free(records);
+    if (data != file)
+    {
+        free(data);
+    }
+    free(file);
+    free(elf_data);
+    return 0;
+}
@@ -0,0 +1,97 @@
+#ifndef METER_SIM_H
+#define METER_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Generates HDLC framed DLMS push messages as sent by Kamstrup, Aidon and Kaifa meters on the
+// HAN port, or DSMR P1 telegrams, with a simple household load model behind the values. Line impairments (idle noise,
+// bit flips, truncated frames, starting mid-frame) can be added to exercise parser recovery.
+// The APDU can be ciphered with general-glo-ciphering as DSO-provisioned meters send it, and
+// split over segmented HDLC frames as meters with a small maximum information field do.
+
+#define METER_SIM_PHASES 3
+#define METER_SIM_MAX_FRAME 1024                        // Largest frame any format generates
+#define METER_SIM_MAX_NOISE 256                         // Upper limit of noise_bytes
+#define METER_SIM_MIN_SEGMENT 16                        // Lower limit of segment_size, keeps the frame overhead in bounds
+#define METER_SIM_BUFFER_SIZE (METER_SIM_MAX_FRAME + METER_SIM_MAX_NOISE)
+#define METER_SIM_KEY_SIZE 16
+#define METER_SIM_SECURITY_ENCRYPTED 0x20                // Security control byte, encryption only
+#define METER_SIM_SECURITY_AUTHENTICATED 0x30            // Encryption and authentication
+
+typedef enum {
+    METER_SIM_KAMSTRUP,     // List 2 with OBIS codes, clock in the notification header
+    METER_SIM_AIDON,        // Array of OBIS/value structures with scaler and unit, energies hourly
+    METER_SIM_KAIFA,        // Structure of plain values without OBIS codes, energies hourly
+    METER_SIM_DSMR,         // DSMR 5 P1 ASCII telegram with CRC, never ciphered
+    METER_SIM_FORMAT_COUNT
+} meter_sim_format_t;
+
+typedef struct {
+    meter_sim_format_t format;
+    uint32_t seed;
+    uint32_t start_time;        // Meter clock of the first push, seconds since 2000-01-01
+    uint32_t push_interval_ms;  // Meter clock advance per push
+    uint16_t noise_bytes;       // Up to this many random bytes are sent before each frame
+    double bit_flip_rate;       // Probability of one flipped bit per frame byte
+    double truncate_rate;       // Probability of a frame being cut short
+    bool mid_frame_start;       // The first frame starts at a random offset
+    uint8_t security;           // 0 for plain APDUs, else METER_SIM_SECURITY_*
+    uint16_t segment_size;      // Largest information field per HDLC frame, 0 for one frame per push
+    bool i_frames;              // Numbered I-frames with a send sequence N(S) instead of UI frames
+    uint8_t encryption_key[METER_SIM_KEY_SIZE];
+    uint8_t authentication_key[METER_SIM_KEY_SIZE];
+} meter_sim_config_t;
+
+// Values of the last generated frame, before the format scales them
+typedef struct {
+    uint32_t time;                              // Seconds since 2000-01-01
+    uint16_t voltage_dv[METER_SIM_PHASES];      // V/10
+    uint32_t current_ma[METER_SIM_PHASES];      // mA
+    uint32_t power_w[METER_SIM_PHASES];         // W
+    uint32_t reactive_var[METER_SIM_PHASES];    // var
+    uint16_t power_factor[METER_SIM_PHASES];    // 1/100
+    uint32_t energy_import_wh;
+    uint32_t energy_export_wh;
+    bool has_energy;                            // The frame carried the energy registers
+} meter_sim_reading_t;
+
+typedef struct {
+    uint32_t frames;
+    uint32_t truncated;
+    uint32_t bit_flips;
+    uint64_t noise_bytes;
+    uint64_t bytes;
+} meter_sim_stats_t;
+
+typedef struct {
+    meter_sim_config_t config;
+    meter_sim_stats_t stats;
+    meter_sim_reading_t reading;
+    uint64_t rng;
+    uint64_t clock_ms;                          // Meter clock, ms since 2000-01-01
+    uint32_t serial;
+    uint32_t frame_counter;                     // Invocation counter of the last ciphered APDU
+    uint8_t send_sequence;                      // N(S) of the next I-frame
+    uint16_t base_load[METER_SIM_PHASES];       // W, always-on consumption
+    uint32_t appliances[METER_SIM_PHASES];      // Bitmap of running appliances
+    double energy_import_wh;
+} meter_sim_t;
+
+void meter_sim_default_config(meter_sim_config_t *config);
+void meter_sim_init(meter_sim_t *sim, const meter_sim_config_t *config);
+
+// Generate the next push: idle noise followed by one frame with the configured impairments.
+// Returns the number of bytes written to buffer, 0 if size is below METER_SIM_BUFFER_SIZE.
+size_t meter_sim_next(meter_sim_t *sim, uint8_t *buffer, size_t size);
+
+// Format names as used on the command line: "kamstrup", "aidon", "kaifa", "dsmr"
+bool meter_sim_parse_format(const char *name, meter_sim_format_t *format);
+const char *meter_sim_format_name(meter_sim_format_t format);
+
+// Keys as on the command line, "EK:AK" with 32 hex digits each. Sets them and turns on
+// authenticated encryption.
+bool meter_sim_parse_keys(const char *text, meter_sim_config_t *config);
+
+#endif // METER_SIM_H
@@ -0,0 +1,800 @@
+#include "include/meter_sim.h"
+#include "dlms_gcm.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HDLC_FLAG 0x7E
+#define HDLC_CONTROL_UI 0x13
+#define HDLC_CONTROL_I 0x10             // Final bit set, N(S) in bits 1-3
+#define HDLC_FORMAT 0xA000              // Frame format type 3, the length goes in the low 11 bits
+#define HDLC_SEGMENTED 0x0800           // The information field goes on in the next frame
+#define LLC_HEADER 0xE6, 0xE7, 0x00
+#define APDU_DATA_NOTIFICATION 0x0F
+#define APDU_GENERAL_GLO_CIPHERING 0xDB
+#define SYSTEM_TITLE_SIZE 8
+#define CIPHER_TAG_SIZE 12
+#define SECURITY_AUTHENTICATION 0x10
+
+// COSEM data type tags
+#define TAG_ARRAY 0x01
+#define TAG_STRUCTURE 0x02
+#define TAG_DOUBLE_LONG_UNSIGNED 0x06
+#define TAG_OCTET_STRING 0x09
+#define TAG_VISIBLE_STRING 0x0A
+#define TAG_INTEGER 0x0F
+#define TAG_LONG 0x10
+#define TAG_LONG_UNSIGNED 0x12
+#define TAG_ENUM 0x16
+
+// COSEM units
+#define UNIT_W 27
+#define UNIT_VAR 29
+#define UNIT_WH 30
+#define UNIT_VARH 32
+#define UNIT_A 33
+#define UNIT_V 35
+
+#define DATETIME_SIZE 12
+#define HOUR_MS 3600000ULL
+
+// Appliances switched on and off at random by the load model
+typedef struct {
+    uint16_t watts;
+    uint16_t on_permille;   // Chance per push of switching on
+    uint16_t off_permille;  // Chance per push of switching off
+} appliance_t;
+
+static const appliance_t kAppliances[] = {
+    {120, 50, 100},     // Fridge
+    {2000, 10, 300},    // Kettle
+    {2200, 5, 20},      // Oven
+    {450, 5, 20},       // Washing machine
+    {900, 10, 30},      // Heat pump
+    {110, 10, 10},      // TV
+};
+
+#define APPLIANCE_COUNT (sizeof(kAppliances) / sizeof(kAppliances[0]))
+
+static const char *kFormatNames[METER_SIM_FORMAT_COUNT] = {"kamstrup", "aidon", "kaifa", "dsmr"};
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+} writer_t;
+
+// xorshift64*
+static uint32_t next_random(meter_sim_t *sim)
+{
+    sim->rng ^= sim->rng >> 12;
+    sim->rng ^= sim->rng << 25;
+    sim->rng ^= sim->rng >> 27;
+    return (uint32_t)((sim->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static double next_uniform(meter_sim_t *sim)
+{
+    return next_random(sim) / 4294967296.0;
+}
+
+static bool chance(meter_sim_t *sim, double probability)
+{
+    return probability > 0 && next_uniform(sim) < probability;
+}
+
+// CRC-16/X.25 as used for the HDLC header and frame check sequences
+static uint16_t fcs16(const uint8_t *data, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc ^ 0xFFFF;
+}
+
+// CRC-16/ARC as used for the P1 telegram CRC
+static uint16_t crc16(const uint8_t *data, size_t length)
+{
+    uint16_t crc = 0x0000;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static void put8(writer_t *w, uint8_t value)
+{
+    w->data[w->length++] = value;
+}
+
+static void put16(writer_t *w, uint16_t value)
+{
+    put8(w, (uint8_t)(value >> 8));
+    put8(w, (uint8_t)value);
+}
+
+static void put32(writer_t *w, uint32_t value)
+{
+    put16(w, (uint16_t)(value >> 16));
+    put16(w, (uint16_t)value);
+}
+
+static void put_bytes(writer_t *w, const void *bytes, size_t length)
+{
+    memcpy(&w->data[w->length], bytes, length);
+    w->length += length;
+}
+
+static void put_string(writer_t *w, uint8_t tag, const char *text)
+{
+    size_t length = strlen(text);
+    put8(w, tag);
+    put8(w, (uint8_t)length);
+    put_bytes(w, text, length);
+}
+
+static void put_obis(writer_t *w, uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t e)
+{
+    const uint8_t obis[] = {TAG_OCTET_STRING, 6, a, b, c, d, e, 0xFF};
+    put_bytes(w, obis, sizeof(obis));
+}
+
+static void put_u32(writer_t *w, uint32_t value)
+{
+    put8(w, TAG_DOUBLE_LONG_UNSIGNED);
+    put32(w, value);
+}
+
+static void put_u16(writer_t *w, uint16_t value)
+{
+    put8(w, TAG_LONG_UNSIGNED);
+    put16(w, value);
+}
+
+static void put_scaler_unit(writer_t *w, int8_t scaler, uint8_t unit)
+{
+    const uint8_t scaler_unit[] = {TAG_STRUCTURE, 2, TAG_INTEGER, (uint8_t)scaler, TAG_ENUM, unit};
+    put_bytes(w, scaler_unit, sizeof(scaler_unit));
+}
+
+// COSEM date-time: year, month, day, weekday, hour, minute, second, hundredths, deviation, status
+static void encode_datetime(uint32_t seconds, uint8_t *datetime)
+{
+    uint32_t days = seconds / 86400;
+    uint32_t rest = seconds % 86400;
+
+    // Civil date from days since 2000-01-01 (a Saturday), see days_from_civil in the DLMS parser
+    int32_t z = (int32_t)days + 10957 + 719468;
+    int32_t era = z / 146097;
+    uint32_t doe = (uint32_t)(z - era * 146097);
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+    uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+    uint32_t year = yoe + (uint32_t)era * 400 + (month <= 2);
+
+    datetime[0] = (uint8_t)(year >> 8);
+    datetime[1] = (uint8_t)year;
+    datetime[2] = (uint8_t)month;
+    datetime[3] = (uint8_t)day;
+    datetime[4] = (uint8_t)((days + 5) % 7 + 1); // Monday is 1
+    datetime[5] = (uint8_t)(rest / 3600);
+    datetime[6] = (uint8_t)(rest / 60 % 60);
+    datetime[7] = (uint8_t)(rest % 60);
+    datetime[8] = 0xFF;
+    datetime[9] = 0x80;
+    datetime[10] = 0x00;
+    datetime[11] = 0x00;
+}
+
+static void put_datetime(writer_t *w, uint32_t seconds)
+{
+    uint8_t datetime[DATETIME_SIZE];
+    encode_datetime(seconds, datetime);
+    put8(w, TAG_OCTET_STRING);
+    put8(w, DATETIME_SIZE);
+    put_bytes(w, datetime, DATETIME_SIZE);
+}
+
+static uint32_t total(const uint32_t *values)
+{
+    return values[0] + values[1] + values[2];
+}
+
+static void update_reading(meter_sim_t *sim, bool has_energy)
+{
+    meter_sim_reading_t *r = &sim->reading;
+
+    r->time = (uint32_t)(sim->clock_ms / 1000);
+    r->has_energy = has_energy;
+
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        for (size_t a = 0; a < APPLIANCE_COUNT; a++)
+        {
+            uint32_t bit = 1UL << a;
+            bool running = (sim->appliances[p] & bit) != 0;
+            if (chance(sim, (running ? kAppliances[a].off_permille : kAppliances[a].on_permille) / 1000.0))
+            {
+                sim->appliances[p] ^= bit;
+            }
+        }
+
+        double power = sim->base_load[p];
+        for (size_t a = 0; a < APPLIANCE_COUNT; a++)
+        {
+            if (sim->appliances[p] & (1UL << a))
+            {
+                power += kAppliances[a].watts;
+            }
+        }
+        power *= 0.99 + 0.02 * next_uniform(sim);
+
+        // Heavier load pulls the voltage down a little
+        double voltage = 232.0 - power / 500.0 + 1.5 * (next_uniform(sim) - 0.5);
+        double factor = 0.85 + 0.14 * next_uniform(sim);
+
+        r->power_w[p] = (uint32_t)power;
+        r->voltage_dv[p] = (uint16_t)(voltage * 10);
+        r->power_factor[p] = (uint16_t)(factor * 100);
+        r->current_ma[p] = (uint32_t)(power * 1000 / (voltage * factor));
+        r->reactive_var[p] = (uint32_t)(power * sqrt(1 - factor * factor) / factor);
+    }
+
+    sim->energy_import_wh += total(r->power_w) * sim->config.push_interval_ms / 3600000.0;
+    r->energy_import_wh = (uint32_t)sim->energy_import_wh;
+    r->energy_export_wh = 0;
+}
+
+// Kamstrup list 2: visible string list id, then OBIS/value pairs. Voltage in V, current in A/100.
+static void encode_kamstrup(meter_sim_t *sim, writer_t *w)
+{
+    const meter_sim_reading_t *r = &sim->reading;
+    uint8_t datetime[DATETIME_SIZE];
+
+    put8(w, APDU_DATA_NOTIFICATION);
+    put32(w, 0);
+    put8(w, DATETIME_SIZE);
+    encode_datetime(r->time, datetime);
+    put_bytes(w, datetime, DATETIME_SIZE);
+
+    put8(w, TAG_STRUCTURE);
+    size_t count_at = w->length;
+    put8(w, 0);
+    put_string(w, TAG_VISIBLE_STRING, "Kamstrup_V0001");
+    uint8_t items = 0;
+
+    put_obis(w, 1, 1, 1, 8, 0);
+    put_u32(w, r->energy_import_wh);
+    put_obis(w, 1, 1, 2, 8, 0);
+    put_u32(w, r->energy_export_wh);
+    put_obis(w, 1, 1, 0, 0, 1);
+    put_u32(w, sim->serial);
+    put_obis(w, 1, 1, 1, 7, 0);
+    put_u32(w, total(r->power_w));
+    put_obis(w, 1, 1, 2, 7, 0);
+    put_u32(w, 0);
+    put_obis(w, 1, 1, 3, 7, 0);
+    put_u32(w, total(r->reactive_var));
+    put_obis(w, 0, 1, 1, 0, 0);
+    put_datetime(w, r->time);
+    items += 7;
+
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        uint8_t c = (uint8_t)(20 * p);
+        put_obis(w, 1, 1, 32 + c, 7, 0);
+        put_u16(w, (uint16_t)((r->voltage_dv[p] + 5) / 10));
+        put_obis(w, 1, 1, 31 + c, 7, 0);
+        put_u32(w, r->current_ma[p] / 10);
+        put_obis(w, 1, 1, 21 + c, 7, 0);
+        put_u32(w, r->power_w[p]);
+        put_obis(w, 1, 1, 22 + c, 7, 0);
+        put_u32(w, r->reactive_var[p]);
+        put_obis(w, 1, 1, 33 + c, 7, 0);
+        put_u16(w, r->power_factor[p]);
+        items += 5;
+    }
+
+    w->data[count_at] = (uint8_t)(1 + 2 * items);
+}
+
+static void put_aidon_item(writer_t *w, uint8_t c, uint8_t d, uint8_t tag, uint32_t value, int8_t scaler, uint8_t unit)
+{
+    put8(w, TAG_STRUCTURE);
+    put8(w, 3);
+    put_obis(w, 1, 0, c, d, 0);
+    put8(w, tag);
+    if (tag == TAG_DOUBLE_LONG_UNSIGNED)
+    {
+        put32(w, value);
+    }
+    else
+    {
+        put16(w, (uint16_t)value);
+    }
+    put_scaler_unit(w, scaler, unit);
+}
+
+// Aidon: array of {OBIS, value[, scaler/unit]} structures, voltage in V/10, current in A/10
+static void encode_aidon(meter_sim_t *sim, writer_t *w, bool hourly)
+{
+    const meter_sim_reading_t *r = &sim->reading;
+    char serial[17];
+
+    put8(w, APDU_DATA_NOTIFICATION);
+    put32(w, 0x40000000);
+    put8(w, 0); // No date-time in the header
+
+    put8(w, TAG_ARRAY);
+    put8(w, hourly ? 21 : 16);
+
+    const uint8_t list_id[] = {TAG_STRUCTURE, 2};
+    put_bytes(w, list_id, sizeof(list_id));
+    put_obis(w, 1, 1, 0, 2, 129);
+    put_string(w, TAG_VISIBLE_STRING, "AIDON_V0001");
+
+    put_bytes(w, list_id, sizeof(list_id));
+    put_obis(w, 0, 0, 96, 1, 0);
+    for (int i = 0; i < 16; i++)
+    {
+        serial[i] = (char)('0' + (sim->serial >> (i % 8)) % 10);
+    }
+    serial[16] = '\0';
+    put_string(w, TAG_VISIBLE_STRING, serial);
+
+    put_bytes(w, list_id, sizeof(list_id));
+    put_obis(w, 0, 0, 96, 1, 7);
+    put_string(w, TAG_VISIBLE_STRING, "6534");
+
+    put_aidon_item(w, 1, 7, TAG_DOUBLE_LONG_UNSIGNED, total(r->power_w), 0, UNIT_W);
+    put_aidon_item(w, 2, 7, TAG_DOUBLE_LONG_UNSIGNED, 0, 0, UNIT_W);
+    put_aidon_item(w, 3, 7, TAG_DOUBLE_LONG_UNSIGNED, total(r->reactive_var), 0, UNIT_VAR);
+    put_aidon_item(w, 4, 7, TAG_DOUBLE_LONG_UNSIGNED, 0, 0, UNIT_VAR);
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        put_aidon_item(w, (uint8_t)(31 + 20 * p), 7, TAG_LONG, r->current_ma[p] / 100, -1, UNIT_A);
+    }
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        put_aidon_item(w, (uint8_t)(32 + 20 * p), 7, TAG_LONG_UNSIGNED, r->voltage_dv[p], -1, UNIT_V);
+    }
+    // Per-phase power, newer firmware only
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        put_aidon_item(w, (uint8_t)(21 + 20 * p), 7, TAG_DOUBLE_LONG_UNSIGNED, r->power_w[p], 0, UNIT_W);
+    }
+
+    if (hourly)
+    {
+        put_bytes(w, list_id, sizeof(list_id));
+        put_obis(w, 0, 0, 1, 0, 0);
+        put_datetime(w, r->time);
+        put_aidon_item(w, 1, 8, TAG_DOUBLE_LONG_UNSIGNED, r->energy_import_wh / 10, 1, UNIT_WH);
+        put_aidon_item(w, 2, 8, TAG_DOUBLE_LONG_UNSIGNED, r->energy_export_wh / 10, 1, UNIT_WH);
+        put_aidon_item(w, 3, 8, TAG_DOUBLE_LONG_UNSIGNED, 0, 1, UNIT_VARH);
+        put_aidon_item(w, 4, 8, TAG_DOUBLE_LONG_UNSIGNED, 0, 1, UNIT_VARH);
+    }
+}
+
+// Kaifa: one structure of values in a fixed order without OBIS codes, voltage in V/10, current in mA
+static void encode_kaifa(meter_sim_t *sim, writer_t *w, bool hourly)
+{
+    const meter_sim_reading_t *r = &sim->reading;
+    char serial[17];
+
+    put8(w, APDU_DATA_NOTIFICATION);
+    put32(w, 0x40000000);
+    put_datetime(w, r->time);
+
+    put8(w, TAG_STRUCTURE);
+    put8(w, hourly ? 18 : 13);
+    put_string(w, TAG_OCTET_STRING, "KFM_001");
+    for (int i = 0; i < 16; i++)
+    {
+        serial[i] = (char)('0' + (sim->serial >> (i % 8)) % 10);
+    }
+    serial[16] = '\0';
+    put_string(w, TAG_OCTET_STRING, serial);
+    put_string(w, TAG_OCTET_STRING, "MA304H3E");
+    put_u32(w, total(r->power_w));
+    put_u32(w, 0);
+    put_u32(w, total(r->reactive_var));
+    put_u32(w, 0);
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        put_u32(w, r->current_ma[p]);
+    }
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        put_u32(w, r->voltage_dv[p]);
+    }
+
+    if (hourly)
+    {
+        put_datetime(w, r->time);
+        put_u32(w, r->energy_import_wh);
+        put_u32(w, r->energy_export_wh);
+        put_u32(w, 0);
+        put_u32(w, 0);
+    }
+}
+
+static void put_text(writer_t *w, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf((char *)&w->data[w->length], METER_SIM_MAX_FRAME - w->length, format, args);
+    va_end(args);
+    w->length += (size_t)length;
+}
+
+// kW or kWh with three decimals from W or Wh
+static void put_dsmr_kilo(writer_t *w, const char *reference, int digits, uint32_t value, const char *unit)
+{
+    put_text(w, "%s(%0*u.%03u*%s)\r\n", reference, digits, value / 1000, value % 1000, unit);
+}
+
+// DSMR 5 telegram as sent by a three phase meter with a gas meter on M-Bus: voltage with one
+// decimal, current in whole A, powers and energies in kW and kWh
+static void encode_dsmr(meter_sim_t *sim, writer_t *w)
+{
+    const meter_sim_reading_t *r = &sim->reading;
+    uint8_t datetime[DATETIME_SIZE];
+    char serial[16];
+
+    encode_datetime(r->time, datetime);
+    char timestamp[20];
+    snprintf(timestamp, sizeof(timestamp), "%02u%02u%02u%02u%02u%02uW", (datetime[0] << 8 | datetime[1]) % 100,
+             datetime[2], datetime[3], datetime[5], datetime[6], datetime[7]);
+
+    put_text(w, "/WZS5\\2WattZig-Sim\r\n\r\n");
+    put_text(w, "1-3:0.2.8(50)\r\n");
+    put_text(w, "0-0:1.0.0(%s)\r\n", timestamp);
+    put_text(w, "0-0:96.1.1(");
+    snprintf(serial, sizeof(serial), "WZS%u", sim->serial);
+    for (const char *c = serial; *c != '\0'; c++)
+    {
+        put_text(w, "%02X", *c);
+    }
+    put_text(w, ")\r\n");
+
+    // Day and night tariff
+    uint32_t day = r->energy_import_wh * 3 / 5;
+    put_dsmr_kilo(w, "1-0:1.8.1", 6, day, "kWh");
+    put_dsmr_kilo(w, "1-0:1.8.2", 6, r->energy_import_wh - day, "kWh");
+    put_dsmr_kilo(w, "1-0:2.8.1", 6, r->energy_export_wh, "kWh");
+    put_dsmr_kilo(w, "1-0:2.8.2", 6, 0, "kWh");
+    put_text(w, "0-0:96.14.0(0001)\r\n");
+    put_dsmr_kilo(w, "1-0:1.7.0", 2, total(r->power_w), "kW");
+    put_dsmr_kilo(w, "1-0:2.7.0", 2, 0, "kW");
+    put_text(w, "0-0:96.7.21(00004)\r\n0-0:96.7.9(00002)\r\n");
+    put_text(w, "1-0:99.97.0(1)(0-0:96.7.19)(240101120000W)(0000000240*s)\r\n");
+
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        put_text(w, "1-0:%d.7.0(%03u.%u*V)\r\n", 32 + 20 * p, r->voltage_dv[p] / 10, r->voltage_dv[p] % 10);
+    }
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        put_text(w, "1-0:%d.7.0(%03u*A)\r\n", 31 + 20 * p, (r->current_ma[p] + 500) / 1000);
+    }
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        char reference[12];
+        snprintf(reference, sizeof(reference), "1-0:%d.7.0", 21 + 20 * p);
+        put_dsmr_kilo(w, reference, 2, r->power_w[p], "kW");
+    }
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        char reference[12];
+        snprintf(reference, sizeof(reference), "1-0:%d.7.0", 22 + 20 * p);
+        put_dsmr_kilo(w, reference, 2, 0, "kW");
+    }
+
+    put_text(w, "0-1:24.1.0(003)\r\n");
+    put_text(w, "0-1:96.1.0(4730303332353631323334353637383930)\r\n");
+    put_text(w, "0-1:24.2.1(%s)(%05u.%03u*m3)\r\n", timestamp, r->time / 86400 % 100000, r->time % 1000);
+
+    put_text(w, "!");
+    put_text(w, "%04X\r\n", crc16(w->data, w->length));
+}
+
+// Replace the APDU from apdu_at with its general-glo-ciphering: system title, length, security
+// control byte, frame counter, ciphertext and the first 12 bytes of the tag
+static void cipher_apdu(meter_sim_t *sim, writer_t *w, size_t apdu_at)
+{
+    uint8_t apdu[METER_SIM_MAX_FRAME];
+    size_t apdu_length = w->length - apdu_at;
+    memcpy(apdu, &w->data[apdu_at], apdu_length);
+    w->length = apdu_at;
+
+    uint8_t security = sim->config.security;
+    bool authenticated = security & SECURITY_AUTHENTICATION;
+    sim->frame_counter++;
+
+    // IV: system title (manufacturer and serial number) and frame counter
+    uint8_t iv[DLMS_GCM_IV_SIZE] = {'W', 'Z', 'S', 0x00};
+    for (int i = 0; i < 4; i++)
+    {
+        iv[4 + i] = (uint8_t)(sim->serial >> (24 - 8 * i));
+        iv[SYSTEM_TITLE_SIZE + i] = (uint8_t)(sim->frame_counter >> (24 - 8 * i));
+    }
+
+    size_t length = 5 + apdu_length + (authenticated ? CIPHER_TAG_SIZE : 0);
+    put8(w, APDU_GENERAL_GLO_CIPHERING);
+    put8(w, SYSTEM_TITLE_SIZE);
+    put_bytes(w, iv, SYSTEM_TITLE_SIZE);
+    if (length >= 0x100)
+    {
+        put8(w, 0x82);
+        put16(w, (uint16_t)length);
+    }
+    else
+    {
+        if (length >= 0x80)
+        {
+            put8(w, 0x81);
+        }
+        put8(w, (uint8_t)length);
+    }
+    put8(w, security);
+    put_bytes(w, &iv[SYSTEM_TITLE_SIZE], DLMS_GCM_IV_SIZE - SYSTEM_TITLE_SIZE);
+
+    uint8_t aad[1 + METER_SIM_KEY_SIZE] = {security};
+    memcpy(&aad[1], sim->config.authentication_key, METER_SIM_KEY_SIZE);
+
+    dlms_gcm_t gcm;
+    dlms_gcm_init(&gcm);
+    dlms_gcm_set_key(&gcm, sim->config.encryption_key);
+    dlms_gcm_start(&gcm, iv, aad, authenticated ? sizeof(aad) : 0);
+    for (size_t i = 0; i < apdu_length; i++)
+    {
+        put8(w, dlms_gcm_encrypt(&gcm, apdu[i]));
+    }
+    if (authenticated)
+    {
+        uint8_t tag[DLMS_GCM_BLOCK_SIZE];
+        dlms_gcm_finish(&gcm, tag);
+        put_bytes(w, tag, CIPHER_TAG_SIZE);
+    }
+    dlms_gcm_free(&gcm);
+}
+
+// One HDLC type 3 frame with header and frame check sequences around (part of) the information field
+static void put_hdlc_frame(writer_t *w, const uint8_t *address, size_t address_length, uint8_t control, const uint8_t *info, size_t info_length, bool segmented)
+{
+    uint8_t *frame = &w->data[w->length];
+
+    // Length counts everything between the flags, including the FCS
+    size_t header_length = 2 + address_length + 1;
+    uint16_t length = (uint16_t)(header_length + 2 + info_length + 2);
+
+    put8(w, HDLC_FLAG);
+    put16(w, (uint16_t)(HDLC_FORMAT | (segmented ? HDLC_SEGMENTED : 0) | length));
+    put_bytes(w, address, address_length);
+    put8(w, control);
+
+    uint16_t hcs = fcs16(&frame[1], header_length);
+    put8(w, (uint8_t)hcs);
+    put8(w, (uint8_t)(hcs >> 8));
+    put_bytes(w, info, info_length);
+
+    uint16_t fcs = fcs16(&frame[1], length - 2);
+    put8(w, (uint8_t)fcs);
+    put8(w, (uint8_t)(fcs >> 8));
+    put8(w, HDLC_FLAG);
+}
+
+// Wrap the information field in HDLC type 3 frames, split into segments if configured. DSMR
+// telegrams are plain text with their own CRC.
+static size_t build_frame(meter_sim_t *sim, uint8_t *frame)
+{
+    static const uint8_t kKamstrupAddress[] = {0x2B, 0x21};
+    static const uint8_t kAidonAddress[] = {0x41, 0x08, 0x83};
+    static const uint8_t kKaifaAddress[] = {0x01, 0x02, 0x01};
+    static const uint8_t kLlcHeader[] = {LLC_HEADER};
+
+    const uint8_t *address = kKamstrupAddress;
+    size_t address_length = sizeof(kKamstrupAddress);
+    bool hourly = sim->stats.frames == 0 || (sim->clock_ms / HOUR_MS) != ((sim->clock_ms - sim->config.push_interval_ms) / HOUR_MS);
+
+    if (sim->config.format == METER_SIM_AIDON)
+    {
+        address = kAidonAddress;
+        address_length = sizeof(kAidonAddress);
+    }
+    else if (sim->config.format == METER_SIM_KAIFA)
+    {
+        address = kKaifaAddress;
+        address_length = sizeof(kKaifaAddress);
+    }
+
+    update_reading(sim, sim->config.format == METER_SIM_KAMSTRUP || sim->config.format == METER_SIM_DSMR || hourly);
+
+    writer_t w = {frame, 0};
+    if (sim->config.format == METER_SIM_DSMR)
+    {
+        encode_dsmr(sim, &w);
+        return w.length;
+    }
+
+    uint8_t info_buffer[METER_SIM_MAX_FRAME];
+    writer_t info = {info_buffer, 0};
+    put_bytes(&info, kLlcHeader, sizeof(kLlcHeader));
+    size_t apdu_at = info.length;
+
+    switch (sim->config.format)
+    {
+    case METER_SIM_AIDON:
+        encode_aidon(sim, &info, hourly);
+        break;
+    case METER_SIM_KAIFA:
+        encode_kaifa(sim, &info, hourly);
+        break;
+    default:
+        encode_kamstrup(sim, &info);
+        break;
+    }
+
+    if (sim->config.security != 0)
+    {
+        cipher_apdu(sim, &info, apdu_at);
+    }
+
+    // Segments are cut at a fixed size, wherever that falls in the APDU
+    size_t segment = sim->config.segment_size > 0 ? sim->config.segment_size : info.length;
+    for (size_t at = 0; at < info.length; at += segment)
+    {
+        size_t length = info.length - at < segment ? info.length - at : segment;
+        uint8_t control = HDLC_CONTROL_UI;
+        if (sim->config.i_frames)
+        {
+            control = (uint8_t)(HDLC_CONTROL_I | sim->send_sequence << 1);
+            sim->send_sequence = (sim->send_sequence + 1) & 0x07;
+        }
+        put_hdlc_frame(&w, address, address_length, control, &info.data[at], length, at + length < info.length);
+    }
+
+    return w.length;
+}
+
+void meter_sim_default_config(meter_sim_config_t *config)
+{
+    memset(config, 0, sizeof(meter_sim_config_t));
+    config->format = METER_SIM_KAMSTRUP;
+    config->seed = 1;
+    config->start_time = 789004800; // 2025-01-01 00:00:00
+    config->push_interval_ms = 10000;
+}
+
+void meter_sim_init(meter_sim_t *sim, const meter_sim_config_t *config)
+{
+    memset(sim, 0, sizeof(meter_sim_t));
+    sim->config = *config;
+    if (sim->config.noise_bytes > METER_SIM_MAX_NOISE)
+    {
+        sim->config.noise_bytes = METER_SIM_MAX_NOISE;
+    }
+    if (sim->config.segment_size > 0 && sim->config.segment_size < METER_SIM_MIN_SEGMENT)
+    {
+        sim->config.segment_size = METER_SIM_MIN_SEGMENT;
+    }
+
+    sim->rng = 0x9E3779B97F4A7C15ULL ^ config->seed;
+    sim->clock_ms = (uint64_t)config->start_time * 1000;
+    sim->serial = 57000000 + next_random(sim) % 1000000;
+    sim->energy_import_wh = 1000000 + next_random(sim) % 9000000;
+    for (int p = 0; p < METER_SIM_PHASES; p++)
+    {
+        sim->base_load[p] = (uint16_t)(40 + next_random(sim) % 160);
+    }
+}
+
+size_t meter_sim_next(meter_sim_t *sim, uint8_t *buffer, size_t size)
+{
+    uint8_t frame[METER_SIM_MAX_FRAME];
+
+    if (size < METER_SIM_BUFFER_SIZE)
+    {
+        return 0;
+    }
+
+    size_t length = 0;
+    if (sim->config.noise_bytes > 0)
+    {
+        uint32_t noise = next_random(sim) % (sim->config.noise_bytes + 1U);
+        for (uint32_t i = 0; i < noise; i++)
+        {
+            buffer[length++] = (uint8_t)next_random(sim);
+        }
+        sim->stats.noise_bytes += noise;
+    }
+
+    size_t frame_length = build_frame(sim, frame);
+    size_t start = 0;
+
+    if (sim->config.mid_frame_start && sim->stats.frames == 0)
+    {
+        start = 1 + next_random(sim) % (frame_length - 1);
+    }
+    if (frame_length - start > 1 && chance(sim, sim->config.truncate_rate))
+    {
+        frame_length = start + 1 + next_random(sim) % (frame_length - start - 1);
+        sim->stats.truncated++;
+    }
+
+    for (size_t i = start; i < frame_length; i++)
+    {
+        uint8_t byte = frame[i];
+        if (chance(sim, sim->config.bit_flip_rate))
+        {
+            byte ^= (uint8_t)(1 << (next_random(sim) % 8));
+            sim->stats.bit_flips++;
+        }
+        buffer[length++] = byte;
+    }
+
+    sim->stats.frames++;
+    sim->stats.bytes += length;
+    sim->clock_ms += sim->config.push_interval_ms;
+    return length;
+}
+
+bool meter_sim_parse_format(const char *name, meter_sim_format_t *format)
+{
+    for (int i = 0; i < METER_SIM_FORMAT_COUNT; i++)
+    {
+        if (strcmp(name, kFormatNames[i]) == 0)
+        {
+            *format = (meter_sim_format_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *meter_sim_format_name(meter_sim_format_t format)
+{
+    return format < METER_SIM_FORMAT_COUNT ? kFormatNames[format] : "unknown";
+}
+
+static bool parse_hex(const char *text, uint8_t *out, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        unsigned int byte;
+        if (sscanf(&text[2 * i], "%2x", &byte) != 1)
+        {
+            return false;
+        }
+        out[i] = (uint8_t)byte;
+    }
+    return true;
+}
+
+bool meter_sim_parse_keys(const char *text, meter_sim_config_t *config)
+{
+    const size_t digits = 2 * METER_SIM_KEY_SIZE;
+
+    if (strlen(text) != 2 * digits + 1 || text[digits] != ':' ||
+        !parse_hex(text, config->encryption_key, METER_SIM_KEY_SIZE) ||
+        !parse_hex(&text[digits + 1], config->authentication_key, METER_SIM_KEY_SIZE))
+    {
+        return false;
+    }
+    config->security = METER_SIM_SECURITY_AUTHENTICATED;
+    return true;
+}
@@ -0,0 +1,344 @@
+// Meter stream simulator.
+//
+// Usage: meter_sim [options]
+//   -f, --format NAME      kamstrup (default), aidon, kaifa or dsmr
+//   -i, --interval MS      push interval, default 10000
+//   -n, --count N          number of pushes, 0 runs until interrupted (default)
+//   -b, --baud RATE        line speed used for pacing, default 2400, 0 sends frames at once
+//   -s, --seed N           random seed of the load model and the impairments
+//       --noise N          up to N random bytes before each frame
+//       --flip RATE        probability of a bit flip per byte, e.g. 1e-4
+//       --truncate RATE    probability of a frame being cut short
+//       --mid-start        start in the middle of the first frame
+//   -k, --keys EK:AK       cipher the APDUs with these hex keys, encrypted and authenticated (not dsmr)
+//       --encrypt-only     with -k, leave out the authentication tag
+//       --segment N        split each push over HDLC frames of at most N information bytes (not dsmr)
+//       --i-frames         send numbered I-frames instead of UI frames (not dsmr)
+//   -o, --output PATH      write to a file, serial device or pty, default stdout
+//   -p, --pty LINK         create a pty and symlink its slave to LINK
+//   -x, --hex              write a hex dump that the parser tests and benchmark can load
+//       --fast             no pacing, even on a terminal
+//
+// Output to a terminal (pty, serial device) is paced at the push interval and the baud rate,
+// files and pipes get the stream as fast as it is generated.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "meter_sim.h"
+
+#define BITS_PER_BYTE 10 // 8N1
+#define CHUNK_SIZE 16
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int signal)
+{
+    (void)signal;
+    stop = 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-f kamstrup|aidon|kaifa|dsmr] [-i interval_ms] [-n count] [-b baud] [-s seed]\n"
+            "          [--noise N] [--flip RATE] [--truncate RATE] [--mid-start]\n"
+            "          [-k EK:AK [--encrypt-only]] [--segment N] [--i-frames]\n"
+            "          [-o path | -p link] [-x] [--fast]\n",
+            name);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline_ns)
+{
+    struct timespec ts = {(time_t)(deadline_ns / 1000000000ULL), (long)(deadline_ns % 1000000000ULL)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !stop)
+    {
+    }
+}
+
+static bool write_all(int fd, const void *data, size_t length)
+{
+    const uint8_t *p = data;
+    while (length > 0)
+    {
+        ssize_t written = write(fd, p, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("write");
+            return false;
+        }
+        p += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static bool write_hex(int fd, uint32_t push, const uint8_t *data, size_t length)
+{
+    char line[128];
+    int n = snprintf(line, sizeof(line), "# push %u, %zu bytes\n", push, length);
+    if (!write_all(fd, line, (size_t)n))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; i += 32)
+    {
+        n = 0;
+        for (size_t j = i; j < length && j < i + 32; j++)
+        {
+            n += snprintf(line + n, sizeof(line) - (size_t)n, j == i ? "%02X" : " %02X", data[j]);
+        }
+        line[n++] = '\n';
+        if (!write_all(fd, line, (size_t)n))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int open_pty(const char *link)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        perror("pty");
+        return -1;
+    }
+
+    // Keep the slave open in raw mode so the line survives readers coming and going
+    const char *slave_name = ptsname(master);
+    int slave = open(slave_name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave >= 0 && tcgetattr(slave, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+    }
+
+    if (link != NULL)
+    {
+        unlink(link);
+        if (symlink(slave_name, link) != 0)
+        {
+            perror("symlink");
+            return -1;
+        }
+    }
+    fprintf(stderr, "Meter UART on %s%s%s\n", slave_name, link ? " -> " : "", link ? link : "");
+    return master;
+}
+
+int main(int argc, char **argv)
+{
+    enum { OPT_NOISE = 256, OPT_FLIP, OPT_TRUNCATE, OPT_MID_START, OPT_FAST, OPT_ENCRYPT_ONLY, OPT_SEGMENT, OPT_I_FRAMES };
+    static const struct option kOptions[] = {
+        {"format", required_argument, NULL, 'f'},
+        {"interval", required_argument, NULL, 'i'},
+        {"count", required_argument, NULL, 'n'},
+        {"baud", required_argument, NULL, 'b'},
+        {"seed", required_argument, NULL, 's'},
+        {"noise", required_argument, NULL, OPT_NOISE},
+        {"flip", required_argument, NULL, OPT_FLIP},
+        {"truncate", required_argument, NULL, OPT_TRUNCATE},
+        {"mid-start", no_argument, NULL, OPT_MID_START},
+        {"keys", required_argument, NULL, 'k'},
+        {"encrypt-only", no_argument, NULL, OPT_ENCRYPT_ONLY},
+        {"segment", required_argument, NULL, OPT_SEGMENT},
+        {"i-frames", no_argument, NULL, OPT_I_FRAMES},
+        {"output", required_argument, NULL, 'o'},
+        {"pty", required_argument, NULL, 'p'},
+        {"hex", no_argument, NULL, 'x'},
+        {"fast", no_argument, NULL, OPT_FAST},
+        {NULL, 0, NULL, 0},
+    };
+
+    meter_sim_config_t config;
+    meter_sim_default_config(&config);
+    uint32_t count = 0;
+    uint32_t baud = 2400;
+    const char *output = NULL;
+    const char *link = NULL;
+    bool use_pty = false;
+    bool hex = false;
+    bool fast = false;
+    bool encrypt_only = false;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:i:n:b:s:k:o:p:x", kOptions, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            if (!meter_sim_parse_format(optarg, &config.format))
+            {
+                fprintf(stderr, "Unknown format %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'i':
+            config.push_interval_ms = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            count = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            baud = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            config.seed = (uint32_t)strtoul(optarg, NULL, 10);
+            break;
+        case OPT_NOISE:
+            config.noise_bytes = (uint16_t)strtoul(optarg, NULL, 10);
+            break;
+        case OPT_FLIP:
+            config.bit_flip_rate = strtod(optarg, NULL);
+            break;
+        case OPT_TRUNCATE:
+            config.truncate_rate = strtod(optarg, NULL);
+            break;
+        case OPT_MID_START:
+            config.mid_frame_start = true;
+            break;
+        case 'k':
+            if (!meter_sim_parse_keys(optarg, &config))
+            {
+                fprintf(stderr, "Keys must be EK:AK, 32 hex digits each\n");
+                return 1;
+            }
+            break;
+        case OPT_ENCRYPT_ONLY:
+            encrypt_only = true;
+            break;
+        case OPT_SEGMENT:
+            config.segment_size = (uint16_t)strtoul(optarg, NULL, 10);
+            break;
+        case OPT_I_FRAMES:
+            config.i_frames = true;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'p':
+            use_pty = true;
+            link = optarg;
+            break;
+        case 'x':
+            hex = true;
+            break;
+        case OPT_FAST:
+            fast = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (encrypt_only && config.security != 0)
+    {
+        config.security = METER_SIM_SECURITY_ENCRYPTED;
+    }
+
+    int fd = STDOUT_FILENO;
+    if (use_pty)
+    {
+        fd = open_pty(link);
+    }
+    else if (output != NULL)
+    {
+        fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_NOCTTY, 0644);
+        if (fd < 0)
+        {
+            perror(output);
+        }
+    }
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    bool paced = !fast && (use_pty || isatty(fd));
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    meter_sim_t sim;
+    meter_sim_init(&sim, &config);
+
+    static uint8_t buffer[METER_SIM_BUFFER_SIZE];
+    uint64_t start = now_ns();
+    uint64_t next_push = start;
+    uint64_t byte_ns = baud > 0 ? 1000000000ULL * BITS_PER_BYTE / baud : 0;
+    bool ok = true;
+
+    for (uint32_t push = 0; ok && !stop && (count == 0 || push < count); push++)
+    {
+        if (paced)
+        {
+            sleep_until(next_push);
+            next_push += (uint64_t)config.push_interval_ms * 1000000ULL;
+        }
+
+        size_t length = meter_sim_next(&sim, buffer, sizeof(buffer));
+
+        if (hex)
+        {
+            ok = write_hex(fd, push, buffer, length);
+        }
+        else if (paced && byte_ns > 0)
+        {
+            // Trickle the frame out at line speed so readers see realistic chunking
+            uint64_t deadline = now_ns();
+            for (size_t i = 0; ok && i < length && !stop; i += CHUNK_SIZE)
+            {
+                size_t chunk = length - i < CHUNK_SIZE ? length - i : CHUNK_SIZE;
+                ok = write_all(fd, buffer + i, chunk);
+                deadline += chunk * byte_ns;
+                sleep_until(deadline);
+            }
+        }
+        else
+        {
+            ok = write_all(fd, buffer, length);
+        }
+
+        // A push that takes longer than the interval on the line delays the following ones
+        if (paced && now_ns() > next_push)
+        {
+            next_push = now_ns();
+        }
+    }
+
+    double elapsed = (double)(now_ns() - start) / 1e9;
+    fprintf(stderr, "%s: %u frames, %llu bytes, %u truncated, %u bit flips, %llu noise bytes in %.1f s (%.1f frames/s)\n",
+            meter_sim_format_name(config.format), sim.stats.frames, (unsigned long long)sim.stats.bytes,
+            sim.stats.truncated, sim.stats.bit_flips, (unsigned long long)sim.stats.noise_bytes, elapsed,
+            elapsed > 0 ? sim.stats.frames / elapsed : 0);
+
+    if (link != NULL)
+    {
+        unlink(link);
+    }
+    return ok ? 0 : 1;
+}